@@ -0,0 +1,44 @@
+// Authorship: James Kortman (a1648090)
+// Synthetic landscapes for the benchmarks
+// Builds landscapes from a height function, so the benchmarks can run
+// without generating terrain.
+
+#ifndef BENCH_LANDSCAPE_HPP
+#define BENCH_LANDSCAPE_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+#include "Landscape.hpp"
+
+// A square landscape of size*size vertices over edge*edge, centred on the
+// origin, where the vertex at x, z has height height(x, z). Its height
+// grid is built, so it can be queried.
+template <typename Height>
+inline void make_landscape(Landscape& landscape, int size, float edge, Height height)
+{
+    landscape.size = size;
+    landscape.edge = edge;
+    landscape.origin = glm::vec2(-0.5f * edge);
+    landscape.positions.resize(std::size_t(size) * size);
+    for (int row = 0; row < size; row += 1)
+    {
+        for (int col = 0; col < size; col += 1)
+        {
+            const float x = -0.5f * edge + edge * row / (size - 1);
+            const float z = -0.5f * edge + edge * col / (size - 1);
+            landscape.positions[std::size_t(size) * row + col] = glm::vec3(x, height(x, z), z);
+        }
+    }
+    landscape.build_height_grid();
+}
+
+// Rolling hills, with smaller ridges across them.
+inline float rolling_hills(float x, float z)
+{
+    return 20.0f * std::sin(0.05f * x) * std::cos(0.07f * z)
+         + 3.0f * std::sin(0.6f * x + 0.4f * z);
+}
+
+#endif // BENCH_LANDSCAPE_HPP
@@ -0,0 +1,116 @@
+// Authorship: James Kortman (a1648090)
+// Erosion benchmark
+// Erodes the same island heightmap on pools of 1 to N threads with the
+// default parameters, and reports the time each took and its speedup over
+// one thread. Erosion is meant to give the same heights on any number of
+// threads, so each result is also checked against the one-thread result.
+// Usage: erosion_bench [size] [max threads] [runs]
+
+// The benchmarks are linked without main.cpp, so define the globals here.
+#define MAIN_FILE
+#include "core.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "Erosion.hpp"
+#include "Noise.hpp"
+#include "ThreadPool.hpp"
+
+// A size*size island: fractal noise over a dome falling off to the edges.
+static std::vector<float> make_heightmap(int size, float max_height)
+{
+    const std::size_t count = std::size_t(size) * size;
+    std::vector<float> x(count), y(count, 0.0f), z(count), noise(count);
+    for (int row = 0; row < size; row += 1)
+    {
+        for (int col = 0; col < size; col += 1)
+        {
+            x[std::size_t(size) * row + col] = 6.0f * row / size;
+            z[std::size_t(size) * row + col] = 6.0f * col / size;
+        }
+    }
+    fbm_noise3_batch(
+        x.data(), y.data(), z.data(), 2.0f, 0.5f, 6, noise.data(), int(count));
+
+    std::vector<float> heights(count);
+    for (int row = 0; row < size; row += 1)
+    {
+        for (int col = 0; col < size; col += 1)
+        {
+            const float u = 2.0f * row / (size - 1) - 1.0f;
+            const float v = 2.0f * col / (size - 1) - 1.0f;
+            const float dome = std::max(0.0f, 1.0f - std::sqrt(u * u + v * v));
+            const std::size_t i = std::size_t(size) * row + col;
+            heights[i] = max_height * dome * (0.6f + 0.4f * noise[i]);
+        }
+    }
+    return heights;
+}
+
+int main(int argc, char** argv)
+{
+    const int hardware = int(std::thread::hardware_concurrency());
+    const int size = argc > 1 ? std::atoi(argv[1]) : 512;
+    const int max_threads = argc > 2 ? std::atoi(argv[2]) : std::max(hardware, 1);
+    const int runs = argc > 3 ? std::atoi(argv[3]) : 3;
+    if (size < 2 || max_threads < 1 || runs < 1)
+    {
+        std::fprintf(stderr,
+            "usage: %s [size >= 2] [max threads >= 1] [runs >= 1]\n", argv[0]);
+        return 1;
+    }
+
+    const float spacing = 1.0f;
+    const int seed = 0;
+    const ErosionParams params;
+    const std::vector<float> original = make_heightmap(size, 0.25f * size);
+
+    std::printf(
+        "size %d, %d iterations, %d hardware threads, best of %d runs\n",
+        size, params.iterations, hardware, runs);
+    std::printf("%8s %10s %8s %s\n", "threads", "ms", "speedup", "result");
+
+    std::vector<float> reference;
+    float reference_ms = 0.0f;
+    bool all_identical = true;
+    for (int threads = 1; threads <= max_threads; threads += 1)
+    {
+        ThreadPool pool(threads);
+        float best_ms = 0.0f;
+        std::vector<float> heights;
+        for (int run = 0; run < runs; run += 1)
+        {
+            heights = original;
+            const ErosionStats stats =
+                erode(heights, size, spacing, seed, params, &pool);
+            if (run == 0 || stats.ms < best_ms) best_ms = stats.ms;
+        }
+
+        if (threads == 1)
+        {
+            reference = heights;
+            reference_ms = best_ms;
+        }
+        const bool identical =
+            std::memcmp(heights.data(), reference.data(),
+                        heights.size() * sizeof(float)) == 0;
+        all_identical = all_identical && identical;
+        std::printf(
+            "%8d %10.1f %7.2fx %s\n",
+            threads, best_ms, reference_ms / best_ms,
+            identical ? "identical" : "DIFFERS from 1 thread");
+    }
+
+    if (!all_identical)
+    {
+        std::printf("FAIL: the eroded heights depend on the number of threads\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+// Authorship: James Kortman (a1648090)
+// Height query benchmark
+// Times Landscape height queries over a synthetic landscape: the scalar
+// path they replaced (one point at a time, through the positions with
+// bounds checks and divisions), get_height_at, and the batched
+// query_heights with and without normals and slopes.
+// Usage: query_bench [size] [points]
+
+// The benchmarks are linked without main.cpp, so define the globals here.
+#define MAIN_FILE
+#include "core.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Landscape.hpp"
+
+#include "bench_landscape.hpp"
+
+// The scalar path before batched queries, with the step corrected.
+static float scalar_height_at(const Landscape& landscape, float x, float z)
+{
+    const float step = landscape.edge / (landscape.size - 1);
+    int row_x = (x - landscape.origin.x)/step;
+    int row_z = (z - landscape.origin.y)/step;
+    std::array<int, 3> indices;
+    indices[0] = landscape.size * row_x + row_z;
+    indices[1] = indices[0] + 1;
+    indices[2] = indices[0] + landscape.size;
+    for (int i = 0; i < 3; i++)
+    {
+        if (indices[i] < 0 || std::size_t(indices[i]) >= landscape.positions.size())
+        {
+            return Landscape::outside_height;
+        }
+    }
+    glm::vec3 downward =
+        landscape.positions.at(indices[1])
+        - landscape.positions.at(indices[0]);
+    glm::vec3 rightward =
+        landscape.positions.at(indices[2])
+        - landscape.positions.at(indices[0]);
+    rightward = (1.0f / rightward.x) * rightward;
+    downward = (1.0f / downward.z) * downward;
+    float dx = x - landscape.positions.at(indices[0]).x;
+    float dz = z - landscape.positions.at(indices[0]).z;
+    return (landscape.positions.at(indices[0]) + dx * rightward + dz * downward).y;
+}
+
+// Run 'fn' until at least 200ms have passed, and give the points
+// queried per second.
+template <typename Function>
+static double points_per_second(int points, Function fn)
+{
+    using clock = std::chrono::steady_clock;
+    int runs = 0;
+    const auto start = clock::now();
+    double seconds = 0.0;
+    do
+    {
+        fn();
+        runs += 1;
+        seconds = std::chrono::duration<double>(clock::now() - start).count();
+    } while (seconds < 0.2);
+    return double(points) * runs / seconds;
+}
+
+int main(int argc, char** argv)
+{
+    const int size = argc > 1 ? std::atoi(argv[1]) : 600;
+    const int points = argc > 2 ? std::atoi(argv[2]) : 1 << 16;
+    if (size < 2 || points < 1)
+    {
+        std::fprintf(stderr, "usage: %s [size >= 2] [points >= 1]\n", argv[0]);
+        return 1;
+    }
+    const float edge = 480.0f;
+    Landscape landscape;
+    make_landscape(landscape, size, edge, rolling_hills);
+
+    // Points spread over the landscape, with a few just off it.
+    std::vector<float> xs(points), zs(points);
+    unsigned int state = 12345;
+    auto next = [&]()
+    {
+        state = state * 1664525u + 1013904223u;
+        return float(state >> 8) / float(1 << 24);
+    };
+    for (int i = 0; i < points; i += 1)
+    {
+        xs[i] = 1.02f * edge * (next() - 0.5f);
+        zs[i] = 1.02f * edge * (next() - 0.5f);
+    }
+
+    std::vector<float> heights(points), reference(points), slope_cos(points);
+    std::vector<glm::vec3> normals(points);
+    float sink = 0.0f;
+    const double scalar = points_per_second(points, [&]()
+    {
+        for (int i = 0; i < points; i += 1) sink += scalar_height_at(landscape, xs[i], zs[i]);
+    });
+    const double single = points_per_second(points, [&]()
+    {
+        for (int i = 0; i < points; i += 1) reference[i] = landscape.get_height_at(xs[i], zs[i]);
+    });
+    const double batch = points_per_second(points, [&]()
+    {
+        landscape.query_heights(xs.data(), zs.data(), points, heights.data());
+    });
+    const double batch_normals = points_per_second(points, [&]()
+    {
+        landscape.query_heights(
+            xs.data(), zs.data(), points, heights.data(), normals.data(), slope_cos.data());
+    });
+
+    // The batched and single point queries should agree exactly.
+    float difference = 0.0f;
+    for (int i = 0; i < points; i += 1)
+    {
+        difference = std::max(difference, std::abs(heights[i] - reference[i]));
+    }
+
+    std::printf("size %d, %d points (%.0f)\n", size, points, sink * 0.0f);
+    std::printf("%-24s %8.2f Mpoints/s\n", "scalar (before)", scalar * 1e-6);
+    std::printf("%-24s %8.2f Mpoints/s\n", "get_height_at", single * 1e-6);
+    std::printf("%-24s %8.2f Mpoints/s  (%.1fx)\n", "query_heights", batch * 1e-6, batch / scalar);
+    std::printf("%-24s %8.2f Mpoints/s  (%.1fx)\n", "query_heights + normals",
+                batch_normals * 1e-6, batch_normals / scalar);
+    std::printf("largest difference from get_height_at: %g\n", difference);
+    return difference == 0.0f ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+// Authorship: James Kortman (a1648090)
+// Ray casting benchmark
+// Times HeightPyramid ray casts over a synthetic landscape, and checks
+// them against marching along each ray with height queries. Rays are cast
+// from a camera height at shallow angles (the hardest case, as they cross
+// many cells before hitting), at steeper angles (as for picking), and as
+// short segments near the ground (as for camera collision).
+// Each set is timed on one thread and on the shared pool, and compared
+// with the target of casting 4096 rays in under 1 ms per frame.
+// Usage: ray_bench [size] [rays]
+
+// The benchmarks are linked without main.cpp, so define the globals here.
+#define MAIN_FILE
+#include "core.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "HeightPyramid.hpp"
+#include "Landscape.hpp"
+#include "ThreadPool.hpp"
+
+#include "bench_landscape.hpp"
+
+// The distance along a ray at which it first goes below the landscape,
+// found by marching in small steps then bisecting, or -1.
+// (Height queries off the landscape give the water height, which the
+// pyramid does not cover, so the march stops at the edge.)
+static float march(const Landscape& landscape, const HeightPyramid::Ray& ray, float step)
+{
+    auto inside = [&](float t)
+    {
+        const glm::vec3 p = ray.origin + t * ray.direction;
+        return std::abs(p.x) <= 0.5f * landscape.edge && std::abs(p.z) <= 0.5f * landscape.edge;
+    };
+    auto below = [&](float t)
+    {
+        const glm::vec3 p = ray.origin + t * ray.direction;
+        return p.y <= landscape.get_height_at(p.x, p.z);
+    };
+    const float length = glm::length(ray.direction);
+    const float dt = step / length;
+    float previous = 0.0f;
+    for (float t = dt; t < ray.max_distance + dt; t += dt)
+    {
+        const float clamped = std::min(t, ray.max_distance);
+        if (!inside(clamped)) break;
+        if (below(clamped))
+        {
+            float lo = previous;
+            float hi = clamped;
+            for (int i = 0; i < 32; i += 1)
+            {
+                const float mid = 0.5f * (lo + hi);
+                if (below(mid)) hi = mid; else lo = mid;
+            }
+            return hi;
+        }
+        previous = clamped;
+    }
+    return -1.0f;
+}
+
+int main(int argc, char** argv)
+{
+    const int size = argc > 1 ? std::atoi(argv[1]) : 600;
+    const int n = argc > 2 ? std::atoi(argv[2]) : 4096;
+    if (size < 2 || n < 1)
+    {
+        std::fprintf(stderr, "usage: %s [size >= 2] [rays >= 1]\n", argv[0]);
+        return 1;
+    }
+    const float edge = 480.0f;
+    Landscape landscape;
+    make_landscape(landscape, size, edge, rolling_hills);
+
+    using clock = std::chrono::steady_clock;
+    const auto build_start = clock::now();
+    const HeightPyramid pyramid(landscape);
+    const double build_ms = std::chrono::duration<double, std::milli>(
+        clock::now() - build_start).count();
+
+    unsigned int state = 12345;
+    auto next = [&]()
+    {
+        state = state * 1664525u + 1013904223u;
+        return float(state >> 8) / float(1 << 24);
+    };
+    // Rays from a point above the landscape at some angle below the
+    // horizon, as far as half the edge.
+    auto make_rays = [&](float min_dip, float max_dip)
+    {
+        std::vector<HeightPyramid::Ray> rays(n);
+        for (HeightPyramid::Ray& ray: rays)
+        {
+            const float angle = 6.2831853f * next();
+            const float dip = min_dip + (max_dip - min_dip) * next();
+            ray.origin = glm::vec3(0.8f * edge * (next() - 0.5f), 30.0f, 0.8f * edge * (next() - 0.5f));
+            ray.direction = glm::normalize(glm::vec3(std::cos(angle), -dip, std::sin(angle)));
+            ray.max_distance = 0.5f * edge;
+        }
+        return rays;
+    };
+    // Segments 6 units long from just above the landscape, like a camera
+    // kept from passing into the ground.
+    auto make_segments = [&]()
+    {
+        std::vector<HeightPyramid::Ray> rays(n);
+        for (HeightPyramid::Ray& ray: rays)
+        {
+            const float x = 0.8f * edge * (next() - 0.5f);
+            const float z = 0.8f * edge * (next() - 0.5f);
+            ray.origin = glm::vec3(x, landscape.get_height_at(x, z) + 2.0f, z);
+            ray.direction = 6.0f * glm::normalize(glm::vec3(next() - 0.5f, next() - 0.7f, next() - 0.5f));
+            ray.max_distance = 1.0f;
+        }
+        return rays;
+    };
+
+    std::printf("size %d, %d levels, built in %.2f ms\n", size, pyramid.levels(), build_ms);
+    ThreadPool single(1);
+    const float step = edge / (size - 1);
+    int mismatches = 0;
+    // The frame budget for 4096 rays, and the slowest set on the pool.
+    const double target_ms = 1.0;
+    double worst_ms = 0.0;
+    auto run = [&](const char* name, const std::vector<HeightPyramid::Ray>& rays)
+    {
+        std::vector<HeightPyramid::Hit> hits(n);
+        // The fastest of the runs in 200 ms, so other work on the machine
+        // does not inflate the time.
+        auto time_ms = [&](ThreadPool* pool)
+        {
+            const auto start = clock::now();
+            double fastest = 0.0;
+            do
+            {
+                const auto run_start = clock::now();
+                pyramid.cast(rays.data(), n, hits.data(), pool);
+                const double ms = std::chrono::duration<double, std::milli>(
+                    clock::now() - run_start).count();
+                if (fastest == 0.0 || ms < fastest) fastest = ms;
+            } while (clock::now() - start < std::chrono::milliseconds(200));
+            return fastest;
+        };
+        const double single_ms = time_ms(&single);
+        const double shared_ms = time_ms(nullptr);
+        worst_ms = std::max(worst_ms, shared_ms * 4096.0 / n);
+
+        // Check against marching. The march may step over a point where a
+        // ray only grazes the landscape, so an earlier hit also agrees if
+        // it is on the landscape.
+        int hit_count = 0;
+        int differ = 0;
+        const int checked = std::min(n, 512);
+        for (int i = 0; i < checked; i += 1)
+        {
+            const float t = march(landscape, rays[i], 0.05f * step);
+            if (hits[i].hit) hit_count += 1;
+            const glm::vec3 p = hits[i].position;
+            const bool grazed = hits[i].hit && (t < 0.0f || hits[i].distance < t)
+                && std::abs(p.y - landscape.get_height_at(p.x, p.z)) <= 1e-3f;
+            const float length = glm::length(rays[i].direction);
+            const bool agree = grazed || ((t < 0.0f)
+                ? !hits[i].hit
+                : hits[i].hit && std::abs(hits[i].distance - t) * length <= 0.1f * step);
+            if (!agree) differ += 1;
+        }
+        mismatches += differ;
+        std::printf("%-9s %d rays: %.3f ms on 1 thread (%.0f ns per ray), %.3f ms on %d threads; "
+                    "%d of %d checked hit, %d differ from marching\n",
+                    name, n, single_ms, 1e6 * single_ms / n,
+                    shared_ms, ThreadPool::shared().num_threads(),
+                    hit_count, checked, differ);
+    };
+    run("shallow", make_rays(0.05f, 0.35f));
+    run("steep", make_rays(0.35f, 1.5f));
+    run("segments", make_segments());
+    // The timings vary with the machine, so only a mismatch fails the run.
+    std::printf("slowest set: %.3f ms per 4096 rays on %d threads, %s the %.1f ms target\n",
+                worst_ms, ThreadPool::shared().num_threads(),
+                worst_ms < target_ms ? "within" : "over", target_ms);
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,496 @@
+// Authorship: James Kortman (a1648090)
+// Terrain generation benchmark
+// Generates the island at a range of sizes, without a window or GL
+// context, and reports each TerrainGenerator stage's wall time, its
+// throughput in vertices per second and the allocations made during it,
+// with the peak resident memory of the whole generation.
+// Each size is generated in a separate process (this program, run with
+// --run), so the peak memory of one size does not hide that of the next.
+//
+// Usage:
+//   terrain_bench [--sizes 128,256,...] [--format csv|json] [--out FILE]
+//                 [--seed N] [--no-erosion]
+//       Benchmark each size (128 to 8192 by default), writing the results
+//       to FILE (or stdout).
+//   terrain_bench --compare BASE NEW [--threshold PERCENT] [--min-ms MS]
+//       Compare two results files (either format), flagging every stage
+//       that is more than PERCENT (10 by default) slower, or allocates more
+//       than PERCENT more often. Stages that take less than MS (1 by
+//       default) in both runs are not flagged for time, as they are mostly
+//       noise. Exits with status 1 if anything is flagged.
+//   terrain_bench --stream MB [--sizes 128,256,...] [--seed N]
+//       Generate each size with TerrainGenerator::stream_landscape, under a
+//       memory ceiling of MB megabytes, and check that the peak resident
+//       memory of the whole process stays under it. Exits with status 1 if
+//       any size goes over, or does not fit at all.
+
+// The benchmarks are linked without main.cpp, so define the globals here.
+#define MAIN_FILE
+#include "core.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/resource.h>
+
+#include "Erosion.hpp"
+#include "Landscape.hpp"
+#include "Mesh.hpp"
+#include "ResourceManager.hpp"
+#include "Shader.hpp"
+#include "TerrainGenerator.hpp"
+
+// --------------------------
+// -- Allocation counting --
+// --------------------------
+// Every allocation in the program goes through these.
+static std::atomic<long long> allocation_count(0);
+static std::atomic<long long> allocation_bytes(0);
+
+void* operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* pointer = std::malloc(size != 0 ? size : 1);
+    if (pointer == nullptr) throw std::bad_alloc();
+    return pointer;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+// -------------
+// -- Results --
+// -------------
+// The result for one stage (or the total) at one size.
+struct Row
+{
+    int size;
+    std::string stage;
+    double ms;
+    double vertices_per_s;
+    long long allocations;
+    long long allocated_kb;
+    long peak_rss_kb;
+};
+
+static const char* const csv_header =
+    "size,stage,ms,vertices_per_s,allocations,allocated_kb,peak_rss_kb";
+
+static std::string to_csv(const Row& row)
+{
+    char line[256];
+    std::snprintf(line, sizeof(line), "%d,%s,%.3f,%.0f,%lld,%lld,%ld",
+                  row.size, row.stage.c_str(), row.ms, row.vertices_per_s,
+                  row.allocations, row.allocated_kb, row.peak_rss_kb);
+    return line;
+}
+
+static std::string to_json(const Row& row)
+{
+    char line[320];
+    std::snprintf(line, sizeof(line),
+                  "{\"size\": %d, \"stage\": \"%s\", \"ms\": %.3f, "
+                  "\"vertices_per_s\": %.0f, \"allocations\": %lld, "
+                  "\"allocated_kb\": %lld, \"peak_rss_kb\": %ld}",
+                  row.size, row.stage.c_str(), row.ms, row.vertices_per_s,
+                  row.allocations, row.allocated_kb, row.peak_rss_kb);
+    return line;
+}
+
+static bool from_csv(const std::string& line, Row& row)
+{
+    char stage[64];
+    if (std::sscanf(line.c_str(), "%d,%63[^,],%lf,%lf,%lld,%lld,%ld",
+                    &row.size, stage, &row.ms, &row.vertices_per_s,
+                    &row.allocations, &row.allocated_kb, &row.peak_rss_kb) != 7)
+    {
+        return false;
+    }
+    row.stage = stage;
+    return true;
+}
+
+// Read the value of "key" from a line written by to_json.
+static bool json_value(const std::string& line, const char* key, std::string& value)
+{
+    const std::string quoted = std::string("\"") + key + "\":";
+    std::size_t at = line.find(quoted);
+    if (at == std::string::npos) return false;
+    at = line.find_first_not_of(' ', at + quoted.size());
+    if (at == std::string::npos) return false;
+    if (line[at] == '"')
+    {
+        const std::size_t end = line.find('"', at + 1);
+        if (end == std::string::npos) return false;
+        value = line.substr(at + 1, end - at - 1);
+    }
+    else
+    {
+        const std::size_t end = line.find_first_of(",}", at);
+        value = line.substr(at, end - at);
+    }
+    return true;
+}
+
+static bool from_json(const std::string& line, Row& row)
+{
+    std::string size, stage, ms, vertices_per_s, allocations, allocated_kb, peak_rss_kb;
+    if (!json_value(line, "size", size)
+        || !json_value(line, "stage", stage)
+        || !json_value(line, "ms", ms)
+        || !json_value(line, "vertices_per_s", vertices_per_s)
+        || !json_value(line, "allocations", allocations)
+        || !json_value(line, "allocated_kb", allocated_kb)
+        || !json_value(line, "peak_rss_kb", peak_rss_kb))
+    {
+        return false;
+    }
+    row.size = std::atoi(size.c_str());
+    row.stage = stage;
+    row.ms = std::atof(ms.c_str());
+    row.vertices_per_s = std::atof(vertices_per_s.c_str());
+    row.allocations = std::atoll(allocations.c_str());
+    row.allocated_kb = std::atoll(allocated_kb.c_str());
+    row.peak_rss_kb = std::atol(peak_rss_kb.c_str());
+    return true;
+}
+
+// Read a results file in either format.
+static bool read_results(const std::string& path, std::vector<Row>& rows)
+{
+    std::ifstream file(path);
+    if (!file) return false;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        Row row;
+        if (line.find('{') != std::string::npos ? from_json(line, row) : from_csv(line, row))
+        {
+            rows.push_back(row);
+        }
+    }
+    return true;
+}
+
+// --------------------
+// -- Benchmark runs --
+// --------------------
+// The peak resident memory of this process, in KB.
+static long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    #ifdef __APPLE__
+        return long(usage.ru_maxrss / 1024);
+    #else
+        return long(usage.ru_maxrss);
+    #endif
+}
+
+// Generate the island at one size, streamed within 'budget' bytes, and
+// print a CSV row for the total.
+static int run_streamed(int size, int seed, std::size_t budget)
+{
+    ResourceManager resources;
+    resources.give_mesh("Pine02", new Mesh);
+    resources.give_mesh("Stump", new Mesh);
+    resources.give_shader("obj-cel", new Shader);
+
+    const long long first_count = allocation_count;
+    const long long first_bytes = allocation_bytes;
+    const auto start = std::chrono::steady_clock::now();
+    {
+        std::unique_ptr<Landscape> landscape(TerrainGenerator::stream_landscape(
+            seed, size, 4.0f * size, 128.0f, budget, &resources));
+        if (landscape == nullptr) return 1;
+        for (Object* object: landscape->objects) delete object;
+    }
+    const double total_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    const double vertices = double(size) * size;
+    const Row total = {
+        size, "stream", total_ms, vertices / (total_ms * 1e-3),
+        allocation_count - first_count, (allocation_bytes - first_bytes) / 1024,
+        peak_rss_kb() };
+    std::printf("%s\n", to_csv(total).c_str());
+    return 0;
+}
+
+// Generate the island at one size, and print a CSV row for each stage
+// and the total.
+static int run_size(int size, int seed, bool erode)
+{
+    // Objects only need meshes and a shader to point to, not GL objects.
+    ResourceManager resources;
+    resources.give_mesh("Pine02", new Mesh);
+    resources.give_mesh("Stump", new Mesh);
+    resources.give_shader("obj-cel", new Shader);
+    const ErosionParams erosion;
+
+    // The allocations made during each stage.
+    long long stage_allocations[TerrainGenerator::num_stages] = {};
+    long long stage_bytes[TerrainGenerator::num_stages] = {};
+    long long last_count = allocation_count;
+    long long last_bytes = allocation_bytes;
+    TerrainGenerator::Progress progress;
+    progress.on_stage = [&](int stage)
+    {
+        const long long count = allocation_count;
+        const long long bytes = allocation_bytes;
+        stage_allocations[stage] = count - last_count;
+        stage_bytes[stage] = bytes - last_bytes;
+        last_count = count;
+        last_bytes = bytes;
+    };
+
+    const long long first_count = allocation_count;
+    const long long first_bytes = allocation_bytes;
+    const auto start = std::chrono::steady_clock::now();
+    {
+        TerrainGenerator generator(
+            seed, size, 4.0f * size, 128.0f, &resources, &progress,
+            erode ? &erosion : nullptr);
+        std::unique_ptr<Landscape> landscape(generator.landscape());
+        for (Object* object: landscape->objects) delete object;
+    }
+    const double total_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+
+    const double vertices = double(size) * size;
+    const long peak = peak_rss_kb();
+    for (int stage = 0; stage < TerrainGenerator::num_stages; stage += 1)
+    {
+        const double ms = progress.stage_ms[stage];
+        const Row row = {
+            size, TerrainGenerator::stage_names[stage], ms,
+            ms > 0.0 ? vertices / (ms * 1e-3) : 0.0,
+            stage_allocations[stage], stage_bytes[stage] / 1024, peak };
+        std::printf("%s\n", to_csv(row).c_str());
+    }
+    const Row total = {
+        size, "total", total_ms, vertices / (total_ms * 1e-3),
+        allocation_count - first_count, (allocation_bytes - first_bytes) / 1024, peak };
+    std::printf("%s\n", to_csv(total).c_str());
+    return 0;
+}
+
+// Run each size in its own process, collecting the rows it prints.
+// Sizes are streamed if 'stream_mb' is given.
+static std::vector<Row> run_sizes(
+    const char* program, const std::vector<int>& sizes, int seed, bool erode,
+    int stream_mb = 0)
+{
+    std::vector<Row> rows;
+    for (int size: sizes)
+    {
+        std::fprintf(stderr, "Generating %d x %d...\n", size, size);
+        std::ostringstream command;
+        command << '"' << program << "\" --run " << size << " --seed " << seed;
+        if (!erode) command << " --no-erosion";
+        if (stream_mb > 0) command << " --stream " << stream_mb;
+        FILE* child = popen(command.str().c_str(), "r");
+        if (child == nullptr)
+        {
+            warn("Could not start the benchmark for size " + std::to_string(size));
+            continue;
+        }
+        char line[512];
+        int found = 0;
+        while (std::fgets(line, sizeof(line), child) != nullptr)
+        {
+            Row row;
+            if (from_csv(line, row))
+            {
+                rows.push_back(row);
+                found += 1;
+            }
+        }
+        if (pclose(child) != 0 || found == 0)
+        {
+            warn("The benchmark for size " + std::to_string(size)
+                 + " failed (it may have run out of memory)");
+        }
+    }
+    return rows;
+}
+
+// ----------------
+// -- Comparison --
+// ----------------
+static int compare(
+    const std::string& base_path, const std::string& new_path,
+    double threshold, double min_ms)
+{
+    std::vector<Row> base_rows, new_rows;
+    if (!read_results(base_path, base_rows)) fatal("Could not read " + base_path);
+    if (!read_results(new_path, new_rows)) fatal("Could not read " + new_path);
+    std::map<std::pair<int, std::string>, Row> base;
+    for (const Row& row: base_rows) base[std::make_pair(row.size, row.stage)] = row;
+
+    const double limit = 1.0 + threshold / 100.0;
+    int regressions = 0;
+    std::printf("%6s %-10s %10s %10s %8s %10s %10s  %s\n",
+                "size", "stage", "base ms", "new ms", "change",
+                "base alloc", "new alloc", "");
+    for (const Row& now: new_rows)
+    {
+        auto it = base.find(std::make_pair(now.size, now.stage));
+        if (it == base.end()) continue;
+        const Row& was = it->second;
+        const bool slower = now.ms > was.ms * limit && std::max(now.ms, was.ms) >= min_ms;
+        const bool allocates = now.allocations > was.allocations * limit;
+        const double change = was.ms > 0.0 ? 100.0 * (now.ms - was.ms) / was.ms : 0.0;
+        std::string flags;
+        if (slower) flags += " SLOWER";
+        if (allocates) flags += " MORE-ALLOCATIONS";
+        if (slower || allocates) regressions += 1;
+        std::printf("%6d %-10s %10.2f %10.2f %+7.1f%% %10lld %10lld %s\n",
+                    now.size, now.stage.c_str(), was.ms, now.ms, change,
+                    was.allocations, now.allocations, flags.c_str());
+    }
+    std::printf("%d regression%s over %.0f%%\n",
+                regressions, regressions == 1 ? "" : "s", threshold);
+    return regressions == 0 ? 0 : 1;
+}
+
+// ------------------
+// -- Memory check --
+// ------------------
+// Stream each size under a ceiling of 'stream_mb' megabytes, and check the
+// peak resident memory of each stays under it.
+static int check_streamed(
+    const char* program, const std::vector<int>& sizes, int seed, int stream_mb)
+{
+    const std::vector<Row> rows = run_sizes(program, sizes, seed, false, stream_mb);
+    const long ceiling_kb = long(stream_mb) * 1024;
+    int failures = 0;
+    std::printf("%6s %10s %14s %14s  %s\n", "size", "ms", "peak rss kb", "ceiling kb", "");
+    for (int size: sizes)
+    {
+        auto row = std::find_if(rows.begin(), rows.end(),
+                                [=](const Row& candidate) { return candidate.size == size; });
+        if (row == rows.end())
+        {
+            std::printf("%6d %10s %14s %14ld  FAILED\n", size, "-", "-", ceiling_kb);
+            failures += 1;
+            continue;
+        }
+        const bool over = row->peak_rss_kb > ceiling_kb;
+        if (over) failures += 1;
+        std::printf("%6d %10.1f %14ld %14ld  %s\n",
+                    size, row->ms, row->peak_rss_kb, ceiling_kb, over ? "OVER" : "ok");
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// ----------
+// -- Main --
+// ----------
+static std::vector<int> parse_sizes(const std::string& list)
+{
+    std::vector<int> sizes;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        const int size = std::atoi(item.c_str());
+        if (size >= 2) sizes.push_back(size);
+    }
+    return sizes;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<int> sizes = { 128, 256, 512, 1024, 2048, 4096, 8192 };
+    std::string format = "csv";
+    std::string out_path;
+    std::string base_path, new_path;
+    int run = 0;
+    int seed = 0;
+    int stream_mb = 0;
+    bool erode = true;
+    double threshold = 10.0;
+    double min_ms = 1.0;
+    for (int i = 1; i < argc; i += 1)
+    {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if      (arg == "--sizes" && has_value)     sizes = parse_sizes(argv[++i]);
+        else if (arg == "--format" && has_value)    format = argv[++i];
+        else if (arg == "--out" && has_value)       out_path = argv[++i];
+        else if (arg == "--seed" && has_value)      seed = std::atoi(argv[++i]);
+        else if (arg == "--run" && has_value)       run = std::atoi(argv[++i]);
+        else if (arg == "--threshold" && has_value) threshold = std::atof(argv[++i]);
+        else if (arg == "--min-ms" && has_value)    min_ms = std::atof(argv[++i]);
+        else if (arg == "--stream" && has_value)    stream_mb = std::atoi(argv[++i]);
+        else if (arg == "--no-erosion")             erode = false;
+        else if (arg == "--compare" && i + 2 < argc)
+        {
+            base_path = argv[++i];
+            new_path = argv[++i];
+        }
+        else
+        {
+            std::fprintf(stderr, "Unknown or incomplete option: %s\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    if (!base_path.empty()) return compare(base_path, new_path, threshold, min_ms);
+    if (run >= 2 && stream_mb > 0)
+    {
+        return run_streamed(run, seed, std::size_t(stream_mb) << 20);
+    }
+    if (run >= 2) return run_size(run, seed, erode);
+    if (stream_mb > 0) return check_streamed(argv[0], sizes, seed, stream_mb);
+    if (format != "csv" && format != "json") fatal("The format must be csv or json");
+
+    const std::vector<Row> rows = run_sizes(argv[0], sizes, seed, erode);
+    FILE* out = stdout;
+    if (!out_path.empty())
+    {
+        out = std::fopen(out_path.c_str(), "w");
+        if (out == nullptr) fatal("Could not write " + out_path);
+    }
+    if (format == "csv")
+    {
+        std::fprintf(out, "%s\n", csv_header);
+        for (const Row& row: rows) std::fprintf(out, "%s\n", to_csv(row).c_str());
+    }
+    else
+    {
+        std::fprintf(out, "[\n");
+        for (std::size_t i = 0; i < rows.size(); i += 1)
+        {
+            std::fprintf(out, "  %s%s\n", to_json(rows[i]).c_str(),
+                         i + 1 < rows.size() ? "," : "");
+        }
+        std::fprintf(out, "]\n");
+    }
+    if (out != stdout) std::fclose(out);
+    return 0;
+}
@@ -0,0 +1,153 @@
+// Authorship: James Kortman (a1648090)
+// Water mesh benchmark
+// Times building the ocean mesh at a range of level sizes, around a
+// synthetic island which hides part of it, and following a camera across
+// it, and reports its vertices, triangles and average vertex cache miss
+// ratio. The mesh is checked for cracks (without the island): every edge
+// used by only one triangle must be where the water ends. And the vertices
+// are checked to stay on their levels' lattices as it moves.
+// Usage: water_bench [size...]
+
+// The benchmarks are linked without main.cpp, so define the globals here.
+#define MAIN_FILE
+#include "core.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "IndexOptimizer.hpp"
+#include "Landscape.hpp"
+#include "ThreadPool.hpp"
+#include "Water.hpp"
+
+#include "bench_landscape.hpp"
+
+// Whether a water mesh is free of cracks: no edge is used by more than two
+// triangles, and each edge used by only one is where the water ends, with
+// both ends dropped to height 0.
+static bool watertight(const Water& water)
+{
+    std::map<std::pair<unsigned int, unsigned int>, int> uses;
+    for (const std::array<unsigned int, 3>& triangle: water.indices)
+    {
+        for (int k = 0; k < 3; k += 1)
+        {
+            const unsigned int a = triangle[k], b = triangle[(k + 1) % 3];
+            uses[std::make_pair(std::min(a, b), std::max(a, b))] += 1;
+        }
+    }
+    for (const auto& edge: uses)
+    {
+        if (edge.second > 2) return false;
+        if (edge.second == 1
+            && (water.positions[edge.first.first].y != 0.0f
+                || water.positions[edge.first.second].y != 0.0f))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether each vertex of each level lies on the lattice of multiples of
+// that level's spacing, so it stays put as the mesh follows the camera.
+static bool on_lattice(const Water& water, int size, float spacing)
+{
+    const std::size_t per_level = std::size_t(size + 1) * (size + 1);
+    for (std::size_t i = 0; i < water.positions.size(); i += 1)
+    {
+        const float step = spacing * float(1 << (i / per_level));
+        const glm::vec3 p = water.positions[i];
+        if (p.x / step != std::floor(p.x / step) || p.z / step != std::floor(p.z / step))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; i += 1) sizes.push_back(std::atoi(argv[i]));
+    if (sizes.empty()) sizes = { 8, 16, 32, 64, 128 };
+    for (int size: sizes)
+    {
+        if (size < 8 || size % 4 != 0)
+        {
+            std::fprintf(stderr, "usage: %s [size, a multiple of 4 >= 8...]\n", argv[0]);
+            return 1;
+        }
+    }
+    const float edge = 1000.0f;
+    const float spacing = 2.0f;
+    const float level = 6.4f;
+    Landscape landscape;
+    // A round island in the middle, 400 units across.
+    make_landscape(landscape, 257, 400.0f, [](float x, float z)
+    {
+        const float falloff = 1.0f - std::sqrt(x * x + z * z) / (0.45f * 400.0f);
+        return 40.0f * falloff + 4.0f * std::sin(0.1f * x) * std::cos(0.13f * z);
+    });
+
+    using clock = std::chrono::steady_clock;
+    int failures = 0;
+    std::printf("%6s %7s %9s %10s %10s %10s %8s %8s %8s\n",
+                "size", "levels", "vertices", "build ms", "follow ms", "triangles",
+                "culled", "acmr", "check");
+    for (int size: sizes)
+    {
+        // The best of a few runs, as the first touches fresh memory.
+        std::unique_ptr<Water> water;
+        double best_ms = 0.0;
+        for (int run = 0; run < 3; run += 1)
+        {
+            const auto start = clock::now();
+            water.reset(new Water(size, spacing, edge, level, &landscape));
+            const double ms = std::chrono::duration<double, std::milli>(
+                clock::now() - start).count();
+            if (run == 0 || ms < best_ms) best_ms = ms;
+        }
+        const std::size_t triangles = water->indices.size();
+        const double acmr = triangles == 0 ? 0.0
+            : double(vertex_cache_misses(&water->indices[0][0], 3 * triangles)) / triangles;
+        // The same mesh without the island, which should have no holes.
+        Water open_sea(size, spacing, edge, level);
+        const std::size_t culled = open_sea.indices.size() - triangles;
+        bool ok = watertight(open_sea) && on_lattice(open_sea, size, spacing);
+
+        // Walk the camera across the island and out to sea, checking the
+        // mesh at each step, and timing the rebuilds.
+        int rebuilds = 0;
+        double follow_ms = 0.0;
+        for (int step = 0; step <= 200; step += 1)
+        {
+            const glm::vec3 eye(-300.0f + 3.1f * step, 20.0f, 0.7f * step - 40.0f);
+            const auto start = clock::now();
+            const bool rebuilt = water->follow(eye);
+            follow_ms += std::chrono::duration<double, std::milli>(
+                clock::now() - start).count();
+            if (!rebuilt) continue;
+            rebuilds += 1;
+            open_sea.follow(eye);
+            ok = ok && watertight(open_sea) && on_lattice(open_sea, size, spacing)
+                && water->positions.size() == open_sea.positions.size();
+        }
+        if (!ok) failures += 1;
+        std::printf("%6d %7d %9zu %10.2f %10.3f %10zu %8zu %8.3f %8s\n",
+                    size, water->num_levels(), water->positions.size(), best_ms,
+                    rebuilds == 0 ? 0.0 : follow_ms / rebuilds, triangles, culled, acmr,
+                    ok ? "ok" : "CRACKED");
+    }
+    std::printf("(%d threads)\n", ThreadPool::shared().num_threads());
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,118 @@
+// Authorship: James Kortman (a1648090)
+// Wave query benchmark
+// Times querying the CPU mirror of the ocean's waves (see WaveField) at
+// many points, one at a time and in batches, for heights alone and with
+// normals. The batches are checked against the single queries, the mirror
+// against the wave function at the texel centres it is baked at, and the
+// field against itself a period away, as the water texture repeats.
+// (The mirror is compared with the waves actually baked on the GPU at run
+// time, through the water.check_waves console variable.)
+// Usage: wave_bench [points]
+
+// The benchmarks are linked without main.cpp, so define the globals here.
+#define MAIN_FILE
+#include "core.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Console.hpp"
+#include "ThreadPool.hpp"
+#include "WaveField.hpp"
+
+int main(int argc, char** argv)
+{
+    const int n = argc > 1 ? std::atoi(argv[1]) : 100000;
+    if (n < 1)
+    {
+        std::fprintf(stderr, "usage: %s [points >= 1]\n", argv[0]);
+        return 1;
+    }
+    // The waves register their settings with the console.
+    Console wave_console;
+    wave_console.initialize();
+    WaveField waves;
+    waves.update(37.5f);
+
+    // Points scattered over a few periods of the field.
+    std::vector<float> x(n), z(n);
+    std::srand(1);
+    for (int i = 0; i < n; i += 1)
+    {
+        x[i] = (float(std::rand()) / RAND_MAX - 0.5f) * 4.0f * WaveField::period;
+        z[i] = (float(std::rand()) / RAND_MAX - 0.5f) * 4.0f * WaveField::period;
+    }
+
+    using clock = std::chrono::steady_clock;
+    auto ms_since = [](clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    };
+    std::vector<float> single_height(n), height(n), nx(n), ny(n), nz(n);
+    std::vector<glm::vec3> single_normal(n);
+
+    clock::time_point start = clock::now();
+    for (int i = 0; i < n; i += 1) single_height[i] = waves.height(x[i], z[i]);
+    const double single_height_ms = ms_since(start);
+    start = clock::now();
+    for (int i = 0; i < n; i += 1) single_normal[i] = waves.normal(x[i], z[i]);
+    const double single_normal_ms = ms_since(start);
+    start = clock::now();
+    waves.sample_batch(x.data(), z.data(), n, height.data());
+    const double batch_height_ms = ms_since(start);
+    bool batch_agrees = height == single_height;
+    start = clock::now();
+    waves.sample_batch(x.data(), z.data(), n, height.data(), nx.data(), ny.data(), nz.data());
+    const double batch_normal_ms = ms_since(start);
+    for (int i = 0; i < n; i += 1)
+    {
+        batch_agrees = batch_agrees && height[i] == single_height[i]
+            && nx[i] == single_normal[i].x && ny[i] == single_normal[i].y
+            && nz[i] == single_normal[i].z;
+    }
+
+    // At the texel centres, the mirror gives the baked values.
+    const int resolution = waves.field_resolution();
+    float texel_error = 0.0f;
+    for (int i = 0; i < resolution; i += 3)
+    {
+        for (int j = 0; j < resolution; j += 5)
+        {
+            const float tx = (float(i) + 0.5f) / float(resolution) * WaveField::period;
+            const float tz = (float(j) + 0.5f) / float(resolution) * WaveField::period;
+            texel_error = std::max(texel_error, std::abs(
+                waves.height(tx, tz) - WaveField::evaluate(tx, tz, waves.field_time())));
+        }
+    }
+    // A period away, the field differs only by rounding.
+    float tile_error = 0.0f;
+    for (int i = 0; i < std::min(n, 1000); i += 1)
+    {
+        tile_error = std::max(tile_error, std::abs(
+            WaveField::evaluate(x[i], z[i], waves.field_time())
+            - WaveField::evaluate(x[i] + WaveField::period, z[i] - WaveField::period,
+                                  waves.field_time())));
+    }
+
+    std::printf("%d points, %d texels square\n", n, resolution);
+    std::printf("%-24s %10s %12s\n", "query", "ms", "points/s");
+    auto report = [n](const char* name, double ms)
+    {
+        std::printf("%-24s %10.2f %12.0f\n", name, ms, n / (ms / 1000.0));
+    };
+    report("height, one at a time", single_height_ms);
+    report("height, batched", batch_height_ms);
+    report("normal, one at a time", single_normal_ms);
+    report("height+normal, batched", batch_normal_ms);
+    const bool ok = batch_agrees && texel_error == 0.0f && tile_error < 1e-3f;
+    std::printf("batch matches single queries: %s\n", batch_agrees ? "yes" : "NO");
+    std::printf("largest texel error %g, tiling error %g: %s\n",
+                texel_error, tile_error, ok ? "ok" : "FAILED");
+    std::printf("(%d threads)\n", ThreadPool::shared().num_threads());
+    return ok ? 0 : 1;
+}
@@ -285,3 +285,67 @@ vec3 hsv2rgb(vec3 c)
     return c.z * mix(K.xxx, clamp(p - K.xxx, 0.0, 1.0), c.y);
 }
 
+// Continuous level of detail for the landscape (see Landscape::build_lod).
+// A landscape vertex has a morph attribute (height, level). When the vertex
+// is drawn in a quadtree node of that level, it morphs toward 'height' as
+// its distance from LodEye goes from LodRange.x to LodRange.y, where it
+// matches the coarser node beside it.
+// LodMorph is false when drawing anything other than the landscape.
+uniform bool  LodMorph;
+uniform float LodLevel;
+uniform vec2  LodRange;
+uniform vec3  LodEye;
+
+vec3 lod_morph(vec3 position, vec2 morph)
+{
+    if (!LodMorph || morph.y != LodLevel) return position;
+    float t = clamp(
+        (distance(position, LodEye) - LodRange.x) / (LodRange.y - LodRange.x),
+        0.0, 1.0);
+    return vec3(position.x, mix(position.y, morph.x, t), position.z);
+}
+
+// Compact landscape vertices (see Landscape::pack_vertices).
+// While LandscapePacked is true, the landscape vertex attributes hold:
+//   position.xy: the height and morph height, in [0, 1] over LandscapeHeight
+//                (the lowest height, and the range of heights).
+//   normal.xy:   the octahedral encoded normal.
+//   colour.xy:   the palette index and morph level.
+// The row and column of a vertex come from its index, and its x and z from
+// those with LandscapeOrigin and LandscapeSpacing.
+// The vertex index is passed in, as gl_VertexID is not defined in fragment
+// shaders, which this file is also prepended to.
+uniform bool  LandscapePacked;
+uniform int   LandscapeSize;
+uniform vec2  LandscapeOrigin;
+uniform float LandscapeSpacing;
+uniform vec2  LandscapeHeight;
+
+vec3 octahedral_decode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(
+            n.x >= 0.0 ? 1.0 : -1.0,
+            n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+// Unpack a landscape vertex. The palette index is left to the caller,
+// as the palette is declared by the shaders that use it.
+void landscape_unpack(
+    int vertex_id, vec3 packed_position, vec3 packed_normal, vec3 packed_colour,
+    out vec3 position, out vec3 normal, out vec2 morph)
+{
+    int row = vertex_id / LandscapeSize;
+    int col = vertex_id - row * LandscapeSize;
+    position = vec3(
+        LandscapeOrigin.x + float(row) * LandscapeSpacing,
+        LandscapeHeight.x + packed_position.x * LandscapeHeight.y,
+        LandscapeOrigin.y + float(col) * LandscapeSpacing);
+    normal = octahedral_decode(packed_normal.xy);
+    morph = vec2(
+        LandscapeHeight.x + packed_position.y * LandscapeHeight.y,
+        packed_colour.y);
+}
@@ -4,12 +4,15 @@
 layout (location = 0) in vec3 a_Position;
 layout (location = 1) in vec3 a_Normal;
 layout (location = 2) in vec3 a_Colour;
+layout (location = 3) in vec2 a_Morph;
 
 uniform mat4 ProjectionMatrix;
 uniform mat4 ViewMatrix;
 uniform mat4 ModelMatrix;
 uniform mat3 NormalMatrix;
 uniform mat4 LightSpaceMatrix;
+// The landscape palette, for packed vertices.
+uniform vec3 Palette[16];
 
 out vec3 Colour;
 out vec3 Normal;
@@ -18,14 +21,23 @@ out vec4 FragPosDeviceSpace;
 out vec4 FragPosLightSpace;
 
 void main() {
-    FragPos = vec3(ModelMatrix * vec4(a_Position, 1.0));
-    Colour = a_Colour;
-    Normal = NormalMatrix * a_Normal;
+    vec3 position = a_Position;
+    vec3 normal = a_Normal;
+    vec2 morph = a_Morph;
+    if (LandscapePacked) {
+        landscape_unpack(
+            gl_VertexID, a_Position, a_Normal, a_Colour,
+            position, normal, morph);
+    }
+    position = lod_morph(position, morph);
+    FragPos = vec3(ModelMatrix * vec4(position, 1.0));
+    Colour = LandscapePacked ? Palette[int(a_Colour.x)] : a_Colour;
+    Normal = NormalMatrix * normal;
     FragPosLightSpace = LightSpaceMatrix * vec4(FragPos, 1.0);
     gl_Position =
         ProjectionMatrix
         * ViewMatrix
         * ModelMatrix
-        * vec4(a_Position, 1.0);
+        * vec4(position, 1.0);
     FragPosDeviceSpace = gl_Position;
 }
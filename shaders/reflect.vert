@@ -4,12 +4,15 @@
 layout (location = 0) in vec3 a_Position;
 layout (location = 1) in vec3 a_Normal;
 layout (location = 2) in vec3 a_Colour;
+layout (location = 3) in vec2 a_Morph;
 
 uniform mat4 ProjectionMatrix;
 uniform mat4 ViewMatrix;
 uniform mat4 ModelMatrix;
 uniform mat3 NormalMatrix;
 uniform mat4 LightSpaceMatrix;
+// The landscape palette, for packed vertices.
+uniform vec3 Palette[16];
 
 out vec3 Colour;
 out vec3 Normal;
@@ -17,13 +20,21 @@ out vec3 FragPos;
 
 void main() {
     float water_level = 0.05*128.0;
-    vec3 pos = a_Position;
+    vec3 position = a_Position;
+    vec3 normal = a_Normal;
+    vec2 morph = a_Morph;
+    if (LandscapePacked) {
+        landscape_unpack(
+            gl_VertexID, a_Position, a_Normal, a_Colour,
+            position, normal, morph);
+    }
+    vec3 pos = lod_morph(position, morph);
     pos -= vec3(0.0, water_level, 0.0);
     pos *= vec3(1.0, -1.0, 1.0);
     pos += vec3(0.0, water_level, 0.0);
     FragPos = vec3(ModelMatrix * vec4(pos, 1.0));
-    Colour = a_Colour;
-    Normal = NormalMatrix * a_Normal;
+    Colour = LandscapePacked ? Palette[int(a_Colour.x)] : a_Colour;
+    Normal = NormalMatrix * normal;
     //FragPosLightSpace = LightSpaceMatrix * vec4(FragPos, 1.0);
     gl_Position =
         ProjectionMatrix
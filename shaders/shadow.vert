@@ -4,6 +4,7 @@
 layout (location = 0) in vec3 a_Position;
 layout (location = 1) in vec3 a_Normal;
 layout (location = 2) in vec2 a_TexCoord;
+layout (location = 3) in vec2 a_Morph;
 
 //uniform mat4 ProjectionMatrix;
 //uniform mat4 ViewMatrix;
@@ -12,10 +13,19 @@ uniform mat4 ModelMatrix;
 uniform mat4 LightSpaceMatrix;
 
 void main() {
+    vec3 position = a_Position;
+    vec3 normal = a_Normal;
+    vec2 morph = a_Morph;
+    if (LandscapePacked) {
+        landscape_unpack(
+            gl_VertexID, a_Position, a_Normal, vec3(a_TexCoord, 0.0),
+            position, normal, morph);
+    }
+    position = lod_morph(position, morph);
     gl_Position =
         //ProjectionMatrix
         //* ViewMatrix
         LightSpaceMatrix
         * ModelMatrix
-        * vec4(a_Position, 1.0);
+        * vec4(position, 1.0);
 }
@@ -4,6 +4,7 @@
 layout (location = 0) in vec3 a_Position;
 layout (location = 1) in vec3 a_Normal;
 layout (location = 2) in vec3 a_Colour;
+layout (location = 3) in vec2 a_Morph;
 
 uniform mat4 ProjectionMatrix;
 uniform mat4 ViewMatrix;
@@ -15,12 +16,21 @@ out vec3 FragPos;
 out vec4 FragPosDeviceSpace;
 
 void main() {
-    FragPos = vec3(ModelMatrix * vec4(a_Position, 1.0));
-    Normal = NormalMatrix * a_Normal;
+    vec3 position = a_Position;
+    vec3 normal = a_Normal;
+    vec2 morph = a_Morph;
+    if (LandscapePacked) {
+        landscape_unpack(
+            gl_VertexID, a_Position, a_Normal, a_Colour,
+            position, normal, morph);
+    }
+    position = lod_morph(position, morph);
+    FragPos = vec3(ModelMatrix * vec4(position, 1.0));
+    Normal = NormalMatrix * normal;
     gl_Position =
         ProjectionMatrix
         * ViewMatrix
         * ModelMatrix
-        * vec4(a_Position, 1.0);
+        * vec4(position, 1.0);
     FragPosDeviceSpace = gl_Position;
 }
@@ -6,6 +6,7 @@ in vec3 Colour;
 in vec3 Normal;
 in vec4 FragPosDeviceSpace;
 in vec4 FragPosLightSpace;
+in vec2 WaveCoord;
 
 out vec4 FragColour;
 
@@ -18,12 +19,18 @@ uniform float   Time;
 
 uniform mat4 ProjectionMatrix;
 uniform mat4 ViewMatrix;
+uniform mat3 NormalMatrix;
 
 uniform vec3 ViewPos;
 
 uniform sampler2D DepthMap;
 uniform sampler2D ShadowDepthMap;
 uniform sampler2D ReflectMap;
+uniform sampler2D WaveMap;
+
+// The normal of the water's surface at this fragment, sampled from the
+// baked waves so the lighting follows waves finer than the mesh.
+vec3 SurfaceNormal;
 
 struct LightSource
 {
@@ -68,7 +75,7 @@ float discretize(float value)
 }
 
 vec3 calculate_lighting(in LightSource light) {
-    vec3 norm = normalize(Normal);
+    vec3 norm = SurfaceNormal;
 
     vec3 light_dir;
     float attenuation;
@@ -263,7 +270,7 @@ vec4 world_reflection()
 {
     vec4 norm = ProjectionMatrix * ViewMatrix
     * vec4(
-        Normal * vec3(1.0, 0.0, 1.0)
+        SurfaceNormal * vec3(1.0, 0.0, 1.0)
         + vec3(0.0, -0.04, 0.0),         // height correction to remove blue gaps
         0.0);
     vec4 reflect_pos = FragPosDeviceSpace + 10.0*norm;
@@ -295,6 +302,7 @@ void main()
     // If max_height is updated in main, it needs to be updated here too.
     const float max_height = 128.0;
     const float water_level = 0.05 * max_height;
+    SurfaceNormal = normalize(NormalMatrix * texture(WaveMap, WaveCoord).xyz);
 
     // TODO: Remove duplicate code between this and lighting calculations
     // for calculating light_dir and view_dir.
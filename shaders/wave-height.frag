@@ -0,0 +1,38 @@
+#version 330
+// Authorship: James Kortman (a1648090)
+// Bakes the height of the ocean's waves into a texture, one texel per
+// fragment, at the point in the repeating field at the texel's centre.
+// The CPU mirror of this is WaveField::evaluate; keep the two in step.
+
+in vec2 TexCoord;
+
+out float WaveHeight;
+
+uniform float Time;
+uniform int WaveResolution;
+uniform float WavePeriod;
+
+// These must match WaveField.
+const float scale = 0.02;
+const float cells = 10.0;
+const float height_variance = 0.8;
+
+float wave(vec2 pos, float time)
+{
+    // The noises the others depend on repeat every 'cells' noise cells,
+    // so the whole field repeats every WavePeriod.
+    vec2 coord = pos * scale;
+    vec2 rep = vec2(cells);
+    float a = pnoise(coord + 0.05 * time, rep);
+    float b = pnoise(coord + 1.0, rep);
+    float c = pnoise(coord + a + 0.07 * time, rep);
+    float d = pnoise(coord + b + 0.09 * time, rep);
+    float e = cnoise(vec2(a + b, c + d));
+    return height_variance * (e - 0.5);
+}
+
+void main()
+{
+    vec2 pos = gl_FragCoord.xy / float(WaveResolution) * WavePeriod;
+    WaveHeight = wave(pos, Time);
+}
@@ -0,0 +1,31 @@
+#version 330
+// Authorship: James Kortman (a1648090)
+// Finds the normal of the ocean's surface from the baked heights of the
+// waves, by central differences between each texel's neighbours (which
+// wrap, as the field repeats). Writes the normal, and the height again, so
+// the water samples one texture for both.
+
+in vec2 TexCoord;
+
+out vec4 Wave;
+
+uniform sampler2D WaveHeightMap;
+uniform int WaveResolution;
+uniform float WavePeriod;
+
+float height_at(ivec2 texel)
+{
+    ivec2 wrapped = (texel + WaveResolution) % WaveResolution;
+    return texelFetch(WaveHeightMap, wrapped, 0).r;
+}
+
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float spacing = WavePeriod / float(WaveResolution);
+    vec3 normal = normalize(vec3(
+        height_at(texel - ivec2(1, 0)) - height_at(texel + ivec2(1, 0)),
+        2.0 * spacing,
+        height_at(texel - ivec2(0, 1)) - height_at(texel + ivec2(0, 1))));
+    Wave = vec4(normal, height_at(texel));
+}
@@ -0,0 +1,59 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of BitGrid class member functions.
+
+#include "BitGrid.hpp"
+
+#include <cassert>
+
+BitGrid::BitGrid()
+    : num_rows(0), num_cols(0), row_words(0)
+{}
+
+BitGrid::BitGrid(int rows, int cols)
+{
+    reset(rows, cols);
+}
+
+void BitGrid::reset(int rows, int cols)
+{
+    num_rows = rows;
+    num_cols = cols;
+    row_words = (cols + 63) / 64;
+    words.assign(std::size_t(rows) * row_words, 0);
+}
+
+bool BitGrid::get(int row, int col) const
+{
+    assert(row >= 0 && row < num_rows && col >= 0 && col < num_cols);
+    const uint64_t word = words[std::size_t(row) * row_words + col / 64];
+    return (word >> (col % 64)) & 1;
+}
+
+void BitGrid::set(int row, int col, bool value)
+{
+    assert(row >= 0 && row < num_rows && col >= 0 && col < num_cols);
+    uint64_t& word = words[std::size_t(row) * row_words + col / 64];
+    const uint64_t bit = uint64_t(1) << (col % 64);
+    if (value) word |= bit;
+    else       word &= ~bit;
+}
+
+int BitGrid::rows() const
+{
+    return num_rows;
+}
+
+int BitGrid::cols() const
+{
+    return num_cols;
+}
+
+int BitGrid::count() const
+{
+    int total = 0;
+    for (uint64_t word: words)
+    {
+        total += __builtin_popcountll(word);
+    }
+    return total;
+}
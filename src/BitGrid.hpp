@@ -0,0 +1,40 @@
+// Authorship: James Kortman (a1648090)
+// BitGrid class
+// A rows*cols grid of bits, packed 64 to a word.
+// Each row starts on a new word, so different rows may be written from
+// different threads at the same time.
+
+#ifndef BITGRID_HPP
+#define BITGRID_HPP
+
+#include <cstdint>
+#include <vector>
+
+class BitGrid
+{
+public:
+    // Create an empty 0*0 grid.
+    BitGrid();
+    // Create a rows*cols grid with every bit cleared.
+    BitGrid(int rows, int cols);
+
+    // Resize the grid to rows*cols, and clear every bit.
+    void reset(int rows, int cols);
+
+    bool get(int row, int col) const;
+    void set(int row, int col, bool value = true);
+
+    int rows() const;
+    int cols() const;
+    // The number of set bits.
+    int count() const;
+
+private:
+    int num_rows;
+    int num_cols;
+    // The number of words in each row.
+    int row_words;
+    std::vector<uint64_t> words;
+};
+
+#endif // BITGRID_HPP
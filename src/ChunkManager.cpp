@@ -0,0 +1,317 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of ChunkManager class member functions.
+
+#include "ChunkManager.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <string>
+
+#include "Console.hpp"
+#include "Renderer.hpp"
+#include "TerrainGenerator.hpp"
+#include "ThreadPool.hpp"
+
+// The memory used by a tile on the CPU, once the copies uploaded to the GPU
+// have been released (see Landscape::release_cpu_data).
+static std::size_t landscape_bytes(const Landscape& landscape)
+{
+    return sizeof(float) * landscape.height_grid.size()
+        + sizeof(unsigned int) * landscape.indices.size()
+        + sizeof(Landscape::LodNode) * landscape.lod_nodes.size()
+        + sizeof(Landscape::LodChunk) * landscape.lod_chunks.size();
+}
+
+ChunkManager::ChunkManager(
+    int seed, int chunk_size, float vert_dist, float max_height,
+    int radius, std::size_t budget, ResourceManager* resources)
+    : seed(seed),
+      chunk_size(chunk_size),
+      vert_dist(vert_dist),
+      max_height(max_height),
+      budget(budget),
+      resources(resources),
+      frame(0),
+      num_loaded(0),
+      loaded_kb(0),
+      released_kb(0),
+      failures(0)
+{
+    // Tiles are requested and uploaded nearest first.
+    for (int dx = -radius; dx <= radius; dx += 1)
+    {
+        for (int dz = -radius; dz <= radius; dz += 1)
+        {
+            ring.push_back(Key(dx, dz));
+        }
+    }
+    std::stable_sort(ring.begin(), ring.end(), [](const Key& a, const Key& b)
+    {
+        return a.first * a.first + a.second * a.second
+             < b.first * b.first + b.second * b.second;
+    });
+
+    console->register_var(
+        "chunks.loaded",
+        Int,
+        &num_loaded,
+        1,
+        "The number of terrain tiles loaded",
+        false);
+    console->register_var(
+        "chunks.kb",
+        Int,
+        &loaded_kb,
+        1,
+        "The memory used by loaded terrain tiles, in KB",
+        false);
+    console->register_var(
+        "chunks.released_kb",
+        Int,
+        &released_kb,
+        1,
+        "The CPU memory freed by releasing the copies of tiles uploaded to the GPU, in KB",
+        false);
+    console->register_var(
+        "chunks.failures",
+        Int,
+        &failures,
+        1,
+        "The number of terrain tiles which failed to generate",
+        false);
+}
+
+ChunkManager::~ChunkManager()
+{
+    // Workers still generating tiles write into their chunk.
+    for (auto& entry: chunks)
+    {
+        Chunk& chunk = *entry.second;
+        if (chunk.generated.valid()) chunk.generated.wait();
+        if (chunk.landscape != nullptr)
+        {
+            for (Object* object: chunk.landscape->objects) delete object;
+        }
+    }
+}
+
+// Request the tiles around 'centre', upload generated tiles, and
+// release far tiles if over budget.
+void ChunkManager::update(glm::vec3 centre, Renderer& renderer)
+{
+    frame += 1;
+    const Key centre_key = key_at(centre.x, centre.z);
+    bool changed = false;
+
+    // Request missing tiles, and upload generated tiles.
+    int uploads = 0;
+    for (const Key& offset: ring)
+    {
+        const Key key(centre_key.first + offset.first,
+                      centre_key.second + offset.second);
+        std::unique_ptr<Chunk>& slot = chunks[key];
+        if (slot == nullptr)
+        {
+            slot.reset(new Chunk);
+            slot->uploaded = false;
+            slot->bytes = 0;
+            slot->retry_frame = 0;
+            request(*slot, key);
+        }
+        Chunk& chunk = *slot;
+        chunk.last_used = frame;
+
+        if (!chunk.uploaded
+            && uploads < max_uploads_per_frame
+            && collect(chunk))
+        {
+            if (chunk.landscape == nullptr)
+            {
+                if (frame >= chunk.retry_frame) request(chunk, key);
+                continue;
+            }
+            // Tiles are never edited, so once uploaded they only keep what
+            // is needed to draw them and query their heights.
+            renderer.assign_vao(chunk.landscape.get());
+            const std::size_t gpu_bytes = Renderer::upload_size(chunk.landscape.get());
+            released_kb += int(chunk.landscape->release_cpu_data() / 1024);
+            chunk.uploaded = true;
+            chunk.bytes = gpu_bytes + landscape_bytes(*chunk.landscape)
+                + chunk.pyramid->bytes();
+            uploads += 1;
+            changed = true;
+        }
+    }
+
+    // Release tiles outside the ring, least recently used first, until
+    // the tiles fit in the budget.
+    std::size_t total = 0;
+    for (const auto& entry: chunks) total += entry.second->bytes;
+    while (total > budget)
+    {
+        auto oldest = chunks.end();
+        for (auto it = chunks.begin(); it != chunks.end(); ++it)
+        {
+            Chunk& chunk = *it->second;
+            if (chunk.last_used == frame || !collect(chunk)) continue;
+            if (oldest == chunks.end()
+                || chunk.last_used < oldest->second->last_used)
+            {
+                oldest = it;
+            }
+        }
+        if (oldest == chunks.end()) break;
+        total -= oldest->second->bytes;
+        release(*oldest->second, renderer);
+        chunks.erase(oldest);
+        changed = true;
+    }
+
+    if (changed) rebuild_lists();
+    loaded_kb = int(total / 1024);
+}
+
+// The uploaded tiles, for rendering.
+const std::vector<Landscape*>& ChunkManager::landscapes() const
+{
+    return uploaded_landscapes;
+}
+
+// The objects on the uploaded tiles, for rendering.
+const std::vector<Object*>& ChunkManager::objects() const
+{
+    return uploaded_objects;
+}
+
+// Get the height of the terrain at x, z.
+float ChunkManager::get_height_at(float x, float z) const
+{
+    auto it = chunks.find(key_at(x, z));
+    if (it == chunks.end() || !it->second->uploaded)
+    {
+        return 0.05f * max_height;
+    }
+    return it->second->landscape->get_height_at(x, z);
+}
+
+// Cast a ray against the uploaded tiles, finding the nearest hit.
+bool ChunkManager::cast_ray(const HeightPyramid::Ray& ray, HeightPyramid::Hit& hit) const
+{
+    hit.hit = false;
+    for (const auto& entry: chunks)
+    {
+        const Chunk& chunk = *entry.second;
+        if (!chunk.uploaded) continue;
+        HeightPyramid::Hit tile_hit;
+        if (chunk.pyramid->cast(ray, tile_hit)
+            && (!hit.hit || tile_hit.distance < hit.distance))
+        {
+            hit = tile_hit;
+        }
+    }
+    return hit.hit;
+}
+
+// The length of an edge of a tile.
+float ChunkManager::tile_edge() const
+{
+    return vert_dist * (chunk_size - 1);
+}
+
+// The tile containing x, z.
+ChunkManager::Key ChunkManager::key_at(float x, float z) const
+{
+    return Key(int(std::floor(x / tile_edge())),
+               int(std::floor(z / tile_edge())));
+}
+
+// Start generating the tile for a chunk.
+void ChunkManager::request(Chunk& chunk, Key key)
+{
+    // Copy the settings, so the task doesn't refer to the manager.
+    const int seed = this->seed;
+    const int chunk_size = this->chunk_size;
+    const float vert_dist = this->vert_dist;
+    const float max_height = this->max_height;
+    ResourceManager* resources = this->resources;
+    Chunk* target = &chunk;
+    chunk.generated = ThreadPool::shared().submit([=]()
+    {
+        TerrainGenerator tg(
+            seed, key.first, key.second, chunk_size, vert_dist,
+            max_height, resources);
+        target->landscape.reset(tg.landscape());
+        target->pyramid.reset(new HeightPyramid(*target->landscape));
+    });
+}
+
+// Whether a chunk's worker has finished.
+bool ChunkManager::collect(Chunk& chunk)
+{
+    // Already collected.
+    if (!chunk.generated.valid()) return true;
+    if (chunk.generated.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        return false;
+    }
+    std::string error;
+    try
+    {
+        chunk.generated.get();
+        if (chunk.landscape == nullptr || chunk.pyramid == nullptr)
+        {
+            error = "no tile was created";
+        }
+    }
+    catch (const std::exception& exception)
+    {
+        error = exception.what();
+    }
+    catch (...)
+    {
+        error = "unknown exception";
+    }
+    if (error.empty()) return true;
+
+    // Drop what the worker made, and try again later.
+    warn("Failed to generate terrain tile: " + error);
+    if (chunk.landscape != nullptr)
+    {
+        for (Object* object: chunk.landscape->objects) delete object;
+    }
+    chunk.pyramid.reset();
+    chunk.landscape.reset();
+    chunk.retry_frame = frame + retry_frames;
+    failures += 1;
+    return true;
+}
+
+// Release a chunk's tile and objects.
+void ChunkManager::release(Chunk& chunk, Renderer& renderer)
+{
+    if (chunk.landscape == nullptr) return;
+    if (chunk.uploaded) renderer.release_vao(chunk.landscape.get());
+    for (Object* object: chunk.landscape->objects) delete object;
+    chunk.pyramid.reset();
+    chunk.landscape.reset();
+}
+
+// Rebuild the lists of uploaded tiles and objects.
+void ChunkManager::rebuild_lists()
+{
+    uploaded_landscapes.clear();
+    uploaded_objects.clear();
+    for (const auto& entry: chunks)
+    {
+        const Chunk& chunk = *entry.second;
+        if (!chunk.uploaded) continue;
+        uploaded_landscapes.push_back(chunk.landscape.get());
+        uploaded_objects.insert(
+            uploaded_objects.end(),
+            chunk.landscape->objects.begin(),
+            chunk.landscape->objects.end());
+    }
+    num_loaded = uploaded_landscapes.size();
+}
@@ -0,0 +1,121 @@
+// Authorship: James Kortman (a1648090)
+// ChunkManager class
+// Keeps a ring of terrain tiles (chunks) generated around the camera.
+// Tiles are generated by TerrainGenerator on the shared ThreadPool,
+// uploaded a few per frame, and tiles outside the ring are released,
+// least recently used first, once the tiles use more than a memory budget.
+// A tile whose generation fails is dropped, with a warning, and requested
+// again a little later.
+
+#ifndef CHUNKMANAGER_HPP
+#define CHUNKMANAGER_HPP
+
+#include <cstddef>
+#include <future>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "HeightPyramid.hpp"
+#include "Landscape.hpp"
+#include "Object.hpp"
+#include "ResourceManager.hpp"
+
+class Renderer;
+
+class ChunkManager
+{
+public:
+    // Create a ChunkManager for tiles of chunk_size*chunk_size vertices,
+    // spaced vert_dist apart. Tiles up to 'radius' tiles away from the
+    // camera are kept loaded, and other tiles are kept until all tiles
+    // use more than 'budget' bytes.
+    // The manager does not take ownership of 'resources'.
+    ChunkManager(
+        int seed, int chunk_size, float vert_dist, float max_height,
+        int radius, std::size_t budget, ResourceManager* resources);
+    ChunkManager() = delete;
+    ChunkManager(const ChunkManager&) = delete;
+    ChunkManager& operator=(const ChunkManager&) = delete;
+    ~ChunkManager();
+
+    // Request the tiles around 'centre', upload generated tiles, and
+    // release far tiles if over budget.
+    void update(glm::vec3 centre, Renderer& renderer);
+
+    // The uploaded tiles, for rendering.
+    const std::vector<Landscape*>& landscapes() const;
+    // The objects on the uploaded tiles, for rendering.
+    const std::vector<Object*>& objects() const;
+
+    // Get the height of the terrain at x, z.
+    // If the tile there has not been uploaded, the sea level is returned.
+    float get_height_at(float x, float z) const;
+    // Cast a ray against the uploaded tiles, finding the nearest hit.
+    bool cast_ray(const HeightPyramid::Ray& ray, HeightPyramid::Hit& hit) const;
+
+    // The length of an edge of a tile.
+    float tile_edge() const;
+
+private:
+    typedef std::pair<int, int> Key;
+    struct Chunk
+    {
+        // The generated tile, which is owned by the chunk.
+        // Set by the worker generating the tile, and null if it failed.
+        std::unique_ptr<Landscape> landscape;
+        // The pyramid for casting rays against the tile.
+        std::unique_ptr<HeightPyramid> pyramid;
+        // Ready once the worker generating the tile has finished.
+        std::future<void> generated;
+        bool uploaded;
+        // The memory used by the tile on the CPU and GPU, once generated.
+        std::size_t bytes;
+        // The last frame the tile was inside the ring.
+        unsigned long last_used;
+        // The frame from which a tile that failed to generate is
+        // requested again.
+        unsigned long retry_frame;
+    };
+
+    // The tile containing x, z.
+    Key key_at(float x, float z) const;
+    // Start generating the tile for a chunk.
+    void request(Chunk& chunk, Key key);
+    // Whether a chunk's worker has finished. Once it has, what it threw is
+    // caught, and a tile that failed is dropped, so the chunk's landscape
+    // is only set if the tile was generated.
+    bool collect(Chunk& chunk);
+    // Release a chunk's tile and objects.
+    void release(Chunk& chunk, Renderer& renderer);
+    // Rebuild the lists of uploaded tiles and objects.
+    void rebuild_lists();
+
+    int seed;
+    int chunk_size;
+    float vert_dist;
+    float max_height;
+    std::size_t budget;
+    ResourceManager* resources;
+    // The tile offsets within the radius, nearest first.
+    std::vector<Key> ring;
+    std::map<Key, std::unique_ptr<Chunk>> chunks;
+    unsigned long frame;
+    // The most tiles uploaded in a single frame.
+    const int max_uploads_per_frame = 2;
+    // The frames waited before a tile that failed is requested again.
+    const unsigned long retry_frames = 60;
+
+    std::vector<Landscape*> uploaded_landscapes;
+    std::vector<Object*> uploaded_objects;
+    // Statistics, available through the console.
+    int num_loaded;
+    int loaded_kb;
+    // The total freed over every tile uploaded.
+    int released_kb;
+    int failures;
+};
+
+#endif // CHUNKMANAGER_HPP
@@ -0,0 +1,299 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of the erosion functions.
+
+#include "Erosion.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+#include "ThreadPool.hpp"
+
+ErosionParams::ErosionParams()
+    : iterations(4),
+      max_ms(0.0f),
+      tile_size(64),
+      droplet_density(0.05f),
+      lifetime(28),
+      inertia(0.05f),
+      capacity(0.5f),
+      min_capacity(0.01f),
+      deposition(0.1f),
+      erosion(0.1f),
+      evaporation(0.02f),
+      gravity(4.0f),
+      radius(3),
+      thermal_passes(2),
+      talus(1.2f),
+      thermal_rate(0.25f)
+{}
+
+// A small random number generator for the droplets of one tile.
+struct DropletRandom
+{
+    explicit DropletRandom(uint32_t seed) : state(seed) {}
+    uint32_t next()
+    {
+        state += 0x9E3779B9u;
+        uint32_t z = state;
+        z = (z ^ (z >> 16)) * 0x85EBCA6Bu;
+        z = (z ^ (z >> 13)) * 0xC2B2AE35u;
+        return z ^ (z >> 16);
+    }
+    // A float in [0, 1).
+    float uniform()
+    {
+        return float(next() >> 8) / float(1 << 24);
+    }
+    uint32_t state;
+};
+
+// The cells a droplet erodes around its cell, and how much of the eroded
+// height is taken from each.
+struct Brush
+{
+    std::vector<int> rows;
+    std::vector<int> cols;
+    std::vector<float> weights;
+};
+
+static Brush make_brush(int radius)
+{
+    Brush brush;
+    float total = 0.0f;
+    for (int row = -radius; row <= radius; row += 1)
+    {
+        for (int col = -radius; col <= radius; col += 1)
+        {
+            const float weight = float(radius) - std::sqrt(float(row * row + col * col));
+            if (weight <= 0.0f) continue;
+            brush.rows.push_back(row);
+            brush.cols.push_back(col);
+            brush.weights.push_back(weight);
+            total += weight;
+        }
+    }
+    if (brush.weights.empty())
+    {
+        // A radius of 0 erodes just the droplet's cell.
+        brush.rows.push_back(0);
+        brush.cols.push_back(0);
+        brush.weights.push_back(1.0f);
+        total = 1.0f;
+    }
+    for (float& weight: brush.weights) weight /= total;
+    return brush;
+}
+
+// The height and gradient of the heightmap at a fractional row and column,
+// interpolated from the corners of the cell containing it.
+static void sample(
+    const float* heights, int size, float row, float col,
+    float& height, float& gradient_row, float& gradient_col)
+{
+    const int r = int(row);
+    const int c = int(col);
+    const float u = col - c;
+    const float v = row - r;
+    const float* cell = &heights[std::size_t(r) * size + c];
+    const float h00 = cell[0];
+    const float h01 = cell[1];
+    const float h10 = cell[size];
+    const float h11 = cell[size + 1];
+    gradient_col = (h01 - h00) * (1.0f - v) + (h11 - h10) * v;
+    gradient_row = (h10 - h00) * (1.0f - u) + (h11 - h01) * u;
+    height = h00 * (1.0f - u) * (1.0f - v) + h01 * u * (1.0f - v)
+           + h10 * (1.0f - u) * v          + h11 * u * v;
+}
+
+// Run one droplet from a fractional row and column until it stops, leaves
+// the map, or runs out of steps.
+static void run_droplet(
+    float* heights, int size, float row, float col, int lifetime,
+    const ErosionParams& params, const Brush& brush)
+{
+    float dir_row = 0.0f;
+    float dir_col = 0.0f;
+    float speed = 1.0f;
+    float water = 1.0f;
+    float sediment = 0.0f;
+    for (int step = 0; step < lifetime; step += 1)
+    {
+        const int r = int(row);
+        const int c = int(col);
+        const float u = col - c;
+        const float v = row - r;
+        float height, gradient_row, gradient_col;
+        sample(heights, size, row, col, height, gradient_row, gradient_col);
+
+        // Turn downhill, and move one cell.
+        dir_row = dir_row * params.inertia - gradient_row * (1.0f - params.inertia);
+        dir_col = dir_col * params.inertia - gradient_col * (1.0f - params.inertia);
+        const float length = std::sqrt(dir_row * dir_row + dir_col * dir_col);
+        // (Written so NaNs also stop the droplet.)
+        if (!(length >= 1e-6f)) break;
+        dir_row /= length;
+        dir_col /= length;
+        row += dir_row;
+        col += dir_col;
+        if (!(row >= 0.0f && col >= 0.0f && row < size - 1 && col < size - 1)) break;
+
+        float new_height, unused_row, unused_col;
+        sample(heights, size, row, col, new_height, unused_row, unused_col);
+        const float delta = new_height - height;
+
+        const float capacity = std::max(
+            -delta * speed * water * params.capacity, params.min_capacity);
+        if (sediment > capacity || delta > 0.0f)
+        {
+            // Deposit into the corners of the cell just left, filling any
+            // pit the droplet climbed out of.
+            const float deposit = delta > 0.0f
+                ? std::min(delta, sediment)
+                : (sediment - capacity) * params.deposition;
+            sediment -= deposit;
+            float* cell = &heights[std::size_t(r) * size + c];
+            cell[0]        += deposit * (1.0f - u) * (1.0f - v);
+            cell[1]        += deposit * u * (1.0f - v);
+            cell[size]     += deposit * (1.0f - u) * v;
+            cell[size + 1] += deposit * u * v;
+        }
+        else
+        {
+            // Erode around the cell just left, never digging deeper than
+            // the height lost.
+            const float amount = std::min(
+                (capacity - sediment) * params.erosion, -delta);
+            for (std::size_t i = 0; i < brush.weights.size(); i += 1)
+            {
+                const int br = r + brush.rows[i];
+                const int bc = c + brush.cols[i];
+                if (br < 0 || bc < 0 || br >= size || bc >= size) continue;
+                heights[std::size_t(br) * size + bc] -= amount * brush.weights[i];
+            }
+            sediment += amount;
+        }
+
+        speed = std::sqrt(std::max(0.0f, speed * speed - delta * params.gravity));
+        water *= 1.0f - params.evaporation;
+    }
+}
+
+// The seed for the droplets of a tile in an iteration.
+static uint32_t tile_seed(int seed, int iteration, int tile)
+{
+    uint32_t h = uint32_t(seed) * 0x9E3779B1u;
+    h = (h ^ (uint32_t(iteration) * 0x85EBCA77u)) * 0xC2B2AE3Du;
+    h = (h ^ (h >> 15) ^ (uint32_t(tile) * 0x27D4EB2Fu)) * 0x165667B1u;
+    return h ^ (h >> 16);
+}
+
+// One pass of thermal erosion from 'in' into 'out'.
+// Each pair of neighbouring cells whose difference in height is more than
+// 'talus' moves part of the excess from the higher to the lower, so the
+// pass can be done a cell at a time, in parallel, and keeps the total
+// height.
+static void thermal_pass(
+    const std::vector<float>& in, std::vector<float>& out, int size,
+    float talus, float rate, ThreadPool& pool)
+{
+    pool.parallel_for(0, size, 16, [&](int lo, int hi)
+    {
+        for (int row = lo; row < hi; row += 1)
+        {
+            for (int col = 0; col < size; col += 1)
+            {
+                const std::size_t i = std::size_t(row) * size + col;
+                const float height = in[i];
+                float change = 0.0f;
+                auto exchange = [&](std::size_t j)
+                {
+                    const float difference = height - in[j];
+                    const float excess = std::abs(difference) - talus;
+                    if (!(excess > 0.0f)) return;
+                    const float moved = 0.5f * rate * excess;
+                    change += difference > 0.0f ? -moved : moved;
+                };
+                if (row > 0)        exchange(i - size);
+                if (row < size - 1) exchange(i + size);
+                if (col > 0)        exchange(i - 1);
+                if (col < size - 1) exchange(i + 1);
+                out[i] = height + change;
+            }
+        }
+    });
+}
+
+// Erode a size*size heightmap in place.
+ErosionStats erode(
+    std::vector<float>& heights, int size, float spacing, int seed,
+    const ErosionParams& params, ThreadPool* pool)
+{
+    ThreadPool& workers = pool != nullptr ? *pool : ThreadPool::shared();
+    const auto start = std::chrono::steady_clock::now();
+    ErosionStats stats = { 0, 0.0f };
+    if (size < 2) return stats;
+
+    const int tile_size = std::max(8, params.tile_size);
+    const int radius = std::max(0, params.radius);
+    // A droplet reaches at most its lifetime plus the brush radius (and the
+    // corner of its cell) beyond its tile, which must stay within half a
+    // tile so tiles in the same phase never touch.
+    const int lifetime = std::max(0, std::min(params.lifetime, tile_size / 2 - radius - 1));
+    const Brush brush = make_brush(radius);
+    const int tiles = (size + tile_size - 1) / tile_size;
+    const float talus = params.talus * spacing;
+    std::vector<float> scratch;
+
+    for (int iteration = 0; iteration < params.iterations; iteration += 1)
+    {
+        // -- Hydraulic erosion --
+        for (int phase = 0; phase < 4; phase += 1)
+        {
+            const int phase_row = phase / 2;
+            const int phase_col = phase % 2;
+            const int phase_rows = (tiles - phase_row + 1) / 2;
+            const int phase_cols = (tiles - phase_col + 1) / 2;
+            workers.parallel_for(0, phase_rows * phase_cols, 1, [&](int lo, int hi)
+            {
+                for (int k = lo; k < hi; k += 1)
+                {
+                    const int tile_row = phase_row + 2 * (k / phase_cols);
+                    const int tile_col = phase_col + 2 * (k % phase_cols);
+                    const int row_begin = tile_row * tile_size;
+                    const int col_begin = tile_col * tile_size;
+                    // Droplets start where the cell to their far side is
+                    // still on the map.
+                    const int rows = std::min(tile_size, size - 1 - row_begin);
+                    const int cols = std::min(tile_size, size - 1 - col_begin);
+                    if (rows <= 0 || cols <= 0) continue;
+                    DropletRandom random(
+                        tile_seed(seed, iteration, tile_row * tiles + tile_col));
+                    const int droplets = int(params.droplet_density * rows * cols + 0.5f);
+                    for (int d = 0; d < droplets; d += 1)
+                    {
+                        const float row = row_begin + random.uniform() * rows;
+                        const float col = col_begin + random.uniform() * cols;
+                        run_droplet(
+                            heights.data(), size, row, col, lifetime, params, brush);
+                    }
+                }
+            });
+        }
+
+        // -- Thermal erosion --
+        for (int pass = 0; pass < params.thermal_passes; pass += 1)
+        {
+            scratch.resize(heights.size());
+            thermal_pass(heights, scratch, size, talus, params.thermal_rate, workers);
+            heights.swap(scratch);
+        }
+
+        stats.iterations += 1;
+        stats.ms = std::chrono::duration<float, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        if (params.max_ms > 0.0f && stats.ms >= params.max_ms) break;
+    }
+    return stats;
+}
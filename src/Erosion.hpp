@@ -0,0 +1,84 @@
+// Authorship: James Kortman (a1648090)
+// Erosion
+// Hydraulic and thermal erosion of a square heightmap.
+// Hydraulic erosion simulates water droplets that run downhill, picking up
+// sediment where they speed up and dropping it where they slow down, which
+// carves gullies and fills valleys. Thermal erosion moves material down
+// slopes steeper than the talus slope, which softens cliffs.
+//
+// The map is split into square tiles, and the tiles are run in four
+// phases, like a 2x2 checkerboard, so tiles run at the same time are a
+// whole tile apart. A droplet starts in its tile but may run and erode into
+// the tiles around it (the halo), as far as half a tile, so tiles in one
+// phase never touch the same heights, and the next phase sees the
+// changes made in the halo. Each tile's droplets are seeded from the seed,
+// the iteration and the tile, so the result depends only on the seed and
+// the parameters, never on the number of threads or the order tiles run.
+
+#ifndef EROSION_HPP
+#define EROSION_HPP
+
+#include <vector>
+
+class ThreadPool;
+
+struct ErosionParams
+{
+    // The default parameters.
+    ErosionParams();
+
+    // The number of iterations. Each iteration runs every tile's droplets
+    // once, then the thermal erosion passes.
+    int iterations;
+    // Stop after the iteration during which this many milliseconds have
+    // passed, or 0 for no limit. The result then depends on the speed of
+    // the machine, so this is only for previews.
+    float max_ms;
+    // The size of the tiles, in cells.
+    int tile_size;
+
+    // -- Hydraulic erosion --
+    // The number of droplets per cell in each iteration.
+    float droplet_density;
+    // The most steps a droplet takes. This is limited so droplets stay
+    // within half a tile of their own tile.
+    int lifetime;
+    // How much a droplet keeps its direction rather than turning downhill.
+    float inertia;
+    // Sediment capacity per unit of height lost, speed and water.
+    float capacity;
+    float min_capacity;
+    // The fraction of the excess sediment deposited, and of the spare
+    // capacity eroded, at each step.
+    float deposition;
+    float erosion;
+    // The fraction of water evaporated at each step.
+    float evaporation;
+    float gravity;
+    // The radius, in cells, over which a droplet erodes.
+    int radius;
+
+    // -- Thermal erosion --
+    // The number of passes in each iteration.
+    int thermal_passes;
+    // The steepest stable slope, as height per unit of distance.
+    float talus;
+    // The fraction of the excess height difference moved in each pass.
+    float thermal_rate;
+};
+
+struct ErosionStats
+{
+    // The number of iterations run, and the time they took.
+    int iterations;
+    float ms;
+};
+
+// Erode a size*size heightmap of cells 'spacing' apart, stored row by row,
+// in place.
+// The work is spread over 'pool' (the shared pool if none is given).
+ErosionStats erode(
+    std::vector<float>& heights, int size, float spacing, int seed,
+    const ErosionParams& params, ThreadPool* pool = nullptr);
+
+#endif // EROSION_HPP
@@ -0,0 +1,194 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of the grid filters.
+
+#include "Filters.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+#include "ThreadPool.hpp"
+
+// Blur part of a size*size grid.
+void box_blur(
+    float* values, int size, int channels, int radius, float amount,
+    int row_begin, int row_end, int col_begin, int col_end)
+{
+    assert(row_begin >= 0 && row_end <= size);
+    assert(col_begin >= 0 && col_end <= size);
+    if (row_begin >= row_end || col_begin >= col_end) return;
+    amount = std::max(0.0f, std::min(1.0f, amount));
+    radius = std::max(0, radius);
+
+    // The summed-area table: table[(row * (size+1) + col) * channels + c]
+    // is the sum of channel c over the rows before 'row' and the columns
+    // before 'col'. Sums are kept in doubles so large grids of large
+    // values don't lose precision.
+    // Only the rows and columns reached by the region's kernels are needed.
+    const int stride = size + 1;
+    const int top    = std::max(0, row_begin - radius);
+    const int bottom = std::min(size, row_end + radius);
+    const int left   = std::max(0, col_begin - radius);
+    const int right  = std::min(size, col_end + radius);
+    std::vector<double> table(std::size_t(stride) * stride * channels, 0.0);
+    auto entry = [&](int row, int col) -> double*
+    {
+        return &table[(std::size_t(row) * stride + col) * channels];
+    };
+    for (int row = top; row < bottom; row += 1)
+    {
+        const float* in = &values[(std::size_t(row) * size + left) * channels];
+        const double* above = entry(row, left + 1);
+        double* out = entry(row + 1, left + 1);
+        // The running sum along this row.
+        std::vector<double> line(channels, 0.0);
+        for (int col = left; col < right; col += 1)
+        {
+            for (int c = 0; c < channels; c += 1)
+            {
+                line[c] += *in++;
+                *out++ = *above++ + line[c];
+            }
+        }
+    }
+
+    // Each row of the region only reads the table, so rows are blurred in
+    // parallel.
+    ThreadPool::shared().parallel_for(row_begin, row_end, 16, [&](int lo, int hi)
+    {
+        for (int row = lo; row < hi; row += 1)
+        {
+            const int r0 = std::max(0, row - radius);
+            const int r1 = std::min(size, row + radius + 1);
+            for (int col = col_begin; col < col_end; col += 1)
+            {
+                const int c0 = std::max(0, col - radius);
+                const int c1 = std::min(size, col + radius + 1);
+                const double count = double((r1 - r0) * (c1 - c0));
+                const double* a = entry(r0, c0);
+                const double* b = entry(r0, c1);
+                const double* c = entry(r1, c0);
+                const double* d = entry(r1, c1);
+                float* value = &values[(std::size_t(row) * size + col) * channels];
+                for (int k = 0; k < channels; k += 1)
+                {
+                    const float mean = float((d[k] - b[k] - c[k] + a[k]) / count);
+                    value[k] = (1.0f - amount) * value[k] + amount * mean;
+                }
+            }
+        }
+    });
+}
+
+// Blur a whole size*size grid of values.
+void box_blur(
+    std::vector<float>& values, int size, int radius, float amount)
+{
+    assert(values.size() == std::size_t(size) * size);
+    box_blur(values.data(), size, 1, radius, amount, 0, size, 0, size);
+}
+
+void box_blur(
+    std::vector<glm::vec3>& values, int size, int radius, float amount)
+{
+    assert(values.size() == std::size_t(size) * size);
+    box_blur(&values[0].x, size, 3, radius, amount, 0, size, 0, size);
+}
+
+// The running maximum over a line of n elements spaced 'step' floats
+// apart, for 'lanes' neighbouring lines at once:
+// out[i] = max(in[j]) for j within 'radius' of i and in [0, n).
+// Uses the van Herk/Gil-Werman algorithm. The line is padded with 'radius'
+// lowest values at each end and split into blocks of 2*radius+1 elements;
+// g holds the maximum from the start of each block and h the maximum to the
+// end of each block, so each window is covered by one h and one g value.
+// g and h are scratch space.
+static void running_max(
+    const float* in, float* out, int n, int step, int lanes, int radius,
+    std::vector<float>& g, std::vector<float>& h)
+{
+    const float lowest = std::numeric_limits<float>::lowest();
+    const int window = 2 * radius + 1;
+    const int length = n + 2 * radius;
+    g.resize(std::size_t(length) * lanes);
+    h.resize(std::size_t(length) * lanes);
+    auto padded = [&](int k, int lane) -> float
+    {
+        const int i = k - radius;
+        return (i < 0 || i >= n) ? lowest : in[std::size_t(i) * step + lane];
+    };
+
+    for (int k = 0; k < length; k += 1)
+    {
+        float* gk = &g[std::size_t(k) * lanes];
+        if (k % window == 0)
+        {
+            for (int lane = 0; lane < lanes; lane += 1) gk[lane] = padded(k, lane);
+        }
+        else
+        {
+            const float* previous = gk - lanes;
+            for (int lane = 0; lane < lanes; lane += 1)
+            {
+                gk[lane] = std::max(previous[lane], padded(k, lane));
+            }
+        }
+    }
+    for (int k = length - 1; k >= 0; k -= 1)
+    {
+        float* hk = &h[std::size_t(k) * lanes];
+        if (k % window == window - 1 || k == length - 1)
+        {
+            for (int lane = 0; lane < lanes; lane += 1) hk[lane] = padded(k, lane);
+        }
+        else
+        {
+            const float* next = hk + lanes;
+            for (int lane = 0; lane < lanes; lane += 1)
+            {
+                hk[lane] = std::max(next[lane], padded(k, lane));
+            }
+        }
+    }
+
+    // The window for out[i] is [i, i + 2*radius] in the padded line.
+    for (int i = 0; i < n; i += 1)
+    {
+        const float* hi = &h[std::size_t(i) * lanes];
+        const float* gi = &g[std::size_t(i + 2 * radius) * lanes];
+        float* o = &out[std::size_t(i) * step];
+        for (int lane = 0; lane < lanes; lane += 1)
+        {
+            o[lane] = std::max(hi[lane], gi[lane]);
+        }
+    }
+}
+
+// Set each value to the maximum of the values within 'radius' of it.
+void max_filter(const float* values, float* out, int size, int radius)
+{
+    radius = std::max(0, radius);
+    ThreadPool& pool = ThreadPool::shared();
+
+    // The maximum along each row, in parallel over bands of rows.
+    std::vector<float> row_max(std::size_t(size) * size);
+    pool.parallel_for(0, size, 16, [&](int lo, int hi)
+    {
+        std::vector<float> g, h;
+        for (int row = lo; row < hi; row += 1)
+        {
+            running_max(
+                &values[std::size_t(row) * size], &row_max[std::size_t(row) * size],
+                size, 1, 1, radius, g, h);
+        }
+    });
+
+    // The maximum of those down each column, in parallel over bands of
+    // columns. Each band is processed as many lanes, so the values are
+    // read a row of the band at a time.
+    pool.parallel_for(0, size, 64, [&](int lo, int hi)
+    {
+        std::vector<float> g, h;
+        running_max(&row_max[lo], &out[lo], size, size, hi - lo, radius, g, h);
+    });
+}
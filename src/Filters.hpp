@@ -0,0 +1,37 @@
+// Authorship: James Kortman (a1648090)
+// Grid filters
+// Box and maximum filters over square grids of values, such as a
+// TerrainGenerator's heightmap or its per-vertex positions, normals and
+// colours.
+// The blurs use a summed-area table, and the maximum filter uses the
+// van Herk/Gil-Werman algorithm in two separable passes, so each takes
+// time proportional to the size of the grid regardless of the kernel size.
+
+#ifndef FILTERS_HPP
+#define FILTERS_HPP
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// Blur part of a size*size grid, stored row by row with 'channels' floats
+// per value.
+// Each value in rows [row_begin, row_end) and cols [col_begin, col_end)
+// becomes (1 - amount) * value + amount * mean, where mean is the mean of
+// the values within 'radius' rows and columns of it that are inside the
+// grid. Values outside the region are unchanged.
+void box_blur(
+    float* values, int size, int channels, int radius, float amount,
+    int row_begin, int row_end, int col_begin, int col_end);
+
+// Blur a whole size*size grid of values as above.
+void box_blur(
+    std::vector<float>& values, int size, int radius, float amount = 1.0f);
+void box_blur(
+    std::vector<glm::vec3>& values, int size, int radius, float amount = 1.0f);
+
+// Set each value of 'out' to the maximum of the values of a size*size grid
+// within 'radius' rows and columns of it (only counting values inside the
+// grid). 'values' and 'out' are stored row by row, and must not overlap.
+void max_filter(const float* values, float* out, int size, int radius);
+
+#endif // FILTERS_HPP
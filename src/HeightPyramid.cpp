@@ -0,0 +1,352 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of the HeightPyramid class.
+
+#include "HeightPyramid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "ThreadPool.hpp"
+
+HeightPyramid::HeightPyramid()
+    : landscape(nullptr), quads(0), step(0.0f)
+{}
+
+HeightPyramid::HeightPyramid(const Landscape& landscape)
+    : landscape(&landscape), quads(0), step(0.0f)
+{
+    const int size = int(landscape.size);
+    if (size < 2 || landscape.height_grid.size() != std::size_t(size) * size) return;
+    quads = size - 1;
+    step = landscape.edge / quads;
+
+    // Level 0: the corners of each quad.
+    Level base;
+    base.cells = quads;
+    base.quads_per_cell = 1;
+    base.bounds.resize(std::size_t(quads) * quads);
+    pyramid.push_back(std::move(base));
+    build_base(0, quads, 0, quads);
+
+    // Each further level: the 2x2 blocks of cells of the level below (or
+    // fewer at the far edges).
+    while (pyramid.back().cells > 1)
+    {
+        const Level& below = pyramid.back();
+        Level level;
+        level.cells = (below.cells + 1) / 2;
+        level.quads_per_cell = below.quads_per_cell * 2;
+        level.bounds.resize(std::size_t(level.cells) * level.cells);
+        pyramid.push_back(std::move(level));
+        const int cells = pyramid.back().cells;
+        build_level(levels() - 1, 0, cells, 0, cells);
+    }
+}
+
+void HeightPyramid::build_base(int row_begin, int row_end, int col_begin, int col_end)
+{
+    const int size = quads + 1;
+    const float* heights = landscape->height_grid.data();
+    Level& base = pyramid[0];
+    ThreadPool::shared().parallel_for(row_begin, row_end, 64, [&](int lo, int hi)
+    {
+        for (int row = lo; row < hi; row += 1)
+        {
+            const float* top = heights + std::size_t(row) * size;
+            const float* bottom = top + size;
+            glm::vec2* out = &base.bounds[std::size_t(row) * quads];
+            for (int col = col_begin; col < col_end; col += 1)
+            {
+                const float low = std::min(
+                    std::min(top[col], top[col + 1]), std::min(bottom[col], bottom[col + 1]));
+                const float high = std::max(
+                    std::max(top[col], top[col + 1]), std::max(bottom[col], bottom[col + 1]));
+                out[col] = glm::vec2(low, high);
+            }
+        }
+    });
+}
+
+void HeightPyramid::build_level(
+    int index, int row_begin, int row_end, int col_begin, int col_end)
+{
+    const Level& below = pyramid[index - 1];
+    Level& level = pyramid[index];
+    for (int row = row_begin; row < row_end; row += 1)
+    {
+        for (int col = col_begin; col < col_end; col += 1)
+        {
+            glm::vec2 bounds = below.bounds[std::size_t(2 * row) * below.cells + 2 * col];
+            for (int child = 1; child < 4; child += 1)
+            {
+                const int child_row = 2 * row + child / 2;
+                const int child_col = 2 * col + child % 2;
+                if (child_row >= below.cells || child_col >= below.cells) continue;
+                const glm::vec2 child_bounds =
+                    below.bounds[std::size_t(child_row) * below.cells + child_col];
+                bounds.x = std::min(bounds.x, child_bounds.x);
+                bounds.y = std::max(bounds.y, child_bounds.y);
+            }
+            level.bounds[std::size_t(row) * level.cells + col] = bounds;
+        }
+    }
+}
+
+// Find the cells over some changed vertices again.
+void HeightPyramid::update(int row_begin, int row_end, int col_begin, int col_end)
+{
+    if (pyramid.empty() || row_begin >= row_end || col_begin >= col_end) return;
+    // The quads with a corner among the vertices.
+    row_begin = std::max(row_begin - 1, 0);
+    col_begin = std::max(col_begin - 1, 0);
+    row_end = std::min(row_end, quads);
+    col_end = std::min(col_end, quads);
+    if (row_begin >= row_end || col_begin >= col_end) return;
+    build_base(row_begin, row_end, col_begin, col_end);
+    for (int level = 1; level < levels(); level += 1)
+    {
+        row_begin /= 2;
+        col_begin /= 2;
+        row_end = (row_end + 1) / 2;
+        col_end = (col_end + 1) / 2;
+        build_level(level, row_begin, row_end, col_begin, col_end);
+    }
+}
+
+int HeightPyramid::levels() const
+{
+    return int(pyramid.size());
+}
+
+std::size_t HeightPyramid::bytes() const
+{
+    std::size_t total = 0;
+    for (const Level& level: pyramid) total += sizeof(glm::vec2) * level.bounds.size();
+    return total;
+}
+
+// Intersect a ray with triangle pqr (Moller-Trumbore), giving the distance.
+// Points on the edges are allowed a little tolerance, so rays through the
+// shared edge of two triangles hit one of them.
+static bool hit_triangle(
+    const glm::vec3& origin, const glm::vec3& direction,
+    const glm::vec3& p, const glm::vec3& q, const glm::vec3& r, float& t)
+{
+    const float tolerance = 1e-5f;
+    const glm::vec3 edge1 = q - p;
+    const glm::vec3 edge2 = r - p;
+    const glm::vec3 pvec = glm::cross(direction, edge2);
+    const float det = glm::dot(edge1, pvec);
+    if (std::abs(det) < 1e-12f) return false;
+    const float inverse = 1.0f / det;
+    const glm::vec3 tvec = origin - p;
+    const float u = glm::dot(tvec, pvec) * inverse;
+    if (u < -tolerance || u > 1.0f + tolerance) return false;
+    const glm::vec3 qvec = glm::cross(tvec, edge1);
+    const float v = glm::dot(direction, qvec) * inverse;
+    if (v < -tolerance || u + v > 1.0f + tolerance) return false;
+    t = glm::dot(edge2, qvec) * inverse;
+    return true;
+}
+
+bool HeightPyramid::hit_quad(
+    const Ray& ray, int row, int col, float t_min, float t_max, Hit& hit) const
+{
+    const int size = quads + 1;
+    const float* heights = landscape->height_grid.data();
+    const int a = size * row + col;
+    const int b = a + 1;
+    const int c = a + size;
+    const int d = c + 1;
+    const float x = landscape->origin.x + row * step;
+    const float z = landscape->origin.y + col * step;
+    const glm::vec3 pa(x,        heights[a], z);
+    const glm::vec3 pb(x,        heights[b], z + step);
+    const glm::vec3 pc(x + step, heights[c], z);
+    const glm::vec3 pd(x + step, heights[d], z + step);
+
+    // The quad is split into triangles abc and cbd (see generate_indices).
+    float best = t_max;
+    bool found = false;
+    float t;
+    if (hit_triangle(ray.origin, ray.direction, pa, pb, pc, t) && t >= t_min && t <= best)
+    {
+        best = t;
+        found = true;
+        hit.triangle = {{a, b, c}};
+        hit.normal = glm::cross(pb - pa, pc - pa);
+    }
+    if (hit_triangle(ray.origin, ray.direction, pc, pb, pd, t) && t >= t_min && t <= best)
+    {
+        best = t;
+        found = true;
+        hit.triangle = {{c, b, d}};
+        hit.normal = glm::cross(pb - pc, pd - pc);
+    }
+    if (!found) return false;
+    hit.hit = true;
+    hit.distance = best;
+    hit.position = ray.origin + best * ray.direction;
+    hit.normal = glm::normalize(hit.normal);
+    if (hit.normal.y < 0.0f) hit.normal = -hit.normal;
+    return true;
+}
+
+// The quad row or column containing 'position' along an axis, clamped to
+// [low, high] (NaNs give low).
+static int clamp_quad(float position, int low, int high)
+{
+    if (!(position > float(low))) return low;
+    if (position >= float(high)) return high;
+    return int(position);
+}
+
+// The highest level at which quad rows (or columns) a and b lie in
+// different cells, or -1 if they are the same quad.
+static int highest_split(int a, int b)
+{
+    const unsigned difference = unsigned(a ^ b);
+#if defined(__GNUC__)
+    return difference != 0 ? 31 - __builtin_clz(difference) : -1;
+#else
+    int level = -1;
+    for (unsigned d = difference; d != 0; d >>= 1) level += 1;
+    return level;
+#endif
+}
+
+bool HeightPyramid::cast(const Ray& ray, Hit& hit) const
+{
+    hit.hit = false;
+    if (pyramid.empty() || !(ray.max_distance > 0.0f)) return false;
+    if (ray.direction == glm::vec3(0.0f)) return false;
+
+    // Clip the ray to the box around the landscape, so it starts on it.
+    const float infinity = std::numeric_limits<float>::infinity();
+    const glm::vec2 root = pyramid.back().bounds[0];
+    const glm::vec3 low(landscape->origin.x, root.x, landscape->origin.y);
+    const glm::vec3 high(low.x + quads * step, root.y, low.z + quads * step);
+    glm::vec3 inverse;
+    float t = 0.0f;
+    float t_end = ray.max_distance;
+    for (int axis = 0; axis < 3; axis += 1)
+    {
+        const float d = ray.direction[axis];
+        const float o = ray.origin[axis];
+        if (d == 0.0f)
+        {
+            if (o < low[axis] || o > high[axis]) return false;
+            inverse[axis] = 0.0f;
+            continue;
+        }
+        inverse[axis] = 1.0f / d;
+        const float t0 = (low[axis] - o) * inverse[axis];
+        const float t1 = (high[axis] - o) * inverse[axis];
+        t = std::max(t, std::min(t0, t1));
+        t_end = std::min(t_end, std::max(t0, t1));
+    }
+    if (!(t <= t_end)) return false;
+
+    // The ray is walked through the cells it crosses in order, as by a
+    // DDA on a grid, where the grid is the level of the pyramid currently
+    // being walked. A cell the ray passes above or below is stepped over
+    // whole; otherwise the walk moves down a level into it, until it
+    // reaches a quad, whose triangles are tested. On entering a new cell
+    // the walk moves back up to the largest cell entered, so open ground
+    // is crossed in a few large steps.
+    // The quad containing the point the walk has reached is kept as a row
+    // and column; the cell of each level containing it follows from those.
+    const float inv_step = 1.0f / step;
+    const bool forward_row = ray.direction.x > 0.0f;
+    const bool forward_col = ray.direction.z > 0.0f;
+    // The distance along the ray to the row or column edge at grid
+    // position i is edge_row_base + i * edge_row_scale (likewise for
+    // columns), or infinite if the ray runs along that axis.
+    const bool along_row = ray.direction.x != 0.0f;
+    const bool along_col = ray.direction.z != 0.0f;
+    const float edge_row_scale = step * inverse.x;
+    const float edge_row_base = along_row ? (low.x - ray.origin.x) * inverse.x : infinity;
+    const float edge_col_scale = step * inverse.z;
+    const float edge_col_base = along_col ? (low.z - ray.origin.z) * inverse.z : infinity;
+    // The quad at distance t along the ray.
+    const float row_base = (ray.origin.x - low.x) * inv_step;
+    const float row_scale = ray.direction.x * inv_step;
+    const float col_base = (ray.origin.z - low.z) * inv_step;
+    const float col_scale = ray.direction.z * inv_step;
+    int row = clamp_quad(row_base + t * row_scale, 0, quads - 1);
+    int col = clamp_quad(col_base + t * col_scale, 0, quads - 1);
+
+    // Start from the smallest cell holding the quads between the ends of
+    // the ray, so short rays and segments skip the upper levels.
+    const int top = levels() - 1;
+    const int end_row = clamp_quad(row_base + t_end * row_scale, 0, quads - 1);
+    const int end_col = clamp_quad(col_base + t_end * col_scale, 0, quads - 1);
+    int level = std::min(
+        top, std::max(highest_split(row, end_row), highest_split(col, end_col)) + 1);
+
+    while (true)
+    {
+        const Level& cells = pyramid[level];
+        const int cell_row = row >> level;
+        const int cell_col = col >> level;
+        const glm::vec2 bounds = cells.bounds[std::size_t(cell_row) * cells.cells + cell_col];
+        const int row_begin = cell_row << level;
+        const int col_begin = cell_col << level;
+        const int row_end = std::min(quads, row_begin + (1 << level));
+        const int col_end = std::min(quads, col_begin + (1 << level));
+
+        // Where the ray leaves the cell, across a row or a column edge.
+        const float t_row = edge_row_base + float(forward_row ? row_end : row_begin) * edge_row_scale;
+        const float t_col = edge_col_base + float(forward_col ? col_end : col_begin) * edge_col_scale;
+        const float t_exit = std::min(t_end, std::min(t_row, t_col));
+
+        // The heights of the ray across the cell.
+        const float y0 = ray.origin.y + t * ray.direction.y;
+        const float y1 = ray.origin.y + t_exit * ray.direction.y;
+        if (std::min(y0, y1) <= bounds.y && std::max(y0, y1) >= bounds.x)
+        {
+            if (level > 0)
+            {
+                level -= 1;
+                continue;
+            }
+            if (hit_quad(ray, row, col, 0.0f, ray.max_distance, hit)) return true;
+        }
+
+        // Step into the next cell.
+        if (t_exit >= t_end) return false;
+        t = t_exit;
+        const int previous_row = row;
+        const int previous_col = col;
+        if (t_row <= t_col)
+        {
+            row = forward_row ? row_end : row_begin - 1;
+            if (row < 0 || row >= quads) return false;
+        }
+        else
+        {
+            row = clamp_quad(row_base + t * row_scale, row_begin, row_end - 1);
+        }
+        if (t_col <= t_row)
+        {
+            col = forward_col ? col_end : col_begin - 1;
+            if (col < 0 || col >= quads) return false;
+        }
+        else
+        {
+            col = clamp_quad(col_base + t * col_scale, col_begin, col_end - 1);
+        }
+        level = std::min(top, std::max(highest_split(row, previous_row),
+                                       highest_split(col, previous_col)));
+    }
+}
+
+void HeightPyramid::cast(const Ray* rays, int n, Hit* hits, ThreadPool* pool) const
+{
+    ThreadPool& workers = pool != nullptr ? *pool : ThreadPool::shared();
+    workers.parallel_for(0, n, 64, [&](int lo, int hi)
+    {
+        for (int i = lo; i < hi; i += 1) cast(rays[i], hits[i]);
+    });
+}
@@ -0,0 +1,100 @@
+// Authorship: James Kortman (a1648090)
+// HeightPyramid class
+// Casts rays and segments against a Landscape.
+// The pyramid holds the lowest and highest height over every quad of the
+// landscape (level 0), then over every 2x2 block of level 0 cells
+// (level 1), and so on up to a single cell over the whole landscape.
+// A ray is cast by walking through the cells it crosses in order, as by a
+// DDA on a grid, moving down a level into each cell whose heights the ray
+// passes through and stepping over every cell it passes above or below,
+// then back up to the largest cell it enters next. The two triangles of
+// each quad it reaches are tested exactly as they are rendered. As cells
+// are visited in the order the ray crosses them, the first triangle hit is
+// the nearest.
+
+#ifndef HEIGHTPYRAMID_HPP
+#define HEIGHTPYRAMID_HPP
+
+#include <array>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Landscape.hpp"
+
+class ThreadPool;
+
+class HeightPyramid
+{
+public:
+    // A ray from 'origin' toward 'direction', as far as 'max_distance'
+    // times the length of 'direction'. A segment from a to b is the ray
+    // {a, b - a, 1}.
+    struct Ray
+    {
+        glm::vec3 origin;
+        glm::vec3 direction;
+        float max_distance;
+    };
+    struct Hit
+    {
+        // Whether the ray hit the landscape. The rest is only set if so.
+        bool hit;
+        // The point hit is origin + distance * direction.
+        float distance;
+        glm::vec3 position;
+        // The normal of the triangle hit, facing up.
+        glm::vec3 normal;
+        // The triangle hit, as indices into the landscape's vertices.
+        std::array<int, 3> triangle;
+    };
+
+    // Create an empty pyramid, which no ray hits.
+    HeightPyramid();
+    // Build the pyramid over the height grid of 'landscape' (see
+    // Landscape::build_height_grid). The pyramid reads the landscape's
+    // heights when casting, so the landscape must outlive the pyramid, and
+    // the pyramid must be updated whenever its heights change.
+    explicit HeightPyramid(const Landscape& landscape);
+
+    // Bring the pyramid up to date after the heights of the vertices in
+    // rows [row_begin, row_end) and columns [col_begin, col_end) changed
+    // (see Landscape::edit). Only the cells over them are found again.
+    void update(int row_begin, int row_end, int col_begin, int col_end);
+
+    // Cast a ray. Returns whether it hit the landscape, and fills 'hit'.
+    bool cast(const Ray& ray, Hit& hit) const;
+    // Cast n rays, spread over 'pool' (the shared pool if none is given).
+    void cast(const Ray* rays, int n, Hit* hits, ThreadPool* pool = nullptr) const;
+
+    // The number of levels.
+    int levels() const;
+    // The memory used by the pyramid.
+    std::size_t bytes() const;
+
+private:
+    struct Level
+    {
+        // The number of cells along an edge, and the number of quads
+        // along an edge of a cell.
+        int cells;
+        int quads_per_cell;
+        // The lowest and highest height over each cell, row by row.
+        std::vector<glm::vec2> bounds;
+    };
+    // Find the bounds of the level 0 cells in rows [row_begin, row_end)
+    // and columns [col_begin, col_end), or of the cells of level 'index'
+    // in that range from the level below.
+    void build_base(int row_begin, int row_end, int col_begin, int col_end);
+    void build_level(int index, int row_begin, int row_end, int col_begin, int col_end);
+    // Test the two triangles of a quad, between distances t_min and t_max.
+    bool hit_quad(const Ray& ray, int row, int col, float t_min, float t_max, Hit& hit) const;
+
+    const Landscape* landscape;
+    // The number of quads along an edge, and the distance between vertices.
+    int quads;
+    float step;
+    std::vector<Level> pyramid;
+};
+
+#endif // HEIGHTPYRAMID_HPP
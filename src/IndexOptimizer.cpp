@@ -0,0 +1,216 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of the index optimiser.
+
+#include "IndexOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// The scoring constants from Forsyth's article.
+static const float cache_decay_power   = 1.5f;
+static const float last_triangle_score = 0.75f;
+static const float valence_boost_scale = 2.0f;
+static const float valence_boost_power = 0.5f;
+
+// The largest number of remaining triangles given its own valence score.
+static const int max_valence = 32;
+
+// The score of a vertex at 'cache_position' in the LRU cache (or -1 when
+// not in it), used by 'remaining' triangles not yet emitted.
+// The parts of the score are looked up from tables made on first use.
+static float vertex_score(int cache_position, int remaining)
+{
+    struct Tables
+    {
+        float cache[vertex_cache_size];
+        float valence[max_valence + 1];
+        Tables()
+        {
+            for (int i = 0; i < vertex_cache_size; i += 1)
+            {
+                // The vertices of the last triangle get a fixed score, so
+                // the next triangle doesn't simply reuse its edge and make
+                // long strips.
+                const float scale = 1.0f / (vertex_cache_size - 3);
+                cache[i] = i < 3
+                    ? last_triangle_score
+                    : std::pow(1.0f - (i - 3) * scale, cache_decay_power);
+            }
+            // Vertices with few triangles left are finished off first.
+            valence[0] = 0.0f;
+            for (int i = 1; i <= max_valence; i += 1)
+            {
+                valence[i] = valence_boost_scale
+                    * std::pow(float(i), -valence_boost_power);
+            }
+        }
+    };
+    static const Tables tables;
+
+    if (remaining == 0) return -1.0f;
+    const float score = cache_position >= 0 ? tables.cache[cache_position] : 0.0f;
+    return score + (remaining <= max_valence
+        ? tables.valence[remaining]
+        : valence_boost_scale * std::pow(float(remaining), -valence_boost_power));
+}
+
+template <typename T>
+static void optimize(T* indices, std::size_t count)
+{
+    const int num_triangles = int(count / 3);
+    if (num_triangles < 2) return;
+
+    // Number the vertices used from 0, so the working arrays only cover
+    // them, however sparse the original indices are.
+    std::vector<T> vertices(indices, indices + 3 * num_triangles);
+    std::sort(vertices.begin(), vertices.end());
+    vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+    const int num_vertices = int(vertices.size());
+    std::vector<int> local(3 * num_triangles);
+    for (int i = 0; i < 3 * num_triangles; i += 1)
+    {
+        local[i] = int(std::lower_bound(vertices.begin(), vertices.end(), indices[i])
+                       - vertices.begin());
+    }
+
+    // The triangles not yet emitted that use each vertex are
+    // adjacent[first[v], first[v] + remaining[v]).
+    std::vector<int> remaining(num_vertices, 0);
+    for (int v: local) remaining[v] += 1;
+    std::vector<int> first(num_vertices + 1, 0);
+    for (int v = 0; v < num_vertices; v += 1) first[v + 1] = first[v] + remaining[v];
+    std::vector<int> adjacent(3 * num_triangles);
+    {
+        std::vector<int> filled(first.begin(), first.end() - 1);
+        for (int i = 0; i < 3 * num_triangles; i += 1)
+        {
+            adjacent[filled[local[i]]++] = i / 3;
+        }
+    }
+
+    std::vector<int> cache_position(num_vertices, -1);
+    std::vector<float> score(num_vertices);
+    for (int v = 0; v < num_vertices; v += 1)
+    {
+        score[v] = vertex_score(-1, remaining[v]);
+    }
+    std::vector<float> triangle_score(num_triangles);
+    std::vector<char> emitted(num_triangles, false);
+    int best = -1;
+    for (int t = 0; t < num_triangles; t += 1)
+    {
+        triangle_score[t] =
+            score[local[3 * t]] + score[local[3 * t + 1]] + score[local[3 * t + 2]];
+        if (best == -1 || triangle_score[t] > triangle_score[best]) best = t;
+    }
+
+    // The cache holds the most recently used vertices first. It can briefly
+    // hold three more than its size, before those fall out.
+    std::vector<int> cache;
+    std::vector<int> next_cache;
+    cache.reserve(vertex_cache_size + 3);
+    next_cache.reserve(vertex_cache_size + 3);
+    std::vector<T> result;
+    result.reserve(3 * num_triangles);
+    int next_unemitted = 0;
+    for (int n = 0; n < num_triangles; n += 1)
+    {
+        if (best == -1)
+        {
+            // No triangle touches the cache, so carry on from the earliest
+            // triangle not yet emitted.
+            while (emitted[next_unemitted]) next_unemitted += 1;
+            best = next_unemitted;
+        }
+        emitted[best] = true;
+
+        next_cache.clear();
+        for (int k = 0; k < 3; k += 1)
+        {
+            const int v = local[3 * best + k];
+            result.push_back(indices[3 * best + k]);
+            // Remove the triangle from the vertex's list.
+            int* list = &adjacent[first[v]];
+            int* found = std::find(list, list + remaining[v], best);
+            std::swap(*found, list[remaining[v] - 1]);
+            remaining[v] -= 1;
+            next_cache.push_back(v);
+        }
+        for (int v: cache)
+        {
+            if (v != next_cache[0] && v != next_cache[1] && v != next_cache[2])
+            {
+                next_cache.push_back(v);
+            }
+        }
+        // Vertices pushed out of the cache are rescored too.
+        for (int i = 0; i < int(next_cache.size()); i += 1)
+        {
+            const int v = next_cache[i];
+            cache_position[v] = i < vertex_cache_size ? i : -1;
+            score[v] = vertex_score(cache_position[v], remaining[v]);
+        }
+
+        // The best triangle next is one touching the cache.
+        best = -1;
+        for (int v: next_cache)
+        {
+            for (int j = first[v]; j < first[v] + remaining[v]; j += 1)
+            {
+                const int t = adjacent[j];
+                triangle_score[t] = score[local[3 * t]]
+                    + score[local[3 * t + 1]]
+                    + score[local[3 * t + 2]];
+                if (best == -1 || triangle_score[t] > triangle_score[best]) best = t;
+            }
+        }
+        if (int(next_cache.size()) > vertex_cache_size)
+        {
+            next_cache.resize(vertex_cache_size);
+        }
+        cache.swap(next_cache);
+    }
+
+    std::copy(result.begin(), result.end(), indices);
+}
+
+template <typename T>
+static std::size_t misses(const T* indices, std::size_t count)
+{
+    // A FIFO cache, as a ring buffer.
+    std::vector<T> cache(vertex_cache_size);
+    int size = 0;
+    int next = 0;
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < count; i += 1)
+    {
+        if (std::find(cache.begin(), cache.begin() + size, indices[i])
+            != cache.begin() + size) continue;
+        total += 1;
+        cache[next] = indices[i];
+        next = (next + 1) % vertex_cache_size;
+        size = std::min(size + 1, vertex_cache_size);
+    }
+    return total;
+}
+
+void optimize_vertex_cache(unsigned int* indices, std::size_t count)
+{
+    optimize(indices, count);
+}
+
+void optimize_vertex_cache(uint16_t* indices, std::size_t count)
+{
+    optimize(indices, count);
+}
+
+std::size_t vertex_cache_misses(const unsigned int* indices, std::size_t count)
+{
+    return misses(indices, count);
+}
+
+std::size_t vertex_cache_misses(const uint16_t* indices, std::size_t count)
+{
+    return misses(indices, count);
+}
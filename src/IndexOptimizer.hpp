@@ -0,0 +1,33 @@
+// Authorship: James Kortman (a1648090)
+// Index optimiser
+// Reorders indexed triangle lists so the GPU's post-transform vertex cache
+// is used well, and measures how well it is used.
+// The reordering is Tom Forsyth's "linear-speed vertex cache optimisation":
+// triangles are emitted greedily, scoring each vertex by how recently it
+// was used (in a simulated LRU cache) and how few triangles still use it.
+// Works on any triangle list, such as a Landscape's level of detail
+// chunks, a Water mesh or the shapes of an OBJ mesh.
+
+#ifndef INDEXOPTIMIZER_HPP
+#define INDEXOPTIMIZER_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// The number of vertices in the simulated vertex cache.
+const int vertex_cache_size = 32;
+
+// Reorder the triangles of a list of 'count' indices, three per triangle.
+// The triangles themselves, and the order of the vertices within each one
+// (and so their winding), are unchanged.
+void optimize_vertex_cache(unsigned int* indices, std::size_t count);
+void optimize_vertex_cache(uint16_t* indices, std::size_t count);
+
+// The number of vertices transformed drawing a list of 'count' indices,
+// with a FIFO vertex cache of vertex_cache_size entries that starts empty.
+// Divided by the number of triangles, this gives the average cache miss
+// ratio (ACMR): 3 with no reuse at all, and about 0.5 at best for a grid.
+std::size_t vertex_cache_misses(const unsigned int* indices, std::size_t count);
+std::size_t vertex_cache_misses(const uint16_t* indices, std::size_t count);
+
+#endif // INDEXOPTIMIZER_HPP
@@ -3,12 +3,31 @@
 
 #include "Landscape.hpp"
 
+#include <algorithm>
+#include <limits>
 #include <numeric>
 #include <glm/gtc/matrix_transform.hpp>
 #include <cmath>
 
+#include "IndexOptimizer.hpp"
+#include "ThreadPool.hpp"
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
 Landscape::Landscape()
-    : model_matrix(glm::mat4(1.0f))
+    : edits(0),
+      lod_base_range(0.0f),
+      lod_acmr_before(0.0f),
+      lod_acmr_after(0.0f),
+      height_min(0.0f),
+      height_extent(0.0f),
+      origin(0.0f, 0.0f),
+      model_matrix(glm::mat4(1.0f)),
+      mapped_indices{nullptr, 0},
+      mapped_lod_indices{nullptr, 0},
+      mapped_lod_wide_indices{nullptr, 0}
 {
     normal_matrix = glm::mat3(
         glm::transpose(glm::inverse(model_matrix)));
@@ -16,17 +35,31 @@ Landscape::Landscape()
 
 
 // Get the triangle that encloses point (x,z),
-// as indices.
+// as indices. Points off the landscape are moved to its nearest edge.
 std::array<int, 3> Landscape::get_tri(float x, float z) const
 {
     std::array<int, 3> indices;
 
-    const float step = (2 * edge)/(-1 + size * 2);
-    int row_x = (x + edge/2)/step;
-    int row_z = (z + edge/2)/step;
-    indices[0] = size * row_x + row_z;
-    indices[1] = indices[0] + 1;
-    indices[2] = indices[0] + size;
+    const int last = int(size) - 1;
+    const float step = edge / last;
+    const float row_f = std::max(0.0f, std::min(float(last), (x - origin.x) / step));
+    const float col_f = std::max(0.0f, std::min(float(last), (z - origin.y) / step));
+    const int row = std::min(last - 1, int(row_f));
+    const int col = std::min(last - 1, int(col_f));
+    const int a = int(size) * row + col;
+    // The quad is split into triangles abc and cbd (see generate_indices).
+    if ((row_f - row) + (col_f - col) <= 1.0f)
+    {
+        indices[0] = a;
+        indices[1] = a + 1;
+        indices[2] = a + int(size);
+    }
+    else
+    {
+        indices[0] = a + int(size);
+        indices[1] = a + 1;
+        indices[2] = a + int(size) + 1;
+    }
     
     #if 0
     // Debug printing.
@@ -47,61 +80,957 @@ std::array<int, 3> Landscape::get_tri(float x, float z) const
 
 float Landscape::get_height_at(float x, float z) const
 {
-    std::array<int, 3> indices = get_tri(x, z);
+    float height;
+    query_heights(&x, &z, 1, &height);
+    return height;
+}
+
+// Get the position of the vertex nearest to player_pos (in x and z).
+glm::vec3 Landscape::get_pos_at(glm::vec3 player_pos) const
+{
+    const int last = int(size) - 1;
+    const float step = edge / last;
+    const int row = std::max(0, std::min(last, int(std::round((player_pos.x - origin.x) / step))));
+    const int col = std::max(0, std::min(last, int(std::round((player_pos.z - origin.y) / step))));
+    const std::size_t i = std::size_t(size) * row + col;
+    if (i < positions.size()) return positions[i];
+    // The positions have been released, so use the height grid.
+    return glm::vec3(
+        origin.x + edge * float(row) / last,
+        height_grid[i],
+        origin.y + edge * float(col) / last);
+}
 
-    for (int i = 0; i < 3; i++)
+// --------------------
+// -- Height queries --
+// --------------------
+constexpr float Landscape::outside_height;
+
+// Fill height_grid from the positions.
+void Landscape::build_height_grid()
+{
+    height_grid.resize(positions.size());
+    for (std::size_t i = 0; i < positions.size(); i += 1)
     {
-        // If indicies are outside accepted range, return the water height
-        if (indices[i] >= positions.size()) return 6.4f;
+        height_grid[i] = positions[i].y;
     }
-    glm::vec3 downward = 
-        positions.at(indices[1])
-        - positions.at(indices[0]);
-    glm::vec3 rightward = 
-        positions.at(indices[2])
-        - positions.at(indices[0]);
+}
 
-    rightward = (1.0f / rightward.x) * rightward;
-    downward = (1.0f / downward.z) * downward;
-    float dx = x - positions.at(indices[0]).x;
-    float dz = z - positions.at(indices[0]).z;
-    glm::vec3 position =
-        positions.at(indices[0])
-        + dx * rightward
-        + dz * downward;
+namespace {
+// The grid details shared by both query paths.
+struct HeightGrid
+{
+    const float* heights;
+    int size;
+    // The largest row or column.
+    float last;
+    float origin_x;
+    float origin_z;
+    float inv_step;
+};
+}
 
-    #if 0
-    fprintf(stderr,
-        "get_height_at(%.2f, %.2f) -> (%.2f, %.2f, %.2f)\n",
-        x, z, position.x, position.y, position.z);
-    fprintf(stderr,
-        "position =\n"
-        "  (%.2f, %.2f, %.2f)\n"
-        "  + %.2f * (%.2f, %.2f, %.2f)\n"
-        "  + %.2f * (%.2f, %.2f, %.2f)\n",
-        positions.at(indices[0]).x,
-        positions.at(indices[0]).y,
-        positions.at(indices[0]).z,
-        dx, rightward.x, rightward.y, rightward.z,
-        dz, downward.x, downward.y, downward.z);
-    #endif
+// Find the height and slope at points [begin, end), one at a time.
+// The gradients are the change in height per row and column, so the
+// normal is (-gradient_row, step, -gradient_col), normalised.
+static void query_heights_scalar(
+    const HeightGrid& grid, const float* xs, const float* zs,
+    int begin, int end, float* heights, float* gradient_rows, float* gradient_cols)
+{
+    for (int i = begin; i < end; i += 1)
+    {
+        const float row_f = (xs[i] - grid.origin_x) * grid.inv_step;
+        const float col_f = (zs[i] - grid.origin_z) * grid.inv_step;
+        // (Written so NaNs are also off the landscape.)
+        if (!(row_f >= 0.0f && row_f <= grid.last && col_f >= 0.0f && col_f <= grid.last))
+        {
+            heights[i] = Landscape::outside_height;
+            gradient_rows[i] = 0.0f;
+            gradient_cols[i] = 0.0f;
+            continue;
+        }
+        const float cell_row = std::min(float(int(row_f)), grid.last - 1.0f);
+        const float cell_col = std::min(float(int(col_f)), grid.last - 1.0f);
+        const float fr = row_f - cell_row;
+        const float fc = col_f - cell_col;
+        const float* cell = grid.heights + std::size_t(cell_row) * grid.size + std::size_t(cell_col);
+        const float a = cell[0];
+        const float b = cell[1];
+        const float c = cell[grid.size];
+        const float d = cell[grid.size + 1];
+        // The quad is split into triangles abc and cbd (see generate_indices).
+        if (fr + fc <= 1.0f)
+        {
+            gradient_rows[i] = c - a;
+            gradient_cols[i] = b - a;
+            heights[i] = a + fr * (c - a) + fc * (b - a);
+        }
+        else
+        {
+            gradient_rows[i] = d - b;
+            gradient_cols[i] = d - c;
+            heights[i] = d - (1.0f - fr) * (d - b) - (1.0f - fc) * (d - c);
+        }
+    }
+}
+
+#if defined(__SSE2__)
+// Find the height and slope at points [begin, end), four at a time,
+// leaving any remainder. Returns where it stopped.
+// Each step is the same as in the scalar path, so the results agree.
+static int query_heights_sse2(
+    const HeightGrid& grid, const float* xs, const float* zs,
+    int begin, int end, float* heights, float* gradient_rows, float* gradient_cols)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 last = _mm_set1_ps(grid.last);
+    const __m128 last_cell = _mm_set1_ps(grid.last - 1.0f);
+    const __m128 origin_x = _mm_set1_ps(grid.origin_x);
+    const __m128 origin_z = _mm_set1_ps(grid.origin_z);
+    const __m128 inv_step = _mm_set1_ps(grid.inv_step);
+    const __m128 outside = _mm_set1_ps(Landscape::outside_height);
+    auto select = [](__m128 mask, __m128 a, __m128 b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    };
+
+    int i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        const __m128 row_f = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(xs + i), origin_x), inv_step);
+        const __m128 col_f = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(zs + i), origin_z), inv_step);
+        // Ordered comparisons are false for NaNs.
+        const __m128 inside = _mm_and_ps(
+            _mm_and_ps(_mm_cmpge_ps(row_f, zero), _mm_cmple_ps(row_f, last)),
+            _mm_and_ps(_mm_cmpge_ps(col_f, zero), _mm_cmple_ps(col_f, last)));
+        // Points off the landscape are clamped so the loads stay on it
+        // (max gives its second operand for NaNs).
+        const __m128 row_c = _mm_min_ps(_mm_max_ps(row_f, zero), last);
+        const __m128 col_c = _mm_min_ps(_mm_max_ps(col_f, zero), last);
+        const __m128 cell_row = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(row_c)), last_cell);
+        const __m128 cell_col = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(col_c)), last_cell);
+        const __m128 fr = _mm_sub_ps(row_c, cell_row);
+        const __m128 fc = _mm_sub_ps(col_c, cell_col);
+
+        // SSE2 has no gather, so the corners are loaded a lane at a time.
+        alignas(16) int rows[4];
+        alignas(16) int cols[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(rows), _mm_cvttps_epi32(cell_row));
+        _mm_store_si128(reinterpret_cast<__m128i*>(cols), _mm_cvttps_epi32(cell_col));
+        alignas(16) float corners[4][4];
+        for (int lane = 0; lane < 4; lane += 1)
+        {
+            const float* cell = grid.heights + std::size_t(rows[lane]) * grid.size + cols[lane];
+            corners[0][lane] = cell[0];
+            corners[1][lane] = cell[1];
+            corners[2][lane] = cell[grid.size];
+            corners[3][lane] = cell[grid.size + 1];
+        }
+        const __m128 a = _mm_load_ps(corners[0]);
+        const __m128 b = _mm_load_ps(corners[1]);
+        const __m128 c = _mm_load_ps(corners[2]);
+        const __m128 d = _mm_load_ps(corners[3]);
 
-    return position.y;
+        // Both triangles of the quad, then the one containing each point.
+        const __m128 upper = _mm_cmple_ps(_mm_add_ps(fr, fc), one);
+        const __m128 upper_row = _mm_sub_ps(c, a);
+        const __m128 upper_col = _mm_sub_ps(b, a);
+        const __m128 upper_height = _mm_add_ps(
+            _mm_add_ps(a, _mm_mul_ps(fr, upper_row)), _mm_mul_ps(fc, upper_col));
+        const __m128 lower_row = _mm_sub_ps(d, b);
+        const __m128 lower_col = _mm_sub_ps(d, c);
+        const __m128 lower_height = _mm_sub_ps(
+            _mm_sub_ps(d, _mm_mul_ps(_mm_sub_ps(one, fr), lower_row)),
+            _mm_mul_ps(_mm_sub_ps(one, fc), lower_col));
+
+        _mm_storeu_ps(heights + i,
+            select(inside, select(upper, upper_height, lower_height), outside));
+        _mm_storeu_ps(gradient_rows + i,
+            _mm_and_ps(inside, select(upper, upper_row, lower_row)));
+        _mm_storeu_ps(gradient_cols + i,
+            _mm_and_ps(inside, select(upper, upper_col, lower_col)));
+    }
+    return i;
 }
+#endif
 
+// Find the height, normal and slope at n points.
+void Landscape::query_heights(
+    const float* xs, const float* zs, int n, float* heights,
+    glm::vec3* normals, float* slope_cos) const
+{
+    if (n <= 0) return;
+    HeightGrid grid;
+    grid.heights = height_grid.data();
+    grid.size = int(size);
+    grid.last = size - 1.0f;
+    grid.origin_x = origin.x;
+    grid.origin_z = origin.y;
+    grid.inv_step = grid.last / edge;
 
+    // The gradients are only kept for the normals and slopes, so are
+    // written to a small buffer a block of points at a time.
+    const int block = 256;
+    float gradient_rows[block];
+    float gradient_cols[block];
+    const float step = edge / grid.last;
+    for (int begin = 0; begin < n; begin += block)
+    {
+        const int count = std::min(block, n - begin);
+        int done = 0;
+        #if defined(__SSE2__)
+            done = query_heights_sse2(
+                grid, xs + begin, zs + begin, 0, count,
+                heights + begin, gradient_rows, gradient_cols);
+        #endif
+        query_heights_scalar(
+            grid, xs + begin, zs + begin, done, count,
+            heights + begin, gradient_rows, gradient_cols);
 
+        if (normals == nullptr && slope_cos == nullptr) continue;
+        for (int i = 0; i < count; i += 1)
+        {
+            const glm::vec3 normal = glm::normalize(
+                glm::vec3(-gradient_rows[i], step, -gradient_cols[i]));
+            if (normals != nullptr) normals[begin + i] = normal;
+            if (slope_cos != nullptr) slope_cos[begin + i] = normal.y;
+        }
+    }
+}
 
+// -----------------------------------------
+// -- Continuous level of detail (CDLOD) --
+// -----------------------------------------
+// The number of quads along the edge of a level 0 (full detail) node.
+static const int lod_leaf_quads = 16;
+// The level at which vertex 'i' along an edge is dropped from the mesh.
+// The first and last vertices are in the mesh at every level.
+static int lod_level_of(int i, int last)
+{
+    if (i == 0 || i == last) return 31;
+    int level = 0;
+    while ((i & 1) == 0)
+    {
+        i >>= 1;
+        level += 1;
+    }
+    return level;
+}
 
+// The height a vertex morphs toward, and the level it morphs at.
+glm::vec2 Landscape::morph_target(int row, int col) const
+{
+    const int n = int(size);
+    const int quads = n - 1;
+    auto height = [&](int row, int col) { return positions[n * row + col].y; };
+    auto in_range = [=](int i) { return i >= 0 && i <= quads; };
 
+    // A vertex at level k lies on an edge (or the diagonal) of a quad at
+    // level k+1, so it morphs toward the average height of the ends of
+    // that edge.
+    const int row_level = lod_level_of(row, quads);
+    const int col_level = lod_level_of(col, quads);
+    const int level = std::min(row_level, col_level);
+    float target = height(row, col);
+    if (level < 31)
+    {
+        const int step = 1 << level;
+        int r0 = row, c0 = col, r1 = row, c1 = col;
+        if (row_level == level && col_level == level)
+        {
+            // The diagonal runs from (r, c+1) to (r+1, c).
+            r0 = row - step; c0 = col + step;
+            r1 = row + step; c1 = col - step;
+        }
+        else if (row_level == level)
+        {
+            r0 = row - step;
+            r1 = row + step;
+        }
+        else
+        {
+            c0 = col - step;
+            c1 = col + step;
+        }
+        // Edges cut short by the border of the mesh don't morph.
+        if (in_range(r0) && in_range(c0) && in_range(r1) && in_range(c1))
+        {
+            target = 0.5f * (height(r0, c0) + height(r1, c1));
+        }
+    }
+    return glm::vec2(target, float(level));
+}
 
-glm::vec3 Landscape::get_pos_at(glm::vec3 player_pos) const
+// Build the quadtree and per-vertex morph targets from the positions.
+void Landscape::build_lod(float cull_height)
 {
-    const float step = (2 * edge)/(-1 + size * 2);
-    int row_x = (player_pos.x + edge/2)/step;
-    int row_z = (player_pos.z + edge/2)/step;
-    int index = size * row_x + row_z;
-    return glm::vec3(positions.at(index));
+    const int n = int(size);
+    const int quads = n - 1;
+    morphs.resize(positions.size());
+    for (int row = 0; row < n; row += 1)
+    {
+        for (int col = 0; col < n; col += 1)
+        {
+            morphs[n * row + col] = morph_target(row, col);
+        }
+    }
+
+    int root_level = 0;
+    while ((lod_leaf_quads << root_level) < quads) root_level += 1;
+    lod_nodes.clear();
+    lod_chunks.clear();
+    lod_indices.clear();
+    lod_wide_indices.clear();
+    build_lod_node(root_level, 0, 0, cull_height);
+    lod_base_range = 2.0f * lod_leaf_quads * edge / quads;
+
+    // Order each chunk's triangles for the vertex cache, in parallel,
+    // measuring the cache misses before and after.
+    const int num_chunks = lod_chunks.size();
+    std::vector<std::size_t> misses_before(num_chunks);
+    std::vector<std::size_t> misses_after(num_chunks);
+    ThreadPool::shared().parallel_for(0, num_chunks, 16, [&](int lo, int hi)
+    {
+        for (int i = lo; i < hi; i += 1)
+        {
+            const LodChunk& chunk = lod_chunks[i];
+            if (chunk.wide)
+            {
+                unsigned int* indices = &lod_wide_indices[chunk.first];
+                misses_before[i] = vertex_cache_misses(indices, chunk.count);
+                optimize_vertex_cache(indices, chunk.count);
+                misses_after[i] = vertex_cache_misses(indices, chunk.count);
+            }
+            else
+            {
+                uint16_t* indices = &lod_indices[chunk.first];
+                misses_before[i] = vertex_cache_misses(indices, chunk.count);
+                optimize_vertex_cache(indices, chunk.count);
+                misses_after[i] = vertex_cache_misses(indices, chunk.count);
+            }
+        }
+    });
+    const std::size_t triangles = (lod_indices.size() + lod_wide_indices.size()) / 3;
+    const std::size_t before =
+        std::accumulate(misses_before.begin(), misses_before.end(), std::size_t(0));
+    const std::size_t after =
+        std::accumulate(misses_after.begin(), misses_after.end(), std::size_t(0));
+    lod_acmr_before = triangles > 0 ? float(before) / triangles : 0.0f;
+    lod_acmr_after  = triangles > 0 ? float(after) / triangles : 0.0f;
+}
+
+// Build the node at 'level' with its first quad at row, col, and its
+// children. Returns the index of the node.
+int Landscape::build_lod_node(int level, int row, int col, float cull_height)
+{
+    const int n = int(size);
+    const int quads = n - 1;
+    const int span = lod_leaf_quads << level;
+    const int row_end = std::min(row + span, quads);
+    const int col_end = std::min(col + span, quads);
+    const int step = 1 << level;
+
+    LodNode node;
+    node.level = level;
+    node.first_chunk = lod_chunks.size();
+    // Connect the positions as in TerrainGenerator::generate_indices,
+    // with quads 'step' vertices wide, a row of quads at a time.
+    // Rows are added to a chunk while its indices still fit in 16 bits.
+    std::vector<unsigned int> chunk;
+    int base_vertex = n * row + col;
+    for (int r = row; r < row_end; r += step)
+    {
+        const int r1 = std::min(r + step, row_end);
+        if (!chunk.empty() && n * r1 + col_end - base_vertex > 0xFFFF)
+        {
+            add_lod_chunk(chunk, base_vertex);
+        }
+        if (chunk.empty()) base_vertex = n * r + col;
+        for (int c = col; c < col_end; c += step)
+        {
+            const int c1 = std::min(c + step, col_end);
+            const unsigned int a = n * r  + c;
+            const unsigned int b = n * r  + c1;
+            const unsigned int c_ = n * r1 + c;
+            const unsigned int d = n * r1 + c1;
+            if (positions[a].y     >= cull_height
+                || positions[b].y  >= cull_height
+                || positions[c_].y >= cull_height)
+            {
+                chunk.insert(chunk.end(), {a, b, c_});
+            }
+            if (positions[c_].y    >= cull_height
+                || positions[b].y  >= cull_height
+                || positions[d].y  >= cull_height)
+            {
+                chunk.insert(chunk.end(), {c_, b, d});
+            }
+        }
+    }
+    add_lod_chunk(chunk, base_vertex);
+    node.num_chunks = lod_chunks.size() - node.first_chunk;
+
+    // The bounds include every full detail vertex in the node.
+    node.min = glm::vec3(std::numeric_limits<float>::max());
+    node.max = glm::vec3(std::numeric_limits<float>::lowest());
+    for (int r = row; r <= row_end; r += 1)
+    {
+        for (int c = col; c <= col_end; c += 1)
+        {
+            node.min = glm::min(node.min, positions[n * r + c]);
+            node.max = glm::max(node.max, positions[n * r + c]);
+        }
+    }
+    for (int i = 0; i < 4; i += 1) node.children[i] = -1;
+
+    const int index = lod_nodes.size();
+    lod_nodes.push_back(node);
+    if (level > 0)
+    {
+        const int half = span / 2;
+        int child = 0;
+        for (int dr = 0; dr <= half; dr += half)
+        {
+            for (int dc = 0; dc <= half; dc += half)
+            {
+                if (row + dr >= row_end || col + dc >= col_end) continue;
+                const int child_index =
+                    build_lod_node(level - 1, row + dr, col + dc, cull_height);
+                lod_nodes[index].children[child] = child_index;
+                child += 1;
+            }
+        }
+    }
+    return index;
+}
+
+// Store a chunk's triangles relative to base_vertex, then clear 'chunk'.
+void Landscape::add_lod_chunk(std::vector<unsigned int>& chunk, int base_vertex)
+{
+    if (chunk.empty()) return;
+    LodChunk lod_chunk;
+    lod_chunk.count = chunk.size();
+    lod_chunk.base_vertex = base_vertex;
+    lod_chunk.wide =
+        *std::max_element(chunk.begin(), chunk.end()) - base_vertex > 0xFFFF;
+    if (lod_chunk.wide)
+    {
+        lod_chunk.first = lod_wide_indices.size();
+        for (unsigned int index: chunk) lod_wide_indices.push_back(index - base_vertex);
+    }
+    else
+    {
+        lod_chunk.first = lod_indices.size();
+        for (unsigned int index: chunk) lod_indices.push_back(index - base_vertex);
+    }
+    lod_chunks.push_back(lod_chunk);
+    chunk.clear();
+}
+
+// Select the nodes to draw for a camera at 'eye'.
+void Landscape::select_lod(
+    glm::vec3 eye, float bias, std::vector<int>& selected) const
+{
+    if (!lod_nodes.empty()) select_lod_node(0, eye, bias, selected);
+}
+
+void Landscape::select_lod_node(
+    int index, glm::vec3 eye, float bias, std::vector<int>& selected) const
+{
+    // A node is split into its children when any part of it is closer
+    // than the distance at which its children are fully morphed.
+    const LodNode& node = lod_nodes[index];
+    const glm::vec3 closest = glm::clamp(eye, node.min, node.max);
+    if (node.level == 0
+        || glm::length(closest - eye) >= lod_range(node.level - 1, bias))
+    {
+        selected.push_back(index);
+        return;
+    }
+    for (int i = 0; i < 4; i += 1)
+    {
+        if (node.children[i] != -1)
+        {
+            select_lod_node(node.children[i], eye, bias, selected);
+        }
+    }
+}
+
+// The distance by which vertices of a node at 'level' have fully
+// morphed to the next level.
+float Landscape::lod_range(int level, float bias) const
+{
+    return bias * lod_base_range * float(1 << level);
+}
+
+// -- Compact vertices --
+// Encode a unit vector as a point on the octahedron |x| + |y| + |z| = 1,
+// unfolded onto the square [-1, 1]^2.
+static glm::vec2 octahedral_encode(glm::vec3 n)
+{
+    n /= std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+    glm::vec2 e(n.x, n.y);
+    if (n.z < 0.0f)
+    {
+        e = glm::vec2(
+            (1.0f - std::abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - std::abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    return e;
+}
+
+static int8_t to_snorm8(float value)
+{
+    return int8_t(std::round(127.0f * std::max(-1.0f, std::min(1.0f, value))));
+}
+
+// Fill packed_vertices from the positions, normals, colours, morphs
+// and palette.
+// The index of the palette entry nearest a colour.
+// The colours are palette colours, so the search for the nearest palette
+// entry almost always ends at the one used by the vertex before, which is
+// kept in 'last'.
+static uint8_t palette_index(
+    const std::vector<glm::vec3>& palette, const glm::vec3& colour, int& last)
+{
+    if (palette.empty()) return 0;
+    if (last < int(palette.size()) && palette[last] == colour) return uint8_t(last);
+    float nearest = std::numeric_limits<float>::max();
+    for (int i = 0; i < int(palette.size()); i += 1)
+    {
+        const glm::vec3 d = palette[i] - colour;
+        const float distance = glm::dot(d, d);
+        if (distance < nearest)
+        {
+            nearest = distance;
+            last = i;
+        }
+    }
+    return uint8_t(last);
+}
+
+void Landscape::pack_vertices()
+{
+    // The heights are quantised over the range of every height and
+    // morph target.
+    float low = std::numeric_limits<float>::max();
+    float high = std::numeric_limits<float>::lowest();
+    for (const glm::vec3& position: positions)
+    {
+        low = std::min(low, position.y);
+        high = std::max(high, position.y);
+    }
+    for (const glm::vec2& morph: morphs)
+    {
+        low = std::min(low, morph.x);
+        high = std::max(high, morph.x);
+    }
+    height_min = positions.empty() ? 0.0f : low;
+    height_extent = positions.empty() ? 0.0f : high - low;
+
+    int last_colour = 0;
+    packed_vertices.resize(positions.size());
+    for (std::size_t i = 0; i < positions.size(); i += 1) pack_vertex(i, last_colour);
+}
+
+// Quantise a height over [height_min, height_min + height_extent].
+uint16_t Landscape::quantise_height(float height) const
+{
+    if (height_extent <= 0.0f) return 0;
+    const float t = (height - height_min) / height_extent;
+    return uint16_t(std::round(65535.0f * std::max(0.0f, std::min(1.0f, t))));
+}
+
+// Fill packed vertex i. 'last_colour' is the palette index of the last
+// vertex packed.
+void Landscape::pack_vertex(std::size_t i, int& last_colour)
+{
+    PackedVertex& vertex = packed_vertices[i];
+    const glm::vec2 normal = octahedral_encode(normals[i]);
+    vertex.height = quantise_height(positions[i].y);
+    vertex.normal[0] = to_snorm8(normal.x);
+    vertex.normal[1] = to_snorm8(normal.y);
+    vertex.colour = palette_index(palette, colours[i], last_colour);
+    if (morphs.empty())
+    {
+        vertex.morph_height = vertex.height;
+        vertex.morph_level = 0;
+    }
+    else
+    {
+        vertex.morph_height = quantise_height(morphs[i].x);
+        vertex.morph_level = uint8_t(morphs[i].y);
+    }
+}
+
+// Replace the colours, and repack the colour of the vertices that changed.
+void Landscape::recolour(
+    const std::vector<glm::vec3>& colours, std::size_t& first, std::size_t& count)
+{
+    first = 0;
+    count = 0;
+    if (packed_vertices.size() != colours.size()) return;
+    this->colours = colours;
+    std::size_t last = 0;
+    int last_colour = 0;
+    for (std::size_t i = 0; i < colours.size(); i += 1)
+    {
+        const uint8_t colour = palette_index(palette, colours[i], last_colour);
+        if (packed_vertices[i].colour == colour) continue;
+        packed_vertices[i].colour = colour;
+        if (count == 0) first = i;
+        last = i;
+        count = 1;
+    }
+    if (count > 0) count = last - first + 1;
+}
+
+// -- Releasing CPU data --
+namespace {
+// Free an array, adding the bytes freed to 'freed'. Swapping with an empty
+// vector frees the memory, where clear() does not.
+template <typename T>
+void release_array(std::vector<T>& array, std::size_t& freed)
+{
+    freed += sizeof(T) * array.capacity();
+    std::vector<T>().swap(array);
+}
+}
+
+// Free everything not needed to draw or query an uploaded landscape.
+std::size_t Landscape::release_cpu_data()
+{
+    std::size_t freed = 0;
+    release_array(positions, freed);
+    release_array(normals, freed);
+    release_array(colours, freed);
+    release_array(moisture, freed);
+    release_array(edited, freed);
+    release_array(morphs, freed);
+    release_array(packed_vertices, freed);
+    release_array(lod_indices, freed);
+    release_array(lod_wide_indices, freed);
+    if (!lod_nodes.empty()) release_array(indices, freed);
+    release_mapping();
+    return freed;
+}
+
+// -- Mapped indices --
+// Read the index arrays from a mapped cache file.
+void Landscape::map_indices(
+    std::shared_ptr<const void> mapping, ArrayView<unsigned int> indices,
+    ArrayView<uint16_t> lod_indices, ArrayView<unsigned int> lod_wide_indices)
+{
+    this->mapping = std::move(mapping);
+    mapped_indices = indices;
+    mapped_lod_indices = lod_indices;
+    mapped_lod_wide_indices = lod_wide_indices;
+}
+
+namespace {
+// A view of 'array', or of the mapped array if it is empty.
+template <typename T>
+Landscape::ArrayView<T> view(
+    const std::vector<T>& array, Landscape::ArrayView<T> mapped)
+{
+    if (!array.empty() || mapped.data == nullptr) return { array.data(), array.size() };
+    return mapped;
+}
+}
+
+// The index arrays, from the vectors or the mapping.
+Landscape::ArrayView<unsigned int> Landscape::index_view() const
+{
+    return view(indices, mapped_indices);
+}
+Landscape::ArrayView<uint16_t> Landscape::lod_index_view() const
+{
+    return view(lod_indices, mapped_lod_indices);
+}
+Landscape::ArrayView<unsigned int> Landscape::lod_wide_index_view() const
+{
+    return view(lod_wide_indices, mapped_lod_wide_indices);
+}
+
+// Drop the mapping, keeping the indices that are drawn by count.
+void Landscape::release_mapping()
+{
+    if (mapping == nullptr) return;
+    if (lod_nodes.empty() && indices.empty())
+    {
+        indices.assign(
+            mapped_indices.data, mapped_indices.data + mapped_indices.size);
+    }
+    mapping.reset();
+    mapped_indices = { nullptr, 0 };
+    mapped_lod_indices = { nullptr, 0 };
+    mapped_lod_wide_indices = { nullptr, 0 };
+}
+
+// -- Editing --
+// Apply a brush to the vertices within it.
+Landscape::Edit Landscape::edit(const Brush& brush, const Colouring& colouring)
+{
+    Edit result = { 0, 0, 0, 0, {} };
+    const int n = int(size);
+    const int quads = n - 1;
+    if (n < 2 || height_grid.size() != positions.size()
+        || packed_vertices.size() != positions.size() || !(brush.radius > 0.0f))
+    {
+        return result;
+    }
+    const float step = edge / quads;
+
+    // The vertices within the square around the brush (none for NaNs).
+    auto clamp_vertex = [=](float i) { return int(std::max(0.0f, std::min(float(n), i))); };
+    const int row_begin = clamp_vertex(std::ceil((brush.centre.x - brush.radius - origin.x) / step));
+    const int row_end = clamp_vertex(std::floor((brush.centre.x + brush.radius - origin.x) / step) + 1.0f);
+    const int col_begin = clamp_vertex(std::ceil((brush.centre.y - brush.radius - origin.y) / step));
+    const int col_end = clamp_vertex(std::floor((brush.centre.y + brush.radius - origin.y) / step) + 1.0f);
+    if (row_begin >= row_end || col_begin >= col_end) return result;
+    result.row_begin = row_begin;
+    result.row_end = row_end;
+    result.col_begin = col_begin;
+    result.col_end = col_end;
+    edits += 1;
+    if (edited.size() != positions.size()) edited.assign(positions.size(), 0);
+
+    // The columns of each row whose packed vertices changed.
+    std::vector<int> dirty_begin(n, n);
+    std::vector<int> dirty_end(n, 0);
+    auto mark = [&](int row, int col)
+    {
+        dirty_begin[row] = std::min(dirty_begin[row], col);
+        dirty_end[row] = std::max(dirty_end[row], col + 1);
+    };
+
+    // -- Heights --
+    // The new heights are all found from the old ones before any is
+    // changed, so smoothing does not depend on the order of the vertices.
+    const int cols = col_end - col_begin;
+    std::vector<float> heights(std::size_t(row_end - row_begin) * cols);
+    for (int row = row_begin; row < row_end; row += 1)
+    {
+        for (int col = col_begin; col < col_end; col += 1)
+        {
+            float height = positions[n * row + col].y;
+            const float dx = origin.x + row * step - brush.centre.x;
+            const float dz = origin.y + col * step - brush.centre.y;
+            const float d2 = (dx * dx + dz * dz) / (brush.radius * brush.radius);
+            if (d2 < 1.0f)
+            {
+                const float falloff = (1.0f - d2) * (1.0f - d2);
+                const float amount = std::min(1.0f, brush.strength * falloff);
+                switch (brush.mode)
+                {
+                case Brush::Raise:   height += brush.strength * falloff; break;
+                case Brush::Lower:   height -= brush.strength * falloff; break;
+                case Brush::Flatten: height += (brush.height - height) * amount; break;
+                case Brush::Smooth:
+                {
+                    // The mean of the vertex and its neighbours.
+                    float sum = 0.0f;
+                    int count = 0;
+                    for (int r = std::max(row - 1, 0); r <= std::min(row + 1, quads); r += 1)
+                    {
+                        for (int c = std::max(col - 1, 0); c <= std::min(col + 1, quads); c += 1)
+                        {
+                            sum += positions[n * r + c].y;
+                            count += 1;
+                        }
+                    }
+                    height += (sum / count - height) * amount;
+                    break;
+                }
+                }
+            }
+            heights[std::size_t(row - row_begin) * cols + col - col_begin] = height;
+        }
+    }
+    float edit_low = std::numeric_limits<float>::max();
+    float edit_high = std::numeric_limits<float>::lowest();
+    for (int row = row_begin; row < row_end; row += 1)
+    {
+        for (int col = col_begin; col < col_end; col += 1)
+        {
+            const int i = n * row + col;
+            const float height = heights[std::size_t(row - row_begin) * cols + col - col_begin];
+            positions[i].y = height;
+            height_grid[i] = height;
+            edited[i] = 1;
+            edit_low = std::min(edit_low, height);
+            edit_high = std::max(edit_high, height);
+            mark(row, col);
+        }
+    }
+
+    // -- Normals --
+    // Normals are found as in TerrainGenerator::generate_normals, from the
+    // vertex and those in the next row and column. The last row copies the
+    // normal before it in memory, and the last column the normal up a row
+    // and left a column.
+    auto face_normal = [&](int row, int col) -> glm::vec3
+    {
+        const glm::vec3 at = positions[n * row + col];
+        const glm::vec3 below = positions[n * (row + 1) + col];
+        const glm::vec3 right = positions[n * row + col + 1];
+        return glm::normalize(glm::cross(right - at, below - at));
+    };
+    auto renormal = [&](int row, int col)
+    {
+        int r = row;
+        int c = col;
+        if (r == quads) { r = quads - 1; c = quads; }
+        if (c == quads) { r = std::max(r - 1, 0); c = quads - 1; }
+        normals[n * row + col] = face_normal(r, c);
+        mark(row, col);
+    };
+    // The normals of the vertices one before the edit depend on the
+    // heights edited too.
+    const int normal_row_begin = std::max(row_begin - 1, 0);
+    const int normal_col_begin = std::max(col_begin - 1, 0);
+    for (int row = normal_row_begin; row < row_end; row += 1)
+    {
+        for (int col = normal_col_begin; col < col_end; col += 1) renormal(row, col);
+    }
+    // Then the copies of those normals.
+    if (quads - 1 >= normal_col_begin && quads - 1 < col_end)
+    {
+        for (int row = normal_row_begin; row < std::min(row_end + 1, n); row += 1)
+        {
+            renormal(row, quads);
+        }
+    }
+    const int last_row_source = std::max(quads - 2, 0);
+    if (last_row_source >= normal_row_begin && last_row_source < row_end
+        && quads - 1 >= normal_col_begin && quads - 1 < col_end)
+    {
+        for (int col = 0; col < n; col += 1) renormal(quads, col);
+    }
+
+    // -- Colours --
+    if (colouring && moisture.size() == positions.size())
+    {
+        for (int row = row_begin; row < row_end; row += 1)
+        {
+            for (int col = col_begin; col < col_end; col += 1)
+            {
+                const int i = n * row + col;
+                colours[i] = colouring(positions[i].y, moisture[i]);
+            }
+        }
+    }
+
+    // -- Level of detail --
+    float low = edit_low;
+    float high = edit_high;
+    if (!morphs.empty())
+    {
+        auto remorph = [&](int row, int col)
+        {
+            const int i = n * row + col;
+            const glm::vec2 morph = morph_target(row, col);
+            if (morph.x == morphs[i].x && morph.y == morphs[i].y) return;
+            morphs[i] = morph;
+            low = std::min(low, morph.x);
+            high = std::max(high, morph.x);
+            mark(row, col);
+        };
+        // The vertices edited, some of which morph toward their own height.
+        for (int row = row_begin; row < row_end; row += 1)
+        {
+            for (int col = col_begin; col < col_end; col += 1) remorph(row, col);
+        }
+        // The vertices at each level morph toward heights 2^level away,
+        // and lie on rows and columns that are multiples of 2^level, or on
+        // the last row or column.
+        for (int level = 0; (1 << level) <= quads; level += 1)
+        {
+            const int step = 1 << level;
+            auto first = [=](int begin)
+            {
+                return std::min((std::max(begin - step, 0) + step - 1) / step * step, quads);
+            };
+            auto next = [=](int i) { return i < quads && i + step > quads ? quads : i + step; };
+            for (int row = first(row_begin); row < std::min(row_end + step, n); row = next(row))
+            {
+                for (int col = first(col_begin); col < std::min(col_end + step, n); col = next(col))
+                {
+                    if (std::min(lod_level_of(row, quads), lod_level_of(col, quads)) != level)
+                    {
+                        continue;
+                    }
+                    remorph(row, col);
+                }
+            }
+        }
+    }
+    if (!lod_nodes.empty())
+    {
+        int root_level = 0;
+        while ((lod_leaf_quads << root_level) < quads) root_level += 1;
+        widen_lod_bounds(0, root_level, 0, 0, result, edit_low, edit_high);
+    }
+
+    // -- Packing --
+    int last_colour = 0;
+    const float top = height_min + height_extent;
+    if (low < height_min || high > top)
+    {
+        // Widen the range past the edit, so further edits need not repack
+        // every vertex again.
+        const float margin = 0.25f * std::max(height_extent, 1.0f);
+        const float bottom = low < height_min ? low - margin : height_min;
+        height_min = bottom;
+        height_extent = (high > top ? high + margin : top) - bottom;
+        for (std::size_t i = 0; i < packed_vertices.size(); i += 1) pack_vertex(i, last_colour);
+        result.runs.push_back(std::make_pair(std::size_t(0), packed_vertices.size()));
+        return result;
+    }
+    for (int row = 0; row < n; row += 1)
+    {
+        if (dirty_begin[row] >= dirty_end[row]) continue;
+        const std::size_t first = std::size_t(n) * row + dirty_begin[row];
+        const std::size_t count = dirty_end[row] - dirty_begin[row];
+        for (std::size_t i = first; i < first + count; i += 1) pack_vertex(i, last_colour);
+        result.runs.push_back(std::make_pair(first, count));
+    }
+    return result;
+}
+
+// Widen the height bounds of the node at 'index', which starts at quad
+// row, col, and of its children, where they overlap the vertices edited.
+void Landscape::widen_lod_bounds(
+    int index, int level, int row, int col, const Edit& edit, float low, float high)
+{
+    const int quads = int(size) - 1;
+    const int span = lod_leaf_quads << level;
+    const int row_end = std::min(row + span, quads);
+    const int col_end = std::min(col + span, quads);
+    // The node includes the vertices [row, row_end] by [col, col_end].
+    if (row >= edit.row_end || row_end < edit.row_begin
+        || col >= edit.col_end || col_end < edit.col_begin)
+    {
+        return;
+    }
+    lod_nodes[index].min.y = std::min(lod_nodes[index].min.y, low);
+    lod_nodes[index].max.y = std::max(lod_nodes[index].max.y, high);
+    if (level == 0) return;
+    // The children are in the order build_lod_node adds them.
+    const int half = span / 2;
+    int child = 0;
+    for (int dr = 0; dr <= half; dr += half)
+    {
+        for (int dc = 0; dc <= half; dc += half)
+        {
+            if (row + dr >= row_end || col + dc >= col_end) continue;
+            widen_lod_bounds(
+                lod_nodes[index].children[child], level - 1, row + dr, col + dc,
+                edit, low, high);
+            child += 1;
+        }
+    }
 }
 
 /*
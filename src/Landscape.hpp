@@ -7,7 +7,12 @@
 #ifndef LANDSCAPE_HPP
 #define LANDSCAPE_HPP
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <glm/glm.hpp>
+#include <memory>
+#include <utility>
 #include <vector>
 
 #include "Mesh.hpp"
@@ -20,11 +25,205 @@ struct Landscape
     std::array<int, 3>  get_tri         (float x, float z) const;
     float               get_height_at   (float x, float z) const;
 
+    // -- Height queries --
+    // Find the height of the landscape at n points (xs[i], zs[i]), on the
+    // triangles as they are rendered, and, if asked for, the normal of the
+    // triangle and the cosine of the angle between it and the y axis.
+    // Points off the landscape are at the water height, and flat.
+    // Four points are found at a time with SSE2, where available.
+    // Requires the height grid (see build_height_grid).
+    void query_heights(
+        const float* xs, const float* zs, int n, float* heights,
+        glm::vec3* normals = nullptr, float* slope_cos = nullptr) const;
+    // Fill height_grid from the positions.
+    void build_height_grid();
+    // The height of every vertex, size * size floats, row by row, so
+    // queries read 4 bytes per vertex rather than a whole position.
+    // Kept when the other CPU data is released (see release_cpu_data).
+    std::vector<float> height_grid;
+    // The height given for points off the landscape.
+    static constexpr float outside_height = 6.4f;
+
+    // -- Editing --
+    // A brush changes the heights within 'radius' of 'centre' (an x and z
+    // position), most at the centre and fading to nothing at the radius.
+    struct Brush
+    {
+        enum Mode { Raise, Lower, Flatten, Smooth };
+        Mode mode;
+        glm::vec2 centre;
+        float radius;
+        // For Raise and Lower, the distance heights move at the centre.
+        // For Flatten and Smooth, the fraction of the way heights move
+        // toward the target (or the mean of their neighbours) at the
+        // centre, from 0 to 1.
+        float strength;
+        // The height Flatten moves toward.
+        float height;
+    };
+    // The colour of a vertex with a height and moisture, for recolouring
+    // edited vertices (see TerrainGenerator::colour_for).
+    typedef std::function<glm::vec3(float height, float moisture)> Colouring;
+    // What an edit changed.
+    struct Edit
+    {
+        // The vertices whose heights changed: rows [row_begin, row_end)
+        // and columns [col_begin, col_end), which is empty if none did.
+        int row_begin, row_end;
+        int col_begin, col_end;
+        // The runs of packed vertices changed, as (first, count), to be
+        // uploaded (see Renderer::update_vertices).
+        std::vector<std::pair<std::size_t, std::size_t>> runs;
+    };
+    // Apply a brush. Only the vertices within it are changed: their
+    // heights (and height grid), then the normals around them (one vertex
+    // beyond, as each normal depends on the next row and column), then,
+    // given a colouring and the moisture, their colours. The morph targets
+    // depending on the heights changed are found again, the bounds of the
+    // quadtree nodes over them are widened, and the vertices changed are
+    // repacked. If a height leaves the quantised range, the range is
+    // widened and every vertex is repacked.
+    // Triangles left out below the sea when the quadtree was built are not
+    // added back by raising them, so a landscape to be edited should be
+    // built with them (see TerrainGenerator::set_sea_culling).
+    Edit edit(const Brush& brush, const Colouring& colouring = Colouring());
+    // The normalized moisture of each vertex, used to recolour edited
+    // vertices. May be empty, in which case edits keep the colours.
+    std::vector<float> moisture;
+    // Which vertices have been edited (1) or not (0), or empty if none
+    // has, so the edits can be carried over when the island is
+    // regenerated (see TerrainGenerator::keep_edits).
+    std::vector<uint8_t> edited;
+    // The number of edits which changed the landscape.
+    unsigned edits;
+
+    // -- Continuous level of detail (CDLOD) --
+    // The mesh is split into a quadtree of nodes. A node at level L covers
+    // 16 * 2^L quads along each edge, and is drawn with vertices 2^L apart,
+    // so every node has about the same number of triangles.
+    // Nodes are selected by their distance from the camera, and vertices
+    // morph toward the next coarser level before a node is swapped for
+    // its parent, so the change in detail does not pop.
+    struct LodNode
+    {
+        int level;
+        // The node's triangles are drawn as the chunks
+        // lod_chunks[first_chunk, first_chunk + num_chunks).
+        unsigned int first_chunk;
+        unsigned int num_chunks;
+        // The bounding box of the node.
+        glm::vec3 min;
+        glm::vec3 max;
+        // The indices of the child nodes in lod_nodes, or -1.
+        int children[4];
+    };
+    // A run of a node's triangles, drawn with one call.
+    // Nodes are split into chunks of rows whose vertices span fewer than
+    // 2^16 indices, so their indices are stored in 16 bits, relative to
+    // base_vertex, in lod_indices[first, first + count). Only when one row
+    // of a node's quads spans more than that (at the coarsest levels of
+    // very large landscapes) does a chunk use 32 bit indices, in
+    // lod_wide_indices. The triangles of each chunk are ordered for the
+    // vertex cache (see IndexOptimizer.hpp).
+    struct LodChunk
+    {
+        unsigned int first;
+        unsigned int count;
+        int base_vertex;
+        int wide;
+    };
+    // Build the quadtree and per-vertex morph targets from the positions.
+    // Triangles with every vertex below cull_height are left out.
+    void build_lod(float cull_height);
+    // Select the nodes to draw for a camera at 'eye', as indices into
+    // lod_nodes. The distances at which detail drops are scaled by 'bias',
+    // so a bias below 1 gives coarser detail.
+    void select_lod(glm::vec3 eye, float bias, std::vector<int>& selected) const;
+    // The distance by which vertices of a node at 'level' have fully
+    // morphed to the next level.
+    float lod_range(int level, float bias) const;
+
     // Mesh details for rendering.
     std::vector<glm::vec3> positions;
     std::vector<glm::vec3> normals;
     std::vector<glm::vec3> colours;
     std::vector<unsigned int> indices;
+    // The CDLOD quadtree (the root is first), the chunks and indices for
+    // every node, and the height each vertex morphs toward and the level it
+    // morphs at.
+    std::vector<LodNode> lod_nodes;
+    std::vector<LodChunk> lod_chunks;
+    std::vector<uint16_t> lod_indices;
+    std::vector<unsigned int> lod_wide_indices;
+    std::vector<glm::vec2> morphs;
+    // The distance at which level 0 nodes have fully morphed.
+    float lod_base_range;
+    // The average cache miss ratio of the chunks, in the order the quads
+    // are built and after ordering for the vertex cache.
+    float lod_acmr_before;
+    float lod_acmr_after;
+
+    // -- Compact vertices --
+    // The vertices are uploaded for rendering in 8 bytes each, rather than
+    // the 44 bytes of the positions, normals, colours and morphs.
+    // The x and z of a vertex come from its index (which is
+    // size * row + col) with the origin and the distance between vertices,
+    // its heights are quantised over [height_min, height_min + height_extent],
+    // its normal is octahedral encoded, and its colour is an index into the
+    // palette. The landscape shaders unpack them (see shaderlib.glsl).
+    struct PackedVertex
+    {
+        uint16_t height;
+        uint16_t morph_height;
+        int8_t normal[2];
+        uint8_t colour;
+        uint8_t morph_level;
+    };
+    // Fill packed_vertices from the positions, normals, colours, morphs
+    // and palette.
+    void pack_vertices();
+    // Replace the colours, and repack the colour of only the vertices whose
+    // palette index changed. The packed vertices changed, to be uploaded,
+    // are [first, first + count) (count is 0 if none changed).
+    void recolour(
+        const std::vector<glm::vec3>& colours, std::size_t& first, std::size_t& count);
+    std::vector<PackedVertex> packed_vertices;
+    float height_min;
+    float height_extent;
+
+    // -- Releasing CPU data --
+    // Once a landscape is uploaded (see Renderer::assign_vao), drawing it
+    // only needs its quadtree, and queries only need its height grid.
+    // Free the positions, normals, colours, moisture, morphs, packed
+    // vertices and indices (but for the indices of a landscape without a
+    // quadtree, whose count is drawn), and return the number of bytes
+    // freed. Edits and recolours change nothing afterwards.
+    std::size_t release_cpu_data();
+
+    // -- Mapped indices --
+    // A landscape loaded from the cache (see LandscapeCache::load) reads its
+    // indices, lod_indices and lod_wide_indices straight from the mapped
+    // file rather than copying them, and those vectors stay empty. They
+    // are only needed to upload the landscape, so the mapping is held until
+    // release_mapping is called once it is uploaded.
+    template <typename T>
+    struct ArrayView
+    {
+        const T* data;
+        std::size_t size;
+    };
+    // Read the index arrays from 'mapping', which is released (unmapped)
+    // when the last copy of it is dropped.
+    void map_indices(
+        std::shared_ptr<const void> mapping, ArrayView<unsigned int> indices,
+        ArrayView<uint16_t> lod_indices, ArrayView<unsigned int> lod_wide_indices);
+    // The index arrays, from the vectors or the mapping.
+    ArrayView<unsigned int> index_view() const;
+    ArrayView<uint16_t> lod_index_view() const;
+    ArrayView<unsigned int> lod_wide_index_view() const;
+    // Drop the mapping. The indices of a landscape without a quadtree are
+    // copied out first, as their count is drawn.
+    void release_mapping();
 
     // The colour palette used by the landscape.
     // May be required for a shader program.
@@ -36,6 +235,8 @@ struct Landscape
     float edge;
     // The number of vertices along an edge.
     float size;
+    // The x and z position of the vertex at row 0, col 0.
+    glm::vec2 origin;
 
     // Pointed-to objects are not owned!
     // Landscapes should be consumed by a Scene after being generated,
@@ -45,6 +246,9 @@ struct Landscape
     // Rendering details.
     // The Landscape must be assigned VAO by a Renderer.
     unsigned int vao;
+    // The buffers backing the VAO (packed vertices, indices), kept so they
+    // can be released.
+    unsigned int buffers[2];
     glm::mat4 model_matrix;
     glm::mat3 normal_matrix;
     struct {
@@ -53,6 +257,22 @@ struct Landscape
         glm::vec3 specular;
         float shininess;
     } material;
+
+private:
+    std::shared_ptr<const void> mapping;
+    ArrayView<unsigned int> mapped_indices;
+    ArrayView<uint16_t> mapped_lod_indices;
+    ArrayView<unsigned int> mapped_lod_wide_indices;
+
+    glm::vec2 morph_target(int row, int col) const;
+    uint16_t quantise_height(float height) const;
+    void pack_vertex(std::size_t i, int& last_colour);
+    void widen_lod_bounds(
+        int index, int level, int row, int col, const Edit& edit, float low, float high);
+    int build_lod_node(int level, int row, int col, float cull_height);
+    void add_lod_chunk(std::vector<unsigned int>& chunk, int base_vertex);
+    void select_lod_node(
+        int index, glm::vec3 eye, float bias, std::vector<int>& selected) const;
 };
 
 #endif // LANDSCAPE_HPP
\ No newline at end of file
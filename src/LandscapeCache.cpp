@@ -0,0 +1,387 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of LandscapeCache class member functions.
+
+#include "LandscapeCache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "core.hpp"
+#include "TerrainGenerator.hpp"
+
+// The version of the file layout below. Increase this when it changes.
+static const int format_version = 5;
+
+// The arrays stored in a cache file, in order.
+enum Section
+{
+    Positions, Normals, Colours, Indices,
+    LodNodes, LodChunks, LodIndices, LodWideIndices, Morphs, Palette, Moisture,
+    Objects,
+    NumSections
+};
+
+// The start of a cache file.
+struct Header
+{
+    char magic[8];
+    uint64_t version_hash;
+    // The generation parameters.
+    int32_t seed;
+    int32_t size;
+    float edge;
+    float max_height;
+    int32_t sea_culled;
+    int32_t eroded;
+    // The Landscape's scalar members.
+    float landscape_edge;
+    float landscape_size;
+    float origin[2];
+    float lod_base_range;
+    float lod_acmr[2];
+    float ambient[3];
+    float diffuse[3];
+    float specular[3];
+    float shininess;
+    // Where each array starts in the file, and how many elements it has.
+    uint64_t offset[NumSections];
+    uint64_t count[NumSections];
+};
+
+// An object on the landscape, with its mesh and shader stored by name.
+struct ObjectRecord
+{
+    char mesh[64];
+    char shader[64];
+    float position[4];
+    float scale[3];
+    float rotation[3];
+};
+
+static const char magic[8] = { 'L', 'A', 'N', 'D', 'S', 'C', 'P', '\0' };
+
+// Arrays are aligned to 16 bytes within the file.
+static uint64_t align(uint64_t offset)
+{
+    return (offset + 15) & ~uint64_t(15);
+}
+
+// Copy an array out of the file into 'out'.
+template <typename T>
+static void copy_section(
+    const char* data, const Header& header, Section section, std::vector<T>& out)
+{
+    const T* first = reinterpret_cast<const T*>(data + header.offset[section]);
+    out.assign(first, first + header.count[section]);
+}
+
+// A view of an array in the file.
+template <typename T>
+static Landscape::ArrayView<T> view_section(
+    const char* data, const Header& header, Section section)
+{
+    const T* first = reinterpret_cast<const T*>(data + header.offset[section]);
+    return { first, std::size_t(header.count[section]) };
+}
+
+// 64-bit FNV-1a hash.
+static uint64_t fnv1a(const std::string& data)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c: data)
+    {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+LandscapeCache::LandscapeCache(
+    const std::string& directory,
+    int seed, int size, float edge, float max_height, bool sea_culled,
+    bool eroded)
+    : directory(directory),
+      seed(seed),
+      size(size),
+      edge(edge),
+      max_height(max_height),
+      sea_culled(sea_culled),
+      eroded(eroded)
+{
+    // The parameters are in the name so different landscapes can be
+    // cached side by side; the header is what is checked on loading.
+    char name[128];
+    std::snprintf(
+        name, sizeof(name), "landscape-%d-%d-%g-%g%s%s.bin",
+        seed, size, edge, max_height,
+        sea_culled ? "" : "-uncut", eroded ? "-eroded" : "");
+    file_path = directory + "/" + name;
+}
+
+// The hash of the generator and file format versions.
+uint64_t LandscapeCache::version_hash()
+{
+    // The sizes of the stored types are included, so files written by a
+    // build with a different layout are also stale.
+    return fnv1a(
+        "format " + std::to_string(format_version)
+        + " generator " + std::to_string(int(TerrainGenerator::version))
+        + " header " + std::to_string(sizeof(Header))
+        + " node " + std::to_string(sizeof(Landscape::LodNode))
+        + " chunk " + std::to_string(sizeof(Landscape::LodChunk))
+        + " object " + std::to_string(sizeof(ObjectRecord)));
+}
+
+// Load the cached landscape.
+Landscape* LandscapeCache::load(ResourceManager* resources) const
+{
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd == -1) return nullptr;
+    struct stat info;
+    if (fstat(fd, &info) == -1 || info.st_size < off_t(sizeof(Header)))
+    {
+        close(fd);
+        return nullptr;
+    }
+    const std::size_t length = info.st_size;
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return nullptr;
+    const char* data = static_cast<const char*>(mapping);
+    // Unmapped once the landscape and this function are done with it.
+    std::shared_ptr<const void> held(
+        mapping, [length](const void* address)
+        {
+            munmap(const_cast<void*>(address), length);
+        });
+
+    Header header;
+    std::memcpy(&header, data, sizeof(Header));
+    bool valid =
+        std::memcmp(header.magic, magic, sizeof(magic)) == 0
+        && header.version_hash == version_hash()
+        && header.seed == seed
+        && header.size == size
+        && header.edge == edge
+        && header.max_height == max_height
+        && header.sea_culled == int32_t(sea_culled)
+        && header.eroded == int32_t(eroded);
+
+    const std::size_t element_size[NumSections] = {
+        sizeof(glm::vec3), sizeof(glm::vec3), sizeof(glm::vec3),
+        sizeof(unsigned int), sizeof(Landscape::LodNode),
+        sizeof(Landscape::LodChunk), sizeof(uint16_t), sizeof(unsigned int),
+        sizeof(glm::vec2), sizeof(glm::vec3), sizeof(float), sizeof(ObjectRecord),
+    };
+    for (int i = 0; valid && i < NumSections; i += 1)
+    {
+        valid = header.offset[i] % 16 == 0
+            && header.offset[i] <= length
+            && header.count[i] <= (length - header.offset[i]) / element_size[i];
+    }
+    if (!valid)
+    {
+        warn("Ignoring stale landscape cache '" + file_path + "'");
+        return nullptr;
+    }
+
+    Landscape* landscape = new Landscape;
+    copy_section(data, header, Positions,  landscape->positions);
+    copy_section(data, header, Normals,    landscape->normals);
+    copy_section(data, header, Colours,    landscape->colours);
+    copy_section(data, header, LodNodes,       landscape->lod_nodes);
+    copy_section(data, header, LodChunks,      landscape->lod_chunks);
+    copy_section(data, header, Morphs,         landscape->morphs);
+    copy_section(data, header, Palette,        landscape->palette);
+    copy_section(data, header, Moisture,       landscape->moisture);
+    // The indices are only uploaded, so they are read from the mapping.
+    landscape->map_indices(
+        held,
+        view_section<unsigned int>(data, header, Indices),
+        view_section<uint16_t>(data, header, LodIndices),
+        view_section<unsigned int>(data, header, LodWideIndices));
+    landscape->edge = header.landscape_edge;
+    landscape->size = header.landscape_size;
+    landscape->origin = glm::vec2(header.origin[0], header.origin[1]);
+    landscape->lod_base_range = header.lod_base_range;
+    landscape->lod_acmr_before = header.lod_acmr[0];
+    landscape->lod_acmr_after = header.lod_acmr[1];
+    std::memcpy(&landscape->material.ambient[0],  header.ambient,  sizeof(header.ambient));
+    std::memcpy(&landscape->material.diffuse[0],  header.diffuse,  sizeof(header.diffuse));
+    std::memcpy(&landscape->material.specular[0], header.specular, sizeof(header.specular));
+    landscape->material.shininess = header.shininess;
+    landscape->pack_vertices();
+    landscape->build_height_grid();
+
+    // Recreate the objects. Names that don't match any resource mean the
+    // cache was written with different resources, so it is stale.
+    const ObjectRecord* records =
+        reinterpret_cast<const ObjectRecord*>(data + header.offset[Objects]);
+    try
+    {
+        for (uint64_t i = 0; i < header.count[Objects]; i += 1)
+        {
+            const ObjectRecord& record = records[i];
+            Object* object = new Object(
+                resources->get_mesh(record.mesh),
+                glm::vec3(record.position[0], record.position[1], record.position[2]),
+                resources->get_shader(record.shader));
+            object->position = glm::vec4(
+                record.position[0], record.position[1],
+                record.position[2], record.position[3]);
+            object->scale = glm::vec3(
+                record.scale[0], record.scale[1], record.scale[2]);
+            object->x_rotation = record.rotation[0];
+            object->y_rotation = record.rotation[1];
+            object->z_rotation = record.rotation[2];
+            landscape->objects.push_back(object);
+        }
+    }
+    catch (const std::runtime_error& error)
+    {
+        warn("Ignoring stale landscape cache '" + file_path + "': " + error.what());
+        for (Object* object: landscape->objects) delete object;
+        delete landscape;
+        return nullptr;
+    }
+
+    return landscape;
+}
+
+// Save a landscape generated with the cache's parameters.
+bool LandscapeCache::save(
+    const Landscape& landscape, ResourceManager* resources) const
+{
+    Header header;
+    std::memset(&header, 0, sizeof(Header));
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version_hash = version_hash();
+    header.seed = seed;
+    header.size = size;
+    header.edge = edge;
+    header.max_height = max_height;
+    header.sea_culled = sea_culled;
+    header.eroded = eroded;
+    header.landscape_edge = landscape.edge;
+    header.landscape_size = landscape.size;
+    header.origin[0] = landscape.origin.x;
+    header.origin[1] = landscape.origin.y;
+    header.lod_base_range = landscape.lod_base_range;
+    header.lod_acmr[0] = landscape.lod_acmr_before;
+    header.lod_acmr[1] = landscape.lod_acmr_after;
+    std::memcpy(header.ambient,  &landscape.material.ambient[0],  sizeof(header.ambient));
+    std::memcpy(header.diffuse,  &landscape.material.diffuse[0],  sizeof(header.diffuse));
+    std::memcpy(header.specular, &landscape.material.specular[0], sizeof(header.specular));
+    header.shininess = landscape.material.shininess;
+
+    // Objects are stored with the names of their mesh and shader.
+    std::vector<ObjectRecord> records(landscape.objects.size());
+    for (std::size_t i = 0; i < landscape.objects.size(); i += 1)
+    {
+        const Object& object = *landscape.objects[i];
+        ObjectRecord& record = records[i];
+        std::memset(&record, 0, sizeof(ObjectRecord));
+        const std::string mesh = resources->get_mesh_name(object.render_unit.mesh);
+        const std::string shader = resources->get_shader_name(object.shader);
+        if (mesh.empty() || shader.empty()
+            || mesh.size() >= sizeof(record.mesh)
+            || shader.size() >= sizeof(record.shader))
+        {
+            warn("Not caching landscape: an object's mesh or shader has no usable name");
+            return false;
+        }
+        std::strcpy(record.mesh, mesh.c_str());
+        std::strcpy(record.shader, shader.c_str());
+        for (int j = 0; j < 4; j += 1) record.position[j] = object.position[j];
+        for (int j = 0; j < 3; j += 1) record.scale[j] = object.scale[j];
+        record.rotation[0] = object.x_rotation;
+        record.rotation[1] = object.y_rotation;
+        record.rotation[2] = object.z_rotation;
+    }
+
+    // The indices may still be in the file the landscape was loaded from.
+    const Landscape::ArrayView<unsigned int> indices = landscape.index_view();
+    const Landscape::ArrayView<uint16_t> lod_indices = landscape.lod_index_view();
+    const Landscape::ArrayView<unsigned int> lod_wide_indices =
+        landscape.lod_wide_index_view();
+    const void* sections[NumSections] = {
+        landscape.positions.data(), landscape.normals.data(),
+        landscape.colours.data(), indices.data,
+        landscape.lod_nodes.data(), landscape.lod_chunks.data(),
+        lod_indices.data, lod_wide_indices.data,
+        landscape.morphs.data(), landscape.palette.data(),
+        landscape.moisture.data(), records.data(),
+    };
+    const std::size_t bytes[NumSections] = {
+        sizeof(glm::vec3) * landscape.positions.size(),
+        sizeof(glm::vec3) * landscape.normals.size(),
+        sizeof(glm::vec3) * landscape.colours.size(),
+        sizeof(unsigned int) * indices.size,
+        sizeof(Landscape::LodNode) * landscape.lod_nodes.size(),
+        sizeof(Landscape::LodChunk) * landscape.lod_chunks.size(),
+        sizeof(uint16_t) * lod_indices.size,
+        sizeof(unsigned int) * lod_wide_indices.size,
+        sizeof(glm::vec2) * landscape.morphs.size(),
+        sizeof(glm::vec3) * landscape.palette.size(),
+        sizeof(float) * landscape.moisture.size(),
+        sizeof(ObjectRecord) * records.size(),
+    };
+    const std::size_t counts[NumSections] = {
+        landscape.positions.size(), landscape.normals.size(),
+        landscape.colours.size(), indices.size,
+        landscape.lod_nodes.size(), landscape.lod_chunks.size(),
+        lod_indices.size, lod_wide_indices.size,
+        landscape.morphs.size(), landscape.palette.size(),
+        landscape.moisture.size(), records.size(),
+    };
+    uint64_t offset = align(sizeof(Header));
+    for (int i = 0; i < NumSections; i += 1)
+    {
+        header.offset[i] = offset;
+        header.count[i] = counts[i];
+        offset = align(offset + bytes[i]);
+    }
+
+    // Write to a temporary file, then rename it, so a partly written
+    // file is never loaded.
+    mkdir(directory.c_str(), 0755);
+    const std::string temp_path = file_path + ".tmp";
+    FILE* file = std::fopen(temp_path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        warn("Could not write landscape cache '" + temp_path + "'");
+        return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(Header), 1, file) == 1;
+    uint64_t written = sizeof(Header);
+    const char padding[16] = {};
+    for (int i = 0; ok && i < NumSections; i += 1)
+    {
+        ok = std::fwrite(padding, 1, header.offset[i] - written, file)
+                == header.offset[i] - written
+            && std::fwrite(sections[i], 1, bytes[i], file) == bytes[i];
+        written = header.offset[i] + bytes[i];
+    }
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok || std::rename(temp_path.c_str(), file_path.c_str()) != 0)
+    {
+        warn("Could not write landscape cache '" + file_path + "'");
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// The path of the cache file.
+const std::string& LandscapeCache::path() const
+{
+    return file_path;
+}
@@ -0,0 +1,65 @@
+// Authorship: James Kortman (a1648090)
+// LandscapeCache class
+// Saves generated landscapes to disk, and loads them on later runs instead
+// of generating them again.
+// A cache file holds a fixed header followed by the raw contents of each
+// Landscape array, so loading maps the file into memory and takes the
+// arrays from it without any parsing. The arrays used on the CPU are
+// copied out; the indices, which are only uploaded, are read from the
+// mapping until the landscape is uploaded (see Landscape::map_indices).
+// The header records the generation parameters and a hash of the generator
+// and file format versions; if any of these don't match, the file is stale
+// and is ignored.
+
+#ifndef LANDSCAPECACHE_HPP
+#define LANDSCAPECACHE_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "Landscape.hpp"
+#include "ResourceManager.hpp"
+
+class LandscapeCache
+{
+public:
+    // A cache, stored in 'directory', for the landscape generated by
+    // TerrainGenerator(seed, size, edge, max_height), with or without the
+    // triangles below the sea (see TerrainGenerator::set_sea_culling), and
+    // with or without erosion with the default parameters.
+    LandscapeCache(
+        const std::string& directory,
+        int seed, int size, float edge, float max_height, bool sea_culled = true,
+        bool eroded = false);
+    LandscapeCache() = delete;
+
+    // Load the cached landscape, taking the meshes and shaders for its
+    // objects from 'resources'.
+    // Returns nullptr if there is no cached landscape or it is stale.
+    // The landscape's indices stay in the mapped file until
+    // Landscape::release_mapping is called.
+    Landscape* load(ResourceManager* resources) const;
+
+    // Save a landscape generated with the cache's parameters.
+    // The meshes and shaders of its objects must be in 'resources'.
+    // Returns false (with a warning) if the landscape couldn't be saved.
+    bool save(const Landscape& landscape, ResourceManager* resources) const;
+
+    // The path of the cache file.
+    const std::string& path() const;
+
+private:
+    // The hash of the generator and file format versions.
+    static uint64_t version_hash();
+
+    std::string directory;
+    std::string file_path;
+    int seed;
+    int size;
+    float edge;
+    float max_height;
+    bool sea_culled;
+    bool eroded;
+};
+
+#endif // LANDSCAPECACHE_HPP
@@ -0,0 +1,180 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of LandscapeLoader class member functions.
+
+#include "LandscapeLoader.hpp"
+
+#include <chrono>
+#include <string>
+
+#include "Console.hpp"
+#include "Renderer.hpp"
+#include "ThreadPool.hpp"
+
+LandscapeLoader::LandscapeLoader(
+    int seed, int size, float edge, float max_height,
+    ResourceManager* resources, bool editable, bool eroded)
+    : seed(seed),
+      size(size),
+      edge(edge),
+      max_height(max_height),
+      resources(resources),
+      editable(editable),
+      eroded(eroded),
+      cache("cache", seed, size, edge, max_height, !editable, eroded),
+      cached(false),
+      worker_ms(0.0f),
+      allocated(false),
+      finished(false),
+      uploaded(0),
+      total(0),
+      upload_frames(0),
+      generated_percent(0.0f),
+      uploaded_percent(0.0f),
+      load_ms(0.0f),
+      acmr_before(0.0f),
+      acmr_after(0.0f),
+      released_kb(0)
+{
+    console->register_var(
+        "terrain.generated",
+        Float,
+        &generated_percent,
+        1,
+        "The percentage of the landscape generation stages finished",
+        false);
+    console->register_var(
+        "terrain.uploaded",
+        Float,
+        &uploaded_percent,
+        1,
+        "The percentage of the landscape uploaded to the GPU",
+        false);
+    console->register_var(
+        "terrain.upload_frames",
+        Int,
+        &upload_frames,
+        1,
+        "The number of frames taken to upload the landscape",
+        false);
+    console->register_var(
+        "terrain.load_ms",
+        Float,
+        &load_ms,
+        1,
+        "The time taken to load or generate the landscape, in ms",
+        false);
+    console->register_var(
+        "terrain.acmr_before",
+        Float,
+        &acmr_before,
+        1,
+        "The landscape's average vertex cache miss ratio before reordering",
+        false);
+    console->register_var(
+        "terrain.acmr_after",
+        Float,
+        &acmr_after,
+        1,
+        "The landscape's average vertex cache miss ratio after reordering",
+        false);
+    console->register_var(
+        "terrain.released_kb",
+        Int,
+        &released_kb,
+        1,
+        "The CPU memory freed once the landscape was uploaded to the GPU, in KB",
+        false);
+    for (int i = 0; i < TerrainGenerator::num_stages; i += 1)
+    {
+        stage_ms[i] = 0.0f;
+        console->register_var(
+            std::string("terrain.ms.") + TerrainGenerator::stage_names[i],
+            Float,
+            &stage_ms[i],
+            1,
+            std::string("The time taken by the landscape ")
+                + TerrainGenerator::stage_names[i] + " stage, in ms",
+            false);
+    }
+
+    // The constructor's parameters hide the members used by the worker.
+    created = ThreadPool::shared().submit([this]()
+    {
+        const auto start = std::chrono::steady_clock::now();
+        Landscape* result = cache.load(this->resources);
+        if (result != nullptr)
+        {
+            cached = true;
+        }
+        else
+        {
+            TerrainGenerator tg(
+                this->seed, this->size, this->edge, this->max_height,
+                this->resources, &progress, this->eroded ? &erosion : nullptr);
+            tg.set_sea_culling(!this->editable);
+            result = tg.landscape();
+            cache.save(*result, this->resources);
+        }
+        landscape.reset(result);
+        worker_ms = std::chrono::duration<float, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+    });
+}
+
+LandscapeLoader::~LandscapeLoader()
+{
+    // The worker writes into the loader.
+    if (created.valid()) created.wait();
+    if (landscape != nullptr)
+    {
+        for (Object* object: landscape->objects) delete object;
+    }
+}
+
+// Upload the next slice of the landscape once it has been created.
+Landscape* LandscapeLoader::update(Renderer& renderer)
+{
+    if (finished) return nullptr;
+
+    // Report the worker's progress.
+    for (int i = 0; i < TerrainGenerator::num_stages; i += 1)
+    {
+        stage_ms[i] = progress.stage_ms[i];
+    }
+    const bool ready = created.wait_for(std::chrono::seconds(0))
+        == std::future_status::ready;
+    generated_percent = (ready && cached) ? 100.0f
+        : 100.0f * progress.stages_done / TerrainGenerator::num_stages;
+    if (!ready) return nullptr;
+
+    if (!allocated)
+    {
+        // Rethrows anything thrown by the worker.
+        created.get();
+        load_ms = worker_ms;
+        acmr_before = landscape->lod_acmr_before;
+        acmr_after = landscape->lod_acmr_after;
+        renderer.allocate_vao(landscape.get());
+        total = Renderer::upload_size(landscape.get());
+        allocated = true;
+    }
+    upload_frames += 1;
+    const bool complete = renderer.upload_vao_slice(
+        landscape.get(), uploaded, max_upload_per_frame);
+    uploaded_percent = total > 0 ? 100.0f * uploaded / total : 100.0f;
+    if (!complete) return nullptr;
+
+    finished = true;
+    landscape->release_mapping();
+    if (!editable)
+    {
+        released_kb = int(landscape->release_cpu_data() / 1024);
+    }
+    return landscape.release();
+}
+
+// Whether the landscape has been handed over.
+bool LandscapeLoader::done() const
+{
+    return finished;
+}
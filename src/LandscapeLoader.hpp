@@ -0,0 +1,96 @@
+// Authorship: James Kortman (a1648090)
+// LandscapeLoader class
+// Creates the island landscape without blocking the rendering loop.
+// The landscape is loaded from the LandscapeCache, or generated, on the
+// shared ThreadPool while the first frames are drawn. Once it is ready, it
+// is uploaded to the GPU a slice at a time, a limited number of bytes per
+// frame, and then handed over to the caller.
+// The generation progress and stage timings are available through the
+// console as terrain.* variables.
+
+#ifndef LANDSCAPELOADER_HPP
+#define LANDSCAPELOADER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <future>
+#include <memory>
+
+#include "Landscape.hpp"
+#include "LandscapeCache.hpp"
+#include "ResourceManager.hpp"
+#include "TerrainGenerator.hpp"
+
+class Renderer;
+
+class LandscapeLoader
+{
+public:
+    // Start creating the landscape generated by
+    // TerrainGenerator(seed, size, edge, max_height, resources).
+    // The loader does not take ownership of 'resources', which must not be
+    // changed until the landscape has been handed over.
+    // Unless 'editable' is set, the landscape's CPU copies of what was
+    // uploaded are freed before it is handed over (see
+    // Landscape::release_cpu_data), so it can no longer be edited.
+    // An editable landscape keeps the triangles below the sea (see
+    // TerrainGenerator::set_sea_culling), so the sea floor can be raised.
+    // If 'eroded' is set, the island is eroded with the default parameters
+    // (see Erosion.hpp).
+    LandscapeLoader(
+        int seed, int size, float edge, float max_height,
+        ResourceManager* resources, bool editable = true, bool eroded = false);
+    LandscapeLoader() = delete;
+    LandscapeLoader(const LandscapeLoader&) = delete;
+    LandscapeLoader& operator=(const LandscapeLoader&) = delete;
+    ~LandscapeLoader();
+
+    // Call once per frame. Uploads the next slice of the landscape once it
+    // has been created.
+    // Returns the landscape, with its VAO assigned, on the frame the upload
+    // finishes; the caller then owns it. Returns nullptr otherwise.
+    Landscape* update(Renderer& renderer);
+
+    // Whether the landscape has been handed over.
+    bool done() const;
+
+private:
+    int seed;
+    int size;
+    float edge;
+    float max_height;
+    ResourceManager* resources;
+    bool editable;
+    bool eroded;
+    ErosionParams erosion;
+    LandscapeCache cache;
+
+    // Written by the worker creating the landscape.
+    TerrainGenerator::Progress progress;
+    std::atomic<bool> cached;
+    std::atomic<float> worker_ms;
+    std::unique_ptr<Landscape> landscape;
+    // Ready once the worker has finished.
+    std::future<void> created;
+
+    // The upload state.
+    bool allocated;
+    bool finished;
+    std::size_t uploaded;
+    std::size_t total;
+    int upload_frames;
+    // The most bytes uploaded in a single frame.
+    const std::size_t max_upload_per_frame = 1 << 20;
+
+    // Statistics, available through the console.
+    // Copied from the worker's progress at each update().
+    float generated_percent;
+    float uploaded_percent;
+    float stage_ms[TerrainGenerator::num_stages];
+    float load_ms;
+    float acmr_before;
+    float acmr_after;
+    int released_kb;
+};
+
+#endif // LANDSCAPELOADER_HPP
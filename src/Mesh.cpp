@@ -2,6 +2,7 @@
 // Implementation of Mesh class member functions.
 
 #include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 
@@ -10,12 +11,24 @@
 #include "tiny_obj_loader.h"
 
 #include "core.hpp"
+#include "IndexOptimizer.hpp"
 #include "Mesh.hpp"
+#include "MeshCache.hpp"
 
 void import_bounds(Mesh* mesh, std::string dir);
 
 Mesh* Mesh::load_obj(const std::string& dir, const std::string& file) {
-    Mesh* mesh = new Mesh();
+    const auto start = std::chrono::steady_clock::now();
+    const MeshCache cache("cache", dir, file);
+    Mesh* mesh = cache.load();
+    if (mesh != nullptr) {
+        mesh->cached = true;
+        mesh->load_ms = std::chrono::duration<float, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        return mesh;
+    }
+
+    mesh = new Mesh();
     mesh->dir = dir;
     std::string err;
     bool result = tinyobj::LoadObj(
@@ -31,10 +44,21 @@ Mesh* Mesh::load_obj(const std::string& dir, const std::string& file) {
         return nullptr;
     }
 
+    // Order each shape's triangles for the vertex cache. Shapes have one
+    // material (see Renderer::create_materials), so faces can be moved.
+    for (tinyobj::shape_t& shape: mesh->shapes) {
+        optimize_vertex_cache(shape.mesh.indices.data(), shape.mesh.indices.size());
+    }
+
     mesh->palette = load_palette(dir+"palette");
 
     import_bounds(mesh, dir);
 
+    mesh->cached = false;
+    mesh->load_ms = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    mesh->parse_ms = mesh->load_ms;
+    cache.save(*mesh);
     return mesh;
 }
 
@@ -19,6 +19,9 @@ struct Bound {bound_type type; glm::vec3 center; glm::vec3 dims;};
 struct Mesh
 {
     // Create a Mesh
+    // The mesh is loaded from the mesh cache (see MeshCache.hpp) if it
+    // was cached on an earlier run and its files haven't changed since,
+    // and is cached otherwise.
     static Mesh* load_obj(
         const std::string& dir, const std::string& objfile);
     // Mesh properties.
@@ -35,6 +38,12 @@ struct Mesh
     std::vector<glm::vec3> palette;
     // Bounding Boxes
     std::vector<Bound> bounds;
+    // Whether the mesh was loaded from the mesh cache, the time it took
+    // to load, and the time it took to load from its OBJ and MTL files
+    // (on the run that cached it, if it was cached), in ms.
+    bool cached;
+    float load_ms;
+    float parse_ms;
 };
 
 #endif // MESH_H
\ No newline at end of file
@@ -0,0 +1,562 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of MeshCache class member functions.
+
+#include "MeshCache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "core.hpp"
+
+// The version of the file layout below. Increase this when it changes, or
+// when Mesh::load_obj changes what it does to the meshes it loads.
+static const int format_version = 1;
+
+// The arrays stored in a cache file, in order. The shapes' arrays hold
+// every shape's data, one after another.
+enum Section
+{
+    Shapes,
+    Positions, Normals, Texcoords, Indices, MaterialIds, FaceVertices,
+    Materials, Palette, Bounds, Sources,
+    NumSections
+};
+
+// The number of per-shape arrays, from Positions to FaceVertices.
+static const int num_shape_arrays = FaceVertices - Positions + 1;
+
+// The start of a cache file.
+struct Header
+{
+    char magic[8];
+    uint64_t version_hash;
+    // The time taken to load the mesh from its sources.
+    float parse_ms;
+    int32_t padding;
+    // Where each array starts in the file, and how many elements it has.
+    uint64_t offset[NumSections];
+    uint64_t count[NumSections];
+};
+
+// A shape, with the number of elements it has in each per-shape array.
+struct ShapeRecord
+{
+    char name[64];
+    uint64_t count[num_shape_arrays];
+};
+
+// A material. Only the properties tiny_obj_loader reads into named
+// members are kept.
+struct MaterialRecord
+{
+    char name[64];
+    char ambient_texname[128];
+    char diffuse_texname[128];
+    char specular_texname[128];
+    char specular_highlight_texname[128];
+    char bump_texname[128];
+    char displacement_texname[128];
+    char alpha_texname[128];
+    float ambient[3];
+    float diffuse[3];
+    float specular[3];
+    float transmittance[3];
+    float emission[3];
+    float shininess;
+    float ior;
+    float dissolve;
+    int32_t illum;
+};
+
+struct BoundRecord
+{
+    int32_t type;
+    float center[3];
+    float dims[3];
+};
+
+// A file the mesh was loaded from. A size of -1 means it didn't exist.
+struct SourceRecord
+{
+    char path[256];
+    int64_t size;
+    int64_t mtime;
+    uint64_t hash;
+};
+
+static const char magic[8] = { 'M', 'E', 'S', 'H', 'O', 'B', 'J', '\0' };
+
+// Arrays are aligned to 16 bytes within the file.
+static uint64_t align(uint64_t offset)
+{
+    return (offset + 15) & ~uint64_t(15);
+}
+
+// 64-bit FNV-1a hash, continuing from 'hash'.
+static uint64_t fnv1a(
+    const char* data, std::size_t length, uint64_t hash = 14695981039346656037ull)
+{
+    for (std::size_t i = 0; i < length; i += 1)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// The modification time of a file, in ns.
+static int64_t modified_time(const struct stat& info)
+{
+    return int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+}
+
+// Hash the contents of a file. Returns false if it couldn't be read.
+static bool hash_file(const std::string& path, uint64_t& hash)
+{
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) return false;
+    hash = fnv1a(nullptr, 0);
+    char buffer[1 << 16];
+    std::size_t read;
+    while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        hash = fnv1a(buffer, read, hash);
+    }
+    const bool ok = !std::ferror(file);
+    std::fclose(file);
+    return ok;
+}
+
+// Record the current state of a source file.
+static bool record_source(const std::string& path, SourceRecord& record)
+{
+    std::memset(&record, 0, sizeof(SourceRecord));
+    if (path.size() >= sizeof(record.path)) return false;
+    std::strcpy(record.path, path.c_str());
+    struct stat info;
+    if (stat(path.c_str(), &info) == -1)
+    {
+        record.size = -1;
+        return true;
+    }
+    record.size = info.st_size;
+    record.mtime = modified_time(info);
+    return hash_file(path, record.hash);
+}
+
+// Whether a source file is as it was recorded. Files whose size and time
+// match are taken to be unchanged; others are hashed, and 'touched' is set
+// if they are the same apart from their time.
+static bool source_unchanged(const SourceRecord& record, bool& touched)
+{
+    struct stat info;
+    if (stat(record.path, &info) == -1) return record.size == -1;
+    if (record.size == -1 || info.st_size != record.size) return false;
+    if (modified_time(info) == record.mtime) return true;
+    uint64_t hash;
+    if (!hash_file(record.path, hash) || hash != record.hash) return false;
+    touched = true;
+    return true;
+}
+
+// The files Mesh::load_obj reads: the OBJ, the MTL files it names (as
+// tiny_obj_loader finds them), and the palette and bound in its directory.
+static std::vector<std::string> source_paths(
+    const std::string& dir, const std::string& objfile)
+{
+    std::vector<std::string> paths = { dir + objfile };
+    std::ifstream obj(dir + objfile);
+    std::string line;
+    while (std::getline(obj, line))
+    {
+        if (line.compare(0, 6, "mtllib") != 0 || line.size() < 7
+            || (line[6] != ' ' && line[6] != '\t'))
+        {
+            continue;
+        }
+        std::istringstream stream(line.substr(7));
+        std::string name;
+        if (!(stream >> name)) continue;
+        if (std::find(paths.begin(), paths.end(), dir + name) == paths.end())
+        {
+            paths.push_back(dir + name);
+        }
+    }
+    paths.push_back(dir + "palette");
+    paths.push_back(dir + "bound");
+    return paths;
+}
+
+// Copy a string into a fixed size field. Returns false if it doesn't fit.
+template <std::size_t N>
+static bool copy_string(char (&field)[N], const std::string& value)
+{
+    if (value.size() >= N) return false;
+    std::strcpy(field, value.c_str());
+    return true;
+}
+
+// Copy count elements of an array out of the file into 'out', starting at
+// element 'first'.
+template <typename T>
+static void copy_elements(
+    const char* data, const Header& header, Section section,
+    uint64_t first, uint64_t count, std::vector<T>& out)
+{
+    const T* start = reinterpret_cast<const T*>(data + header.offset[section]) + first;
+    out.assign(start, start + count);
+}
+
+MeshCache::MeshCache(
+    const std::string& directory,
+    const std::string& dir, const std::string& objfile)
+    : directory(directory),
+      dir(dir),
+      objfile(objfile)
+{
+    // The model's path is in the name, so the meshes are cached side by
+    // side; the header is what is checked on loading.
+    std::string name = "mesh-" + dir + objfile + ".bin";
+    std::replace(name.begin(), name.end(), '/', '_');
+    file_path = directory + "/" + name;
+}
+
+// The hash of the file format version.
+uint64_t MeshCache::version_hash()
+{
+    // The sizes of the stored types are included, so files written by a
+    // build with a different layout are also stale.
+    const std::string version =
+        "format " + std::to_string(format_version)
+        + " header " + std::to_string(sizeof(Header))
+        + " shape " + std::to_string(sizeof(ShapeRecord))
+        + " material " + std::to_string(sizeof(MaterialRecord))
+        + " source " + std::to_string(sizeof(SourceRecord));
+    return fnv1a(version.data(), version.size());
+}
+
+// Load the cached mesh.
+Mesh* MeshCache::load() const
+{
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd == -1) return nullptr;
+    struct stat info;
+    if (fstat(fd, &info) == -1 || info.st_size < off_t(sizeof(Header)))
+    {
+        close(fd);
+        return nullptr;
+    }
+    const std::size_t length = info.st_size;
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return nullptr;
+    const char* data = static_cast<const char*>(mapping);
+
+    Header header;
+    std::memcpy(&header, data, sizeof(Header));
+    bool valid =
+        std::memcmp(header.magic, magic, sizeof(magic)) == 0
+        && header.version_hash == version_hash();
+
+    const std::size_t element_size[NumSections] = {
+        sizeof(ShapeRecord),
+        sizeof(float), sizeof(float), sizeof(float), sizeof(unsigned int),
+        sizeof(int), sizeof(unsigned char),
+        sizeof(MaterialRecord), sizeof(glm::vec3), sizeof(BoundRecord),
+        sizeof(SourceRecord),
+    };
+    for (int i = 0; valid && i < NumSections; i += 1)
+    {
+        valid = header.offset[i] % 16 == 0
+            && header.offset[i] <= length
+            && header.count[i] <= (length - header.offset[i]) / element_size[i];
+    }
+    // The shapes' arrays must add up to the arrays stored.
+    const ShapeRecord* shapes =
+        reinterpret_cast<const ShapeRecord*>(data + header.offset[Shapes]);
+    for (int i = 0; valid && i < num_shape_arrays; i += 1)
+    {
+        uint64_t total = 0;
+        for (uint64_t s = 0; s < header.count[Shapes]; s += 1)
+        {
+            total += shapes[s].count[i];
+        }
+        valid = total == header.count[Positions + i];
+    }
+    if (!valid)
+    {
+        warn("Ignoring stale mesh cache '" + file_path + "'");
+        munmap(mapping, length);
+        return nullptr;
+    }
+
+    // Check the sources last, as it is the slowest check.
+    const SourceRecord* sources =
+        reinterpret_cast<const SourceRecord*>(data + header.offset[Sources]);
+    bool touched = false;
+    for (uint64_t i = 0; valid && i < header.count[Sources]; i += 1)
+    {
+        valid = sources[i].path[sizeof(sources[i].path) - 1] == '\0'
+            && source_unchanged(sources[i], touched);
+    }
+    if (!valid)
+    {
+        munmap(mapping, length);
+        return nullptr;
+    }
+
+    Mesh* mesh = new Mesh();
+    mesh->dir = dir;
+    mesh->parse_ms = header.parse_ms;
+    mesh->shapes.resize(header.count[Shapes]);
+    uint64_t first[num_shape_arrays] = {};
+    for (uint64_t s = 0; s < header.count[Shapes]; s += 1)
+    {
+        const ShapeRecord& record = shapes[s];
+        tinyobj::mesh_t& shape = mesh->shapes[s].mesh;
+        mesh->shapes[s].name = std::string(
+            record.name, strnlen(record.name, sizeof(record.name)));
+        std::vector<float>* floats[3] = {
+            &shape.positions, &shape.normals, &shape.texcoords
+        };
+        for (int i = 0; i < 3; i += 1)
+        {
+            copy_elements(
+                data, header, Section(Positions + i),
+                first[i], record.count[i], *floats[i]);
+        }
+        copy_elements(data, header, Indices,
+            first[Indices - Positions], record.count[Indices - Positions],
+            shape.indices);
+        copy_elements(data, header, MaterialIds,
+            first[MaterialIds - Positions], record.count[MaterialIds - Positions],
+            shape.material_ids);
+        copy_elements(data, header, FaceVertices,
+            first[FaceVertices - Positions], record.count[FaceVertices - Positions],
+            shape.num_vertices);
+        for (int i = 0; i < num_shape_arrays; i += 1) first[i] += record.count[i];
+    }
+    mesh->num_shapes = mesh->shapes.size();
+
+    const MaterialRecord* materials =
+        reinterpret_cast<const MaterialRecord*>(data + header.offset[Materials]);
+    mesh->materials.resize(header.count[Materials]);
+    for (uint64_t m = 0; m < header.count[Materials]; m += 1)
+    {
+        const MaterialRecord& record = materials[m];
+        tinyobj::material_t& material = mesh->materials[m];
+        auto text = [](const char* field, std::size_t size)
+        {
+            return std::string(field, strnlen(field, size));
+        };
+        material.name = text(record.name, sizeof(record.name));
+        material.ambient_texname  = text(record.ambient_texname,  sizeof(record.ambient_texname));
+        material.diffuse_texname  = text(record.diffuse_texname,  sizeof(record.diffuse_texname));
+        material.specular_texname = text(record.specular_texname, sizeof(record.specular_texname));
+        material.specular_highlight_texname = text(
+            record.specular_highlight_texname, sizeof(record.specular_highlight_texname));
+        material.bump_texname  = text(record.bump_texname,  sizeof(record.bump_texname));
+        material.displacement_texname = text(
+            record.displacement_texname, sizeof(record.displacement_texname));
+        material.alpha_texname = text(record.alpha_texname, sizeof(record.alpha_texname));
+        std::memcpy(material.ambient,       record.ambient,       sizeof(record.ambient));
+        std::memcpy(material.diffuse,       record.diffuse,       sizeof(record.diffuse));
+        std::memcpy(material.specular,      record.specular,      sizeof(record.specular));
+        std::memcpy(material.transmittance, record.transmittance, sizeof(record.transmittance));
+        std::memcpy(material.emission,      record.emission,      sizeof(record.emission));
+        material.shininess = record.shininess;
+        material.ior = record.ior;
+        material.dissolve = record.dissolve;
+        material.illum = record.illum;
+    }
+
+    copy_elements(data, header, Palette, 0, header.count[Palette], mesh->palette);
+    const BoundRecord* bounds =
+        reinterpret_cast<const BoundRecord*>(data + header.offset[Bounds]);
+    for (uint64_t b = 0; b < header.count[Bounds]; b += 1)
+    {
+        Bound bound;
+        bound.type = bound_type(bounds[b].type);
+        bound.center = glm::vec3(bounds[b].center[0], bounds[b].center[1], bounds[b].center[2]);
+        bound.dims = glm::vec3(bounds[b].dims[0], bounds[b].dims[1], bounds[b].dims[2]);
+        mesh->bounds.push_back(bound);
+    }
+    munmap(mapping, length);
+
+    // Sources which were only touched are hashed on every load until
+    // their new times are recorded.
+    if (touched) save(*mesh);
+    return mesh;
+}
+
+// Save a mesh loaded from the cache's files.
+bool MeshCache::save(const Mesh& mesh) const
+{
+    Header header;
+    std::memset(&header, 0, sizeof(Header));
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version_hash = version_hash();
+    header.parse_ms = mesh.parse_ms;
+
+    // The shapes' arrays are stored one after another.
+    std::vector<ShapeRecord> shapes(mesh.shapes.size());
+    std::vector<float> floats[3];
+    std::vector<unsigned int> indices;
+    std::vector<int> material_ids;
+    std::vector<unsigned char> face_vertices;
+    for (std::size_t s = 0; s < mesh.shapes.size(); s += 1)
+    {
+        const tinyobj::mesh_t& shape = mesh.shapes[s].mesh;
+        ShapeRecord& record = shapes[s];
+        std::memset(&record, 0, sizeof(ShapeRecord));
+        if (!copy_string(record.name, mesh.shapes[s].name))
+        {
+            warn("Not caching mesh '" + dir + objfile + "': a shape's name is too long");
+            return false;
+        }
+        const std::vector<float>* shape_floats[3] = {
+            &shape.positions, &shape.normals, &shape.texcoords
+        };
+        for (int i = 0; i < 3; i += 1)
+        {
+            floats[i].insert(floats[i].end(), shape_floats[i]->begin(), shape_floats[i]->end());
+            record.count[i] = shape_floats[i]->size();
+        }
+        indices.insert(indices.end(), shape.indices.begin(), shape.indices.end());
+        material_ids.insert(
+            material_ids.end(), shape.material_ids.begin(), shape.material_ids.end());
+        face_vertices.insert(
+            face_vertices.end(), shape.num_vertices.begin(), shape.num_vertices.end());
+        record.count[Indices - Positions] = shape.indices.size();
+        record.count[MaterialIds - Positions] = shape.material_ids.size();
+        record.count[FaceVertices - Positions] = shape.num_vertices.size();
+    }
+
+    std::vector<MaterialRecord> materials(mesh.materials.size());
+    for (std::size_t m = 0; m < mesh.materials.size(); m += 1)
+    {
+        const tinyobj::material_t& material = mesh.materials[m];
+        MaterialRecord& record = materials[m];
+        std::memset(&record, 0, sizeof(MaterialRecord));
+        const bool fits =
+            copy_string(record.name, material.name)
+            && copy_string(record.ambient_texname, material.ambient_texname)
+            && copy_string(record.diffuse_texname, material.diffuse_texname)
+            && copy_string(record.specular_texname, material.specular_texname)
+            && copy_string(record.specular_highlight_texname, material.specular_highlight_texname)
+            && copy_string(record.bump_texname, material.bump_texname)
+            && copy_string(record.displacement_texname, material.displacement_texname)
+            && copy_string(record.alpha_texname, material.alpha_texname);
+        if (!fits)
+        {
+            warn("Not caching mesh '" + dir + objfile + "': a material's name is too long");
+            return false;
+        }
+        std::memcpy(record.ambient,       material.ambient,       sizeof(record.ambient));
+        std::memcpy(record.diffuse,       material.diffuse,       sizeof(record.diffuse));
+        std::memcpy(record.specular,      material.specular,      sizeof(record.specular));
+        std::memcpy(record.transmittance, material.transmittance, sizeof(record.transmittance));
+        std::memcpy(record.emission,      material.emission,      sizeof(record.emission));
+        record.shininess = material.shininess;
+        record.ior = material.ior;
+        record.dissolve = material.dissolve;
+        record.illum = material.illum;
+    }
+
+    std::vector<BoundRecord> bounds(mesh.bounds.size());
+    for (std::size_t b = 0; b < mesh.bounds.size(); b += 1)
+    {
+        bounds[b].type = mesh.bounds[b].type;
+        for (int i = 0; i < 3; i += 1)
+        {
+            bounds[b].center[i] = mesh.bounds[b].center[i];
+            bounds[b].dims[i] = mesh.bounds[b].dims[i];
+        }
+    }
+
+    // The sources are recorded as they are now, after the mesh was loaded
+    // from them (and its bound file written, if it had none).
+    const std::vector<std::string> paths = source_paths(dir, objfile);
+    std::vector<SourceRecord> sources(paths.size());
+    for (std::size_t i = 0; i < paths.size(); i += 1)
+    {
+        if (!record_source(paths[i], sources[i]))
+        {
+            warn("Not caching mesh '" + dir + objfile + "': could not read '"
+                + paths[i] + "'");
+            return false;
+        }
+    }
+
+    const void* sections[NumSections] = {
+        shapes.data(),
+        floats[0].data(), floats[1].data(), floats[2].data(),
+        indices.data(), material_ids.data(), face_vertices.data(),
+        materials.data(), mesh.palette.data(), bounds.data(), sources.data(),
+    };
+    const std::size_t counts[NumSections] = {
+        shapes.size(),
+        floats[0].size(), floats[1].size(), floats[2].size(),
+        indices.size(), material_ids.size(), face_vertices.size(),
+        materials.size(), mesh.palette.size(), bounds.size(), sources.size(),
+    };
+    const std::size_t element_size[NumSections] = {
+        sizeof(ShapeRecord),
+        sizeof(float), sizeof(float), sizeof(float), sizeof(unsigned int),
+        sizeof(int), sizeof(unsigned char),
+        sizeof(MaterialRecord), sizeof(glm::vec3), sizeof(BoundRecord),
+        sizeof(SourceRecord),
+    };
+    uint64_t offset = align(sizeof(Header));
+    for (int i = 0; i < NumSections; i += 1)
+    {
+        header.offset[i] = offset;
+        header.count[i] = counts[i];
+        offset = align(offset + element_size[i] * counts[i]);
+    }
+
+    // Write to a temporary file, then rename it, so a partly written
+    // file is never loaded.
+    mkdir(directory.c_str(), 0755);
+    const std::string temp_path = file_path + ".tmp";
+    FILE* file = std::fopen(temp_path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        warn("Could not write mesh cache '" + temp_path + "'");
+        return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(Header), 1, file) == 1;
+    uint64_t written = sizeof(Header);
+    const char padding[16] = {};
+    for (int i = 0; ok && i < NumSections; i += 1)
+    {
+        const std::size_t bytes = element_size[i] * counts[i];
+        ok = std::fwrite(padding, 1, header.offset[i] - written, file)
+                == header.offset[i] - written
+            && std::fwrite(sections[i], 1, bytes, file) == bytes;
+        written = header.offset[i] + bytes;
+    }
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok || std::rename(temp_path.c_str(), file_path.c_str()) != 0)
+    {
+        warn("Could not write mesh cache '" + file_path + "'");
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+// The path of the cache file.
+const std::string& MeshCache::path() const
+{
+    return file_path;
+}
@@ -0,0 +1,53 @@
+// Authorship: James Kortman (a1648090)
+// MeshCache class
+// Saves meshes loaded from OBJ files to disk in a compiled form, and loads
+// them on later runs instead of parsing the OBJ and MTL files again.
+// As with LandscapeCache, a cache file holds a fixed header followed by
+// raw arrays (the shapes' vertex data and indices, already ordered for the
+// vertex cache, the materials, palette and bounds), so loading maps the
+// file into memory and copies the arrays out without any parsing.
+// The file also records the size, modification time and hash of each
+// source file (the OBJ, its MTL files, palette and bound). If a source's
+// size or time has changed, it is hashed again, and the cache is stale
+// only if its contents have changed too.
+
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "Mesh.hpp"
+
+class MeshCache
+{
+public:
+    // A cache, stored in 'directory', for the mesh Mesh::load_obj loads
+    // from objfile in dir.
+    MeshCache(
+        const std::string& directory,
+        const std::string& dir, const std::string& objfile);
+    MeshCache() = delete;
+
+    // Load the cached mesh.
+    // Returns nullptr if there is no cached mesh or it is stale.
+    Mesh* load() const;
+
+    // Save a mesh loaded from the cache's files.
+    // Returns false (with a warning) if the mesh couldn't be saved.
+    bool save(const Mesh& mesh) const;
+
+    // The path of the cache file.
+    const std::string& path() const;
+
+private:
+    // The hash of the file format version.
+    static uint64_t version_hash();
+
+    std::string directory;
+    std::string dir;
+    std::string objfile;
+    std::string file_path;
+};
+
+#endif // MESHCACHE_HPP
@@ -0,0 +1,175 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of MeshLoader class member functions.
+
+#include "MeshLoader.hpp"
+
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+
+#include "Console.hpp"
+#include "ThreadPool.hpp"
+
+MeshLoader::MeshLoader(
+    const std::vector<std::array<std::string, 3>>& meshes,
+    ResourceManager* resources)
+    : resources(resources),
+      total(meshes.size()),
+      uploaded(0),
+      load_ms(0.0f),
+      saved_ms(0.0f),
+      decode_ms(0.0f),
+      upload_ms(0.0f),
+      wait_ms(0.0f)
+{
+    console->register_var(
+        "mesh.load_ms",
+        Float,
+        &load_ms,
+        1,
+        "The time taken to read the meshes, summed over the workers, in ms",
+        false);
+    console->register_var(
+        "mesh.saved_ms",
+        Float,
+        &saved_ms,
+        1,
+        "The time saved reading the meshes from the mesh cache, in ms",
+        false);
+    console->register_var(
+        "mesh.decode_ms",
+        Float,
+        &decode_ms,
+        1,
+        "The time taken to decode the mesh textures, summed over the workers, in ms",
+        false);
+    console->register_var(
+        "mesh.upload_ms",
+        Float,
+        &upload_ms,
+        1,
+        "The time taken to upload the meshes and textures to the GPU, in ms",
+        false);
+    console->register_var(
+        "mesh.wait_ms",
+        Float,
+        &wait_ms,
+        1,
+        "The time start up waited for the meshes to be read, in ms",
+        false);
+
+    // All the meshes are expected before any is read, so nothing looks
+    // one up too early.
+    for (const auto& meshinfo: meshes) resources->expect_mesh(meshinfo[0]);
+    for (const auto& meshinfo: meshes)
+    {
+        const std::string name = meshinfo[0];
+        const std::string dir = "models/" + meshinfo[1] + "/";
+        const std::string file = meshinfo[2] + ".obj";
+        tasks.push_back(ThreadPool::shared().submit([this, name, dir, file]()
+        {
+            Loaded loaded;
+            loaded.mesh = nullptr;
+            loaded.decode_ms = 0.0f;
+            // A failure can't exit from a worker (exiting destroys the
+            // shared pool, which would join its own thread), so it is
+            // reported by finish() on the GL thread. Anything waiting for
+            // the mesh stops waiting, and fails to find it.
+            try
+            {
+                Mesh* mesh = Mesh::load_obj(dir, file);
+                if (mesh == nullptr)
+                {
+                    throw std::runtime_error("Could not load mesh '" + dir + file + "'");
+                }
+                this->resources->give_mesh(name, mesh);
+
+                // Decode each of the textures the shapes use (see
+                // Renderer::create_materials) once.
+                const auto start = std::chrono::steady_clock::now();
+                std::unordered_map<std::string, TextureImage> images;
+                for (const tinyobj::shape_t& shape: mesh->shapes)
+                {
+                    const int id = shape.mesh.material_ids[0];
+                    const std::string& texname = mesh->materials[id].diffuse_texname;
+                    if (images.count(texname) != 0) continue;
+                    images[texname] = Renderer::decode_texture(mesh->dir + texname);
+                }
+                loaded.mesh = mesh;
+                loaded.images = std::move(images);
+                loaded.decode_ms = std::chrono::duration<float, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+            }
+            catch (const std::exception& error)
+            {
+                this->resources->fail_mesh(name);
+                loaded.error = error.what();
+            }
+            catch (...)
+            {
+                this->resources->fail_mesh(name);
+                loaded.error = "Could not load mesh '" + dir + file + "'";
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.push_back(std::move(loaded));
+            mesh_ready.notify_all();
+        }));
+    }
+}
+
+MeshLoader::~MeshLoader()
+{
+    // The workers write into the loader.
+    for (std::future<void>& task: tasks)
+    {
+        if (task.valid()) task.wait();
+    }
+}
+
+// Upload the meshes which have been read.
+bool MeshLoader::update(Renderer& renderer)
+{
+    std::deque<Loaded> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        batch.swap(ready);
+    }
+    for (Loaded& loaded: batch) upload(renderer, loaded);
+    return uploaded == total;
+}
+
+// Upload every mesh, waiting for those not yet read.
+void MeshLoader::finish(Renderer& renderer)
+{
+    while (!update(renderer))
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> lock(mutex);
+        mesh_ready.wait(lock, [&]() { return !ready.empty(); });
+        wait_ms += std::chrono::duration<float, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+    }
+    if (!errors.empty()) fatal(errors.front());
+}
+
+// Upload a mesh read by a worker.
+void MeshLoader::upload(Renderer& renderer, Loaded& loaded)
+{
+    if (loaded.mesh == nullptr)
+    {
+        errors.push_back(loaded.error);
+        uploaded += 1;
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    renderer.create_materials(renderer.assign_vao(loaded.mesh), loaded.images);
+    loaded.images.clear();
+    upload_ms += std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+
+    load_ms += loaded.mesh->load_ms;
+    if (loaded.mesh->cached) saved_ms += loaded.mesh->parse_ms - loaded.mesh->load_ms;
+    decode_ms += loaded.decode_ms;
+    uploaded += 1;
+}
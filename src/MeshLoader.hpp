@@ -0,0 +1,89 @@
+// Authorship: James Kortman (a1648090)
+// MeshLoader class
+// Loads the meshes of the models, and their textures, without holding up
+// the rest of the start up. The CPU work for each mesh (reading its OBJ
+// and MTL files or the MeshCache, its palette and bounds, and decoding its
+// textures) runs on the shared ThreadPool, so the meshes load side by side
+// while shaders are compiled and the terrain is generated. Each mesh is
+// given to the ResourceManager as soon as it is read, so the terrain can
+// place it, and is then queued for the GL thread to upload.
+// The load times are available through the console as mesh.* variables.
+
+#ifndef MESHLOADER_HPP
+#define MESHLOADER_HPP
+
+#include <array>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Mesh.hpp"
+#include "Renderer.hpp"
+#include "ResourceManager.hpp"
+
+class MeshLoader
+{
+public:
+    // Start loading meshes, each given as a name, the directory of its
+    // model under models/, and its OBJ file name without the extension.
+    // The meshes are expected by 'resources' until they are given to it.
+    // The loader does not take ownership of 'resources', which must
+    // outlive it.
+    MeshLoader(
+        const std::vector<std::array<std::string, 3>>& meshes,
+        ResourceManager* resources);
+    MeshLoader() = delete;
+    MeshLoader(const MeshLoader&) = delete;
+    MeshLoader& operator=(const MeshLoader&) = delete;
+    ~MeshLoader();
+
+    // Upload the meshes which have been read. Call from the GL thread.
+    // Returns true once every mesh is uploaded, or has failed to load.
+    bool update(Renderer& renderer);
+
+    // Upload every mesh, waiting for those not yet read.
+    // Exits (through fatal) if a mesh could not be loaded.
+    void finish(Renderer& renderer);
+
+private:
+    // A mesh read by a worker, waiting to be uploaded, or the reason it
+    // could not be loaded (when 'mesh' is nullptr).
+    struct Loaded
+    {
+        Mesh* mesh;
+        std::string error;
+        // Its textures, by name.
+        std::unordered_map<std::string, TextureImage> images;
+        float decode_ms;
+    };
+
+    // Upload a mesh read by a worker.
+    void upload(Renderer& renderer, Loaded& loaded);
+
+    ResourceManager* resources;
+    std::vector<std::future<void>> tasks;
+
+    // The meshes read, and not yet uploaded.
+    std::deque<Loaded> ready;
+    std::mutex mutex;
+    std::condition_variable mesh_ready;
+
+    int total;
+    // The meshes uploaded, or which failed to load.
+    int uploaded;
+    // Why the meshes which could not be loaded failed.
+    std::vector<std::string> errors;
+
+    // Reported through the console.
+    float load_ms;
+    float saved_ms;
+    float decode_ms;
+    float upload_ms;
+    float wait_ms;
+};
+
+#endif // MESHLOADER_HPP
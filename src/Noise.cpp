@@ -0,0 +1,437 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of the batched noise functions.
+// The SIMD kernels follow stb_perlin_noise3 operation for operation (no
+// fused multiply-adds), so they agree with it to within float rounding.
+
+#include "Noise.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "core.hpp"
+
+#define STB_PERLIN_IMPLEMENTATION
+#include "stb_perlin.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+    #define NOISE_X86 1
+    #include <immintrin.h>
+#else
+    #define NOISE_X86 0
+#endif
+
+// -----------------
+// -- Noise tables --
+// -----------------
+// Copies of the stb_perlin tables in a form the SIMD kernels can load from:
+// the permutation table widened to ints (for gathers), and the gradient
+// vector selected by each hash value split into components.
+namespace {
+struct NoiseTables
+{
+    NoiseTables()
+    {
+        for (int i = 0; i < 512; i += 1)
+        {
+            perm[i] = stb__perlin_randtab[i];
+        }
+        for (int hash = 0; hash < 256; hash += 1)
+        {
+            grad_x[hash] = stb__perlin_grad(hash, 1.0f, 0.0f, 0.0f);
+            grad_y[hash] = stb__perlin_grad(hash, 0.0f, 1.0f, 0.0f);
+            grad_z[hash] = stb__perlin_grad(hash, 0.0f, 0.0f, 1.0f);
+        }
+    }
+    int   perm[512];
+    float grad_x[256];
+    float grad_y[256];
+    float grad_z[256];
+};
+
+const NoiseTables& tables()
+{
+    static const NoiseTables instance;
+    return instance;
+}
+
+enum class SimdLevel { Scalar, SSE2, AVX2 };
+}
+
+// ------------------
+// -- Scalar paths --
+// ------------------
+static void noise3_scalar(
+    const float* x, const float* y, const float* z, float* out, int n)
+{
+    for (int i = 0; i < n; i += 1)
+    {
+        out[i] = stb_perlin_noise3(x[i], y[i], z[i], 0, 0, 0);
+    }
+}
+
+static void fbm_noise3_scalar(
+    const float* x, const float* y, const float* z,
+    float lacunarity, float gain, int octaves, float* out, int n)
+{
+    for (int i = 0; i < n; i += 1)
+    {
+        out[i] = stb_perlin_fbm_noise3(
+            x[i], y[i], z[i], lacunarity, gain, octaves, 0, 0, 0);
+    }
+}
+
+#if NOISE_X86
+// ----------------------
+// -- SSE2 (4 lanes) --
+// ----------------------
+// Hashing is done per lane, as SSE2 has no gather instruction;
+// the interpolation arithmetic is vectorized.
+static inline __m128 ease_sse2(__m128 a)
+{
+    // (((a*6-15)*a + 10) * a * a * a)
+    __m128 t = _mm_mul_ps(a, _mm_set1_ps(6.0f));
+    t = _mm_sub_ps(t, _mm_set1_ps(15.0f));
+    t = _mm_mul_ps(t, a);
+    t = _mm_add_ps(t, _mm_set1_ps(10.0f));
+    t = _mm_mul_ps(t, a);
+    t = _mm_mul_ps(t, a);
+    return _mm_mul_ps(t, a);
+}
+
+static inline __m128 lerp_sse2(__m128 a, __m128 b, __m128 t)
+{
+    return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+}
+
+static inline __m128i floor_sse2(__m128 a)
+{
+    __m128i ai = _mm_cvttps_epi32(a);
+    __m128 below = _mm_cmplt_ps(a, _mm_cvtepi32_ps(ai));
+    // The comparison mask is -1 in lanes that truncated upwards.
+    return _mm_add_epi32(ai, _mm_castps_si128(below));
+}
+
+static inline __m128 noise3_sse2(__m128 x, __m128 y, __m128 z)
+{
+    const NoiseTables& t = tables();
+    const __m128i px = floor_sse2(x);
+    const __m128i py = floor_sse2(y);
+    const __m128i pz = floor_sse2(z);
+    x = _mm_sub_ps(x, _mm_cvtepi32_ps(px));
+    y = _mm_sub_ps(y, _mm_cvtepi32_ps(py));
+    z = _mm_sub_ps(z, _mm_cvtepi32_ps(pz));
+    const __m128 u = ease_sse2(x);
+    const __m128 v = ease_sse2(y);
+    const __m128 w = ease_sse2(z);
+
+    alignas(16) int ipx[4], ipy[4], ipz[4];
+    _mm_store_si128((__m128i*)ipx, px);
+    _mm_store_si128((__m128i*)ipy, py);
+    _mm_store_si128((__m128i*)ipz, pz);
+
+    // Gradient components for each of the 8 cube corners, per lane.
+    // Corner c has offsets (c>>2 & 1, c>>1 & 1, c & 1).
+    alignas(16) float gx[8][4], gy[8][4], gz[8][4];
+    for (int lane = 0; lane < 4; lane += 1)
+    {
+        const int x0 = ipx[lane] & 255, x1 = (ipx[lane] + 1) & 255;
+        const int y0 = ipy[lane] & 255, y1 = (ipy[lane] + 1) & 255;
+        const int z0 = ipz[lane] & 255, z1 = (ipz[lane] + 1) & 255;
+        const int r0 = t.perm[x0];
+        const int r1 = t.perm[x1];
+        const int r[4] = {
+            t.perm[r0 + y0], t.perm[r0 + y1],
+            t.perm[r1 + y0], t.perm[r1 + y1] };
+        for (int c = 0; c < 8; c += 1)
+        {
+            const int hash = t.perm[r[c >> 1] + ((c & 1) ? z1 : z0)];
+            gx[c][lane] = t.grad_x[hash];
+            gy[c][lane] = t.grad_y[hash];
+            gz[c][lane] = t.grad_z[hash];
+        }
+    }
+
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 xs[2] = { x, _mm_sub_ps(x, one) };
+    const __m128 ys[2] = { y, _mm_sub_ps(y, one) };
+    const __m128 zs[2] = { z, _mm_sub_ps(z, one) };
+    __m128 n[8];
+    for (int c = 0; c < 8; c += 1)
+    {
+        // grad[0]*x + grad[1]*y + grad[2]*z
+        n[c] = _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(_mm_load_ps(gx[c]), xs[(c >> 2) & 1]),
+                _mm_mul_ps(_mm_load_ps(gy[c]), ys[(c >> 1) & 1])),
+            _mm_mul_ps(_mm_load_ps(gz[c]), zs[c & 1]));
+    }
+
+    const __m128 n00 = lerp_sse2(n[0], n[1], w);
+    const __m128 n01 = lerp_sse2(n[2], n[3], w);
+    const __m128 n10 = lerp_sse2(n[4], n[5], w);
+    const __m128 n11 = lerp_sse2(n[6], n[7], w);
+    const __m128 n0 = lerp_sse2(n00, n01, v);
+    const __m128 n1 = lerp_sse2(n10, n11, v);
+    return lerp_sse2(n0, n1, u);
+}
+
+static void fbm_noise3_sse2(
+    const float* x, const float* y, const float* z,
+    float lacunarity, float gain, int octaves, float* out, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128 px = _mm_loadu_ps(x + i);
+        const __m128 py = _mm_loadu_ps(y + i);
+        const __m128 pz = _mm_loadu_ps(z + i);
+        __m128 sum = _mm_setzero_ps();
+        float frequency = 1.0f;
+        float amplitude = 1.0f;
+        for (int octave = 0; octave < octaves; octave += 1)
+        {
+            const __m128 f = _mm_set1_ps(frequency);
+            const __m128 value = noise3_sse2(
+                _mm_mul_ps(px, f), _mm_mul_ps(py, f), _mm_mul_ps(pz, f));
+            sum = _mm_add_ps(sum, _mm_mul_ps(value, _mm_set1_ps(amplitude)));
+            frequency *= lacunarity;
+            amplitude *= gain;
+        }
+        _mm_storeu_ps(out + i, sum);
+    }
+    fbm_noise3_scalar(
+        x + i, y + i, z + i, lacunarity, gain, octaves, out + i, n - i);
+}
+
+// ----------------------
+// -- AVX2 (8 lanes) --
+// ----------------------
+// Uses gathers for the permutation and gradient table lookups.
+#define NOISE_AVX2 __attribute__((target("avx2")))
+
+NOISE_AVX2 static inline __m256 ease_avx2(__m256 a)
+{
+    __m256 t = _mm256_mul_ps(a, _mm256_set1_ps(6.0f));
+    t = _mm256_sub_ps(t, _mm256_set1_ps(15.0f));
+    t = _mm256_mul_ps(t, a);
+    t = _mm256_add_ps(t, _mm256_set1_ps(10.0f));
+    t = _mm256_mul_ps(t, a);
+    t = _mm256_mul_ps(t, a);
+    return _mm256_mul_ps(t, a);
+}
+
+NOISE_AVX2 static inline __m256 lerp_avx2(__m256 a, __m256 b, __m256 t)
+{
+    return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+}
+
+NOISE_AVX2 static inline __m256i floor_avx2(__m256 a)
+{
+    __m256i ai = _mm256_cvttps_epi32(a);
+    __m256 below = _mm256_cmp_ps(a, _mm256_cvtepi32_ps(ai), _CMP_LT_OQ);
+    return _mm256_add_epi32(ai, _mm256_castps_si256(below));
+}
+
+NOISE_AVX2 static inline __m256 grad_avx2(
+    const NoiseTables& t, __m256i hash, __m256 x, __m256 y, __m256 z)
+{
+    const __m256 gx = _mm256_i32gather_ps(t.grad_x, hash, 4);
+    const __m256 gy = _mm256_i32gather_ps(t.grad_y, hash, 4);
+    const __m256 gz = _mm256_i32gather_ps(t.grad_z, hash, 4);
+    return _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(gx, x), _mm256_mul_ps(gy, y)),
+        _mm256_mul_ps(gz, z));
+}
+
+NOISE_AVX2 static inline __m256 noise3_avx2(__m256 x, __m256 y, __m256 z)
+{
+    const NoiseTables& t = tables();
+    const __m256i mask = _mm256_set1_epi32(255);
+    const __m256i ione = _mm256_set1_epi32(1);
+    const __m256i px = floor_avx2(x);
+    const __m256i py = floor_avx2(y);
+    const __m256i pz = floor_avx2(z);
+    const __m256i x0 = _mm256_and_si256(px, mask);
+    const __m256i x1 = _mm256_and_si256(_mm256_add_epi32(px, ione), mask);
+    const __m256i y0 = _mm256_and_si256(py, mask);
+    const __m256i y1 = _mm256_and_si256(_mm256_add_epi32(py, ione), mask);
+    const __m256i z0 = _mm256_and_si256(pz, mask);
+    const __m256i z1 = _mm256_and_si256(_mm256_add_epi32(pz, ione), mask);
+
+    x = _mm256_sub_ps(x, _mm256_cvtepi32_ps(px));
+    y = _mm256_sub_ps(y, _mm256_cvtepi32_ps(py));
+    z = _mm256_sub_ps(z, _mm256_cvtepi32_ps(pz));
+    const __m256 u = ease_avx2(x);
+    const __m256 v = ease_avx2(y);
+    const __m256 w = ease_avx2(z);
+
+    const __m256i r0 = _mm256_i32gather_epi32(t.perm, x0, 4);
+    const __m256i r1 = _mm256_i32gather_epi32(t.perm, x1, 4);
+    const __m256i r00 = _mm256_i32gather_epi32(t.perm, _mm256_add_epi32(r0, y0), 4);
+    const __m256i r01 = _mm256_i32gather_epi32(t.perm, _mm256_add_epi32(r0, y1), 4);
+    const __m256i r10 = _mm256_i32gather_epi32(t.perm, _mm256_add_epi32(r1, y0), 4);
+    const __m256i r11 = _mm256_i32gather_epi32(t.perm, _mm256_add_epi32(r1, y1), 4);
+
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 xm = _mm256_sub_ps(x, one);
+    const __m256 ym = _mm256_sub_ps(y, one);
+    const __m256 zm = _mm256_sub_ps(z, one);
+    #define NOISE_HASH(r, zi) \
+        _mm256_i32gather_epi32(t.perm, _mm256_add_epi32(r, zi), 4)
+    const __m256 n000 = grad_avx2(t, NOISE_HASH(r00, z0), x,  y,  z );
+    const __m256 n001 = grad_avx2(t, NOISE_HASH(r00, z1), x,  y,  zm);
+    const __m256 n010 = grad_avx2(t, NOISE_HASH(r01, z0), x,  ym, z );
+    const __m256 n011 = grad_avx2(t, NOISE_HASH(r01, z1), x,  ym, zm);
+    const __m256 n100 = grad_avx2(t, NOISE_HASH(r10, z0), xm, y,  z );
+    const __m256 n101 = grad_avx2(t, NOISE_HASH(r10, z1), xm, y,  zm);
+    const __m256 n110 = grad_avx2(t, NOISE_HASH(r11, z0), xm, ym, z );
+    const __m256 n111 = grad_avx2(t, NOISE_HASH(r11, z1), xm, ym, zm);
+    #undef NOISE_HASH
+
+    const __m256 n00 = lerp_avx2(n000, n001, w);
+    const __m256 n01 = lerp_avx2(n010, n011, w);
+    const __m256 n10 = lerp_avx2(n100, n101, w);
+    const __m256 n11 = lerp_avx2(n110, n111, w);
+    const __m256 n0 = lerp_avx2(n00, n01, v);
+    const __m256 n1 = lerp_avx2(n10, n11, v);
+    return lerp_avx2(n0, n1, u);
+}
+
+NOISE_AVX2 static void fbm_noise3_avx2(
+    const float* x, const float* y, const float* z,
+    float lacunarity, float gain, int octaves, float* out, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 px = _mm256_loadu_ps(x + i);
+        const __m256 py = _mm256_loadu_ps(y + i);
+        const __m256 pz = _mm256_loadu_ps(z + i);
+        __m256 sum = _mm256_setzero_ps();
+        float frequency = 1.0f;
+        float amplitude = 1.0f;
+        for (int octave = 0; octave < octaves; octave += 1)
+        {
+            const __m256 f = _mm256_set1_ps(frequency);
+            const __m256 value = noise3_avx2(
+                _mm256_mul_ps(px, f), _mm256_mul_ps(py, f), _mm256_mul_ps(pz, f));
+            sum = _mm256_add_ps(
+                sum, _mm256_mul_ps(value, _mm256_set1_ps(amplitude)));
+            frequency *= lacunarity;
+            amplitude *= gain;
+        }
+        _mm256_storeu_ps(out + i, sum);
+    }
+    fbm_noise3_sse2(
+        x + i, y + i, z + i, lacunarity, gain, octaves, out + i, n - i);
+}
+#endif // NOISE_X86
+
+// -----------------------------
+// -- Instruction set selection --
+// -----------------------------
+static void fbm_noise3_with(
+    SimdLevel level,
+    const float* x, const float* y, const float* z,
+    float lacunarity, float gain, int octaves, float* out, int n)
+{
+    switch (level)
+    {
+    #if NOISE_X86
+    case SimdLevel::AVX2:
+        fbm_noise3_avx2(x, y, z, lacunarity, gain, octaves, out, n);
+        break;
+    case SimdLevel::SSE2:
+        fbm_noise3_sse2(x, y, z, lacunarity, gain, octaves, out, n);
+        break;
+    #endif
+    default:
+        fbm_noise3_scalar(x, y, z, lacunarity, gain, octaves, out, n);
+    }
+}
+
+// Check a SIMD path against stb_perlin over a spread of points, including
+// negative and integer coordinates.
+static bool validate(SimdLevel level)
+{
+    const int n = 256;
+    std::vector<float> x(n), y(n), z(n), simd(n), reference(n);
+    unsigned int state = 12345;
+    auto next = [&]()
+    {
+        state = state * 1664525u + 1013904223u;
+        return float(state >> 8) / float(1 << 24);
+    };
+    for (int i = 0; i < n; i += 1)
+    {
+        x[i] = (i % 16 == 0) ? float(i / 16 - 8) : 600.0f * next() - 300.0f;
+        y[i] = 600.0f * next() - 300.0f;
+        z[i] = 4.0f * next() - 2.0f;
+    }
+    const float tolerance = 1e-5f;
+    for (int octaves = 1; octaves <= 6; octaves += 5)
+    {
+        fbm_noise3_with(level, x.data(), y.data(), z.data(),
+                        2.0f, 0.5f, octaves, simd.data(), n);
+        fbm_noise3_scalar(x.data(), y.data(), z.data(),
+                          2.0f, 0.5f, octaves, reference.data(), n);
+        for (int i = 0; i < n; i += 1)
+        {
+            if (!(std::abs(simd[i] - reference[i]) <= tolerance)) return false;
+        }
+    }
+    return true;
+}
+
+static SimdLevel select_simd_level()
+{
+    SimdLevel level = SimdLevel::Scalar;
+    #if NOISE_X86
+        __builtin_cpu_init();
+        if      (__builtin_cpu_supports("avx2")) level = SimdLevel::AVX2;
+        else if (__builtin_cpu_supports("sse2")) level = SimdLevel::SSE2;
+    #endif
+    while (level != SimdLevel::Scalar && !validate(level))
+    {
+        warn("Batched noise does not match stb_perlin, "
+             "falling back to a narrower instruction set");
+        level = (level == SimdLevel::AVX2) ? SimdLevel::SSE2 : SimdLevel::Scalar;
+    }
+    return level;
+}
+
+static SimdLevel simd_level()
+{
+    static const SimdLevel level = select_simd_level();
+    return level;
+}
+
+// --------------------
+// -- Public functions --
+// --------------------
+void noise3_batch(
+    const float* x, const float* y, const float* z, float* out, int n)
+{
+    // A single octave of fBm is exactly the base noise.
+    fbm_noise3_with(simd_level(), x, y, z, 2.0f, 0.5f, 1, out, n);
+}
+
+void fbm_noise3_batch(
+    const float* x, const float* y, const float* z,
+    float lacunarity, float gain, int octaves,
+    float* out, int n)
+{
+    fbm_noise3_with(simd_level(), x, y, z, lacunarity, gain, octaves, out, n);
+}
+
+const char* noise_simd_name()
+{
+    switch (simd_level())
+    {
+    case SimdLevel::AVX2: return "avx2";
+    case SimdLevel::SSE2: return "sse2";
+    default:              return "scalar";
+    }
+}
@@ -0,0 +1,30 @@
+// Authorship: James Kortman (a1648090)
+// Batched noise functions
+// Evaluate stb_perlin noise for many points at once, using SSE2 or AVX2
+// instructions when the CPU supports them (selected at runtime), and the
+// scalar stb_perlin functions otherwise.
+// Only the non-wrapping form of the noise (wrap arguments of 0) is provided.
+
+#ifndef NOISE_HPP
+#define NOISE_HPP
+
+#include "stb_perlin.h"
+
+// Set out[i] = stb_perlin_noise3(x[i], y[i], z[i], 0, 0, 0)
+// for i in [0, n).
+void noise3_batch(
+    const float* x, const float* y, const float* z, float* out, int n);
+
+// Set out[i] = stb_perlin_fbm_noise3(
+//     x[i], y[i], z[i], lacunarity, gain, octaves, 0, 0, 0)
+// for i in [0, n).
+void fbm_noise3_batch(
+    const float* x, const float* y, const float* z,
+    float lacunarity, float gain, int octaves,
+    float* out, int n);
+
+// The name of the instruction set used by the batched functions:
+// "avx2", "sse2" or "scalar".
+const char* noise_simd_name();
+
+#endif // NOISE_HPP
@@ -0,0 +1,94 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of the blue noise placement functions.
+
+#include "Placement.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "BitGrid.hpp"
+#include "Filters.hpp"
+
+// The choices used by the candidate points.
+enum { ChoiceU = 0, ChoiceV = 1, ChoicePriority = 2 };
+
+float placement_randf(int seed, int row, int col, int k)
+{
+    uint32_t h = uint32_t(seed) * 0x9E3779B1u;
+    h = (h ^ (uint32_t(row) * 0x85EBCA77u)) * 0xC2B2AE3Du;
+    h = (h ^ (h >> 15) ^ (uint32_t(col) * 0x27D4EB2Fu)) * 0x165667B1u;
+    h = (h ^ (h >> 13) ^ uint32_t(k)) * 0x85EBCA77u;
+    h ^= h >> 16;
+    return float(h >> 8) / float(1 << 24);
+}
+
+// Find the kept points in global cells [row_begin, row_end) and
+// [col_begin, col_end).
+std::vector<PlacementPoint> blue_noise_points(
+    int seed, int radius,
+    int row_begin, int row_end, int col_begin, int col_end)
+{
+    std::vector<PlacementPoint> points;
+    if (row_begin >= row_end || col_begin >= col_end) return points;
+
+    // The priorities of a square of cells covering the region and the
+    // 'radius' cells around it, which decide whether the region's
+    // candidates are kept.
+    const int size = std::max(row_end - row_begin, col_end - col_begin) + 2 * radius;
+    const int first_row = row_begin - radius;
+    const int first_col = col_begin - radius;
+    std::vector<float> priorities(std::size_t(size) * size);
+    for (int row = 0; row < size; row += 1)
+    {
+        for (int col = 0; col < size; col += 1)
+        {
+            priorities[std::size_t(row) * size + col] = placement_randf(
+                seed, first_row + row, first_col + col, ChoicePriority);
+        }
+    }
+    std::vector<float> maxima(priorities.size());
+    max_filter(priorities.data(), maxima.data(), size, radius);
+
+    // A candidate is kept if it is the first candidate in its window
+    // (in global row major order) with the window's highest priority.
+    BitGrid kept(row_end - row_begin, col_end - col_begin);
+    for (int row = radius; row < radius + row_end - row_begin; row += 1)
+    {
+        for (int col = radius; col < radius + col_end - col_begin; col += 1)
+        {
+            const float priority = priorities[std::size_t(row) * size + col];
+            if (priority != maxima[std::size_t(row) * size + col]) continue;
+            // Ties are rare, so checking the earlier candidates in the
+            // window for them costs little.
+            bool first = true;
+            for (int x = row - radius; first && x <= row; x += 1)
+            {
+                const int last = (x == row) ? col - 1 : col + radius;
+                for (int y = col - radius; y <= last; y += 1)
+                {
+                    if (priorities[std::size_t(x) * size + y] == priority)
+                    {
+                        first = false;
+                        break;
+                    }
+                }
+            }
+            if (first) kept.set(row - radius, col - radius);
+        }
+    }
+
+    for (int row = row_begin; row < row_end; row += 1)
+    {
+        for (int col = col_begin; col < col_end; col += 1)
+        {
+            if (!kept.get(row - row_begin, col - col_begin)) continue;
+            PlacementPoint point;
+            point.row = row;
+            point.col = col;
+            point.u = placement_randf(seed, row, col, ChoiceU);
+            point.v = placement_randf(seed, row, col, ChoiceV);
+            points.push_back(point);
+        }
+    }
+    return points;
+}
@@ -0,0 +1,39 @@
+// Authorship: James Kortman (a1648090)
+// Blue noise placement
+// Chooses well spread, deterministic positions for objects on the terrain.
+// Space is divided into a global grid of cells, and each cell has one
+// candidate point, jittered within the cell, with a random priority.
+// A candidate is kept if its priority is the highest within 'radius' cells
+// (Matern type II thinning), so kept points are at least about 'radius'
+// cells apart. Every value is hashed from the seed and the global cell, so
+// any part of the grid can be found separately, in any order or on any
+// thread, and always gives the same points.
+
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <vector>
+
+// A kept candidate point.
+struct PlacementPoint
+{
+    // The global cell containing the point.
+    int row;
+    int col;
+    // The position of the point within its cell, in [0, 1).
+    float u;
+    float v;
+};
+
+// A hashed random float in [0, 1), which depends only on the seed, the
+// global cell, and which choice 'k' it is for.
+// Choices 0 to 2 are used for the candidate points themselves.
+float placement_randf(int seed, int row, int col, int k);
+
+// Find the kept points in global cells [row_begin, row_end) and
+// [col_begin, col_end), in row major order of their cells.
+std::vector<PlacementPoint> blue_noise_points(
+    int seed, int radius,
+    int row_begin, int row_end, int col_begin, int col_end);
+
+#endif // PLACEMENT_HPP
@@ -3,9 +3,13 @@
 
 #include "Renderer.hpp"
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstddef>
 #include <cstdio>
 #include <iostream>
+#include <limits>
 #include <unordered_map>
 #include <vector>
 
@@ -61,6 +65,36 @@ void Renderer::initialize(bool wf, unsigned int aa_samples)
 {
     wireframe = wf;
     console->register_var("wf", Bool, &wireframe, 1, "the rendering mode (fill or wireframe)");
+    lod_enabled = true;
+    console->register_var("lod", Bool, &lod_enabled, 1, "Toggles landscape level of detail");
+    check_waves = false;
+    wave_error = 0.0f;
+    console->register_var(
+        "water.check_waves",
+        Bool,
+        &check_waves,
+        1,
+        "Set to compare the waves baked on the GPU with the CPU mirror, once");
+    console->register_var(
+        "water.wave_error",
+        Float,
+        &wave_error,
+        1,
+        "The largest difference between the GPU and CPU waves, at the last check",
+        false);
+    const std::array<std::string, 5> pass_names =
+        {{ "scene", "shadow", "depth", "reflect", "ssao" }};
+    for (int i = 0; i < 5; i += 1)
+    {
+        landscape_triangles[i] = 0;
+        console->register_var(
+            "tris." + pass_names[i],
+            Int,
+            &landscape_triangles[i],
+            1,
+            "Landscape triangles drawn in the " + pass_names[i] + " pass",
+            false);
+    }
 
     glfwSetErrorCallback(error_callback);
     fatal_if(!glfwInit(), "Failed to initialise GLFW");
@@ -392,6 +426,27 @@ void Renderer::initialize(bool wf, unsigned int aa_samples)
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     get_error(__LINE__);
 
+    // -----------------------------------------
+    // -- FBO initialization for wave buffers --
+    // -----------------------------------------
+    // The textures are sized when the waves are first baked.
+    glGenFramebuffers(1, &wave_height_buffer);
+    glGenTextures(1, &wave_height_texture);
+    glGenFramebuffers(1, &wave_buffer);
+    glGenTextures(1, &wave_texture);
+    for (GLuint texture: { wave_height_texture, wave_texture })
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    wave_texture_resolution = 0;
+    baked_wave_generation = 0;
+    get_error(__LINE__);
+
     // --------------------------
     // -- Postprocessing setup --
     // --------------------------
@@ -492,59 +547,171 @@ void assign_generic_vao(
     get_error(__LINE__);
 }
 
+// The arrays of a landscape, in the order they are uploaded.
+struct LandscapeArray
+{
+    GLenum target;
+    // The index of the buffer in Landscape::buffers, and where the array
+    // starts within it.
+    int buffer;
+    std::size_t offset;
+    const void* data;
+    std::size_t bytes;
+};
+// Where the 32 bit level of detail indices start in the index buffer,
+// after the 16 bit ones.
+static std::size_t wide_indices_offset(const Landscape& landscape)
+{
+    return (sizeof(uint16_t) * landscape.lod_index_view().size + 3) & ~std::size_t(3);
+}
+static std::vector<LandscapeArray> landscape_arrays(const Landscape& landscape)
+{
+    std::vector<LandscapeArray> arrays = {{
+        { GL_ARRAY_BUFFER, 0, 0, landscape.packed_vertices.data(),
+          sizeof(Landscape::PackedVertex) * landscape.packed_vertices.size() },
+    }};
+    // With level of detail, the chunks of every quadtree node are used.
+    // The indices may be in a mapped cache file (see Landscape::map_indices).
+    if (landscape.lod_nodes.empty())
+    {
+        const Landscape::ArrayView<unsigned int> indices = landscape.index_view();
+        arrays.push_back({ GL_ELEMENT_ARRAY_BUFFER, 1, 0,
+            indices.data, sizeof(unsigned int) * indices.size });
+    }
+    else
+    {
+        const Landscape::ArrayView<uint16_t> lod_indices = landscape.lod_index_view();
+        const Landscape::ArrayView<unsigned int> lod_wide_indices =
+            landscape.lod_wide_index_view();
+        arrays.push_back({ GL_ELEMENT_ARRAY_BUFFER, 1, 0,
+            lod_indices.data, sizeof(uint16_t) * lod_indices.size });
+        arrays.push_back({ GL_ELEMENT_ARRAY_BUFFER, 1,
+            wide_indices_offset(landscape),
+            lod_wide_indices.data, sizeof(unsigned int) * lod_wide_indices.size });
+    }
+    return arrays;
+}
+
 // Generate and assign a VAO to a landscape object.
 Landscape* Renderer::assign_vao(Landscape* landscape)
+{
+    allocate_vao(landscape);
+    std::size_t uploaded = 0;
+    upload_vao_slice(landscape, uploaded, upload_size(landscape));
+    return landscape;
+}
+
+// Generate a VAO for a landscape object, with its buffers allocated
+// but not yet filled.
+Landscape* Renderer::allocate_vao(Landscape* landscape)
 {
     glGenVertexArrays(1, &landscape->vao);
 
     glBindVertexArray(landscape->vao);
 
-    // Create buffers for positions, normals, texcoords, indices
-    unsigned int buffer[4];
-    glGenBuffers(4, buffer);
+    // Create buffers for the packed vertices and the indices.
+    if (landscape->packed_vertices.empty()) landscape->pack_vertices();
+    unsigned int* buffer = landscape->buffers;
+    glGenBuffers(2, buffer);
+    const std::vector<LandscapeArray> arrays = landscape_arrays(*landscape);
+    for (int i = 0; i < 2; i += 1)
+    {
+        std::size_t bytes = 0;
+        GLenum target = GL_ARRAY_BUFFER;
+        for (const LandscapeArray& array: arrays)
+        {
+            if (array.buffer != i) continue;
+            bytes = std::max(bytes, array.offset + array.bytes);
+            target = array.target;
+        }
+        glBindBuffer(target, buffer[i]);
+        glBufferData(target, bytes, nullptr, GL_STATIC_DRAW);
+    }
 
-    // Set vertex position attribute
+    // The packed vertex fields are read into the attributes that the
+    // landscape shaders unpack them from (see shaderlib.glsl):
+    //   0: the height and morph height, normalised to [0, 1].
+    //   1: the octahedral normal, normalised to [-1, 1].
+    //   2: the palette index and morph level.
     glBindBuffer(GL_ARRAY_BUFFER, buffer[0]);
-    glBufferData(
-        GL_ARRAY_BUFFER,
-        sizeof(float) * 3 * landscape->positions.size(),
-        landscape->positions.data(),
-        GL_STATIC_DRAW);
+    const GLsizei stride = sizeof(Landscape::PackedVertex);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, VALS_PER_VERT, GL_FLOAT, GL_FALSE, 0, 0);
-
-    // Set normal attribute
-    glBindBuffer(GL_ARRAY_BUFFER, buffer[1]);
-    glBufferData(
-        GL_ARRAY_BUFFER,
-        sizeof(float) * 3 * landscape->normals.size(),
-        landscape->normals.data(),
-        GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+        (void*)offsetof(Landscape::PackedVertex, height));
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, VALS_PER_NORMAL, GL_FLOAT, GL_FALSE, 0, 0);
-
-    // Set colour attribute
-    glBindBuffer(GL_ARRAY_BUFFER, buffer[2]);
-    glBufferData(
-        GL_ARRAY_BUFFER,
-        sizeof(float) * 3 * landscape->colours.size(),
-        landscape->colours.data(),
-        GL_STATIC_DRAW);
+    glVertexAttribPointer(1, 2, GL_BYTE, GL_TRUE, stride,
+        (void*)offsetof(Landscape::PackedVertex, normal));
     glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, VALS_PER_COLOUR, GL_FLOAT, GL_FALSE, 0, 0);\
-
-    // Set vertex indices attrib
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer[3]);
-    glBufferData(
-        GL_ELEMENT_ARRAY_BUFFER,
-        sizeof(float) * landscape->indices.size(),
-        landscape->indices.data(),
-        GL_STATIC_DRAW);
+    glVertexAttribPointer(2, 2, GL_UNSIGNED_BYTE, GL_FALSE, stride,
+        (void*)offsetof(Landscape::PackedVertex, colour));
 
     get_error(__LINE__);
     return landscape;
 }
 
+// Upload up to max_bytes more of a landscape's data to its buffers.
+bool Renderer::upload_vao_slice(
+    Landscape* landscape, std::size_t& uploaded, std::size_t max_bytes)
+{
+    glBindVertexArray(landscape->vao);
+
+    // The arrays are treated as one run of bytes, with 'start' the offset
+    // of the current array within it.
+    std::size_t start = 0;
+    for (const LandscapeArray& array: landscape_arrays(*landscape))
+    {
+        const std::size_t end = start + array.bytes;
+        if (uploaded < end && max_bytes > 0)
+        {
+            const std::size_t offset = uploaded - start;
+            const std::size_t bytes = std::min(max_bytes, array.bytes - offset);
+            glBindBuffer(array.target, landscape->buffers[array.buffer]);
+            glBufferSubData(
+                array.target,
+                array.offset + offset,
+                bytes,
+                static_cast<const char*>(array.data) + offset);
+            uploaded += bytes;
+            max_bytes -= bytes;
+        }
+        start = end;
+    }
+
+    get_error(__LINE__);
+    return uploaded == start;
+}
+
+// The number of bytes uploaded for a landscape object.
+std::size_t Renderer::upload_size(const Landscape* landscape)
+{
+    std::size_t bytes = 0;
+    for (const LandscapeArray& array: landscape_arrays(*landscape))
+    {
+        bytes += array.bytes;
+    }
+    return bytes;
+}
+
+// Re-upload some of the packed vertices of a landscape.
+void Renderer::update_vertices(Landscape* landscape, std::size_t first, std::size_t count)
+{
+    if (count == 0) return;
+    const std::size_t stride = sizeof(Landscape::PackedVertex);
+    glBindBuffer(GL_ARRAY_BUFFER, landscape->buffers[0]);
+    glBufferSubData(
+        GL_ARRAY_BUFFER, first * stride, count * stride,
+        &landscape->packed_vertices[first]);
+    get_error(__LINE__);
+}
+
+// Release the VAO and buffers assigned to a landscape object.
+void Renderer::release_vao(Landscape* landscape)
+{
+    glDeleteBuffers(2, landscape->buffers);
+    glDeleteVertexArrays(1, &landscape->vao);
+    get_error(__LINE__);
+}
+
 Water* Renderer::assign_vao(Water* water)
 {
     glGenVertexArrays(1, &water->vao);
@@ -552,7 +719,7 @@ Water* Renderer::assign_vao(Water* water)
     glBindVertexArray(water->vao);
 
     // Create buffers for positions, normals, texcoords, indices
-    unsigned int buffer[4];
+    unsigned int* buffer = water->buffers;
     glGenBuffers(4, buffer);
 
     // Set vertex position attribute
@@ -561,7 +728,7 @@ Water* Renderer::assign_vao(Water* water)
         GL_ARRAY_BUFFER,
         sizeof(float) * 3 * water->positions.size(),
         &water->positions[0].x,
-        GL_STATIC_DRAW);
+        GL_DYNAMIC_DRAW);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, VALS_PER_VERT, GL_FLOAT, GL_FALSE, 0, 0);
 
@@ -591,12 +758,41 @@ Water* Renderer::assign_vao(Water* water)
         GL_ELEMENT_ARRAY_BUFFER,
         sizeof(float) * 3 * water->indices.size(),
         water->indices.data(),
-        GL_STATIC_DRAW);
+        GL_DYNAMIC_DRAW);
 
     get_error(__LINE__);
     return water;
 }
 
+void Renderer::update_vao(Water* water)
+{
+    // There are always as many positions, but the number of indices
+    // changes as quads are hidden by the landscape or not.
+    glBindBuffer(GL_ARRAY_BUFFER, water->buffers[0]);
+    glBufferSubData(
+        GL_ARRAY_BUFFER,
+        0, sizeof(float) * 3 * water->positions.size(),
+        &water->positions[0].x);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glBindVertexArray(water->vao);
+    glBufferData(
+        GL_ELEMENT_ARRAY_BUFFER,
+        sizeof(unsigned int) * 3 * water->indices.size(),
+        water->indices.data(),
+        GL_DYNAMIC_DRAW);
+    glBindVertexArray(0);
+    get_error(__LINE__);
+}
+
+// Release the VAO and buffers assigned to a water object.
+void Renderer::release_vao(Water* water)
+{
+    glDeleteBuffers(4, water->buffers);
+    glDeleteVertexArrays(1, &water->vao);
+    get_error(__LINE__);
+}
+
 Skybox* Renderer::assign_vao(Skybox* skybox)
 {
     glGenVertexArrays(1, &skybox->vao);
@@ -662,10 +858,17 @@ Mesh* Renderer::assign_vao(Mesh* mesh)
 // Forward declare helper functions for material loading.
 enum ImageFormat {JPEG, PNG, UNKNOWN};
 static ImageFormat get_image_type(const std::string& path);
-static void load_texture(const std::string& path);
+static void upload_texture(const TextureImage& image);
 
 // Read and load mesh textures onto the GPU.
 Mesh* Renderer::create_materials(Mesh* mesh)
+{
+    return create_materials(mesh, std::unordered_map<std::string, TextureImage>());
+}
+
+// Load mesh textures onto the GPU from images already decoded.
+Mesh* Renderer::create_materials(
+    Mesh* mesh, const std::unordered_map<std::string, TextureImage>& images)
 {
     // Maps filenames of already loaded textures to texture IDs.
     std::unordered_map<std::string, unsigned int> loaded_textures;
@@ -708,9 +911,12 @@ Mesh* Renderer::create_materials(Mesh* mesh)
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            load_texture(mesh->dir + texname);
+            const auto image = images.find(texname);
+            upload_texture(image != images.end()
+                ? image->second : decode_texture(mesh->dir + texname));
             glGenerateMipmap(GL_TEXTURE_2D);
             glBindTexture(GL_TEXTURE_2D, 0);
+            loaded_textures[texname] = texID;
         } else {
             texID = loaded_textures[texname];
         }
@@ -812,6 +1018,9 @@ void Renderer::init_shader(
         glUniform1i(
             glGetUniformLocation(shader->program_id, "SSAOMap"),
             4);
+        glUniform1i(
+            glGetUniformLocation(shader->program_id, "WaveMap"),
+            6);
     }
 
     get_error(__LINE__);
@@ -951,9 +1160,15 @@ void Renderer::draw_scene(const Scene& scene, RenderMode render_mode)
 
     get_error(__LINE__);
 
-    // Render the landscape.
-    Landscape* landscape = scene.landscape.get();
-    if (landscape != nullptr)
+    // Render the landscape, or the terrain tiles.
+    std::vector<const Landscape*> landscapes;
+    if (scene.landscape != nullptr) landscapes.push_back(scene.landscape.get());
+    if (scene.chunks != nullptr)
+    {
+        const std::vector<Landscape*>& tiles = scene.chunks->landscapes();
+        landscapes.insert(landscapes.end(), tiles.begin(), tiles.end());
+    }
+    if (!landscapes.empty())
     {
         if (render_mode == RenderMode::Scene)
         {
@@ -965,7 +1180,16 @@ void Renderer::draw_scene(const Scene& scene, RenderMode render_mode)
         glUniform1f(
             glGetUniformLocation(current_program, "Time"),
             scene.time_elapsed);
-
+    }
+    // Shadow and reflection detail isn't seen up close, so those passes
+    // use coarser levels of detail.
+    const float lod_bias =
+        (render_mode == RenderMode::Shadow || render_mode == RenderMode::Reflect)
+        ? 0.25f : 1.0f;
+    int& triangles = landscape_triangles[int(render_mode)];
+    triangles = 0;
+    for (const Landscape* landscape: landscapes)
+    {
         // Load model and normal matrices.
         glUniformMatrix4fv(
             glGetUniformLocation(current_program, "ModelMatrix"),
@@ -987,14 +1211,106 @@ void Renderer::draw_scene(const Scene& scene, RenderMode render_mode)
             glGetUniformLocation(current_program, "MtlShininess"),
             landscape->material.shininess);
 
+        // The grid, height range and palette the packed vertices are
+        // unpacked with.
+        glUniform1i(
+            glGetUniformLocation(current_program, "LandscapePacked"),
+            true);
+        glUniform1i(
+            glGetUniformLocation(current_program, "LandscapeSize"),
+            int(landscape->size));
+        glUniform2fv(
+            glGetUniformLocation(current_program, "LandscapeOrigin"),
+            1, glm::value_ptr(landscape->origin));
+        glUniform1f(
+            glGetUniformLocation(current_program, "LandscapeSpacing"),
+            landscape->edge / (landscape->size - 1.0f));
+        glUniform2f(
+            glGetUniformLocation(current_program, "LandscapeHeight"),
+            landscape->height_min, landscape->height_extent);
+        if (!landscape->palette.empty())
+        {
+            glUniform3fv(
+                glGetUniformLocation(current_program, "Palette"),
+                std::min(int(landscape->palette.size()), 16),
+                glm::value_ptr(landscape->palette[0]));
+        }
+
         glBindVertexArray(landscape->vao);
-        glDrawElements(
-            GL_TRIANGLES,
-            landscape->indices.size(),
-            GL_UNSIGNED_INT,
-            0);
+        if (landscape->lod_nodes.empty())
+        {
+            glDrawElements(
+                GL_TRIANGLES,
+                landscape->index_view().size,
+                GL_UNSIGNED_INT,
+                0);
+            triangles += landscape->index_view().size / 3;
+        }
+        else
+        {
+            // With level of detail disabled, every node is split down to
+            // full detail, and nothing morphs.
+            std::vector<int> selected;
+            landscape->select_lod(
+                scene.camera.position,
+                lod_enabled ? lod_bias : std::numeric_limits<float>::infinity(),
+                selected);
+            glUniform1i(
+                glGetUniformLocation(current_program, "LodMorph"),
+                lod_enabled);
+            glUniform3fv(
+                glGetUniformLocation(current_program, "LodEye"),
+                1, glm::value_ptr(scene.camera.position));
+            for (int index: selected)
+            {
+                const Landscape::LodNode& node = landscape->lod_nodes[index];
+                const float range = landscape->lod_range(node.level, lod_bias);
+                glUniform1f(
+                    glGetUniformLocation(current_program, "LodLevel"),
+                    float(node.level));
+                glUniform2f(
+                    glGetUniformLocation(current_program, "LodRange"),
+                    0.75f * range, range);
+                for (unsigned int i = 0; i < node.num_chunks; i += 1)
+                {
+                    const Landscape::LodChunk& chunk =
+                        landscape->lod_chunks[node.first_chunk + i];
+                    if (chunk.wide)
+                    {
+                        glDrawElementsBaseVertex(
+                            GL_TRIANGLES,
+                            chunk.count,
+                            GL_UNSIGNED_INT,
+                            (void*)(wide_indices_offset(*landscape)
+                                    + sizeof(unsigned int) * chunk.first),
+                            chunk.base_vertex);
+                    }
+                    else
+                    {
+                        glDrawElementsBaseVertex(
+                            GL_TRIANGLES,
+                            chunk.count,
+                            GL_UNSIGNED_SHORT,
+                            (void*)(sizeof(uint16_t) * chunk.first),
+                            chunk.base_vertex);
+                    }
+                    triangles += chunk.count / 3;
+                }
+            }
+            // The shadow, depth and SSAO shaders also draw other objects.
+            glUniform1i(
+                glGetUniformLocation(current_program, "LodMorph"),
+                false);
+        }
         glBindVertexArray(0);
     }
+    // The shadow, depth, SSAO and reflection shaders also draw other objects.
+    if (!landscapes.empty())
+    {
+        glUniform1i(
+            glGetUniformLocation(current_program, "LandscapePacked"),
+            false);
+    }
 
     get_error(__LINE__);
 
@@ -1036,10 +1352,10 @@ void Renderer::draw_scene(const Scene& scene, RenderMode render_mode)
         glUniform1f(
             glGetUniformLocation(current_program, "Time"),
             scene.time_elapsed);
-        // Load the distance between vertices into the shader.
+        // Load the period the baked waves repeat over into the shader.
         glUniform1f(
-            glGetUniformLocation(current_program, "VertDist"),
-            water->vert_dist());
+            glGetUniformLocation(current_program, "WavePeriod"),
+            WaveField::period);
 
         glBindVertexArray(water->vao);
         glDrawElements(
@@ -1087,8 +1403,14 @@ void Renderer::draw_scene(const Scene& scene, RenderMode render_mode)
 
     get_error(__LINE__);
 
-    // Load and draw each object in the scene.
-    for (const auto& object : scene.objects)
+    // Load and draw each object in the scene, and on the terrain tiles.
+    std::vector<Object*> objects = scene.objects;
+    if (scene.chunks != nullptr)
+    {
+        const std::vector<Object*>& tile_objects = scene.chunks->objects();
+        objects.insert(objects.end(), tile_objects.begin(), tile_objects.end());
+    }
+    for (const auto& object : objects)
     {
         const RenderUnit& render_unit = object->render_unit;
         if (render_mode == RenderMode::Scene)
@@ -1119,6 +1441,11 @@ void Renderer::render(const Scene& scene)
     if (wireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     else           glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
+    // -----------------------------
+    // -- Pass 0: Bake the waves. --
+    // -----------------------------
+    bake_waves(scene);
+
     // -----------------------------------
     // -- Pass 1: Render shadow buffer. --
     // -----------------------------------
@@ -1201,6 +1528,8 @@ void Renderer::render(const Scene& scene)
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glViewport(0, 0, scene_texture_size[0], scene_texture_size[1]);
 
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, wave_texture);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, depth_texture);
     glActiveTexture(GL_TEXTURE1);
@@ -1317,6 +1646,140 @@ void Renderer::render(const Scene& scene)
     #endif
 }
 
+void Renderer::allocate_wave_textures(int resolution)
+{
+    // The heights, which the normals are found from.
+    glBindFramebuffer(GL_FRAMEBUFFER, wave_height_buffer);
+    glBindTexture(GL_TEXTURE_2D, wave_height_texture);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0, GL_R32F, resolution, resolution,
+        0, GL_RED, GL_FLOAT, 0);
+    glFramebufferTexture2D(
+        GL_FRAMEBUFFER,
+        GL_COLOR_ATTACHMENT0,
+        GL_TEXTURE_2D,
+        wave_height_texture, 0);
+    {
+        GLenum fb_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        fatal_if(
+            fb_status != GL_FRAMEBUFFER_COMPLETE,
+            "Wave height frame buffer error, status: " + std::to_string(fb_status));
+    }
+
+    // The normals and heights, which the water samples.
+    glBindFramebuffer(GL_FRAMEBUFFER, wave_buffer);
+    glBindTexture(GL_TEXTURE_2D, wave_texture);
+    glTexImage2D(
+        GL_TEXTURE_2D,
+        0, GL_RGBA32F, resolution, resolution,
+        0, GL_RGBA, GL_FLOAT, 0);
+    glFramebufferTexture2D(
+        GL_FRAMEBUFFER,
+        GL_COLOR_ATTACHMENT0,
+        GL_TEXTURE_2D,
+        wave_texture, 0);
+    {
+        GLenum fb_status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        fatal_if(
+            fb_status != GL_FRAMEBUFFER_COMPLETE,
+            "Wave frame buffer error, status: " + std::to_string(fb_status));
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    wave_texture_resolution = resolution;
+    get_error(__LINE__);
+}
+
+void Renderer::bake_waves(const Scene& scene)
+{
+    const WaveField& waves = scene.waves;
+    if (waves.field_generation() == baked_wave_generation)
+    {
+        if (check_waves) check_baked_waves(scene);
+        return;
+    }
+    const int resolution = waves.field_resolution();
+    if (resolution != wave_texture_resolution) allocate_wave_textures(resolution);
+
+    // The quad is always filled, even when drawing in wireframe.
+    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    glViewport(0, 0, resolution, resolution);
+    glBindVertexArray(quad_vao);
+
+    // Evaluate the height of the waves once per texel.
+    GLuint program = scene.wave_height_shader->program_id;
+    glBindFramebuffer(GL_FRAMEBUFFER, wave_height_buffer);
+    glUseProgram(program);
+    glUniform1f(glGetUniformLocation(program, "Time"), waves.field_time());
+    glUniform1i(glGetUniformLocation(program, "WaveResolution"), resolution);
+    glUniform1f(glGetUniformLocation(program, "WavePeriod"), WaveField::period);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    // Find the normals from the heights.
+    program = scene.wave_normal_shader->program_id;
+    glBindFramebuffer(GL_FRAMEBUFFER, wave_buffer);
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "WaveHeightMap"), 6);
+    glUniform1i(glGetUniformLocation(program, "WaveResolution"), resolution);
+    glUniform1f(glGetUniformLocation(program, "WavePeriod"), WaveField::period);
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, wave_height_texture);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (wireframe) glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+    baked_wave_generation = waves.field_generation();
+    get_error(__LINE__);
+    if (check_waves) check_baked_waves(scene);
+}
+
+void Renderer::check_baked_waves(const Scene& scene)
+{
+    check_waves = false;
+    const int resolution = wave_texture_resolution;
+    std::vector<float> texels(4 * std::size_t(resolution) * resolution);
+    glBindTexture(GL_TEXTURE_2D, wave_texture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, texels.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+    get_error(__LINE__);
+
+    // At the centre of a texel the mirror gives that texel's normal and
+    // height. Every few texels are compared, to keep the check quick at
+    // high resolutions.
+    const int stride = std::max(1, resolution / 64);
+    std::vector<float> x, z;
+    std::vector<std::size_t> texel_index;
+    for (int row = 0; row < resolution; row += stride)
+    {
+        for (int col = 0; col < resolution; col += stride)
+        {
+            x.push_back((float(col) + 0.5f) / float(resolution) * WaveField::period);
+            z.push_back((float(row) + 0.5f) / float(resolution) * WaveField::period);
+            texel_index.push_back(4 * (std::size_t(row) * resolution + col));
+        }
+    }
+    const int n = int(x.size());
+    std::vector<float> height(n), normal_x(n), normal_y(n), normal_z(n);
+    scene.waves.sample_batch(
+        x.data(), z.data(), n, height.data(),
+        normal_x.data(), normal_y.data(), normal_z.data());
+
+    wave_error = 0.0f;
+    for (int i = 0; i < n; i += 1)
+    {
+        const float* texel = &texels[texel_index[i]];
+        wave_error = std::max(wave_error, std::abs(texel[0] - normal_x[i]));
+        wave_error = std::max(wave_error, std::abs(texel[1] - normal_y[i]));
+        wave_error = std::max(wave_error, std::abs(texel[2] - normal_z[i]));
+        wave_error = std::max(wave_error, std::abs(texel[3] - height[i]));
+    }
+}
+
 // Cleanup after a single render
 void Renderer::postrender()
 {
@@ -1352,22 +1815,33 @@ static ImageFormat get_image_type(const std::string& path) {
     return UNKNOWN;
 }
 
-// Load a texture from a given path to an image
-static void load_texture(const std::string& path)
+// Read a texture image into memory.
+TextureImage Renderer::decode_texture(const std::string& path)
 {
+    TextureImage image = { 0, 0, 0, nullptr };
     ImageFormat image_fmt = get_image_type(path);
-    int x, y, n;
+    int n;
     unsigned char* data = nullptr;
-    
+
     switch (image_fmt) {
-        case JPEG: data = stbi_load(path.c_str(), &x, &y, &n, 3); break;
-        case PNG:  data = stbi_load(path.c_str(), &x, &y, &n, 4); break;
+        case JPEG: data = stbi_load(path.c_str(), &image.width, &image.height, &n, 3); break;
+        case PNG:  data = stbi_load(path.c_str(), &image.width, &image.height, &n, 4); break;
         default: break;
     }
 
     if (data == nullptr || image_fmt == UNKNOWN) {
         warn("No path to image '" + path  + "'");
+        return image;
+    }
+    image.format = image_fmt == JPEG ? GL_RGB : GL_RGBA;
+    image.pixels.reset(data, stbi_image_free);
+    return image;
+}
 
+// Load a decoded texture image into the bound texture.
+static void upload_texture(const TextureImage& image)
+{
+    if (image.format == 0) {
         // A red texture to be used when no texture is provided.
         const std::array<unsigned char, 3> error_texture({{255, 0, 0}});
 
@@ -1377,20 +1851,8 @@ static void load_texture(const std::string& path)
         return;
     }
 
-    switch (image_fmt) {
-        case JPEG:
-            glTexImage2D(
-                GL_TEXTURE_2D, 0, GL_RGB, x, y, 0, GL_RGB,
-                GL_UNSIGNED_BYTE, data);
-            break;
-        case PNG:
-            glTexImage2D(
-                GL_TEXTURE_2D, 0, GL_RGBA, x, y, 0, GL_RGBA,
-                GL_UNSIGNED_BYTE, data);
-            break;
-        default:
-            fatal("Unknown image type");
-    }
-    stbi_image_free(data);
+    glTexImage2D(
+        GL_TEXTURE_2D, 0, image.format, image.width, image.height, 0,
+        image.format, GL_UNSIGNED_BYTE, image.pixels.get());
     glGenerateMipmap(GL_TEXTURE_2D); 
 }
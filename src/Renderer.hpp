@@ -5,6 +5,11 @@
 #ifndef RENDERER_HPP
 #define RENDERER_HPP
 
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
 #define GLFW_INCLUDE_NONE
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -22,6 +27,16 @@
 #include "Skybox.hpp"
 #include "Shader.hpp"
 
+// A texture image decoded on the CPU, ready to be uploaded.
+struct TextureImage
+{
+    int width;
+    int height;
+    // GL_RGB or GL_RGBA, or 0 if the image couldn't be read.
+    GLenum format;
+    std::shared_ptr<unsigned char> pixels;
+};
+
 class Renderer
 {
 public:
@@ -35,8 +50,35 @@ public:
     Water* assign_vao(Water* water);
     Skybox* assign_vao(Skybox* skybox);
     Mesh* assign_vao(Mesh* mesh);
+    // Re-upload the positions and indices of water with a VAO assigned,
+    // after it has followed the camera.
+    void update_vao(Water* water);
+    // Release the VAO and buffers assigned to a landscape or water.
+    void release_vao(Landscape* landscape);
+    void release_vao(Water* water);
+    // Assign a VAO to a landscape over several calls, to spread the upload
+    // over several frames. allocate_vao() creates the VAO and buffers, and
+    // each upload_vao_slice() call then uploads up to max_bytes more data.
+    // 'uploaded' counts the bytes uploaded so far, and should start at 0.
+    // upload_vao_slice() returns true once all of the data is uploaded.
+    Landscape* allocate_vao(Landscape* landscape);
+    bool upload_vao_slice(
+        Landscape* landscape, std::size_t& uploaded, std::size_t max_bytes);
+    // The number of bytes uploaded for a landscape.
+    static std::size_t upload_size(const Landscape* landscape);
+    // Re-upload the packed vertices [first, first + count) of a landscape
+    // with a VAO assigned, after they have been changed.
+    void update_vertices(Landscape* landscape, std::size_t first, std::size_t count);
     // Read and load mesh textures onto the GPU.
-    Mesh* create_materials(Mesh* mesh);;
+    Mesh* create_materials(Mesh* mesh);
+    // Load mesh textures onto the GPU from images already decoded (with
+    // decode_texture), by texture name. Textures missing from 'images'
+    // are read here.
+    Mesh* create_materials(
+        Mesh* mesh, const std::unordered_map<std::string, TextureImage>& images);
+    // Read a texture image (PNG or JPEG) into memory.
+    // Needs no GL context, so it can be called from any thread.
+    static TextureImage decode_texture(const std::string& path);
     // Render a scene.
     void render(const Scene& scene);
     // Cleanup after a single render cycle
@@ -51,6 +93,14 @@ private:
     void draw_scene(const Scene& scene, RenderMode render_mode);
     void init_shader(
         const Scene& scene, Shader* shader, RenderMode render_mode);
+    // Bake the scene's waves into the wave texture, if they have changed
+    // since they were last baked.
+    void bake_waves(const Scene& scene);
+    // Size the wave textures for a resolution, and attach them.
+    void allocate_wave_textures(int resolution);
+    // Read back the baked waves and compare them with the scene's CPU
+    // mirror of them (see WaveField), setting wave_error.
+    void check_baked_waves(const Scene& scene);
 
     // Internally, textures are assigned the following numbers:
     //  Num Name              Usage
@@ -58,6 +108,7 @@ private:
     //  1   ShadowDepthMap    The light-perspective depth map.
     //  2   Texture           A texture for a shape in a Mesh object.
     //  3   ReflectMap        The color map for a top-down ortho view of the scene.
+    //  6   WaveMap           The normal and height of the ocean's waves.
 
     // The FBO and texture for light-perspective depth map (for shadow mapping).
     GLuint shadow_buffer;
@@ -89,10 +140,29 @@ private:
     GLuint bloom_texture;
     GLuint bloom_intermediate_buffer;
     GLuint bloom_intermediate_texture;
+    // The FBOs and textures the ocean's waves are baked into: the heights
+    // of the waves, and from them the surface normal and height (see
+    // WaveField). Both repeat, and are resized when the resolution of the
+    // waves changes.
+    GLuint wave_height_buffer;
+    GLuint wave_height_texture;
+    GLuint wave_buffer;
+    GLuint wave_texture;
+    int wave_texture_resolution;
+    // The generation of the waves last baked.
+    unsigned int baked_wave_generation;
+    // Whether to check the next waves baked against the CPU mirror, and the
+    // largest difference found, available through the console.
+    bool check_waves;
+    float wave_error;
     // The quad to draw on, for postprocessing.
     GLuint quad_vao;
     unsigned int quad_size;
     bool wireframe;
+    // Whether the landscape is drawn with level of detail.
+    bool lod_enabled;
+    // The number of landscape triangles drawn in each pass (by RenderMode).
+    int landscape_triangles[5];
 };
 
 #endif // RENDERER_HPP
\ No newline at end of file
@@ -8,11 +8,29 @@ ResourceManager::ResourceManager()
 
 void ResourceManager::give_mesh(const std::string& name, Mesh* mesh)
 {
+    std::lock_guard<std::mutex> lock(mutex);
     owned_meshes[name] = std::unique_ptr<Mesh>(mesh);
+    expected_meshes.erase(name);
+    mesh_given.notify_all();
+}
+
+void ResourceManager::expect_mesh(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (owned_meshes.find(name) == owned_meshes.end()) expected_meshes.insert(name);
+}
+
+void ResourceManager::fail_mesh(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    expected_meshes.erase(name);
+    mesh_given.notify_all();
 }
 
 Mesh* ResourceManager::get_mesh(const std::string& name)
 {
+    std::unique_lock<std::mutex> lock(mutex);
+    mesh_given.wait(lock, [&]() { return expected_meshes.count(name) == 0; });
     if (owned_meshes.find(name) == owned_meshes.end())
     {
         // 'name' not in meshes
@@ -21,7 +39,18 @@ Mesh* ResourceManager::get_mesh(const std::string& name)
     return owned_meshes[name].get();
 }
 
+std::string ResourceManager::get_mesh_name(const Mesh* mesh) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& entry: owned_meshes)
+    {
+        if (entry.second.get() == mesh) return entry.first;
+    }
+    return std::string();
+}
+
 void ResourceManager::give_shader(const std::string& name, Shader* shader) {
+    std::lock_guard<std::mutex> lock(mutex);
     owned_shaders[name] = std::unique_ptr<Shader>(shader);
 }
 
@@ -30,6 +59,7 @@ void ResourceManager::give_shader(Shader* shader) {
 }
 
 Shader* ResourceManager::get_shader(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex);
     if (owned_shaders.find(name) == owned_shaders.end())
     {
         // 'name' not in shaders
@@ -38,4 +68,12 @@ Shader* ResourceManager::get_shader(const std::string& name) {
     return owned_shaders[name].get();
 }
 
-
+std::string ResourceManager::get_shader_name(const Shader* shader) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& entry: owned_shaders)
+    {
+        if (entry.second.get() == shader) return entry.first;
+    }
+    return std::string();
+}
@@ -3,6 +3,8 @@
 // Provides named access to resources needed by the program:
 //  - meshes
 //  - shaders
+// Meshes may be given by other threads (see MeshLoader.hpp), so access is
+// guarded by a mutex, and a mesh can be expected before it is given.
 
 #ifndef RESOURCEMANAGER_HPP
 #define RESOURCEMANAGER_HPP
@@ -10,9 +12,12 @@
 #include "Mesh.hpp"
 #include "Shader.hpp"
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 class ResourceManager
 {
@@ -25,9 +30,19 @@ public:
 
     // Give the manager a mesh to own.
     void give_mesh(const std::string& name, Mesh* mesh);
-    // Get a mesh owned by the scene by name.
+    // Note that a mesh will be given with this name later, perhaps by
+    // another thread. Until then, get_mesh waits for it.
+    void expect_mesh(const std::string& name);
+    // Note that an expected mesh will not be given after all, as it could
+    // not be loaded. get_mesh then fails for it rather than waiting.
+    void fail_mesh(const std::string& name);
+    // Get a mesh owned by the scene by name, waiting for it if it is
+    // expected.
     // Throws std::runtime_error on failure.
     Mesh* get_mesh(const std::string& name);
+    // Get the name of a mesh owned by the manager.
+    // Returns an empty string if the mesh is not owned by the manager.
+    std::string get_mesh_name(const Mesh* mesh) const;
 
     // Give the manager a shader to own.
     void give_shader(const std::string& name, Shader* shader);
@@ -35,12 +50,19 @@ public:
     // Get a shader owned by the manager by name.
     // Throws std::runtime_error on failure.
     Shader* get_shader(const std::string& name);
+    // Get the name of a shader owned by the manager.
+    // Returns an empty string if the shader is not owned by the manager.
+    std::string get_shader_name(const Shader* shader) const;
 
 private:
     // The meshes, stored as owning pointers hashed by name.
     std::unordered_map<std::string, std::unique_ptr<Mesh>> owned_meshes;
     // The owned shaders.
     std::unordered_map<std::string, std::unique_ptr<Shader>> owned_shaders;
+    // The names of meshes expected but not yet given.
+    std::unordered_set<std::string> expected_meshes;
+    mutable std::mutex mutex;
+    std::condition_variable mesh_given;
 };
 
 #endif // RESOURCEMANAGER_HPP
\ No newline at end of file
@@ -3,13 +3,16 @@
 
 #include "Scene.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <cstdio>
 #include <GL/glew.h>
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 #include <glm/gtx/rotate_vector.hpp>
+#include <limits>
 #include <stdexcept>
+#include <unordered_set>
 
 #include "Console.hpp"
 
@@ -42,6 +45,7 @@ Scene::Scene()
 void Scene::update(float dt)
 {
     time_elapsed += dt;
+    waves.update(time_elapsed);
     const float rotate_factor = 0.006f;
     float move_speed;
     if (InputHandler::keys[GLFW_KEY_LEFT_ALT])
@@ -205,10 +209,26 @@ void Scene::give_object(Object* object)
     owned_objects.push_back(std::unique_ptr<Object>(object));
 }
 
+void Scene::remove_objects(const std::vector<Object*>& removed)
+{
+    const std::unordered_set<Object*> remove(removed.begin(), removed.end());
+    objects.erase(
+        std::remove_if(objects.begin(), objects.end(),
+            [&](Object* object) { return remove.count(object) != 0; }),
+        objects.end());
+    owned_objects.erase(
+        std::remove_if(owned_objects.begin(), owned_objects.end(),
+            [&](const std::unique_ptr<Object>& object) { return remove.count(object.get()) != 0; }),
+        owned_objects.end());
+}
+
 void Scene::give_landscape(Landscape* landscape, Shader* shader)
 {
+    // The pyramid refers to the landscape, so goes first.
+    this->landscape_pyramid.reset();
     this->landscape.reset(landscape);
     this->landscape_shader = shader;
+    this->landscape_pyramid.reset(new HeightPyramid(*landscape));
 
     // Give the Landscape's objects to the Scene.
     for (auto object: landscape->objects)
@@ -225,6 +245,36 @@ void Scene::give_landscape(Landscape* landscape, Shader* shader)
         "The shininess of the landscape");
 }
 
+Landscape::Edit Scene::edit_landscape(
+    const Landscape::Brush& brush, const Landscape::Colouring& colouring)
+{
+    if (landscape == nullptr) return Landscape::Edit{ 0, 0, 0, 0, {} };
+    const Landscape::Edit edit = landscape->edit(brush, colouring);
+    if (edit.row_begin >= edit.row_end) return edit;
+    if (landscape_pyramid != nullptr)
+    {
+        landscape_pyramid->update(edit.row_begin, edit.row_end, edit.col_begin, edit.col_end);
+    }
+
+    // Keep the objects within the edit on the ground. (Their matrices are
+    // updated with the rest in update().)
+    const float step = landscape->edge / (landscape->size - 1.0f);
+    const float x_min = landscape->origin.x + (edit.row_begin - 1) * step;
+    const float x_max = landscape->origin.x + edit.row_end * step;
+    const float z_min = landscape->origin.y + (edit.col_begin - 1) * step;
+    const float z_max = landscape->origin.y + edit.col_end * step;
+    for (Object* object: landscape->objects)
+    {
+        if (object->position.x < x_min || object->position.x > x_max
+            || object->position.z < z_min || object->position.z > z_max)
+        {
+            continue;
+        }
+        object->position.y = landscape->get_height_at(object->position.x, object->position.z);
+    }
+    return edit;
+}
+
 Water* Scene::get_water()
 {
     return water.get();
@@ -260,6 +310,17 @@ Landscape* Scene::get_landscape()
     return landscape.get();
 }
 
+void Scene::give_chunks(ChunkManager* chunks, Shader* shader)
+{
+    this->chunks.reset(chunks);
+    this->landscape_shader = shader;
+}
+
+ChunkManager* Scene::get_chunks()
+{
+    return chunks.get();
+}
+
 
 void Scene::give_demo(Demo* demo)
 {
@@ -286,13 +347,17 @@ glm::vec3 Scene::check_collisions(glm::vec3 current, glm::vec3 proposed)
     if (no_clip) return proposed;
     
     // Check terrain
-    if (proposed.y < landscape->get_height_at(proposed.x, proposed.z) + player.height)
+    const float terrain_height = terrain_height_at(proposed.x, proposed.z);
+    if (proposed.y < terrain_height + player.height)
     {
         // Moves player to touch the terrain rather than pass through.
-        proposed.y = landscape->get_height_at(proposed.x, proposed.z) + player.height;
+        proposed.y = terrain_height + player.height;
 
         // Helps handle less well defined behaviour beyond the land, while over water
-        if (length(proposed) > 240 && proposed.y > 30) proposed.y = 6.4f;
+        if (chunks == nullptr && length(proposed) > 240 && proposed.y > 30)
+        {
+            proposed.y = water_height_at(proposed.x, proposed.z);
+        }
     }
 
     // Check objects
@@ -330,4 +395,26 @@ glm::vec3 Scene::check_collisions(glm::vec3 current, glm::vec3 proposed)
         }
     }
     return proposed;
-}
\ No newline at end of file
+}
+
+float Scene::terrain_height_at(float x, float z) const
+{
+    if (chunks != nullptr) return chunks->get_height_at(x, z);
+    // The landscape may still be loading.
+    if (landscape == nullptr) return std::numeric_limits<float>::lowest();
+    return landscape->get_height_at(x, z);
+}
+
+float Scene::water_height_at(float x, float z) const
+{
+    if (water == nullptr) return std::numeric_limits<float>::lowest();
+    return water->get_level() + waves.height(x, z);
+}
+
+bool Scene::cast_terrain_ray(const HeightPyramid::Ray& ray, HeightPyramid::Hit& hit) const
+{
+    if (chunks != nullptr) return chunks->cast_ray(ray, hit);
+    hit.hit = false;
+    if (landscape_pyramid == nullptr) return false;
+    return landscape_pyramid->cast(ray, hit);
+}
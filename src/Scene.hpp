@@ -19,7 +19,10 @@
 #include "Shader.hpp"
 #include "InputHandler.hpp"
 #include "Landscape.hpp"
+#include "ChunkManager.hpp"
+#include "HeightPyramid.hpp"
 #include "Water.hpp"
+#include "WaveField.hpp"
 #include "Skybox.hpp"
 #include "Demo.hpp"
 #include "Sound.hpp"
@@ -45,9 +48,15 @@ public:
     // The landscape.
     std::unique_ptr<Landscape> landscape;
     Shader* landscape_shader;
+    // The pyramid for casting rays against the landscape.
+    std::unique_ptr<HeightPyramid> landscape_pyramid;
+    // The terrain tiles, used in place of the landscape for tiled terrain.
+    std::unique_ptr<ChunkManager> chunks;
     // The water.
     std::unique_ptr<Water> water;
     Shader* water_shader;
+    // The waves on the water, baked into a texture by the Renderer.
+    WaveField waves;
     // The skybox.
     std::unique_ptr<Skybox> skybox;
     Shader* skybox_shader;
@@ -62,17 +71,32 @@ public:
     Shader* ssao_shader;
     Shader* blur_shader;
     Shader* hdr_shader;
+    Shader* wave_height_shader;
+    Shader* wave_normal_shader;
     
     // Update the scene after given an elapsed amount of time.
     void update(float dt);
 
     // Give the scene an object to own.
     void give_object(Object* object);
+    // Remove objects from the scene, and delete them.
+    void remove_objects(const std::vector<Object*>& removed);
 
     // Give the scene a landscape to own.
     void give_landscape(Landscape* landscape, Shader* shader);
     // Get the owned landscape.
     Landscape* get_landscape();
+    // Apply a brush to the landscape (see Landscape::edit), keeping the
+    // collision queries and ray casts, and the objects standing on it, up
+    // to date. The caller uploads the runs of vertices changed.
+    Landscape::Edit edit_landscape(
+        const Landscape::Brush& brush,
+        const Landscape::Colouring& colouring = Landscape::Colouring());
+
+    // Give the scene a tiled terrain to own.
+    void give_chunks(ChunkManager* chunks, Shader* shader);
+    // Get the owned tiled terrain.
+    ChunkManager* get_chunks();
 
     // Give the scene a body of water to own.
     void give_water(Water* water, Shader* shader);
@@ -88,6 +112,15 @@ public:
     void give_sound(Sound* sound);
     
     glm::vec3 check_collisions(glm::vec3 current, glm::vec3 proposed);
+    // Get the height of the landscape or terrain tiles at x, z.
+    // Returns the lowest float if there is no landscape yet.
+    float terrain_height_at(float x, float z) const;
+    // Get the height of the water's surface at x, z, waves included.
+    // Returns the lowest float if there is no water.
+    float water_height_at(float x, float z) const;
+    // Cast a ray against the landscape or terrain tiles (for picking, line
+    // of sight and the like). Returns whether it hit, and fills 'hit'.
+    bool cast_terrain_ray(const HeightPyramid::Ray& ray, HeightPyramid::Hit& hit) const;
 
 private:
     // The meshes, stored as owning pointers hashed by name.
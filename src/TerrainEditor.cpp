@@ -0,0 +1,104 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of TerrainEditor class member functions.
+
+#include "TerrainEditor.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+#include "Console.hpp"
+#include "InputHandler.hpp"
+#include "Renderer.hpp"
+#include "Scene.hpp"
+
+TerrainEditor::TerrainEditor()
+    : enabled(false),
+      mode(Landscape::Brush::Raise),
+      radius(12.0f),
+      strength(8.0f),
+      held(false),
+      flatten_height(0.0f),
+      edit_ms(0.0f),
+      uploaded_vertices(0)
+{
+    console->register_var(
+        "terrain.brush",
+        Bool,
+        &enabled,
+        1,
+        "Whether the left mouse button edits the landscape");
+    console->register_var(
+        "terrain.brush_mode",
+        Int,
+        &mode,
+        1,
+        "The brush: 0 raises, 1 lowers, 2 flattens, 3 smooths");
+    console->register_var(
+        "terrain.brush_radius",
+        Float,
+        &radius,
+        1,
+        "The radius of the brush");
+    console->register_var(
+        "terrain.brush_strength",
+        Float,
+        &strength,
+        1,
+        "The distance raised or lowered, or the fraction flattened or smoothed, per second");
+    console->register_var(
+        "terrain.edit_ms",
+        Float,
+        &edit_ms,
+        1,
+        "The time taken by the last edit of the landscape, in ms",
+        false);
+    console->register_var(
+        "terrain.edit_vertices",
+        Int,
+        &uploaded_vertices,
+        1,
+        "The number of vertices uploaded by the last edit of the landscape",
+        false);
+}
+
+void TerrainEditor::update(
+    Scene& scene, Renderer& renderer, float dt,
+    const TerrainGenerator::Params& params)
+{
+    const bool pressed = enabled && InputHandler::mouse_buttons[GLFW_MOUSE_BUTTON_LEFT];
+    const bool first = pressed && !held;
+    held = pressed;
+    Landscape* landscape = scene.get_landscape();
+    if (!pressed || landscape == nullptr) return;
+
+    // Find where the camera is looking.
+    HeightPyramid::Ray ray;
+    ray.origin = scene.camera.position;
+    ray.direction = glm::normalize(scene.camera.direction);
+    ray.max_distance = 1000.0f;
+    HeightPyramid::Hit hit;
+    if (!scene.cast_terrain_ray(ray, hit)) return;
+
+    if (first) flatten_height = hit.position.y;
+    Landscape::Brush brush;
+    brush.mode = Landscape::Brush::Mode(std::max(0, std::min(3, mode)));
+    brush.centre = glm::vec2(hit.position.x, hit.position.z);
+    brush.radius = radius;
+    brush.strength = strength * dt;
+    brush.height = flatten_height;
+
+    const auto start = std::chrono::steady_clock::now();
+    const Landscape::Edit edit = scene.edit_landscape(brush,
+        [&params](float height, float moisture)
+        {
+            return TerrainGenerator::colour_for(height, moisture, params);
+        });
+    uploaded_vertices = 0;
+    for (const std::pair<std::size_t, std::size_t>& run: edit.runs)
+    {
+        renderer.update_vertices(landscape, run.first, run.second);
+        uploaded_vertices += int(run.second);
+    }
+    edit_ms = std::chrono::duration<float, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
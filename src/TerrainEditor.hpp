@@ -0,0 +1,52 @@
+// Authorship: James Kortman (a1648090)
+// TerrainEditor class
+// Edits the island's landscape with a brush while the game runs.
+// The brush is set up through the console (terrain.brush, and the
+// terrain.brush_* variables), and applied where the camera is looking
+// while the left mouse button is held. Each edit only changes the vertices
+// within the brush, and only the packed vertices changed are uploaded (see
+// Landscape::edit), so edits run at full frame rate on large landscapes.
+
+#ifndef TERRAINEDITOR_HPP
+#define TERRAINEDITOR_HPP
+
+#include "TerrainGenerator.hpp"
+
+class Renderer;
+class Scene;
+
+class TerrainEditor
+{
+public:
+    TerrainEditor();
+    TerrainEditor(const TerrainEditor&) = delete;
+    TerrainEditor& operator=(const TerrainEditor&) = delete;
+
+    // Call once per frame, with the time elapsed and the parameters the
+    // landscape was generated with (to recolour the vertices edited).
+    void update(
+        Scene& scene, Renderer& renderer, float dt,
+        const TerrainGenerator::Params& params);
+
+private:
+    // The brush, set through the console.
+    bool enabled;
+    // A Landscape::Brush::Mode.
+    int mode;
+    float radius;
+    // For raising and lowering, the distance moved per second at the
+    // centre. For flattening and smoothing, the fraction of the way moved
+    // per second.
+    float strength;
+
+    // Whether the button was held last frame, and the height flattened to,
+    // which is the height first pointed at.
+    bool held;
+    float flatten_height;
+
+    // Statistics, available through the console.
+    float edit_ms;
+    int uploaded_vertices;
+};
+
+#endif // TERRAINEDITOR_HPP
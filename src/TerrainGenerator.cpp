@@ -7,79 +7,156 @@
 #include <cassert>
 #include <array>
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <numeric>
+#include <utility>
 #include <vector>
 
 #include <glm/glm.hpp>
 
-#define STB_PERLIN_IMPLEMENTATION
-#include "stb_perlin.h"
+#include "Filters.hpp"
+#include "Noise.hpp"
+#include "ThreadPool.hpp"
+
+const char* const TerrainGenerator::stage_names[num_stages] = {
+    "heightmap", "erosion", "positions", "normals", "indices",
+    "object_positions", "objects", "landscape",
+};
+
+const unsigned TerrainGenerator::output_inputs[num_outputs] = {
+    /* AltitudeMap */ 0,
+    /* MoistureMap */ 0,
+    /* HeightMap   */ output_bit(AltitudeMap),
+    /* BiomeMap    */ output_bit(AltitudeMap) | output_bit(MoistureMap),
+    /* ColourMap   */ output_bit(BiomeMap),
+    /* PositionMap */ output_bit(HeightMap),
+    /* NormalMap   */ output_bit(PositionMap),
+    /* IndexList   */ output_bit(PositionMap),
+    /* ObjectList  */ output_bit(BiomeMap) | output_bit(PositionMap),
+};
+
+TerrainGenerator::Params::Params()
+    : flatness(3.5f),
+      island_base(0.03f),
+      island_falloff(0.03f),
+      height_scale(92.0f),
+      moisture_bias(0.0f),
+      altitude_bands{ 0.05f, 0.08f, 0.30f, 0.6f, 0.84f },
+      lowland_moisture{ 0.12f, 0.25f, 0.70f, 0.90f },
+      upland_moisture{ 0.25f, 0.5f, 0.7f },
+      alpine_moisture{ 0.3f, 0.6f },
+      peak_moisture{ 0.2f, 0.4f, 0.7f },
+      vegetation_density(1.0f)
+{
+    const std::vector<glm::vec3> biome_colours = make_biome_colours();
+    std::copy(biome_colours.begin(), biome_colours.end(), colours);
+}
+
+TerrainGenerator::Progress::Progress()
+    : stages_done(0)
+{
+    for (int i = 0; i < num_stages; i += 1) stage_ms[i] = 0.0f;
+}
 
 // Create a new TerrainGenerator.
 // The terrain will consist of size*size vertices, and will have
 // dimensions edge*edge.
 TerrainGenerator::TerrainGenerator(
     int seed, int size, float edge, float max_height,
-    ResourceManager* resources)
-    : size(size), edge(edge), max_height(max_height), resources(resources)
+    ResourceManager* resources, Progress* progress,
+    const ErosionParams* erosion, const Params* params)
+    : size(size), first_row_held(0), edge(edge), cull_sea(true),
+      max_height(max_height), resources(resources), tiled(false), origin_row(0), origin_col(0),
+      vert_dist(edge / (size - 1)), seed(seed), progress(progress),
+      erosion(erosion)
 {
+    if (params != nullptr) this->params = *params;
     positions.resize(size * size);
     normals.resize(size * size);
     colours.resize(size * size);
     biomes.resize(size * size);
 
-    // Build colours.
-    std::vector<std::array<unsigned char, 3>> biome_colours_raw = {{
-        /* Error      */ {{ 255,   0,   0 }},
-        /* Ocean      */ {{ 222, 198, 160 }},
-        /* Beach      */ {{ 209, 184, 142 }},
-        /* Dunes      */ {{ 160, 144, 120 }},
-        /* Veldt      */ {{ 201, 209, 157 }},
-        /* Grassland  */ {{ 137, 169,  90 }},
-        /* Woodland   */ {{ 104, 147,  91 }},
-        /* Forest     */ {{  71, 135,  87 }},
-        /* PineForest */ {{ 153, 169, 121 }},
-        /* Rock       */ {{  85,  85,  85 }},
-        /* Bare       */ {{ 136, 136, 136 }},
-        /* Moor       */ {{ 136, 152, 120 }},
-        /* Tundra     */ {{ 187, 187, 171 }},
-        /* LightSnow  */ {{ 221, 221, 228 }},
-        /* HeavySnow  */ {{ 238, 238, 238 }},
-    }};
-    for (int i = 0; i < biome_colours_raw.size(); i += 1)
+    generate();
+}
+
+// Create a TerrainGenerator for one tile of an unbounded, tiled terrain.
+TerrainGenerator::TerrainGenerator(
+    int seed, int tile_x, int tile_z, int size, float vert_dist,
+    float max_height, ResourceManager* resources)
+    : size(size), first_row_held(0), edge(vert_dist * (size - 1)),
+      cull_sea(true), max_height(max_height), resources(resources), tiled(true),
+      origin_row(tile_x * (size - 1)),
+      origin_col(tile_z * (size - 1)), vert_dist(vert_dist), seed(seed),
+      progress(nullptr), erosion(nullptr)
+{
+    positions.resize(size * size);
+    normals.resize(size * size);
+    colours.resize(size * size);
+    biomes.resize(size * size);
+
+    generate();
+}
+
+// Whether the landscapes created leave out the triangles below the sea.
+void TerrainGenerator::set_sea_culling(bool cull)
+{
+    if (cull == cull_sea) return;
+    cull_sea = cull;
+    // The triangles were already found by the constructor.
+    if (!indices.empty())
     {
-        biome_colours.push_back(glm::vec3(
-            float(biome_colours_raw[i][0]) / 255.0f,
-            float(biome_colours_raw[i][1]) / 255.0f,
-            float(biome_colours_raw[i][2]) / 255.0f));
+        indices.clear();
+        generate_indices();
     }
-
-    generate(seed, max_height);
 }
 
 // Convert the contained terrain data into a landscape object.
-Landscape* TerrainGenerator::landscape()
+Landscape* TerrainGenerator::landscape(bool keep)
 {
     // Initialize landscape object.
     Landscape* landscape = new Landscape;
+    stage_start = std::chrono::steady_clock::now();
     landscape->edge = edge;
     landscape->size = size;
-    
-    // Copy values into landscape.
-    for (int i = 0; i < positions.size(); i += 1)
+    landscape->origin = glm::vec2(positions[0].x, positions[0].z);
+
+    // The vertex data and triangles are already laid out as the landscape
+    // keeps them, so they are moved over whole (or copied, if the generator
+    // keeps them). The moisture is kept so edited vertices can be
+    // recoloured.
+    if (keep)
     {
-        landscape->positions.push_back(positions[i]);
-        landscape->normals.push_back(normals[i]);
-        landscape->colours.push_back(colours[i]);
+        landscape->positions = positions;
+        landscape->normals = normals;
+        landscape->colours = colours;
+        landscape->moisture = moisture_map.map;
+        landscape->edited = edited;
+        landscape->indices = indices;
     }
-    for (int i = 0; i < indices.size(); i += 1)
+    else
     {
-        landscape->indices.push_back(indices[i][0]);
-        landscape->indices.push_back(indices[i][1]);
-        landscape->indices.push_back(indices[i][2]);
+        landscape->positions = std::move(positions);
+        landscape->normals = std::move(normals);
+        landscape->colours = std::move(colours);
+        landscape->moisture = std::move(moisture_map.map);
+        landscape->edited = std::move(edited);
+        landscape->indices = std::move(indices);
     }
 
+    finish_landscape(landscape);
+    finish_stage(7);
+    return landscape;
+}
+
+// Build the level of detail, palette and packed vertices of a landscape
+// with its vertices and indices, and give it the objects.
+void TerrainGenerator::finish_landscape(Landscape* landscape)
+{
+    // Build the level of detail quadtree, culling as generate_indices does.
+    landscape->build_lod(
+        tiled || !cull_sea ? std::numeric_limits<float>::lowest() : sealevel * 0.5f);
+
     // Note that ambient and diffuse probably aren't used in the shader,
     // in favor of the per-vertex colours.
     landscape->material.ambient   = glm::vec3(0.1f, 0.5f, 0.2f);
@@ -88,14 +165,137 @@ Landscape* TerrainGenerator::landscape()
     landscape->material.shininess = 0.05f;
 
     // Copy the palette over to the landscape.
-    landscape->palette = std::vector<glm::vec3>(
-        biome_colours.begin() + 1,  // skip error colour
-        biome_colours.end());
+    landscape->palette = landscape_palette();
+
+    // Pack the vertices for rendering, and keep the heights for queries,
+    // while still off the render thread.
+    landscape->pack_vertices();
+    landscape->build_height_grid();
 
     // Give generated objects to landscape.
     landscape->objects = objects;
+}
 
-    return landscape;
+// The colour palette used by generated landscapes.
+std::vector<glm::vec3> TerrainGenerator::palette()
+{
+    std::vector<glm::vec3> colours = make_biome_colours();
+    // Skip the error colour, as landscape() does.
+    return std::vector<glm::vec3>(colours.begin() + 1, colours.end());
+}
+
+// ------------------
+// -- Regeneration --
+// ------------------
+// Change the island's parameters, recomputing only the outputs that depend
+// on the parameters changed.
+unsigned TerrainGenerator::regenerate(const Params& params)
+{
+    if (tiled) return 0;
+    const unsigned outputs = outputs_changed(this->params, params);
+    this->params = params;
+    stage_start = std::chrono::steady_clock::now();
+    compute(outputs);
+    return outputs;
+}
+
+// The outputs that depend on the differences between two sets of parameters.
+unsigned TerrainGenerator::outputs_changed(const Params& before, const Params& after)
+{
+    auto differ = [](const float* a, const float* b, int n) -> bool
+    {
+        return !std::equal(a, a + n, b);
+    };
+    // The outputs directly computed from each parameter.
+    unsigned outputs = 0;
+    if (before.flatness != after.flatness
+        || before.island_base != after.island_base
+        || before.island_falloff != after.island_falloff)
+    {
+        outputs |= output_bit(AltitudeMap);
+    }
+    if (before.height_scale != after.height_scale) outputs |= output_bit(HeightMap);
+    if (before.moisture_bias != after.moisture_bias
+        || differ(before.altitude_bands, after.altitude_bands, 5)
+        || differ(before.lowland_moisture, after.lowland_moisture, 4)
+        || differ(before.upland_moisture, after.upland_moisture, 3)
+        || differ(before.alpine_moisture, after.alpine_moisture, 2)
+        || differ(before.peak_moisture, after.peak_moisture, 3))
+    {
+        outputs |= output_bit(BiomeMap);
+    }
+    if (before.vegetation_density != after.vegetation_density)
+    {
+        outputs |= output_bit(ObjectList);
+    }
+    if (differ(&before.colours[0].x, &after.colours[0].x, 3 * num_biomes))
+    {
+        outputs |= output_bit(ColourMap);
+    }
+
+    // Then every output computed from one of those. The outputs are in an
+    // order where each comes after its inputs, so one pass is enough.
+    for (int output = 0; output < num_outputs; output += 1)
+    {
+        if (output_inputs[output] & outputs) outputs |= 1u << output;
+    }
+    return outputs;
+}
+
+// The parameters the terrain was generated with.
+const TerrainGenerator::Params& TerrainGenerator::parameters() const
+{
+    return params;
+}
+
+// The colour of every vertex.
+const std::vector<glm::vec3>& TerrainGenerator::vertex_colours() const
+{
+    return colours;
+}
+
+// The palette of the landscapes created.
+std::vector<glm::vec3> TerrainGenerator::landscape_palette() const
+{
+    // Skip the error colour.
+    return std::vector<glm::vec3>(params.colours + 1, params.colours + num_biomes);
+}
+
+// Take the objects placed.
+std::vector<Object*> TerrainGenerator::take_objects()
+{
+    std::vector<Object*> taken;
+    taken.swap(objects);
+    return taken;
+}
+
+// The colour of a vertex with some height and moisture.
+glm::vec3 TerrainGenerator::colour_for(float height, float moisture, const Params& params)
+{
+    return params.colours[int(height_biome(height, moisture, params))];
+}
+
+// Keep the edits made to a landscape created by the generator.
+void TerrainGenerator::keep_edits(
+    const std::vector<glm::vec3>& positions, const std::vector<uint8_t>& edited)
+{
+    if (tiled
+        || positions.size() != this->positions.size()
+        || edited.size() != positions.size()
+        || heightmap.map.size() != positions.size())
+    {
+        return;
+    }
+    this->edited = edited;
+    height_edits.resize(edited.size());
+    for (std::size_t i = 0; i < edited.size(); i += 1)
+    {
+        height_edits[i] = edited[i] ? positions[i].y - heightmap.map[i] : 0.0f;
+    }
+    // Then the outputs found from the positions, bar the objects, which
+    // have already been taken.
+    stage_start = std::chrono::steady_clock::now();
+    compute(output_bit(PositionMap) | output_bit(NormalMap) | output_bit(IndexList));
 }
 
 // ---------------------------
@@ -103,7 +303,7 @@ Landscape* TerrainGenerator::landscape()
 // ---------------------------
 glm::vec3 TerrainGenerator::get_position(int row, int col) const
 {
-    return positions[size * row + col];
+    return positions[size * (row - first_row_held) + col];
 }
 
 glm::vec3 TerrainGenerator::get_normal(int row, int col) const
@@ -118,12 +318,12 @@ glm::vec3 TerrainGenerator::get_colour(int row, int col) const
 
 TerrainGenerator::Biome TerrainGenerator::get_biome(int row, int col) const
 {
-    return biomes[size * row + col];
+    return biomes[size * (row - first_row_held) + col];
 }
 
 glm::vec3 TerrainGenerator::get_closest_pos(float x, float z) const
 {
-    const float step = (2 * edge)/(-1 + size * 2);
+    const float step = edge / (size - 1);
     int row_x = (x + edge/2)/step;
     int row_z = (z + edge/2)/step;
     int index = size * row_x + row_z;
@@ -136,7 +336,7 @@ std::array<int, 3> TerrainGenerator::get_tri(float x, float z) const
 {
     std::array<int, 3> indices;
 
-    const float step = (2 * edge)/(-1 + size * 2);
+    const float step = edge / (size - 1);
     int row_x = (x + edge/2)/step;
     int row_z = (z + edge/2)/step;
     indices[0] = size * row_x + row_z;
@@ -201,9 +401,18 @@ float TerrainGenerator::get_height_at(float x, float z) const
     return position.y;
 }
 
+// The position of the tile vertex at row, col.
+glm::vec3 TerrainGenerator::tile_position(int row, int col) const
+{
+    return glm::vec3(
+        float(origin_row + row) * vert_dist,
+        heightmap.map[heightmap.size * row + col],
+        float(origin_col + col) * vert_dist);
+}
+
 void TerrainGenerator::set_position(int row, int col, glm::vec3 pos)
 {
-    positions[size * row + col] = pos;
+    positions[size * (row - first_row_held) + col] = pos;
 }
 
 void TerrainGenerator::set_normal(int row, int col, glm::vec3 norm)
@@ -218,7 +427,7 @@ void TerrainGenerator::set_colour(int row, int col, glm::vec3 colour)
 
 void TerrainGenerator::set_biome(int row, int col, Biome biome)
 {
-    biomes[size * row + col] = biome;
+    biomes[size * (row - first_row_held) + col] = biome;
 }
 
 // ---------------------------------------
@@ -226,195 +435,354 @@ void TerrainGenerator::set_biome(int row, int col, Biome biome)
 // ---------------------------------------
 
 // Calls all of the core generator functions in order to create a terrain.
-void TerrainGenerator::generate(int seed, float max_height)
+void TerrainGenerator::generate()
 {
-    generate_base_map(seed, max_height);
-    generate_positions();
-    generate_normals();
+    stage_start = std::chrono::steady_clock::now();
+    if (!tiled) generate_noise();
+    compute(all_outputs);
+}
+
+// Compute a set of outputs, in order, from the outputs before them.
+void TerrainGenerator::compute(unsigned outputs)
+{
+    auto wanted = [=](Output output) { return (outputs & output_bit(output)) != 0; };
+    if (tiled)
+    {
+        generate_tile_map();
+    }
+    else
+    {
+        if (wanted(AltitudeMap)) generate_altitude_map();
+        if (wanted(MoistureMap)) generate_moisture_map();
+        if (wanted(BiomeMap))    generate_biome_map();
+        if (wanted(ColourMap))   generate_colour_map();
+        if (wanted(HeightMap))   generate_heightmap();
+    }
+    finish_stage(0);
+    if (wanted(HeightMap)) erode_heightmap();
+    finish_stage(1);
+    if (wanted(PositionMap)) generate_positions();
+    if (wanted(PositionMap) || wanted(BiomeMap)) colour_edits();
+    finish_stage(2);
+    if (wanted(NormalMap)) generate_normals();
+    finish_stage(3);
 
-    /*
     // Blur normals
-    for (int row = 0; row < size; row += 1)
+    //blur(Normals, 0.8f, 2);
+
+    if (wanted(IndexList))
     {
-        for (int col = 0; col < size; col += 1)
+        indices.clear();
+        generate_indices();
+    }
+    finish_stage(4);
+    ObjectCells cells;
+    if (wanted(ObjectList)) cells = object_positions(0, size - 1);
+    finish_stage(5);
+    if (wanted(ObjectList))
+    {
+        objects.clear();
+        populate(cells);
+    }
+    finish_stage(6);
+}
+
+// Record that a stage has finished, and start timing the next one.
+void TerrainGenerator::finish_stage(int stage)
+{
+    auto now = std::chrono::steady_clock::now();
+    if (progress != nullptr)
+    {
+        progress->stage_ms[stage] =
+            std::chrono::duration<float, std::milli>(now - stage_start).count();
+        progress->stages_done = stage + 1;
+        if (progress->on_stage)
         {
-            blur_value(Normals, row, col, 0.8f, 2);
+            progress->on_stage(stage);
+            now = std::chrono::steady_clock::now();
         }
     }
-    */
+    stage_start = now;
+}
+
+// -- Stage 1 --
+// Uses a biome system that creates two value maps, moisture and altitude,
+// and uses them to assign biomes using the following rules:
+//  (O = Ocean, C = Coast, D = Dirt, R = Rock,
+//   V = dark grass, G = light grass, F = Forest, S = Snow)
+// todo
 
-    generate_indices();
-    populate();
+// The noise coordinate for a row or column of an island.
+static float island_noise_coord(int i, int size)
+{
+    return float(i) / (size * 0.25f) + 0.5f;
 }
 
-// Stage 1: Use noise functions to generate a heightmap according to some
-// noise function(s);
-void TerrainGenerator::generate_base_map(int seed, float max_height)
+// The cliff modifier: if position is very close to the edge,
+// force the altitude downward.
+static float island_cliff_at(int row, int col, int size)
 {
-    heightmap = ValueMap(size);
+    const float maxdist = std::max(
+        std::abs(float(row) - 0.5 * float(size)),
+        std::abs(float(col) - 0.5 * float(size)));
+    const float k = 1.3f;
+    float cliffmod = 1.0f - 1.0f / (1.0f + std::exp(-k*(maxdist - (0.5f * float(size) - 5.0f))));
+    return std::max(0.0f, std::min(1.0f, cliffmod));
+}
 
-    // -- Generator method --
-    // Uses a biome system that creates two value maps, moisture and altitude,
-    // and uses them to assign biomes using the following rules:
-    //  (O = Ocean, C = Coast, D = Dirt, R = Rock,
-    //   V = dark grass, G = light grass, F = Forest, S = Snow)
-    // todo
-
-    // Moisture and altitude can be obtained for a row/col point using
-    // these functions.
-    auto altitude_at = [=](int row, int col) -> float
-    {
-        const float frow = float(row);
-        const float fcol = float(col);
-        float alt = 0.5 + 0.5 * stb_perlin_fbm_noise3(
-            float(row) / (size * 0.25f) + 0.5f,            // Coordinates
-            float(col) / (size * 0.25f) + 0.5f,
-            0.5f,
-            2.0,                            // Frequency increase per octave
-            0.5,                            // Multiplier per successive octave
-            6,                              // Number of octaves
-            0,0,0);                         // wrapping settings
-        // Flatten the altitude to force plains.
-        alt = std::pow(alt, 3.5f);
-        // The altitude is modified by distance from the centre.
-        const float distance =
-            std::sqrt(
-                std::pow(frow - 0.5 * float(size), 2)
-                + std::pow(fcol - 0.5 * float(size), 2))
-            / std::sqrt(2 * std::pow(0.5 * float(size), 2));
-        // Changing a,b,c changes the island generated.
-        const float a = 0.03f;
-        const float b = 2.00f;
-        const float c = 0.03f; //0.2
-        //alt = (alt + a) - b * std::pow(distance, c);
-        alt = (alt + a) * b * std::pow(distance, c);
-        return alt;
-    };
-    auto moisture_at = [=](int row, int col) -> float
-    {
-        return stb_perlin_fbm_noise3(
-            float(row) / (size * 0.25f) + 0.5f,            // Coordinates
-            float(col) / (size * 0.25f) + 0.5f,
-            1.5f,
-            2.1,                            // Frequency increase per octave
-            0.4,                            // Multiplier per successive octave
-            6,                              // Number of octaves
-            0,0,0);                         // wrapping settings
-    };
-    auto assign_biome = [=](float altitude, float moisture) -> Biome
+// Get the altitude and moisture noise for cols [0, count) of a row of an
+// island, using the batched noise functions.
+static void island_noise_row(int row, int size, int count, float* altitude, float* moisture)
+{
+    std::vector<float> xs(count, island_noise_coord(row, size));
+    std::vector<float> ys(count);
+    std::vector<float> zs(count, 0.5f);
+    for (int col = 0; col < count; col += 1) ys[col] = island_noise_coord(col, size);
+    fbm_noise3_batch(
+        xs.data(), ys.data(), zs.data(),
+        2.0f,                           // Frequency increase per octave
+        0.5f,                           // Multiplier per successive octave
+        6,                              // Number of octaves
+        altitude, count);
+    std::fill(zs.begin(), zs.end(), 1.5f);
+    fbm_noise3_batch(
+        xs.data(), ys.data(), zs.data(),
+        2.1f,                           // Frequency increase per octave
+        0.4f,                           // Multiplier per successive octave
+        6,                              // Number of octaves
+        moisture, count);
+}
+
+// With some distance metrics there is a singularity at 0.0, 0.0, which
+// looks ugly. To avoid this, at 0,0 we copy a neighbouring value: this is
+// the altitude noise used there, shaped as at that neighbour.
+static float island_centre_noise(int size)
+{
+    std::vector<float> above(size / 2 + 1), unused(size / 2 + 1);
+    island_noise_row(size / 2 - 1, size, size / 2 + 1, above.data(), unused.data());
+    return above[size / 2];
+}
+
+// Shape the altitude noise value at a row/col point of an island, before
+// it is normalized.
+static float island_altitude(
+    float noise, int row, int col, int size, const TerrainGenerator::Params& params)
+{
+    const float frow = float(row);
+    const float fcol = float(col);
+    float alt = 0.5 + 0.5 * noise;
+    // Flatten the altitude to force plains.
+    // The noise can fall just below -1, which would give a NaN.
+    alt = std::pow(std::max(0.0f, alt), params.flatness);
+    // The altitude is modified by distance from the centre.
+    const float distance =
+        std::sqrt(
+            std::pow(frow - 0.5 * float(size), 2)
+            + std::pow(fcol - 0.5 * float(size), 2))
+        / std::sqrt(2 * std::pow(0.5 * float(size), 2));
+    // Changing a,b,c changes the island generated.
+    const float a = params.island_base;
+    const float b = 2.00f;
+    const float c = params.island_falloff;
+    //alt = (alt + a) - b * std::pow(distance, c);
+    alt = (alt + a) * b * std::pow(distance, c);
+    return alt;
+}
+
+// Sample the altitude and moisture noise.
+void TerrainGenerator::generate_noise()
+{
+    // Moisture and altitude are evaluated a row of vertices at a time.
+    altitude_noise.resize(size * size);
+    moisture_noise.resize(size * size);
+    ThreadPool::shared().parallel_for(0, size, 8, [&](int row_begin, int row_end)
     {
-        if (altitude < 0.05f) return Ocean;
-        if (altitude < 0.08f) return Beach;
-        if (altitude < 0.30f)
+        for (int row = row_begin; row < row_end; row += 1)
         {
-            if (moisture < 0.12f) return Dunes;
-            if (moisture < 0.25f) return Veldt;
-            if (moisture < 0.70f) return Grassland;
-            if (moisture < 0.90f) return Woodland;
-            return Forest;
+            island_noise_row(
+                row, size, size, &altitude_noise[size * row], &moisture_noise[size * row]);
         }
-        if (altitude < 0.6f)
-        {
-            if (moisture < 0.25) return Veldt;
-            if (moisture < 0.5f) return Grassland;
-            if (moisture < 0.7f) return Woodland;
-            return Forest;
-        }
-        if (altitude < 0.84f)
-        {
-            if (moisture < 0.3f) return Tundra;
-            if (moisture < 0.6f) return Moor;
-            return PineForest;
-        }
-        if (moisture < 0.2f) return Rock;
-        if (moisture < 0.4f) return Bare;
-        if (moisture < 0.7f) return LightSnow;
-        return HeavySnow;
+    });
+    centre_noise = island_centre_noise(size);
+}
+
+// Shape the altitude noise into the island, and normalize it.
+void TerrainGenerator::generate_altitude_map()
+{
+    // Shape the altitude noise value at a row/col point.
+    const int size = this->size;
+    const Params& params = this->params;
+    auto altitude_from_noise = [=, &params](float noise, int row, int col) -> float
+    {
+        return island_altitude(noise, row, col, size, params);
     };
 
-    // -- Initialization pass --
-    // Sets and normalizes the altitude and moisture maps.
-    ValueMap altitude_map(size);
-    ValueMap moisture_map(size);
-    ValueMap cliff_map(size);
-    for (int row = 0; row < size; row += 1)
+    ThreadPool& pool = ThreadPool::shared();
+    altitude_map = ValueMap(size);
+    pool.parallel_for(0, size, 8, [&](int row_begin, int row_end)
     {
-        for (int col = 0; col < size; col += 1)
+        for (int row = row_begin; row < row_end; row += 1)
         {
-            // With some distance metrics there is a singularity at
-            // 0.0, 0.0, which looks ugly. To avoid this, at 0,0 we
-            // copy a neighbouring value.
-            if (row == size / 2 && col == size / 2)
+            for (int col = 0; col < size; col += 1)
             {
-                altitude_map.set(row, col, altitude_at(row-1, col));
+                const int i = size * row + col;
+                altitude_map.map[i] = altitude_from_noise(altitude_noise[i], row, col);
             }
-            else
+        }
+    });
+    altitude_map.map[size * (size / 2) + size / 2] =
+        altitude_from_noise(centre_noise, size / 2 - 1, size / 2);
+    altitude_map.find_range();
+
+    // Normalize the altitude, and apply the cliff modifier. The range of
+    // the map is kept as found above.
+    pool.parallel_for(0, size, 8, [&](int row_begin, int row_end)
+    {
+        for (int row = row_begin; row < row_end; row += 1)
+        {
+            for (int col = 0; col < size; col += 1)
             {
-                altitude_map.set(row, col, altitude_at(row, col));
+                float& altitude = altitude_map.map[size * row + col];
+                altitude = altitude_map.normalized(altitude, 0.0f, 1.0f)
+                         * island_cliff_at(row, col, size);
             }
-            moisture_map.set(row, col, moisture_at(row, col));
-
-            // Cliff modifier: if position is very close to the edge, force the altitude downward.
-            const float maxdist = std::max(
-                std::abs(float(row) - 0.5 * float(size)),
-                std::abs(float(col) - 0.5 * float(size)));
-            const float k = 1.3f;
-            float cliffmod = 1.0f - 1.0f / (1.0f + std::exp(-k*(maxdist - (0.5f * float(size) - 5.0f))));
-            cliff_map.set(row, col, std::max(0.0f, std::min(1.0f, cliffmod)));
         }
+    });
+}
+
+// Normalize the moisture noise.
+void TerrainGenerator::generate_moisture_map()
+{
+    moisture_map = ValueMap(size);
+    moisture_map.map = moisture_noise;
+    moisture_map.find_range();
+    for (float& moisture: moisture_map.map)
+    {
+        moisture = moisture_map.normalized(moisture, 0.0f, 1.0f);
     }
-    altitude_map.normalize(0.0f, 1.0f);
-    moisture_map.normalize(0.0f, 1.0f);
+}
 
-    for (int row = 0; row < size; row += 1)
+// Scale the altitude into heights, and smooth the centre of the island.
+void TerrainGenerator::generate_heightmap()
+{
+    heightmap = ValueMap(size);
+    for (std::size_t i = 0; i < heightmap.map.size(); i += 1)
     {
-        for (int col = 0; col < size; col += 1)
+        heightmap.map[i] = altitude_map.map[i] * params.height_scale;
+    }
+    heightmap.find_range();
+
+    // Blur the region around 0,0.
+    // This smooths the heightmap, as the positions are only created from
+    // it in the next stage.
+    const int r = 3;
+    box_blur(
+        heightmap.map.data(), size, 1, 20, 1.0f,
+        size / 2 - r, size / 2 + r + 1,
+        size / 2 - r, size / 2 + r + 1);
+
+    sealevel = 0.05f * max_height;
+}
+
+// Assign the biome of each vertex from its altitude and moisture.
+void TerrainGenerator::generate_biome_map()
+{
+    ThreadPool::shared().parallel_for(0, size, 8, [&](int row_begin, int row_end)
+    {
+        for (int i = size * row_begin; i < size * row_end; i += 1)
         {
-            altitude_map.set(row, col, altitude_map.get(row, col)
-                                       * cliff_map.get(row, col));
+            biomes[i] = assign_biome(
+                altitude_map.map[i], moisture_map.map[i] + params.moisture_bias, params);
         }
+    });
+}
+
+// Colour each vertex by its biome.
+void TerrainGenerator::generate_colour_map()
+{
+    for (std::size_t i = 0; i < biomes.size(); i += 1)
+    {
+        colours[i] = params.colours[int(biomes[i])];
     }
+}
 
-    // The altitude is modified to force a coast look using a quarter-circle.
-    auto interpol = [](float x, float x0, float x1, float y0, float y1)
+// Stage 1 for tiles: Like the island stages, but with values that depend
+// only on the global index of each vertex.
+void TerrainGenerator::generate_tile_map()
+{
+    // The heightmap extends one vertex past the far edges of the tile.
+    const int map_size = size + 1;
+    heightmap = ValueMap(map_size);
+
+    // The noise is sampled with the same feature scale (in vertices) as
+    // the default 100 vertex island.
+    auto noise_coord = [](int global) -> float
     {
-        return y0 + (x - x0) * (y1 - y0) / (x1 - x0);
+        return float(global) / 25.0f + 0.5f;
     };
-    
-    for (int row = 0; row < size; row += 1)
+    // Fixed bounds are used in place of a map's min and max when
+    // normalizing, so a value does not depend on the rest of the tile.
+    auto normalized = [](float value, float min, float max) -> float
     {
-        for (int col = 0; col < size; col += 1)
+        return std::max(0.0f, std::min(1.0f, (value - min) / (max - min)));
+    };
+
+    ThreadPool::shared().parallel_for(0, map_size, 8, [&](int row_begin, int row_end)
+    {
+        std::vector<float> xs(map_size), ys(map_size), zs(map_size);
+        std::vector<float> altitudes(map_size), moistures(map_size);
+        for (int col = 0; col < map_size; col += 1)
         {
-            float altitude = altitude_map.get(row, col);
-            float moisture = moisture_map.get(row, col);
-            // Set height based on the altitude.
-            // The height maps altitude [0,1] to height [0,max_height], but not linearly.
-            float vert_height = max_height * pow(altitude, 1.5f);
-            heightmap.set(row, col, altitude * 92.0f);//max_height);
-
-            // Assign colour based on the biome.
-            Biome biome = assign_biome(altitude, moisture);
-            glm::vec3 colour = biome_colours[int(biome)];
-            set_biome(row, col, biome);
-            set_colour(row, col, colour);
+            ys[col] = noise_coord(origin_col + col);
         }
-    }
-    
-    // Blue the region around 0,0.
-    int r = 3;
-    for (int i = -r; i <= r; i += 1)
-    {
-        for (int j = -r; j <= r; j += 1)
+        for (int row = row_begin; row < row_end; row += 1)
         {
-            set_position(i + size / 2, j + size/ 2,
-                blur_value(Positions, i + size/2, j + size/2, 1.0, 20));
+            std::fill(xs.begin(), xs.end(), noise_coord(origin_row + row));
+            std::fill(zs.begin(), zs.end(), 0.5f);
+            fbm_noise3_batch(
+                xs.data(), ys.data(), zs.data(),
+                2.0f,                           // Frequency increase per octave
+                0.5f,                           // Multiplier per successive octave
+                6,                              // Number of octaves
+                altitudes.data(), map_size);
+            std::fill(zs.begin(), zs.end(), 1.5f);
+            fbm_noise3_batch(
+                xs.data(), ys.data(), zs.data(),
+                2.1f,                           // Frequency increase per octave
+                0.4f,                           // Multiplier per successive octave
+                6,                              // Number of octaves
+                moistures.data(), map_size);
+
+            for (int col = 0; col < map_size; col += 1)
+            {
+                // Flatten the altitude to force plains, as on the island.
+                float altitude = std::pow(
+                    normalized(altitudes[col], -1.0f, 1.0f), 3.5f);
+                altitude = normalized(altitude, 0.0f, 0.5f);
+                const float moisture = normalized(moistures[col], -0.6f, 0.6f);
+
+                heightmap.map[map_size * row + col] = altitude * 92.0f;
+
+                // The extra row and column only need heights.
+                if (row >= size || col >= size) continue;
+                Biome biome = assign_biome(altitude, moisture, params);
+                set_biome(row, col, biome);
+                set_colour(row, col, params.colours[int(biome)]);
+            }
         }
-    }
+    });
 
     sealevel = 0.05f * max_height;
 }
 
-// Stage 2: Convert the heightmap into positions.
+// Stage 2: Erode the heightmap, if erosion parameters were given.
+void TerrainGenerator::erode_heightmap()
+{
+    if (erosion == nullptr || tiled) return;
+    erode(heightmap.map, size, vert_dist, seed, *erosion);
+}
+
+// Stage 3: Convert the heightmap into positions.
 void TerrainGenerator::generate_positions()
 {
     // Build positions.
@@ -424,13 +792,26 @@ void TerrainGenerator::generate_positions()
     //  x = -size/2 + size * (row / size)
     //  y = the heightmap value
     //  z = -size/2 + size * (col / size)
+    // Tiles are instead positioned by their global vertex index.
+    if (tiled)
+    {
+        for (int row = 0; row < size; row += 1)
+        {
+            for (int col = 0; col < size; col += 1)
+            {
+                set_position(row, col, tile_position(row, col));
+            }
+        }
+        return;
+    }
     for (int row = 0; row < size; row += 1)
     {
         for (int col = 0; col < size; col += 1)
         {
+            const float edit = height_edits.empty() ? 0.0f : height_edits[size * row + col];
             glm::vec3 position(
                 -edge / 2.0f + edge * float(row) / (size - 1),
-                heightmap.get(row, col),
+                heightmap.get(row, col) + edit,
                 -edge / 2.0f + edge * float(col) / (size - 1));
 
             set_position(row, col, position);
@@ -438,7 +819,18 @@ void TerrainGenerator::generate_positions()
     }
 }
 
-// Stage 3: Generate normals.
+// Give the vertices edited the biome and colour of their height.
+void TerrainGenerator::colour_edits()
+{
+    for (std::size_t i = 0; i < edited.size(); i += 1)
+    {
+        if (!edited[i]) continue;
+        biomes[i] = height_biome(positions[i].y, moisture_map.map[i], params);
+        colours[i] = params.colours[int(biomes[i])];
+    }
+}
+
+// Stage 4: Generate normals.
 void TerrainGenerator::generate_normals()
 {
     // Build normals.
@@ -448,13 +840,36 @@ void TerrainGenerator::generate_normals()
     //                            |
     //                            v  
     //               row+1,col -> .
+    // Tiles have heights one vertex past their far edges, so each normal
+    // is found this way, and matches the normal on a neighbouring tile.
+    if (tiled)
+    {
+        for (int row = 0; row < size; row += 1)
+        {
+            for (int col = 0; col < size; col += 1)
+            {
+                glm::vec3 at    = tile_position(  row,   col);
+                glm::vec3 below = tile_position(row+1,   col);
+                glm::vec3 right = tile_position(  row, col+1);
+
+                glm::vec3 downward = below - at;
+                glm::vec3 rightward = right - at;
+                set_normal(row, col, glm::normalize(glm::cross(rightward, downward)));
+            }
+        }
+        return;
+    }
     for (int row = 0; row < size; row += 1)
     {
         for (int col = 0; col < size; col += 1)
         {
+            // The last row and column have no vertex below or to the right,
+            // so they copy a normal already found: the last row copies the
+            // vertex to its left, and the last column the vertex up and to
+            // its left (or to its left, in row 0, which has none above).
             glm::vec3 norm;
             if      (row == size-1) norm = get_normal(  row, col-1);
-            else if (col == size-1) norm = get_normal(row-1, col-1);
+            else if (col == size-1) norm = get_normal(std::max(row-1, 0), col-1);
             else
             {
                 // Get the points at, above, and to the right of the current point.
@@ -483,13 +898,13 @@ glm::vec3 randomize_shade(glm::vec3 colour, float amt)
         + glm::vec3(1.0f, 1.0f, 1.0f) * 2.0f * (randf() - 0.5f) * amt;
 }
 
-// Stage 4: Generate materials accociated with each position.
+// Stage 5: Generate materials accociated with each position.
 void TerrainGenerator::generate_materials()
 {
     fatal("Deprecated function generate_materials");
 }
 
-// Stage 5: Generate indices.
+// Stage 6: Generate indices.
 void TerrainGenerator::generate_indices()
 {
     // Build indices.
@@ -514,200 +929,581 @@ void TerrainGenerator::generate_indices()
             const float d_height = get_position(row + 1, col + 1).y;
 
             // Only render a triangle if at least one vert is above sea level.
+            // Tiles keep every triangle: sea culling is only done over the
+            // whole island, and tiles are never edited. Editable islands
+            // keep them too (see set_sea_culling).
             // First triangle (upper-left on diagram).
-            const float cull_height = sealevel * 0.5;
+            const float cull_height = tiled || !cull_sea
+                ? std::numeric_limits<float>::lowest() : sealevel * 0.5;
             if (a_height    >= cull_height
                 || b_height >= cull_height
                 || c_height >= cull_height)
             {
-                indices.push_back({{a, b, c}});
+                indices.insert(indices.end(), {a, b, c});
             }
             // Second triangle (lower-right on diagram).
             if (c_height    >= cull_height
                 || b_height >= cull_height
                 || d_height >= cull_height)
             {
-                indices.push_back({{c, b, d}});
+                indices.insert(indices.end(), {c, b, d});
             }
         }
     }
 }
 
 
-void TerrainGenerator::populate()
+// Objects are placed at blue noise points on a grid of div*div cells per
+// quad (see Placement.hpp), where the table for the biome below chooses
+// whether an object is placed, and which.
+// The cells are indexed globally, so tiles (and the bands of a streamed
+// island) agree at their seams, and each only places objects in the cells
+// of its own quads.
+static const int object_div = 2;
+static const int object_radius = 1;
+// The cells are split into blocks which are placed in parallel. Each
+// block's points and objects are kept separately and joined in block
+// order, so the result does not depend on the number of threads.
+static const int object_block_cells = 32;
+
+// Stage 7: Object positions, over quad rows [row_begin, row_end).
+TerrainGenerator::ObjectCells TerrainGenerator::object_positions(
+    int row_begin, int row_end) const
 {
-    // The objects required are:
-    Mesh* pine          = resources->get_mesh("Pine02");
-    Mesh* stump         = resources->get_mesh("Stump");
-    Shader* tex_shader  = resources->get_shader("obj-cel");
+    ObjectCells cells;
+    cells.row_cells = (row_end - row_begin) * object_div;
+    cells.col_cells = (size - 1) * object_div;
+    cells.first_row = origin_row * object_div;
+    cells.first_col = origin_col * object_div;
+    cells.first_cell_row = cells.first_row + row_begin * object_div;
+    cells.row_blocks = ThreadPool::num_bands(0, cells.row_cells, object_block_cells);
+    cells.col_blocks = ThreadPool::num_bands(0, cells.col_cells, object_block_cells);
+    cells.points.resize(cells.row_blocks * cells.col_blocks);
+    ThreadPool::shared().parallel_for(0, int(cells.points.size()), 1, [&](int block_begin, int block_end)
+    {
+        for (int block = block_begin; block < block_end; block += 1)
+        {
+            const int block_row = cells.first_cell_row + (block / cells.col_blocks) * object_block_cells;
+            const int block_col = cells.first_col + (block % cells.col_blocks) * object_block_cells;
+            cells.points[block] = blue_noise_points(
+                seed, object_radius,
+                block_row, std::min(block_row + object_block_cells, cells.first_cell_row + cells.row_cells),
+                block_col, std::min(block_col + object_block_cells, cells.first_col + cells.col_cells));
+        }
+    });
+    return cells;
+}
 
-    // To place objects, we evaluate some noise function and
-    // select the local maxima, and place an object there with some
-    // optional probability. The density of the placed objects
-    // depends on the period of the noise function.
+// Stage 8: Object population, at the points of each block.
+void TerrainGenerator::populate(const ObjectCells& cells)
+{
+    const int div = object_div;
+    const int first_row = cells.first_row;
+    const int first_col = cells.first_col;
+    // The x of row 0, which the bands of a streamed island may not hold.
+    const float x0 = first_row_held == 0 ? positions[0].x : -edge / 2.0f;
+
+    // The objects required are those in the vegetation table.
+    Shader* shader = resources->get_shader("obj-cel");
+    struct Choice { Mesh* mesh; float weight; float scale; };
+    std::vector<std::vector<Choice>> choices(num_biomes);
+    const std::vector<Vegetation> vegetation = make_vegetation_table();
+    for (int biome = 0; biome < num_biomes; biome += 1)
+    {
+        for (const VegetationChoice& choice: vegetation[biome].choices)
+        {
+            choices[biome].push_back(
+                {resources->get_mesh(choice.mesh), choice.weight, choice.scale});
+        }
+    }
 
-    // Add pine trees to PineForest biome.
+    const int num_blocks = cells.points.size();
+    std::vector<std::vector<Object*>> block_objects(num_blocks);
+    ThreadPool::shared().parallel_for(0, num_blocks, 1, [&](int block_begin, int block_end)
     {
-        std::vector<std::vector<bool>> locations;
-        int div = 2;
-        float div_size = edge / (size * div);
-        object_position_map(1, div, locations);
-        // The number of positions to divide an edge unit into.
-        // 1 will assign 1 possible position per vertex,
-        // 2 four (an equal distance apart), etc.
-        for (int row = 0; row < size; row += 1)
+        for (int block = block_begin; block < block_end; block += 1)
         {
-            for (int col = 0; col < size; col += 1)
+            // Keep the points on biomes that pass their density test.
+            std::vector<PlacementPoint> candidates;
+            std::vector<float> rows, cols;
+            for (const PlacementPoint& point: cells.points[block])
+            {
+                const float row = float(point.row - first_row + point.u) / div;
+                const float col = float(point.col - first_col + point.v) / div;
+                const Biome biome = get_biome(int(row), int(col));
+                if (choices[biome].empty()) continue;
+                if (placement_randf(seed, point.row, point.col, 3)
+                    >= vegetation[biome].density * params.vegetation_density) continue;
+                candidates.push_back(point);
+                rows.push_back(row);
+                cols.push_back(col);
+            }
+
+            // Find the height and slope under every candidate at once.
+            const int n = candidates.size();
+            std::vector<float> heights(n), slope_cos(n);
+            sample_terrain(rows.data(), cols.data(), n, heights.data(), slope_cos.data());
+
+            for (int i = 0; i < n; i += 1)
             {
-                for (int dr = 0; dr < div; dr += 1)
+                const PlacementPoint& point = candidates[i];
+                const Biome biome = get_biome(int(rows[i]), int(cols[i]));
+                // Don't generate if we're above a certain gradient.
+                if (slope_cos[i] < vegetation[biome].min_slope_cos) continue;
+
+                // Select object to generate.
+                float total = 0.0f;
+                for (const Choice& choice: choices[biome]) total += choice.weight;
+                float pick = total * placement_randf(seed, point.row, point.col, 4);
+                const Choice* chosen = &choices[biome].back();
+                for (const Choice& choice: choices[biome])
                 {
-                    for (int dc = 0; dc < div; dc += 1)
+                    if (pick < choice.weight)
                     {
-                        if (locations.at(div * row + dr).at(div * col + dc)
-                            && ( get_biome(row, col) == Woodland
-                              || get_biome(row, col) == Forest
-                              || get_biome(row, col) == PineForest))
-                        {
-                            // Get the height at this position.
-                            const float x = get_position(row, col).x + dr * div_size;
-                            const float z = get_position(row, col).z + dc * div_size;
-                            const float y = get_height_at(x, z);
-
-                            // Don't generate if we're above a certain gradient.
-                            if (get_face_norm_cos_angle(x, z) < 0.8f) continue;
-
-                            // Select object to generate.
-                            float p = randf();
-                            Mesh* model;
-                            glm::vec3 scale;
-                            if (p < 0.90f)
-                            {
-                                model = pine;
-                                scale = glm::vec3(1.2f);
-                            }
-                            else
-                            {
-                                model = stump;
-                                scale = glm::vec3(1.0f);
-                            }
-
-                            glm::vec3 offset(
-                                randf() * 0.5f * div_size,
-                                -0.7f,
-                                randf() * 0.5f * div_size);
-
-                            Object* obj = new Object(
-                                model,
-                                glm::vec3(x, y, z), 
-                                tex_shader);
-                            obj->scale = scale + 0.1f * randf();
-                            objects.push_back(obj);
-                        }
+                        chosen = &choice;
+                        break;
                     }
+                    pick -= choice.weight;
                 }
+
+                Object* obj = new Object(
+                    chosen->mesh,
+                    glm::vec3(
+                        x0 + rows[i] * vert_dist,
+                        heights[i],
+                        positions[0].z + cols[i] * vert_dist),
+                    shader);
+                obj->scale = glm::vec3(chosen->scale)
+                    + 0.1f * placement_randf(seed, point.row, point.col, 5);
+                // Tile objects are not updated by the Scene each frame.
+                obj->update_model_matrix();
+                obj->update_normal_matrix();
+                block_objects[block].push_back(obj);
             }
         }
+    });
+    for (const std::vector<Object*>& block: block_objects)
+    {
+        objects.insert(objects.end(), block.begin(), block.end());
     }
-    
 }
 
-// ----------------------------------
-// -- Processing utility functions --
-// ----------------------------------
-// Blur a property of a vertex on the map by some ammount.
-glm::vec3 TerrainGenerator::blur_value(
-    Property property, int row, int col, float amt, int kernel_size)
+// Stages 7 and 8, over quad rows [row_begin, row_end).
+void TerrainGenerator::populate(int row_begin, int row_end)
 {
-    // Clamp amt to [0, 1].
-    if (amt < 0.0f) amt = 0.0f;
-    if (amt > 1.0f) amt = 1.0f;
+    populate(object_positions(row_begin, row_end));
+}
 
-    // Determine the property vector to blur.
-    std::vector<glm::vec3>* properties = nullptr;
-    switch (property)
+// Find the height, and the cosine of the angle between the face normal
+// and the y axis, at n points on the terrain.
+void TerrainGenerator::sample_terrain(
+    const float* rows, const float* cols, int n,
+    float* heights, float* slope_cos) const
+{
+    for (int i = 0; i < n; i += 1)
     {
-    case Positions: properties = &positions; break;
-    case Normals:   properties = &normals;   break;
-    case Colours:   properties = &colours;   break;
-    default:
-        fatal("TerrainGenerator::blur_value was passed an invalid property");
+        // The quad containing the point, clamped to the terrain.
+        const int row = std::max(0, std::min(size - 2, int(rows[i])));
+        const int col = std::max(0, std::min(size - 2, int(cols[i])));
+        const float fr = rows[i] - row;
+        const float fc = cols[i] - col;
+        const glm::vec3 a = get_position(row, col);
+        const glm::vec3 b = get_position(row, col + 1);
+        const glm::vec3 c = get_position(row + 1, col);
+        const glm::vec3 d = get_position(row + 1, col + 1);
+        // The quad is split into triangles abc and cbd (see generate_indices).
+        glm::vec3 face_norm;
+        if (fr + fc <= 1.0f)
+        {
+            heights[i] = a.y + fc * (b.y - a.y) + fr * (c.y - a.y);
+            face_norm = glm::cross(b - a, c - a);
+        }
+        else
+        {
+            heights[i] = d.y + (1.0f - fc) * (c.y - d.y) + (1.0f - fr) * (b.y - d.y);
+            face_norm = glm::cross(b - c, d - c);
+        }
+        slope_cos[i] = std::abs(glm::normalize(face_norm).y);
     }
+}
 
-    // Average the values over the kernel.
-    glm::vec3 sum(0.0f, 0.0f, 0.0f);
-    int num_values = 0;
-    for (int i = row - kernel_size; i <= row + kernel_size; i += 1)
+// ---------------
+// -- Streaming --
+// ---------------
+// Generate an island a band of rows at a time, within a memory budget.
+Landscape* TerrainGenerator::stream_landscape(
+    int seed, int size, float edge, float max_height, std::size_t memory_budget,
+    ResourceManager* resources, const Params* params)
+{
+    // Each row of a band holds a position and a biome for each vertex,
+    // and each band holds up to three rows beyond it (see stream()).
+    const std::size_t row_bytes = std::size_t(size) * (sizeof(glm::vec3) + sizeof(Biome));
+    const std::size_t landscape_bytes = streamed_landscape_bytes(size);
+    const int min_band_rows = 8;
+    const std::size_t least_bytes = landscape_bytes + (min_band_rows + 3) * row_bytes;
+    if (memory_budget < least_bytes)
     {
-        for (int j = col - kernel_size; j <= col + kernel_size; j += 1)
-        {
-            if (i >= 0 && j >= 0 && i < size && j < size)
-            {
-                sum += properties->at(size * i + j);
-                num_values += 1;
-            }
-        }
+        warn("A streamed island of " + std::to_string(size) + " x " + std::to_string(size)
+             + " vertices needs at least "
+             + std::to_string((least_bytes + (1 << 20) - 1) >> 20) + " MB");
+        return nullptr;
     }
-    // Return the blurred ammount.
-    return (1.0f - amt) * properties->at(size * row + col)
-                 + amt  * sum * (1.0f / num_values);
+    const std::size_t band_rows = (memory_budget - landscape_bytes) / row_bytes - 3;
+    TerrainGenerator generator(
+        seed, size, edge, max_height, resources, params != nullptr ? *params : Params());
+    return generator.stream(int(std::min(band_rows, std::size_t(size))));
+}
+
+// The most memory a streamed landscape of size*size vertices takes.
+std::size_t TerrainGenerator::streamed_landscape_bytes(int size)
+{
+    const std::size_t vertices = std::size_t(size) * size;
+    const std::size_t quads = std::size_t(size - 1) * (size - 1);
+    // The positions, normals, colours, moisture, morph targets, packed
+    // vertices and height grid of every vertex.
+    const std::size_t vertex_bytes =
+        3 * sizeof(glm::vec3) + sizeof(float) + sizeof(glm::vec2)
+        + sizeof(Landscape::PackedVertex) + sizeof(float);
+    // Two triangles for every quad, above the sea or not. The level of
+    // detail adds a third as many again in 16 bits, in vectors which may
+    // hold up to twice their size as they grow.
+    const std::size_t quad_bytes = 6 * sizeof(unsigned int) + 2 * 8 * sizeof(uint16_t);
+    // There are fewer objects than one per 8 quads, even on the densest
+    // biomes.
+    const std::size_t object_bytes = sizeof(Object) + sizeof(Object*);
+    return vertices * vertex_bytes + quads * quad_bytes + quads / 8 * object_bytes;
 }
 
-// Populate
-static float seed = 0.0f;
-void TerrainGenerator::object_position_map(
-    int radius,     // The search radius for maxima, or how
-                    // dense the generated objects should be.
-    int div,        // Each square in the heightmap will be divided
-                    // into div*div regions, each of which can have an
-                    // object.
-    std::vector<std::vector<bool>>& objects) // The output.
+// Create a generator for streaming an island.
+TerrainGenerator::TerrainGenerator(
+    int seed, int size, float edge, float max_height,
+    ResourceManager* resources, const Params& params)
+    : size(size), first_row_held(0), edge(edge), sealevel(0.05f * max_height),
+      cull_sea(true), params(params), max_height(max_height), resources(resources),
+      tiled(false), origin_row(0), origin_col(0), vert_dist(edge / (size - 1)),
+      seed(seed), progress(nullptr), erosion(nullptr)
+{}
+
+// Generate the island in bands of band_rows rows, into a new landscape.
+Landscape* TerrainGenerator::stream(int band_rows)
 {
-    objects.resize(size * div);
-    for (auto& vec: objects)
+    ThreadPool& pool = ThreadPool::shared();
+    const int quads = size - 1;
+    const int centre = size / 2;
+    centre_noise = island_centre_noise(size);
+    // The shaped altitude, before it is normalized, at row, col, given the
+    // noise of the row (see generate_altitude_map).
+    auto shaped_altitude = [&](const float* noise, int row, int col) -> float
+    {
+        if (row == centre && col == centre)
+        {
+            return island_altitude(centre_noise, centre - 1, centre, size, params);
+        }
+        return island_altitude(noise[col], row, col, size, params);
+    };
+
+    // -- Ranges --
+    // The altitude and moisture are normalized over their ranges on the
+    // whole island, so the noise is first sampled just to find those,
+    // a row at a time.
+    std::vector<std::array<float, 4>> row_ranges(size);
+    pool.parallel_for(0, size, 8, [&](int row_begin, int row_end)
     {
-        vec.resize(size * div);
-        std::fill(vec.begin(), vec.end(), false);
+        std::vector<float> altitude(size), moisture(size);
+        for (int row = row_begin; row < row_end; row += 1)
+        {
+            island_noise_row(row, size, size, altitude.data(), moisture.data());
+            std::array<float, 4>& range = row_ranges[row];
+            range = {{ std::numeric_limits<float>::max(), std::numeric_limits<float>::min(),
+                       std::numeric_limits<float>::max(), std::numeric_limits<float>::min() }};
+            for (int col = 0; col < size; col += 1)
+            {
+                const float value = shaped_altitude(altitude.data(), row, col);
+                range[0] = std::min(range[0], value);
+                range[1] = std::max(range[1], value);
+                range[2] = std::min(range[2], moisture[col]);
+                range[3] = std::max(range[3], moisture[col]);
+            }
+        }
+    });
+    // The same starting range as ValueMap::find_range.
+    altitude_map.min = moisture_map.min = std::numeric_limits<float>::max();
+    altitude_map.max = moisture_map.max = std::numeric_limits<float>::min();
+    for (const std::array<float, 4>& range: row_ranges)
+    {
+        altitude_map.min = std::min(altitude_map.min, range[0]);
+        altitude_map.max = std::max(altitude_map.max, range[1]);
+        moisture_map.min = std::min(moisture_map.min, range[2]);
+        moisture_map.max = std::max(moisture_map.max, range[3]);
     }
 
-    ValueMap noise(size * div);
-    float density = 100.0f;
+    // Sample the normalized altitude and moisture of a row.
+    auto sample_row = [&](int row, float* altitude, float* moisture)
+    {
+        island_noise_row(row, size, size, altitude, moisture);
+        for (int col = 0; col < size; col += 1)
+        {
+            altitude[col] = altitude_map.normalized(shaped_altitude(altitude, row, col), 0.0f, 1.0f)
+                          * island_cliff_at(row, col, size);
+            moisture[col] = moisture_map.normalized(moisture[col], 0.0f, 1.0f);
+        }
+    };
 
-    for (int row = 0; row < size * div; row += 1)
+    // -- Centre --
+    // The heights around the centre are blurred (see generate_heightmap),
+    // which needs the heights within the blur's radius of them. These are
+    // found first, in a square window of the map.
+    const int r = 3;
+    const int blur_radius = 20;
+    const int window_begin = std::max(centre - r - blur_radius, 0);
+    const int window_end = std::min(centre + r + 1 + blur_radius, size);
+    const int window = window_end - window_begin;
+    std::vector<float> window_heights(std::size_t(window) * window);
     {
-        for (int col = 0; col < size * div; col += 1)
+        std::vector<float> altitude(size), moisture(size);
+        for (int row = window_begin; row < window_end; row += 1)
         {
-            float value = stb_perlin_noise3(
-                float(row) * density / (size * div) + 0.5f,
-                float(col) * density / (size * div) + 0.5f,
-                seed,
-                0,0,0);
-            noise.set(row, col, value);
+            sample_row(row, altitude.data(), moisture.data());
+            for (int col = window_begin; col < window_end; col += 1)
+            {
+                window_heights[window * (row - window_begin) + col - window_begin] =
+                    altitude[col] * params.height_scale;
+            }
         }
     }
+    box_blur(
+        window_heights.data(), window, 1, blur_radius, 1.0f,
+        centre - r - window_begin, centre + r + 1 - window_begin,
+        centre - r - window_begin, centre + r + 1 - window_begin);
+    auto blurred = [&](int row, int col)
+    {
+        return std::abs(row - centre) <= r && std::abs(col - centre) <= r
+            && row >= 0 && row < size && col >= 0 && col < size;
+    };
 
-    for (int row = 0; row < size * div; row += 1)
+    // -- Bands --
+    Landscape* landscape = new Landscape;
+    landscape->edge = edge;
+    landscape->size = size;
+    landscape->positions.resize(std::size_t(size) * size);
+    landscape->normals.resize(std::size_t(size) * size);
+    landscape->colours.resize(std::size_t(size) * size);
+    landscape->moisture.resize(std::size_t(size) * size);
+    const float cull_height =
+        cull_sea ? sealevel * 0.5f : std::numeric_limits<float>::lowest();
+    for (int band_begin = 0; band_begin < size; band_begin += band_rows)
     {
-        for (int col = 0; col < size * div; col += 1)
+        const int band_end = std::min(band_begin + band_rows, size);
+        // The rows held are the band and the rows its normals and
+        // triangles use: the row after it, the row before it (for the
+        // normals of the last column, copied from the row before) and, for
+        // the last band, the rows the normals of the last row are copied
+        // from.
+        int held_begin = std::max(band_begin - 1, 0);
+        if (band_end == size) held_begin = std::min(held_begin, std::max(size - 3, 0));
+        const int held_end = std::min(band_end + 1, size);
+        first_row_held = held_begin;
+        positions.resize(std::size_t(held_end - held_begin) * size);
+        biomes.resize(std::size_t(held_end - held_begin) * size);
+
+        // Positions, biomes and colours, as in stage 1 and 3.
+        pool.parallel_for(held_begin, held_end, 8, [&](int row_begin, int row_end)
         {
-            float max = std::numeric_limits<float>::lowest();
-            int xmax, ymax;
-            for (int i = -radius; i <= radius; i += 1)
+            std::vector<float> altitude(size), moisture(size);
+            for (int row = row_begin; row < row_end; row += 1)
             {
-                for (int j = -radius; j <= radius; j += 1)
+                sample_row(row, altitude.data(), moisture.data());
+                for (int col = 0; col < size; col += 1)
                 {
-                    int x = row + i, y = col + j;
-                    if (x < 0 || y < 0 || x >= size*div || y >= size*div) continue;
-                    if (noise.get(x, y) > max) 
+                    float height = altitude[col] * params.height_scale;
+                    if (blurred(row, col))
                     {
-                        max = noise.get(x, y);
-                        xmax = x; ymax = y;
+                        height = window_heights[
+                            window * (row - window_begin) + col - window_begin];
                     }
+                    const glm::vec3 position(
+                        -edge / 2.0f + edge * float(row) / (size - 1),
+                        height,
+                        -edge / 2.0f + edge * float(col) / (size - 1));
+                    const Biome biome = assign_biome(
+                        altitude[col], moisture[col] + params.moisture_bias, params);
+                    set_position(row, col, position);
+                    set_biome(row, col, biome);
+                    if (row < band_begin || row >= band_end) continue;
+                    const std::size_t i = std::size_t(size) * row + col;
+                    landscape->positions[i] = position;
+                    landscape->colours[i] = params.colours[int(biome)];
+                    landscape->moisture[i] = moisture[col];
+                }
+            }
+        });
+
+        // Normals, as in stage 4: the last row copies the normal before it
+        // in memory, and the last column the normal up a row and left a
+        // column, so both are found from the quad those normals are.
+        pool.parallel_for(band_begin, band_end, 8, [&](int row_begin, int row_end)
+        {
+            for (int row = row_begin; row < row_end; row += 1)
+            {
+                for (int col = 0; col < size; col += 1)
+                {
+                    int r = row;
+                    int c = col;
+                    if      (r == quads) { r = std::max(quads - 2, 0); c = quads - 1; }
+                    else if (c == quads) { r = std::max(r - 1, 0);     c = quads - 1; }
+                    const glm::vec3 at    = get_position(  r,   c);
+                    const glm::vec3 below = get_position(r+1,   c);
+                    const glm::vec3 right = get_position(  r, c+1);
+                    landscape->normals[std::size_t(size) * row + col] =
+                        glm::normalize(glm::cross(right - at, below - at));
                 }
             }
-            if (xmax == row && ymax == col) objects.at(row).at(col) = true;
+        });
+
+        // Triangles, as in stage 6, and objects, as in stage 7, on the
+        // band's quads.
+        const int quad_end = std::min(band_end, quads);
+        for (int row = band_begin; row < quad_end; row += 1)
+        {
+            for (int col = 0; col < quads; col += 1)
+            {
+                const unsigned int a = ( row      * size + col);
+                const unsigned int b = ( row      * size + col + 1);
+                const unsigned int c = ((row + 1) * size + col);
+                const unsigned int d = (unsigned int)((row + 1) * size + col + 1);
+                const float a_height = get_position(row,     col).y;
+                const float b_height = get_position(row,     col + 1).y;
+                const float c_height = get_position(row + 1, col).y;
+                const float d_height = get_position(row + 1, col + 1).y;
+                if (a_height >= cull_height || b_height >= cull_height || c_height >= cull_height)
+                {
+                    landscape->indices.insert(landscape->indices.end(), {a, b, c});
+                }
+                if (c_height >= cull_height || b_height >= cull_height || d_height >= cull_height)
+                {
+                    landscape->indices.insert(landscape->indices.end(), {c, b, d});
+                }
+            }
+        }
+        if (band_begin < quad_end)
+        {
+            populate(band_begin, quad_end);
         }
     }
-    seed += 1.0f;
+    // The band is no longer needed.
+    std::vector<glm::vec3>().swap(positions);
+    std::vector<Biome>().swap(biomes);
+    first_row_held = 0;
+
+    landscape->origin = glm::vec2(landscape->positions[0].x, landscape->positions[0].z);
+    finish_landscape(landscape);
+    return landscape;
+}
+
+// ----------------------------------
+// -- Processing utility functions --
+// ----------------------------------
+// The per-biome colours, indexed by Biome.
+std::vector<glm::vec3> TerrainGenerator::make_biome_colours()
+{
+    std::vector<std::array<unsigned char, 3>> biome_colours_raw = {{
+        /* Error      */ {{ 255,   0,   0 }},
+        /* Ocean      */ {{ 222, 198, 160 }},
+        /* Beach      */ {{ 209, 184, 142 }},
+        /* Dunes      */ {{ 160, 144, 120 }},
+        /* Veldt      */ {{ 201, 209, 157 }},
+        /* Grassland  */ {{ 137, 169,  90 }},
+        /* Woodland   */ {{ 104, 147,  91 }},
+        /* Forest     */ {{  71, 135,  87 }},
+        /* PineForest */ {{ 153, 169, 121 }},
+        /* Rock       */ {{  85,  85,  85 }},
+        /* Bare       */ {{ 136, 136, 136 }},
+        /* Moor       */ {{ 136, 152, 120 }},
+        /* Tundra     */ {{ 187, 187, 171 }},
+        /* LightSnow  */ {{ 221, 221, 228 }},
+        /* HeavySnow  */ {{ 238, 238, 238 }},
+    }};
+    std::vector<glm::vec3> colours;
+    for (int i = 0; i < biome_colours_raw.size(); i += 1)
+    {
+        colours.push_back(glm::vec3(
+            float(biome_colours_raw[i][0]) / 255.0f,
+            float(biome_colours_raw[i][1]) / 255.0f,
+            float(biome_colours_raw[i][2]) / 255.0f));
+    }
+    return colours;
+}
+
+// The objects placed on each biome, indexed by Biome.
+std::vector<TerrainGenerator::Vegetation> TerrainGenerator::make_vegetation_table()
+{
+    std::vector<Vegetation> table(num_biomes, Vegetation{0.0f, 0.8f, {}});
+    //                density  slope  choices: mesh, weight, scale
+    table[Woodland]   = { 0.5f, 0.8f, {{"Pine02", 0.7f, 1.2f}, {"Stump", 0.3f, 1.0f}} };
+    table[Forest]     = { 1.0f, 0.8f, {{"Pine02", 0.9f, 1.2f}, {"Stump", 0.1f, 1.0f}} };
+    table[PineForest] = { 1.0f, 0.8f, {{"Pine02", 0.9f, 1.2f}, {"Stump", 0.1f, 1.0f}} };
+    return table;
+}
+
+// The biome for a point with some normalized altitude and moisture.
+TerrainGenerator::Biome TerrainGenerator::assign_biome(
+    float altitude, float moisture, const Params& params)
+{
+    const float* bands = params.altitude_bands;
+    if (altitude < bands[0]) return Ocean;
+    if (altitude < bands[1]) return Beach;
+    if (altitude < bands[2])
+    {
+        const float* m = params.lowland_moisture;
+        if (moisture < m[0]) return Dunes;
+        if (moisture < m[1]) return Veldt;
+        if (moisture < m[2]) return Grassland;
+        if (moisture < m[3]) return Woodland;
+        return Forest;
+    }
+    if (altitude < bands[3])
+    {
+        const float* m = params.upland_moisture;
+        if (moisture < m[0]) return Veldt;
+        if (moisture < m[1]) return Grassland;
+        if (moisture < m[2]) return Woodland;
+        return Forest;
+    }
+    if (altitude < bands[4])
+    {
+        const float* m = params.alpine_moisture;
+        if (moisture < m[0]) return Tundra;
+        if (moisture < m[1]) return Moor;
+        return PineForest;
+    }
+    const float* m = params.peak_moisture;
+    if (moisture < m[0]) return Rock;
+    if (moisture < m[1]) return Bare;
+    if (moisture < m[2]) return LightSnow;
+    return HeavySnow;
+}
+
+// The biome for a vertex with some height and normalized moisture.
+TerrainGenerator::Biome TerrainGenerator::height_biome(
+    float height, float moisture, const Params& params)
+{
+    // The altitude is the height before it was scaled (see
+    // generate_heightmap).
+    const float altitude = params.height_scale != 0.0f ? height / params.height_scale : 0.0f;
+    return assign_biome(altitude, moisture + params.moisture_bias, params);
+}
+
+// Blur a property of a vertex on the map by some ammount.
+void TerrainGenerator::blur(Property property, float amt, int kernel_size)
+{
+    switch (property)
+    {
+    case Positions: box_blur(positions, size, kernel_size, amt); break;
+    case Normals:   box_blur(normals,   size, kernel_size, amt); break;
+    case Colours:   box_blur(colours,   size, kernel_size, amt); break;
+    default:
+        fatal("TerrainGenerator::blur was passed an invalid property");
+    }
 }
 
 // ----------------------------------------------------
@@ -746,16 +1542,8 @@ void TerrainGenerator::ValueMap::normalize(float norm_min, float norm_max)
     {
         for (int col = 0; col < size; col += 1)
         {
-            if (this->min >= this->max)
-            {
-                map[size * row + col] = norm_min;
-            } else
-            {
-                float value = map[size * row + col];
-                float prop = (value - min) / (max - min);
-                float norm_value = norm_min + prop * (norm_max - norm_min);
-                map[size * row + col] = norm_value;
-            }
+            map[size * row + col] =
+                normalized(map[size * row + col], norm_min, norm_max);
         }
     }
 
@@ -763,3 +1551,24 @@ void TerrainGenerator::ValueMap::normalize(float norm_min, float norm_max)
     this->max = norm_max;
 }
 
+void TerrainGenerator::ValueMap::find_range()
+{
+    // The same starting range as a new map.
+    min = std::numeric_limits<float>::max();
+    max = std::numeric_limits<float>::min();
+    for (float value: map)
+    {
+        if (value < min) min = value;
+        if (value > max) max = value;
+    }
+}
+
+float TerrainGenerator::ValueMap::normalized(
+    float value, float norm_min, float norm_max) const
+{
+    // Map value from range <min, max> to <norm_min, norm_max>.
+    if (this->min >= this->max) return norm_min;
+    float prop = (value - min) / (max - min);
+    return norm_min + prop * (norm_max - norm_min);
+}
+
@@ -6,12 +6,19 @@
 #define TERRAINGENERATOR_HPP
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <vector>
 #include <glm/glm.hpp>
 #include <unordered_map>
 
+#include "Erosion.hpp"
 #include "Mesh.hpp"
 #include "Landscape.hpp"
+#include "Placement.hpp"
 #include "ResourceManager.hpp"
 
 #include "stb_perlin.h"
@@ -19,18 +26,187 @@
 class TerrainGenerator
 {
 public:
+    // The number of biomes (see Biome).
+    static constexpr int num_biomes = 15;
+
+    // The number of generation stages reported in Progress, and their names.
+    // The last stage is the conversion in landscape().
+    static const int num_stages = 8;
+    static const char* const stage_names[num_stages];
+
+    // The progress of a generator. This is written by the generator as
+    // each stage finishes, and may be read from other threads meanwhile.
+    struct Progress
+    {
+        Progress();
+        // The number of stages finished.
+        std::atomic<int> stages_done;
+        // The time taken by each finished stage, in milliseconds.
+        std::atomic<float> stage_ms[num_stages];
+        // If set, called on the generating thread as each stage finishes
+        // (after its time is recorded, and not counted in the next stage).
+        std::function<void(int stage)> on_stage;
+    };
+
+    // The parameters shaping the island, which may be changed after it has
+    // been generated (see regenerate()). Tiles use the defaults.
+    struct Params
+    {
+        Params();
+        // -- Altitude --
+        // The exponent flattening the altitude noise, to force plains.
+        float flatness;
+        // The altitude added everywhere before the falloff.
+        float island_base;
+        // How sharply the altitude falls off away from the centre.
+        float island_falloff;
+        // The height of the highest point, before erosion.
+        float height_scale;
+        // -- Biomes --
+        // Added to the moisture of every vertex before choosing its biome.
+        float moisture_bias;
+        // The altitudes at which the ocean, beach, lowland, upland and
+        // alpine bands end.
+        float altitude_bands[5];
+        // The moistures at which the biomes of each band change:
+        // dunes, veldt, grassland and woodland in the lowlands,
+        float lowland_moisture[4];
+        // veldt, grassland and woodland in the uplands,
+        float upland_moisture[3];
+        // tundra and moor in the alpine band,
+        float alpine_moisture[2];
+        // and rock, bare ground and light snow on the peaks.
+        float peak_moisture[3];
+        // -- Objects --
+        // Scales the density of the objects on every biome.
+        float vegetation_density;
+        // -- Colours --
+        // The colour of each biome, indexed by Biome.
+        glm::vec3 colours[num_biomes];
+    };
+
+    // The cached outputs of the generator. Each is computed only from the
+    // outputs before it (see output_inputs), so changing a parameter only
+    // requires the outputs depending on it, and those after them that
+    // depend on those, to be recomputed.
+    enum Output {
+        AltitudeMap,    // The normalized altitude of each vertex.
+        MoistureMap,    // The normalized moisture of each vertex.
+        HeightMap,      // The heights, eroded.
+        BiomeMap,       // The biome of each vertex.
+        ColourMap,      // The colour of each vertex.
+        PositionMap,    // The vertex positions.
+        NormalMap,      // The vertex normals.
+        IndexList,      // The triangles.
+        ObjectList,     // The objects placed.
+        num_outputs
+    };
+    // The bit for an output, in a set of outputs.
+    static constexpr unsigned output_bit(Output output) { return 1u << output; }
+    static constexpr unsigned all_outputs = (1u << num_outputs) - 1;
+    // The outputs each output is directly computed from.
+    static const unsigned output_inputs[num_outputs];
+
     // Create a new TerrainGenerator.
     // The terrain will consist of size*size vertices, and will have
     // dimensions edge*edge.
     // The generator does not take ownership of 'resources', and will not
     // delete it.
+    // If 'progress' is given, it is updated as each stage finishes.
+    // If 'erosion' is given, the heightmap is eroded with those parameters.
+    // If 'params' is given, the island is generated with those parameters,
+    // rather than the defaults.
     TerrainGenerator(
         int seed, int size, float edge, float max_height,
-        ResourceManager* resources = nullptr);
+        ResourceManager* resources = nullptr, Progress* progress = nullptr,
+        const ErosionParams* erosion = nullptr, const Params* params = nullptr);
+    // Create a TerrainGenerator for one tile of an unbounded, tiled terrain.
+    // Each tile consists of size*size vertices spaced vert_dist apart.
+    // Tile (tile_x, tile_z) starts at global vertex (tile_x, tile_z) * (size-1),
+    // so neighbouring tiles share their edge vertices. Every vertex depends
+    // only on its global vertex index, so tiles match exactly at the seams.
+    // (Tiles are not eroded, as erosion depends on the rest of the map.)
+    TerrainGenerator(
+        int seed, int tile_x, int tile_z, int size, float vert_dist,
+        float max_height, ResourceManager* resources = nullptr);
     TerrainGenerator() = delete;
 
+    // Whether the landscapes created leave out the triangles below the sea
+    // (see Landscape::build_lod), as they do unless this is turned off.
+    // Landscapes which may be edited keep them, so raising the sea floor
+    // shows (see Landscape::edit). Tiles never leave them out.
+    void set_sea_culling(bool cull);
+
     // Convert the contained terrain data into a landscape object.
-    Landscape* landscape();
+    // The vertex data and triangles are moved into the landscape, so this
+    // may only be called once, unless 'keep' is set (for a generator that
+    // will be regenerated), in which case they are copied.
+    Landscape* landscape(bool keep = false);
+
+    // -- Streaming --
+    // Generate an island of size*size vertices as the first constructor
+    // does (without erosion, which depends on the whole map), but a band
+    // of rows at a time, writing each band straight into the landscape
+    // returned. Only one band's positions and biomes are held besides the
+    // landscape, so islands too large for every stage's output to be held
+    // at once can be generated within 'memory_budget' bytes. Bands are as
+    // tall as fit in what is left of the budget after the landscape (see
+    // streamed_landscape_bytes).
+    // The noise is sampled twice, once to find the ranges it is normalized
+    // over and once as each band is generated. The heights blurred at the
+    // centre may differ from the first constructor's in the last bits, as
+    // the blur only sees the vertices around them, and the objects are
+    // placed in another order; the rest is the same.
+    // Returns nullptr, with a warning, if the landscape and the smallest
+    // band do not fit in the budget.
+    static Landscape* stream_landscape(
+        int seed, int size, float edge, float max_height, std::size_t memory_budget,
+        ResourceManager* resources = nullptr, const Params* params = nullptr);
+    // The most memory a streamed landscape of size*size vertices takes,
+    // including the objects placed on it and what is briefly held while
+    // its level of detail is built.
+    static std::size_t streamed_landscape_bytes(int size);
+
+    // -- Regeneration --
+    // Change the island's parameters, recomputing only the outputs that
+    // depend on the parameters changed. Returns the set of outputs
+    // recomputed (see output_bit).
+    // Objects placed before are not deleted; they belong to whoever took
+    // them (with landscape() or take_objects()).
+    // Tiles are not regenerated.
+    unsigned regenerate(const Params& params);
+    // The outputs that depend on the differences between two sets of
+    // parameters, including those computed from them.
+    static unsigned outputs_changed(const Params& before, const Params& after);
+    // The parameters the terrain was generated with.
+    const Params& parameters() const;
+    // The colour of every vertex, and the palette of the landscapes created.
+    const std::vector<glm::vec3>& vertex_colours() const;
+    std::vector<glm::vec3> landscape_palette() const;
+    // Take the objects placed. The caller then owns them, and they are not
+    // given to landscapes created afterwards.
+    std::vector<Object*> take_objects();
+    // Keep the edits made to a landscape created by the generator (see
+    // Landscape::edit), given its positions and the vertices edited.
+    // Each edited vertex keeps the difference between its height and the
+    // generated height, so the edit is carried over when the island's
+    // shape is regenerated, and is coloured by its height (see
+    // colour_for) rather than its altitude, as the edit coloured it.
+    // Edits kept before are replaced; the landscapes created afterwards
+    // include them.
+    void keep_edits(
+        const std::vector<glm::vec3>& positions, const std::vector<uint8_t>& edited);
+    // The colour of a vertex with some height and (normalized) moisture,
+    // as the island would be coloured with 'params', for recolouring
+    // edited landscapes (see Landscape::edit).
+    static glm::vec3 colour_for(float height, float moisture, const Params& params);
+
+    // The colour palette used by generated landscapes.
+    static std::vector<glm::vec3> palette();
+
+    // The version of the generated landscapes. Increase this with any
+    // change to the generator's output, so cached landscapes are replaced.
+    static const int version = 4;
 private:
     // --------------------
     // -- Internal types --
@@ -53,7 +229,32 @@ private:
         LightSnow   = 13,
         HeavySnow   = 14,
     };
-    static constexpr int num_biomes = 15;
+    // An object that may be placed on a biome.
+    struct VegetationChoice {
+        const char* mesh;   // The name of the mesh in the resources.
+        float weight;       // The relative chance of this choice.
+        float scale;        // The scale of the object (before jitter).
+    };
+    // The objects placed on a biome.
+    struct Vegetation {
+        // The chance an object is placed at each blue noise point.
+        float density;
+        // The steepest slope objects are placed on, as the cosine of the
+        // angle between the face normal and the y axis.
+        float min_slope_cos;
+        std::vector<VegetationChoice> choices;
+    };
+    // Create a generator for streaming an island (see stream_landscape).
+    // Nothing is generated until stream() is called.
+    TerrainGenerator(
+        int seed, int size, float edge, float max_height,
+        ResourceManager* resources, const Params& params);
+    // Generate the island in bands of band_rows rows, into a new landscape.
+    Landscape* stream(int band_rows);
+    // Build the level of detail, palette and packed vertices of a
+    // landscape with its vertices and indices, and give it the objects.
+    void finish_landscape(Landscape* landscape);
+
     // A heightmap is a matrix of heights (floats).
     // width is leftwards, breadth is downwards.
     struct ValueMap {
@@ -62,6 +263,10 @@ private:
         float get(int row, int col);
         void set(int row, int col, float value);
         void normalize(float norm_min, float norm_max);
+        // Get the value that normalize() would map 'value' to.
+        float normalized(float value, float norm_min, float norm_max) const;
+        // Set min and max from the values in the map.
+        void find_range();
         int size;
         float min;
         float max;
@@ -73,10 +278,27 @@ private:
     // ------------------
     // The number of vertices along each edge.
     int size;
+    // The first row whose position and biome are held. This is 0, except
+    // for the bands of a streamed island (see stream()).
+    int first_row_held;
     // The length of each edge.
     float edge;
     // The sealevel.
     float sealevel;
+    // Whether the triangles below the sea are left out of landscapes.
+    bool cull_sea;
+    // The parameters of the island.
+    Params params;
+    // The altitude noise of each vertex, before it is shaped into the
+    // island, and the moisture noise.
+    std::vector<float> altitude_noise;
+    std::vector<float> moisture_noise;
+    // The altitude noise used at the centre of the island (see
+    // generate_noise).
+    float centre_noise;
+    // The normalized altitude and moisture maps.
+    ValueMap altitude_map;
+    ValueMap moisture_map;
     // The heightmap for the terrain.
     ValueMap heightmap;
     // The maximum height of the landscape.
@@ -86,13 +308,33 @@ private:
     std::vector<glm::vec3> normals;
     std::vector<glm::vec3> colours;
     std::vector<Biome> biomes;
-    std::vector<std::array<unsigned int, 3>> indices;
+    // Three indices per triangle.
+    std::vector<unsigned int> indices;
+    // The edits kept (see keep_edits): which vertices were edited, and the
+    // height each vertex was moved from the heightmap. Both are empty if
+    // there are none.
+    std::vector<uint8_t> edited;
+    std::vector<float> height_edits;
     // Generated objects.
     std::vector<Object*> objects;
-    // The per-biome colours.
-    std::vector<glm::vec3> biome_colours;
     // The mesh and shader data for creating objects.
     ResourceManager* resources;
+    // Tile details (see the tile constructor).
+    // Whether the generator is creating a tile.
+    bool tiled;
+    // The global index of the vertex at row 0, col 0.
+    int origin_row;
+    int origin_col;
+    // The distance between neighbouring vertices.
+    float vert_dist;
+    // The seed used for the objects.
+    int seed;
+    // Where progress is reported, if anywhere.
+    Progress* progress;
+    // The erosion parameters, if the heightmap is eroded.
+    const ErosionParams* erosion;
+    // When the current stage started.
+    std::chrono::steady_clock::time_point stage_start;
 
     // ---------------------------
     // -- Data access functions --
@@ -105,6 +347,10 @@ private:
     std::array<int, 3>  get_tri                 (float x, float z) const;
     float               get_face_norm_cos_angle (float x, float z) const;
     float               get_height_at           (float x, float z) const;
+    // Find the height, and the cosine of the angle between the face normal
+    // and the y axis, at n points given as (fractional) rows and columns.
+    void                sample_terrain          (const float* rows, const float* cols, int n,
+                                                 float* heights, float* slope_cos) const;
     void                set_position            (int row, int col, glm::vec3 pos);
     void                set_normal              (int row, int col, glm::vec3 norm);
     void                set_colour              (int row, int col, glm::vec3 colour);
@@ -115,47 +361,110 @@ private:
     // ---------------------------------------
     // Note: The generation functions should be called in this order:
     //      1. Heightmap
-    //      2. Positions
-    //      3. Normals
-    //      4. Materials
-    //      5. Indices
-    //      6. Object population
+    //      2. Erosion (optional)
+    //      3. Positions
+    //      4. Normals
+    //      5. Materials
+    //      6. Indices
+    //      7. Object positions
+    //      8. Object population
     // With any required processing functions (see below) called between stages.
 
     // Calls all of the core generator functions in order to create a terrain.
-    void generate(int seed, float max_height);
+    void generate();
+    // Compute a set of outputs (see output_bit), in order, from the
+    // outputs before them.
+    void compute(unsigned outputs);
+    // Record that a stage has finished, and start timing the next one.
+    void finish_stage(int stage);
     // Stage 1: Use noise functions to generate a heightmap according to some
-    // noise function(s). Heights will be normalized to range <0, max_height>.
-    // scale is the distance it takes for the noise function to take on a unique
-    // point. (these are interpolated between)
-    void generate_base_map(int seed, float max_height);
-    // Stage 2: Convert the heightmap into positions.
+    // noise function(s), along with the biome and colour of each vertex.
+    // This is split into the outputs below, so each can be recomputed alone.
+    // Sample the altitude and moisture noise. The parameters do not change
+    // the noise, so this is only done once.
+    void generate_noise();
+    // Shape the altitude noise into the island, and normalize it.
+    void generate_altitude_map();
+    // Normalize the moisture noise.
+    void generate_moisture_map();
+    // Scale the altitude into heights, and smooth the centre of the island.
+    void generate_heightmap();
+    // Assign the biome of each vertex from its altitude and moisture.
+    void generate_biome_map();
+    // Colour each vertex by its biome.
+    void generate_colour_map();
+    // Stage 2: Erode the heightmap (see Erosion.hpp), if erosion parameters
+    // were given.
+    void erode_heightmap();
+    // Stage 3: Convert the heightmap into positions.
     void generate_positions();
-    // Stage 3: Generate normals.
+    // Give the vertices edited (see keep_edits) the biome and colour of
+    // their height.
+    void colour_edits();
+    // Stage 4: Generate normals.
     void generate_normals();
-    // Stage 4: Generate materials accociated with each position.
+    // Stage 5: Generate materials accociated with each position.
     void generate_materials();
-    // Stage 5: Generate indices.
+    // Stage 6: Generate indices.
     void generate_indices();
-    // Stage 6: Object population.
-    void populate();
+    // Objects are placed on a grid of cells, div*div per quad, split into
+    // blocks of cells which are placed in parallel.
+    struct ObjectCells
+    {
+        // The global cells, [first_cell_row, first_cell_row + row_cells)
+        // and [first_col, first_col + col_cells), and the global cell of
+        // the tile's first quad.
+        int first_row;
+        int first_col;
+        int first_cell_row;
+        int row_cells;
+        int col_cells;
+        int row_blocks;
+        int col_blocks;
+        // The blue noise points kept in each block, in row major order of
+        // the blocks.
+        std::vector<std::vector<PlacementPoint>> points;
+    };
+    // Stage 7: Object positions, on the quads in rows [row_begin, row_end).
+    // The deterministic blue noise points of every block (see
+    // Placement.hpp), found in parallel, using the tile's own quads for
+    // tiles.
+    ObjectCells object_positions(int row_begin, int row_end) const;
+    // Stage 8: Object population. Objects are placed at the points by the
+    // vegetation table, in parallel.
+    void populate(const ObjectCells& cells);
+    // Stages 7 and 8, on the quads in rows [row_begin, row_end).
+    void populate(int row_begin, int row_end);
+
+    // Tiles use their own versions of some stages, which depend only on
+    // the global index of each vertex.
+    // Stage 1 for tiles: The heightmap extends one vertex past the far edges
+    // of the tile (so normals can be found at the edges), and values are
+    // normalized with fixed bounds rather than the bounds of the map.
+    void generate_tile_map();
+    // The position of the tile vertex at row, col (which may be in the
+    // extra row and column of the heightmap).
+    glm::vec3 tile_position(int row, int col) const;
 
     // ----------------------------------
     // -- Processing utility functions --
     // ----------------------------------
+    // The per-biome colours, indexed by Biome.
+    static std::vector<glm::vec3> make_biome_colours();
+    // The objects placed on each biome, indexed by Biome.
+    static std::vector<Vegetation> make_vegetation_table();
+    // The biome for a point with some normalized altitude and moisture.
+    static Biome assign_biome(float altitude, float moisture, const Params& params);
+    // The biome for a vertex with some height and normalized moisture, as
+    // edited vertices are coloured (see colour_for).
+    static Biome height_biome(float height, float moisture, const Params& params);
+
     enum Property { Positions, Normals, Colours };
-    // Blur a property of a vertex on the map by some ammount.
+    // Blur a property of every vertex on the map by some ammount.
     // (1.0f = full blur, 0.0f = no blur)
-    glm::vec3 blur_value(
-        Property property, int row, int col, float amt, int kernel_size=1);
-
-    void object_position_map(
-        int radius,     // The search radius for maxima, or how
-                        // dense the generated objects should be.
-        int div,        // Each square in the heightmap will be divided
-                        // into div*div regions, each of which can have an
-                        // object.
-        std::vector<std::vector<bool>>& objects);
+    // Each vertex is mixed with the mean over the vertices within
+    // kernel_size rows and columns, in time independent of kernel_size.
+    void blur(Property property, float amt, int kernel_size=1);
 };
 
 #endif // TERRAINGENERATOR_HPP
\ No newline at end of file
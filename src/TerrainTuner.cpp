@@ -0,0 +1,250 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of TerrainTuner class member functions.
+
+#include "TerrainTuner.hpp"
+
+#include <chrono>
+
+#include "Console.hpp"
+#include "Renderer.hpp"
+#include "Scene.hpp"
+#include "ThreadPool.hpp"
+
+TerrainTuner::TerrainTuner(
+    int seed, int size, float edge, float max_height,
+    ResourceManager* resources, bool eroded)
+    : seed(seed),
+      size(size),
+      edge(edge),
+      max_height(max_height),
+      resources(resources),
+      eroded(eroded),
+      edits_kept(0),
+      changed(0),
+      worker_ms(0.0f),
+      regenerate_ms(0.0f),
+      regenerations(0)
+{
+    // -- Altitude --
+    console->register_var(
+        "terrain.flatness",
+        Float,
+        &params.flatness,
+        1,
+        "The exponent flattening the island's altitude, to force plains");
+    console->register_var(
+        "terrain.island_base",
+        Float,
+        &params.island_base,
+        1,
+        "The altitude added everywhere on the island before the falloff");
+    console->register_var(
+        "terrain.island_falloff",
+        Float,
+        &params.island_falloff,
+        1,
+        "How sharply the island's altitude falls off away from the centre");
+    console->register_var(
+        "terrain.height_scale",
+        Float,
+        &params.height_scale,
+        1,
+        "The height of the island's highest point, before erosion");
+    // -- Biomes --
+    console->register_var(
+        "terrain.moisture_bias",
+        Float,
+        &params.moisture_bias,
+        1,
+        "Added to the moisture of every vertex before choosing its biome");
+    console->register_var(
+        "terrain.altitude_bands",
+        Float,
+        params.altitude_bands,
+        5,
+        "The altitudes at which the ocean, beach, lowland, upland and alpine bands end");
+    console->register_var(
+        "terrain.lowland_moisture",
+        Float,
+        params.lowland_moisture,
+        4,
+        "The moistures ending the lowland dunes, veldt, grassland and woodland");
+    console->register_var(
+        "terrain.upland_moisture",
+        Float,
+        params.upland_moisture,
+        3,
+        "The moistures ending the upland veldt, grassland and woodland");
+    console->register_var(
+        "terrain.alpine_moisture",
+        Float,
+        params.alpine_moisture,
+        2,
+        "The moistures ending the alpine tundra and moor");
+    console->register_var(
+        "terrain.peak_moisture",
+        Float,
+        params.peak_moisture,
+        3,
+        "The moistures ending the rock, bare ground and light snow of the peaks");
+    // -- Objects and colours --
+    console->register_var(
+        "terrain.vegetation_density",
+        Float,
+        &params.vegetation_density,
+        1,
+        "Scales the density of the objects on every biome");
+    console->register_var(
+        "terrain.colours",
+        Float,
+        &params.colours[0].x,
+        3 * TerrainGenerator::num_biomes,
+        "The colour of each biome, as r g b (the first is the error colour)");
+    // -- Statistics --
+    console->register_var(
+        "terrain.regenerate_ms",
+        Float,
+        &regenerate_ms,
+        1,
+        "The time taken by the last regeneration of the island, in ms",
+        false);
+    console->register_var(
+        "terrain.regenerations",
+        Int,
+        &regenerations,
+        1,
+        "The number of times the island has been regenerated",
+        false);
+}
+
+TerrainTuner::~TerrainTuner()
+{
+    // The worker writes into the tuner.
+    if (regenerated.valid()) regenerated.wait();
+    // Anything not yet handed to the scene.
+    if (landscape != nullptr)
+    {
+        for (Object* object: landscape->objects) delete object;
+    }
+    for (Object* object: objects) delete object;
+}
+
+// Start regenerating the island if the parameters have changed, and update
+// the scene once it is done.
+Landscape* TerrainTuner::update(Scene& scene, Renderer& renderer)
+{
+    if (regenerated.valid())
+    {
+        if (regenerated.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            return nullptr;
+        }
+        // Rethrows anything thrown by the worker.
+        regenerated.get();
+        return apply(scene, renderer);
+    }
+    if (scene.get_landscape() == nullptr) return nullptr;
+    if (TerrainGenerator::outputs_changed(applied, params) == 0) return nullptr;
+
+    // The worker uses its own copy of the parameters, as the console may
+    // change them meanwhile, and of the edits made since it last ran.
+    pending = params;
+    const Landscape* current = scene.get_landscape();
+    if (current->edits != edits_kept && current->edited.size() == current->positions.size())
+    {
+        edited_positions = current->positions;
+        edited = current->edited;
+        edits_kept = current->edits;
+    }
+    regenerated = ThreadPool::shared().submit([this]()
+    {
+        const auto start = std::chrono::steady_clock::now();
+        if (generator == nullptr)
+        {
+            generator.reset(new TerrainGenerator(
+                seed, size, edge, max_height, resources, nullptr,
+                eroded ? &erosion : nullptr, &applied));
+            // The island may be edited while it is tuned.
+            generator->set_sea_culling(false);
+            // The scene already has these objects, from the landscape
+            // it was given.
+            for (Object* object: generator->take_objects()) delete object;
+        }
+        if (!edited.empty())
+        {
+            generator->keep_edits(edited_positions, edited);
+            std::vector<glm::vec3>().swap(edited_positions);
+            std::vector<uint8_t>().swap(edited);
+        }
+        changed = generator->regenerate(pending);
+        if (changed & TerrainGenerator::output_bit(TerrainGenerator::PositionMap))
+        {
+            // The generator keeps its outputs, to be reused by later changes.
+            landscape.reset(generator->landscape(true));
+        }
+        else
+        {
+            if (changed & TerrainGenerator::output_bit(TerrainGenerator::ObjectList))
+            {
+                objects = generator->take_objects();
+            }
+            colours = generator->vertex_colours();
+            palette = generator->landscape_palette();
+        }
+        worker_ms = std::chrono::duration<float, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+    });
+    return nullptr;
+}
+
+// The parameters of the landscape in the scene.
+const TerrainGenerator::Params& TerrainTuner::parameters() const
+{
+    return applied;
+}
+
+// Whether the island is being regenerated.
+bool TerrainTuner::regenerating() const
+{
+    return regenerated.valid();
+}
+
+// Update the scene with the worker's results.
+Landscape* TerrainTuner::apply(Scene& scene, Renderer& renderer)
+{
+    applied = pending;
+    regenerate_ms = worker_ms;
+    regenerations += 1;
+    Landscape* current = scene.get_landscape();
+
+    // A new shape needs a new landscape.
+    if (landscape != nullptr)
+    {
+        renderer.assign_vao(landscape.get());
+        scene.remove_objects(current->objects);
+        renderer.release_vao(current);
+        Landscape* replacement = landscape.release();
+        // It already has the edits kept by the generator.
+        edits_kept = replacement->edits;
+        scene.give_landscape(replacement, scene.landscape_shader);
+        return replacement;
+    }
+
+    if (changed & TerrainGenerator::output_bit(TerrainGenerator::ObjectList))
+    {
+        scene.remove_objects(current->objects);
+        current->objects = objects;
+        for (Object* object: objects) scene.give_object(object);
+        objects.clear();
+    }
+    if (changed & TerrainGenerator::output_bit(TerrainGenerator::ColourMap))
+    {
+        // The palette is passed to the shaders each frame, so only the
+        // vertices whose palette index changed are uploaded.
+        current->palette = palette;
+        std::size_t first, count;
+        current->recolour(colours, first, count);
+        renderer.update_vertices(current, first, count);
+    }
+    return nullptr;
+}
@@ -0,0 +1,112 @@
+// Authorship: James Kortman (a1648090)
+// TerrainTuner class
+// Lets the island's generation parameters (see TerrainGenerator::Params)
+// be changed live through the console, as terrain.* variables.
+// When they change, the island is regenerated on the shared ThreadPool,
+// recomputing only the outputs that depend on the parameters changed, and
+// the landscape in the scene is then updated as little as possible:
+//  - A change of colour only changes the landscape's palette, which is
+//    passed to the shaders each frame, so nothing is uploaded.
+//  - A change of biomes repacks and uploads only the vertices whose
+//    palette index changed, and replaces the objects.
+//  - A change of density only replaces the objects.
+//  - A change of shape replaces the whole landscape.
+// Edits made to the landscape (see TerrainEditor.hpp) are kept through
+// each of these: the edited heights are handed to the generator before it
+// regenerates (see TerrainGenerator::keep_edits), so they are carried over
+// onto a new shape, and the edited vertices keep the colours of their
+// heights. The island should not be edited while it is regenerated (see
+// regenerating()), as those edits would be overwritten.
+
+#ifndef TERRAINTUNER_HPP
+#define TERRAINTUNER_HPP
+
+#include <future>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Erosion.hpp"
+#include "Landscape.hpp"
+#include "ResourceManager.hpp"
+#include "TerrainGenerator.hpp"
+
+class Renderer;
+class Scene;
+
+class TerrainTuner
+{
+public:
+    // Tune the island created by LandscapeLoader(seed, size, edge,
+    // max_height, resources, true, eroded), which was generated with the
+    // default parameters.
+    // The tuner does not take ownership of 'resources'.
+    TerrainTuner(
+        int seed, int size, float edge, float max_height,
+        ResourceManager* resources, bool eroded = false);
+    TerrainTuner() = delete;
+    TerrainTuner(const TerrainTuner&) = delete;
+    TerrainTuner& operator=(const TerrainTuner&) = delete;
+    ~TerrainTuner();
+
+    // Call once per frame, once the scene has the island. Starts
+    // regenerating the island if the parameters have changed, and updates
+    // the scene once it is done.
+    // Returns the new landscape if the landscape was replaced (so anything
+    // built from its shape can be rebuilt), or nullptr.
+    Landscape* update(Scene& scene, Renderer& renderer);
+
+    // The parameters of the landscape in the scene.
+    const TerrainGenerator::Params& parameters() const;
+
+    // Whether the island is being regenerated.
+    bool regenerating() const;
+
+private:
+    // Update the scene with the worker's results.
+    Landscape* apply(Scene& scene, Renderer& renderer);
+
+    int seed;
+    int size;
+    float edge;
+    float max_height;
+    ResourceManager* resources;
+    // Whether the island is eroded with the default parameters, as it is
+    // loaded.
+    bool eroded;
+    ErosionParams erosion;
+
+    // The parameters, as set through the console.
+    TerrainGenerator::Params params;
+    // The parameters of the landscape in the scene, and those being
+    // regenerated.
+    TerrainGenerator::Params applied;
+    TerrainGenerator::Params pending;
+
+    // Created by the worker on the first change, and kept, so later
+    // changes reuse its outputs.
+    std::unique_ptr<TerrainGenerator> generator;
+    // Ready once the worker has finished.
+    std::future<void> regenerated;
+    // The number of edits to the landscape in the scene already given to
+    // the generator, and the edits to give it before it next regenerates,
+    // if any (see Landscape::edited).
+    unsigned edits_kept;
+    std::vector<glm::vec3> edited_positions;
+    std::vector<uint8_t> edited;
+    // Written by the worker: the outputs recomputed, and what is needed to
+    // update the landscape. A new landscape is only created if its shape
+    // changed, and new objects only taken if they changed.
+    unsigned changed;
+    std::unique_ptr<Landscape> landscape;
+    std::vector<Object*> objects;
+    std::vector<glm::vec3> colours;
+    std::vector<glm::vec3> palette;
+    float worker_ms;
+
+    // Statistics, available through the console.
+    float regenerate_ms;
+    int regenerations;
+};
+
+#endif // TERRAINTUNER_HPP
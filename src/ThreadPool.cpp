@@ -0,0 +1,75 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of ThreadPool class member functions.
+
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(int num_threads)
+    : stopping(false)
+{
+    if (num_threads <= 0)
+    {
+        num_threads = std::max(1, int(std::thread::hardware_concurrency()));
+    }
+    for (int i = 0; i < num_threads; i += 1)
+    {
+        workers.push_back(std::thread(&ThreadPool::worker_loop, this));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    task_available.notify_all();
+    for (auto& worker: workers) worker.join();
+}
+
+ThreadPool& ThreadPool::shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+int ThreadPool::num_threads() const
+{
+    return workers.size();
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task)
+{
+    auto packaged = std::make_shared<std::packaged_task<void()>>(task);
+    std::future<void> result = packaged->get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back([packaged]() { (*packaged)(); });
+    }
+    task_available.notify_one();
+    return result;
+}
+
+int ThreadPool::num_bands(int begin, int end, int band_size)
+{
+    if (end <= begin) return 0;
+    if (band_size < 1) band_size = 1;
+    return (end - begin + band_size - 1) / band_size;
+}
+
+void ThreadPool::worker_loop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            task_available.wait(lock, [&]() {
+                return stopping || !tasks.empty();
+            });
+            if (stopping && tasks.empty()) return;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
@@ -0,0 +1,128 @@
+// Authorship: James Kortman (a1648090)
+// ThreadPool class
+// A fixed set of worker threads that run queued tasks.
+// Used to spread the terrain generation stages over all available cores.
+
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    // Create a pool with num_threads workers.
+    // If num_threads is 0, one worker is created per hardware thread.
+    explicit ThreadPool(int num_threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // The pool shared by the terrain generation stages.
+    static ThreadPool& shared();
+
+    // The number of worker threads.
+    int num_threads() const;
+
+    // Queue a task to be run by a worker.
+    std::future<void> submit(std::function<void()> task);
+
+    // Split the range [begin, end) into consecutive bands of band_size
+    // items, and call fn(band_begin, band_end) once for each band.
+    // Blocks until every band has been processed. The calling thread also
+    // processes bands, so this is safe to call from inside a pool task.
+    // The band boundaries depend only on the arguments, never on the
+    // number of threads, so per-band results can be combined
+    // deterministically by the caller.
+    // If fn throws, the bands not yet started are skipped, and the first
+    // exception is rethrown once no band is running.
+    template <typename Fn>
+    void parallel_for(int begin, int end, int band_size, Fn fn);
+
+    // The number of bands parallel_for will split a range into.
+    static int num_bands(int begin, int end, int band_size);
+
+private:
+    void worker_loop();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable task_available;
+    bool stopping;
+};
+
+template <typename Fn>
+void ThreadPool::parallel_for(int begin, int end, int band_size, Fn fn)
+{
+    const int bands = num_bands(begin, end, band_size);
+    if (bands == 0) return;
+    if (band_size < 1) band_size = 1;
+
+    // The shared state outlives this call, as helper tasks which are
+    // dequeued after all bands are finished still need to inspect it.
+    struct State
+    {
+        std::atomic<int> next;
+        std::atomic<int> done;
+        std::atomic<bool> failed;
+        // The first exception thrown by fn, guarded by the mutex.
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+    state->next = 0;
+    state->done = 0;
+    state->failed = false;
+
+    std::function<void()> work = [=]()
+    {
+        int band;
+        while ((band = state->next.fetch_add(1)) < bands)
+        {
+            const int lo = begin + band * band_size;
+            const int hi = std::min(end, lo + band_size);
+            // A band that throws still counts as done, so the caller's
+            // wait ends, and the bands after it are skipped.
+            if (!state->failed)
+            {
+                try
+                {
+                    fn(lo, hi);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    if (!state->error) state->error = std::current_exception();
+                    state->failed = true;
+                }
+            }
+            if (state->done.fetch_add(1) + 1 == bands)
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+            }
+        }
+    };
+
+    const int helpers = std::min(bands - 1, num_threads());
+    for (int i = 0; i < helpers; i += 1) submit(work);
+    work();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&]() { return state->done == bands; });
+    if (state->error) std::rethrow_exception(state->error);
+}
+
+#endif // THREADPOOL_HPP
@@ -3,26 +3,52 @@
 
 #include "Water.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "IndexOptimizer.hpp"
+#include "ThreadPool.hpp"
+
 Water::Water(
-    int size, float edge, float level, Landscape* landscape,
+    int size, float spacing, float edge, float level, Landscape* landscape,
     glm::vec2 min, glm::vec2 max)
     : model_matrix(glm::mat4(1.0f)), 
       size(size),
+      spacing(spacing),
       edge(edge),
       level(level),
+      landscape(landscape),
       min(min),
-      max(max)
+      max(max),
+      built(false)
 {
+    fatal_if(size < 8 || size % 4 != 0,
+        "Water level size must be a multiple of 4, at least 8 (got "
+        + std::to_string(size) + ")");
     normal_matrix = glm::mat3(
         glm::transpose(glm::inverse(model_matrix)));
 
-    positions.resize(size * size);
-    normals.resize(size * size);
-    colours.resize(size * size);
+    // Enough levels that the outermost reaches edge / 2 from the centre.
+    // Its centre may be up to about twice its spacing from the innermost's
+    // (as each is snapped to its own lattice), so allow for that.
+    levels = 1;
+    while ((0.5f * size - 2.0f) * spacing * float(1 << (levels - 1)) < 0.5f * edge)
+    {
+        levels += 1;
+    }
+    centre_x.resize(levels);
+    centre_z.resize(levels);
+
+    const std::size_t num_vertices = std::size_t(levels) * (size + 1) * (size + 1);
+    positions.resize(num_vertices);
+    normals.assign(num_vertices, AXIS_Y);
     material.shininess = 50.0f;
 
     // Generate palette.
     base_colour = WATER_COLOUR;
+    colours.assign(num_vertices, base_colour);
     palette = {{
         glm::vec3(0.90f, 0.90f, 1.00f),
         glm::vec3(0.75f, 0.75f, 1.00f),
@@ -32,215 +58,226 @@ Water::Water(
         glm::vec3(0.16f, 0.16f, 0.5f),
         glm::vec3(0.10f, 0.10f, 0.33f),
     }};
-    initialize(landscape);
+    follow(glm::vec3(0.0f));
+}
+
+bool Water::follow(glm::vec3 eye)
+{
+    // Centre each level on the multiple of twice its spacing nearest the
+    // eye. Then each level's centre is a multiple of the spacing of the
+    // level outside it, so the hole it leaves lines up with that level's
+    // quads.
+    bool moved = !built;
+    for (int lvl = 0; lvl < levels; lvl += 1)
+    {
+        const float step = 2.0f * spacing * float(1 << lvl);
+        const int x = int(std::floor(eye.x / step + 0.5f));
+        const int z = int(std::floor(eye.z / step + 0.5f));
+        if (x != centre_x[lvl] || z != centre_z[lvl]) moved = true;
+        centre_x[lvl] = x;
+        centre_z[lvl] = z;
+    }
+    if (!moved) return false;
+    initialize();
+    built = true;
+    return true;
+}
+
+float Water::get_level() const
+{
+    return level;
 }
 
 float Water::vert_dist()
 {
-    return edge / size;
+    return spacing;
+}
+
+int Water::num_levels() const
+{
+    return levels;
 }
 
-void Water::initialize(Landscape* landscape)
+// The reasons a vertex may not need the quads around it, as bits of its
+// mask. A quad is left out only if all four of its vertices share one.
+static const uint8_t outside_radius = 1;
+static const uint8_t outside_bounds = 2;
+static const uint8_t obscured = 4;
+
+void Water::initialize()
 {
+    ThreadPool& pool = ThreadPool::shared();
+    const int side = size + 1;
     auto radius = [](float x, float y) { return std::sqrt(x*x + y*y); };
-    // Initialize positions and colours.
+    // The mesh is centred on the centre of the innermost level.
+    const float mid_x = 2.0f * spacing * float(centre_x[0]);
+    const float mid_z = 2.0f * spacing * float(centre_z[0]);
+    // Initialize positions and masks.
     // Set the alpha on edge values
     // Everything outside the edge radius has height 0.
-    const float edge_radius = 0.5 * edge - 0.5 * edge / size;
+    const float outer_spacing = spacing * float(1 << (levels - 1));
+    const float edge_radius = 0.5 * edge - 0.5 * outer_spacing;
+    const float max_radius = 0.5 * edge;
+    std::vector<uint8_t> masks(positions.size());
 
-    for (int row = 0; row < size; row += 1)
+    // Each level's vertices lie on the lattice of multiples of its spacing,
+    // and the spacings are powers of two apart, so the vertices levels
+    // share have exactly the same positions.
+    pool.parallel_for(0, levels, 1, [&](int lvl_begin, int lvl_end)
     {
-        for (int col = 0; col < size; col += 1)
+        for (int lvl = lvl_begin; lvl < lvl_end; lvl += 1)
         {
-            const float x = -edge / 2.0f + edge * float(row) / (size - 1);
-            const float z = -edge / 2.0f + edge * float(col) / (size - 1);
-
-            #if 1
-                const float height = level;
-            #else
-                // The water is a cap on a sphere. The height of the cap,
-                // 'h', is the default water level. The edge length of the cap
-                // (from the centre out to the edge circle) is a, or edge/2.
-                //     ... 
-                //   .  |h .   
-                //  .-------.
-                //  .     a .
-                const float h = level;
-                const float a = edge / 2.0f;
-                // The radius of the sphere.
-                const float R = (a*a + h*h) / (2.0f * h);
-                // In 3D space, the equation for the sphere is
-                //      x^2 + y^2 + z^2 = R^2.
-                // As we are solving for the height y, we use:
-                //      y = sqrt(R^2 - z^2 - x^2)
-                // But we want the height relative to the base plane of the cap:
-                //      height = sqrt(R^2 - z^2 - x^2) - (R - h)
-                const float height = std::sqrt(R*R - z*z - x*x) - (R - h);
-            #endif
-
-            glm::vec3 position(
-                x,
-                (radius(x, z) > edge_radius) ? 0.0f : height,
-                z);
-            set_position(row, col, position);
-
-            set_colour(row, col, base_colour);
-        }
-    }
+            const float step = spacing * float(1 << lvl);
+            const int first_x = 2 * centre_x[lvl] - size / 2;
+            const int first_z = 2 * centre_z[lvl] - size / 2;
+            for (int row = 0; row < side; row += 1)
+            {
+                for (int col = 0; col < side; col += 1)
+                {
+                    const float x = step * float(first_x + row);
+                    const float z = step * float(first_z + col);
+                    const float r = radius(x - mid_x, z - mid_z);
+                    glm::vec3 position(x, (r > edge_radius) ? 0.0f : level, z);
+                    const unsigned int i = vertex(lvl, row, col);
+                    positions[i] = position;
 
-    // Initialize normals.
-    calculate_normals();
+                    // Whether the vertex is outside the max radius, outside the
+                    // bounds provided, or obscured by the landscape (if it is
+                    // over the landscape, and the landscape is above it).
+                    uint8_t mask = 0;
+                    if (r > max_radius) mask |= outside_radius;
+                    if (!(x >= min[0] && z >= min[1] && x <= max[0] && z <= max[1]))
+                    {
+                        mask |= outside_bounds;
+                    }
+                    if (landscape != nullptr
+                        && x > -landscape->edge / 2.0 && x < landscape->edge / 2.0
+                        && z > -landscape->edge / 2.0 && z < landscape->edge / 2.0
+                        && landscape->get_pos_at(position).y > (level / 2.0) + position.y)
+                    {
+                        mask |= obscured;
+                    }
+                    masks[i] = mask;
+                }
+            }
+        }
+    });
 
     // Initialize indices.
-    // For each vertex except the lowest row and furthest left column,
+    // For each quad of each level not covered by the level inside it,
     // connect positions into two triangles:
     // current vertex r, c -> .___. <- r, c+1
     //                        |  /|
     //                        | / |
     //                        |/  |
     //               r+1,c -> .___. <- r+1, c+1
-    const float max_radius = 0.5 * edge;
-    for (int row = 0; row < size - 1; row += 1)
+    // Quads along the edge of the hole have the vertex of the inner level
+    // halfway along the edge they share, so those are split into three
+    // triangles around it, and the levels meet without cracks.
+    // The corners of a quad, in order around it, and the quad across the
+    // edge from each corner to the next.
+    static const int corner_row[4] = { 0, 0, 1, 1 };
+    static const int corner_col[4] = { 0, 1, 1, 0 };
+    static const int across_row[4] = { -1, 0, 1, 0 };
+    static const int across_col[4] = { 0, 1, 0, -1 };
+    const int quads = size;
+    const int hole = size / 2;
+    std::vector<std::vector<std::array<unsigned int, 3>>> level_indices(levels);
+    pool.parallel_for(0, levels, 1, [&](int lvl_begin, int lvl_end)
     {
-        for (int col = 0; col < size - 1; col += 1)
+        for (int lvl = lvl_begin; lvl < lvl_end; lvl += 1)
         {
-            // Count the number of verts outside of the max_radius provided.
-            int num_outside_radius = 0;
-            if (radius(get_position(row, col).x,
-                       get_position(row, col).z)
-                > max_radius) num_outside_radius += 1;
-            if (radius(get_position(row, col + 1).x,
-                       get_position(row, col + 1).z)
-                > max_radius) num_outside_radius += 1;
-            if (radius(get_position(row + 1, col).x,
-                       get_position(row + 1, col).z)
-                > max_radius) num_outside_radius += 1;
-            if (radius(get_position(row + 1, col + 1).x,
-                       get_position(row + 1, col + 1).z)
-                > max_radius) num_outside_radius += 1;
-
-            // Check if any verts are outside of the bounds provided.
-            auto in_bounds = [=](float x, float z)
+            const int first_x = 2 * centre_x[lvl] - size / 2;
+            const int first_z = 2 * centre_z[lvl] - size / 2;
+            // The first quad of the hole, or none for the innermost level.
+            int hole_row = -quads, hole_col = -quads;
+            int inner_x = 0, inner_z = 0;
+            if (lvl > 0)
             {
-                return x >= min[0] && z >= min[1] && x <= max[0] && z <= max[1];
-            };
-            int num_outside_bounds = 0;
-            if (!in_bounds(get_position(    row,     col).x,
-                           get_position(    row,     col).z)) num_outside_bounds += 1;
-            if (!in_bounds(get_position(    row, col + 1).x,
-                           get_position(    row, col + 1).z)) num_outside_bounds += 1;
-            if (!in_bounds(get_position(row + 1,     col).x,
-                           get_position(row + 1,     col).z)) num_outside_bounds += 1;
-            if (!in_bounds(get_position(row + 1, col + 1).x,
-                           get_position(row + 1, col + 1).z)) num_outside_bounds += 1;
-
-            // Check if any verts are obscured by the landscape.
-            auto is_obscured = [=](int row, int col) {
-                float x = get_position(row, col).x;
-                float z = get_position(row, col).z;
-                // check if x,z is witho bounds for the landscape.
-                if (x <= -landscape->edge / 2.0 
-                    || x >= landscape->edge / 2.0
-                    || z <= -landscape->edge / 2.0 
-                    || z >= landscape->edge / 2.0) return false;
-                return landscape->get_pos_at(get_position(row, col)).y
-                        > (level / 2.0) + get_position(row, col).y;
-            };
-            int num_obscured = 0;
-            if (landscape != nullptr)
-            {
-                if (is_obscured(    row,     col)) num_obscured += 1;
-                if (is_obscured(    row, col + 1)) num_obscured += 1;
-                if (is_obscured(row + 1,     col)) num_obscured += 1;
-                if (is_obscured(row + 1, col + 1)) num_obscured += 1;
+                inner_x = 2 * centre_x[lvl - 1] - size / 2;
+                inner_z = 2 * centre_z[lvl - 1] - size / 2;
+                hole_row = inner_x / 2 - first_x;
+                hole_col = inner_z / 2 - first_z;
             }
-
-            // First triangle (upper-left on diagram).
-            if (num_outside_radius      < 4
-                && num_outside_bounds   < 4
-                && num_obscured         < 4)
+            auto in_hole = [&](int row, int col)
             {
-                indices.push_back(std::array<unsigned int, 3>({{
-                    (unsigned int)( row      * size + col),
-                    (unsigned int)( row      * size + col + 1),
-                    (unsigned int)((row + 1) * size + col),
-                }}));
-                // Second triangle (lower-right on diagram).
-                indices.push_back({{
-                    (unsigned int)((row + 1) * size + col),
-                    (unsigned int)( row      * size + col + 1),
-                    (unsigned int)((row + 1) * size + col + 1),
-                }});
-            }
-        }
-    }
-}
+                return row >= hole_row && row < hole_row + hole
+                    && col >= hole_col && col < hole_col + hole;
+            };
+            // The vertex at a corner of a quad. Those on the edge of the
+            // hole are the inner level's, so the levels share vertices.
+            auto corner_vertex = [&](int row, int col)
+            {
+                if (row >= hole_row && row <= hole_row + hole
+                    && col >= hole_col && col <= hole_col + hole)
+                {
+                    return vertex(lvl - 1,
+                        2 * (first_x + row) - inner_x, 2 * (first_z + col) - inner_z);
+                }
+                return vertex(lvl, row, col);
+            };
+            std::vector<std::array<unsigned int, 3>>& out = level_indices[lvl];
 
-void Water::calculate_normals()
-{
-    for (int row = 0; row < size; row += 1)
-    {
-        for (int col = 0; col < size; col += 1)
-        {
-            glm::vec3 norm;
-            if      (row == size-1) norm = get_normal(  row, col-1);
-            else if (col == size-1) norm = get_normal(row-1, col-1);
-            else
+            // Rather than reordering the triangles for the vertex cache
+            // (see IndexOptimizer.hpp), the quads are emitted in strips of
+            // columns narrow enough that two rows of their vertices stay in
+            // the cache, so most vertices are only transformed once.
+            const int strip_cols = vertex_cache_size / 2 - 2;
+            for (int strip = 0; strip < quads; strip += strip_cols)
             {
-                // Get the points at, above, and to the right of the current point.
-                glm::vec3 at    = get_position(  row,   col);
-                glm::vec3 below = get_position(row+1,   col);
-                glm::vec3 right = get_position(  row, col+1);
-
-                glm::vec3 downward = below - at;
-                glm::vec3 rightward = right - at;
-                norm = glm::normalize(glm::cross(rightward, downward));
+                const int strip_end = std::min(quads, strip + strip_cols);
+                for (int row = 0; row < quads; row += 1)
+                {
+                    for (int col = strip; col < strip_end; col += 1)
+                    {
+                        if (in_hole(row, col)) continue;
+                        unsigned int corner[4];
+                        uint8_t shared = 0xff;
+                        int split = -1;
+                        for (int k = 0; k < 4; k += 1)
+                        {
+                            corner[k] = corner_vertex(row + corner_row[k], col + corner_col[k]);
+                            shared &= masks[corner[k]];
+                            if (in_hole(row + across_row[k], col + across_col[k])) split = k;
+                        }
+                        if (shared != 0) continue;
+                        if (split == -1)
+                        {
+                            // First triangle (upper-left on diagram).
+                            out.push_back({{ corner[0], corner[1], corner[3] }});
+                            // Second triangle (lower-right on diagram).
+                            out.push_back({{ corner[3], corner[1], corner[2] }});
+                            continue;
+                        }
+                        // The inner level's vertex halfway along the split
+                        // edge, at twice the midpoint in its lattice.
+                        const int next = (split + 1) % 4;
+                        const unsigned int middle = vertex(lvl - 1,
+                            2 * (first_x + row) + corner_row[split] + corner_row[next] - inner_x,
+                            2 * (first_z + col) + corner_col[split] + corner_col[next] - inner_z);
+                        const unsigned int v0 = corner[(split + 3) % 4];
+                        const unsigned int v1 = corner[split];
+                        const unsigned int v2 = corner[next];
+                        const unsigned int v3 = corner[(split + 2) % 4];
+                        out.push_back({{ v0, v1, middle }});
+                        out.push_back({{ v0, middle, v2 }});
+                        out.push_back({{ v0, v2, v3 }});
+                    }
+                }
             }
-            set_normal(row, col, norm);
         }
-    }
+    });
 
-    #if 0
-    for (int row = 0; row < size; row += 1)
+    indices.clear();
+    for (const std::vector<std::array<unsigned int, 3>>& part: level_indices)
     {
-        for (int col = 0; col < size; col += 1)
-        {
-            glm::vec3 norm = get_normal(row, col);
-            printf("[%f %f %f] ", norm.x, norm.y, norm.z);
-        }
-        printf("\n");
+        indices.insert(indices.end(), part.begin(), part.end());
     }
-    #endif
 }
 
 // -- Data access functions --
 // ---------------------------
-glm::vec3 Water::get_position(int row, int col)
-{
-    return positions[size * row + col];
-}
-
-glm::vec3 Water::get_normal(int row, int col)
-{
-    return normals[size * row + col];
-}
-
-glm::vec3 Water::get_colour(int row, int col)
-{
-    return colours[size * row + col];
-}
-
-void Water::set_position(int row, int col, glm::vec3 pos)
-{
-    positions[size * row + col] = pos;
-}
-
-void Water::set_normal(int row, int col, glm::vec3 norm)
-{
-    normals[size * row + col] = norm;
-}
-
-void Water::set_colour(int row, int col, glm::vec3 colour)
+unsigned int Water::vertex(int lvl, int row, int col) const
 {
-    colours[size * row + col] = colour;
+    return (unsigned int)((lvl * (size + 1) + row) * (size + 1) + col);
 }
@@ -1,6 +1,12 @@
 // Authorship: James Kortman (a1648090)
 // Water struct
-// A dynamic mesh for water.
+// A dynamic mesh for water, which follows the camera.
+// The mesh is a set of nested square rings (levels) around the camera,
+// each size * size quads, and each with twice the spacing of the one inside
+// it, so the vertices are densest near the viewer and the vertex count is
+// fixed however far the water reaches. Each level is centred on a multiple
+// of twice its spacing, so its vertices stay put in the world as the camera
+// moves, and the mesh is only rebuilt when the centres move.
 
 #ifndef WATER_HPP
 #define WATER_HPP
@@ -14,9 +20,15 @@
 
 struct Water
 {
-    // Create the water mesh.
+    // Create the water mesh at 'level', with levels of size * size quads
+    // (size a multiple of 4, at least 8), the innermost 'spacing' apart,
+    // and enough levels to reach 'edge' / 2 from the centre.
+    // Quads outside the circle of radius edge / 2, outside [min, max] or
+    // hidden under the landscape are left out, so the landscape must
+    // outlive the water. The mesh starts centred on the origin.
     Water(
         int size,
+        float spacing,
         float edge,
         float level,
         Landscape* landscape = nullptr,
@@ -27,10 +39,20 @@ struct Water
             std::numeric_limits<float>::max(),
             std::numeric_limits<float>::max()));
 
-    // Get the distance between vertices.
+    // Move the mesh to follow a viewer at 'eye'. Returns whether the mesh
+    // was rebuilt (and so its positions and indices need uploading).
+    bool follow(glm::vec3 eye);
+
+    // Get the height of the still water (without the waves).
+    float get_level() const;
+    // Get the distance between vertices of the innermost level.
     float vert_dist();
+    // The number of levels.
+    int num_levels() const;
 
     // Mesh data.
+    // The positions are rebuilt as the mesh follows the camera, but there
+    // are always the same number, num_levels() * (size + 1)^2.
     std::vector<glm::vec3> positions;
     std::vector<glm::vec3> normals;
     std::vector<glm::vec3> colours;
@@ -49,30 +71,35 @@ struct Water
 
     // Rendering information.
     unsigned int vao;
+    unsigned int buffers[4];
     glm::mat4 model_matrix;
     glm::mat3 normal_matrix;
 
 private:
     // Generated mesh properties.
     const int size;
+    const float spacing;
     const float edge;
     const float level;
+    int levels;
+    Landscape* landscape;
 
     // The max and min bounds (in x,z) for generating faces.
     glm::vec2 min;
     glm::vec2 max;
 
+    // The centre of each level, in multiples of twice its spacing, in x
+    // and z. A level's first vertex is at lattice point
+    // 2 * centre - size / 2 (in multiples of its spacing).
+    std::vector<int> centre_x;
+    std::vector<int> centre_z;
+    bool built;
+
     // Mesh building functions.
-    void initialize(Landscape* landscape);
-    void calculate_normals();
-
-    // Coordinate-based element access.
-    glm::vec3   get_position    (int row, int col);
-    glm::vec3   get_normal      (int row, int col);
-    glm::vec3   get_colour      (int row, int col);
-    void        set_position    (int row, int col, glm::vec3 pos);
-    void        set_normal      (int row, int col, glm::vec3 norm);
-    void        set_colour      (int row, int col, glm::vec3 colour);
+    void initialize();
+
+    // Coordinate-based element access, by level.
+    unsigned int vertex(int lvl, int row, int col) const;
 };
 
-#endif // WATER_HPP
\ No newline at end of file
+#endif // WATER_HPP
@@ -0,0 +1,416 @@
+// Authorship: James Kortman (a1648090)
+// Implementation of WaveField class member functions.
+
+#include "WaveField.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Console.hpp"
+#include "ThreadPool.hpp"
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+constexpr float WaveField::scale;
+constexpr float WaveField::cells;
+constexpr float WaveField::period;
+constexpr float WaveField::height_variance;
+
+// -- Noise --
+// A port of cnoise and pnoise from external_files/shaderlib.glsl, operation
+// for operation in single precision, so the field matches the one baked on
+// the GPU. The four corners of a cell, which the shader handles as vec4
+// components, are handled in turn.
+
+static inline float fract(float x)
+{
+    return x - std::floor(x);
+}
+
+// GLSL's mod, which (unlike std::fmod) takes the sign of y.
+static inline float glsl_mod(float x, float y)
+{
+    return x - y * std::floor(x / y);
+}
+
+static inline float mod289(float x)
+{
+    return x - std::floor(x * (1.0f / 289.0f)) * 289.0f;
+}
+
+static inline float permute(float x)
+{
+    return mod289(((x * 34.0f) + 1.0f) * x);
+}
+
+static inline float fade(float t)
+{
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+static inline float mix(float a, float b, float t)
+{
+    return a + (b - a) * t;
+}
+
+// Classic Perlin noise at (x, y), repeating every 'rep' cells if rep > 0.
+static float perlin(float x, float y, float rep)
+{
+    // The integer and fractional parts of the cell's corners.
+    float ix0 = std::floor(x), iy0 = std::floor(y);
+    float ix1 = ix0 + 1.0f, iy1 = iy0 + 1.0f;
+    const float fx0 = fract(x), fy0 = fract(y);
+    const float fx1 = fx0 - 1.0f, fy1 = fy0 - 1.0f;
+    if (rep > 0.0f)
+    {
+        ix0 = glsl_mod(ix0, rep);
+        iy0 = glsl_mod(iy0, rep);
+        ix1 = glsl_mod(ix1, rep);
+        iy1 = glsl_mod(iy1, rep);
+    }
+    ix0 = mod289(ix0);
+    iy0 = mod289(iy0);
+    ix1 = mod289(ix1);
+    iy1 = mod289(iy1);
+
+    // The corners in the shader's order: 00, 10, 01, 11.
+    const float ix[4] = { ix0, ix1, ix0, ix1 };
+    const float iy[4] = { iy0, iy0, iy1, iy1 };
+    const float fx[4] = { fx0, fx1, fx0, fx1 };
+    const float fy[4] = { fy0, fy0, fy1, fy1 };
+    float n[4];
+    for (int k = 0; k < 4; k += 1)
+    {
+        const float i = permute(permute(ix[k]) + iy[k]);
+        float gx = fract(i * (1.0f / 41.0f)) * 2.0f - 1.0f;
+        const float gy = std::abs(gx) - 0.5f;
+        gx = gx - std::floor(gx + 0.5f);
+        const float norm = 1.79284291400159f - 0.85373472095314f * (gx * gx + gy * gy);
+        n[k] = (gx * norm) * fx[k] + (gy * norm) * fy[k];
+    }
+
+    const float fade_x = fade(fx0), fade_y = fade(fy0);
+    const float n_x0 = mix(n[0], n[1], fade_x);
+    const float n_x1 = mix(n[2], n[3], fade_x);
+    return 2.3f * mix(n_x0, n_x1, fade_y);
+}
+
+// The height of the waves at a point, as WaveField::evaluate gives it.
+static inline float wave_height(float x, float z, float time)
+{
+    const float cx = x * WaveField::scale, cz = z * WaveField::scale;
+    const float ta = 0.05f * time, tc = 0.07f * time, td = 0.09f * time;
+    const float a = perlin(cx + ta, cz + ta, WaveField::cells);
+    const float b = perlin(cx + 1.0f, cz + 1.0f, WaveField::cells);
+    const float c = perlin(cx + a + tc, cz + a + tc, WaveField::cells);
+    const float d = perlin(cx + b + td, cz + b + td, WaveField::cells);
+    const float e = perlin(a + b, c + d, 0.0f);
+    return WaveField::height_variance * (e - 0.5f);
+}
+
+#if defined(__SSE2__)
+// -- SSE2 (4 lanes) --
+// The same operations as the scalar noise, in the same order (and without
+// fused multiply-adds), so each lane gives exactly the scalar result.
+
+static inline __m128 floor_sse2(__m128 a)
+{
+    const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+    // The comparison mask is all ones in lanes that truncated upwards.
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmplt_ps(a, t), _mm_set1_ps(1.0f)));
+}
+
+static inline __m128 mod_sse2(__m128 x, __m128 y)
+{
+    return _mm_sub_ps(x, _mm_mul_ps(y, floor_sse2(_mm_div_ps(x, y))));
+}
+
+static inline __m128 mod289_sse2(__m128 x)
+{
+    const __m128 f = floor_sse2(_mm_mul_ps(x, _mm_set1_ps(1.0f / 289.0f)));
+    return _mm_sub_ps(x, _mm_mul_ps(f, _mm_set1_ps(289.0f)));
+}
+
+static inline __m128 permute_sse2(__m128 x)
+{
+    const __m128 t = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(34.0f)), _mm_set1_ps(1.0f));
+    return mod289_sse2(_mm_mul_ps(t, x));
+}
+
+static inline __m128 fade_sse2(__m128 t)
+{
+    const __m128 cube = _mm_mul_ps(_mm_mul_ps(t, t), t);
+    __m128 inner = _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f));
+    inner = _mm_add_ps(_mm_mul_ps(t, inner), _mm_set1_ps(10.0f));
+    return _mm_mul_ps(cube, inner);
+}
+
+static inline __m128 mix_sse2(__m128 a, __m128 b, __m128 t)
+{
+    return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+}
+
+// The gradient contribution of one corner.
+static inline __m128 corner_sse2(__m128 ix, __m128 iy, __m128 fx, __m128 fy)
+{
+    const __m128 i = permute_sse2(_mm_add_ps(permute_sse2(ix), iy));
+    const __m128 t = _mm_mul_ps(i, _mm_set1_ps(1.0f / 41.0f));
+    __m128 gx = _mm_sub_ps(
+        _mm_mul_ps(_mm_sub_ps(t, floor_sse2(t)), _mm_set1_ps(2.0f)), _mm_set1_ps(1.0f));
+    const __m128 abs_gx = _mm_andnot_ps(_mm_set1_ps(-0.0f), gx);
+    const __m128 gy = _mm_sub_ps(abs_gx, _mm_set1_ps(0.5f));
+    gx = _mm_sub_ps(gx, floor_sse2(_mm_add_ps(gx, _mm_set1_ps(0.5f))));
+    const __m128 length2 = _mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy));
+    const __m128 norm = _mm_sub_ps(
+        _mm_set1_ps(1.79284291400159f), _mm_mul_ps(_mm_set1_ps(0.85373472095314f), length2));
+    return _mm_add_ps(
+        _mm_mul_ps(_mm_mul_ps(gx, norm), fx), _mm_mul_ps(_mm_mul_ps(gy, norm), fy));
+}
+
+static inline __m128 perlin_sse2(__m128 x, __m128 y, float rep)
+{
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 ix0 = floor_sse2(x), iy0 = floor_sse2(y);
+    __m128 ix1 = _mm_add_ps(ix0, one), iy1 = _mm_add_ps(iy0, one);
+    const __m128 fx0 = _mm_sub_ps(x, floor_sse2(x)), fy0 = _mm_sub_ps(y, floor_sse2(y));
+    const __m128 fx1 = _mm_sub_ps(fx0, one), fy1 = _mm_sub_ps(fy0, one);
+    if (rep > 0.0f)
+    {
+        const __m128 r = _mm_set1_ps(rep);
+        ix0 = mod_sse2(ix0, r);
+        iy0 = mod_sse2(iy0, r);
+        ix1 = mod_sse2(ix1, r);
+        iy1 = mod_sse2(iy1, r);
+    }
+    ix0 = mod289_sse2(ix0);
+    iy0 = mod289_sse2(iy0);
+    ix1 = mod289_sse2(ix1);
+    iy1 = mod289_sse2(iy1);
+
+    const __m128 n00 = corner_sse2(ix0, iy0, fx0, fy0);
+    const __m128 n10 = corner_sse2(ix1, iy0, fx1, fy0);
+    const __m128 n01 = corner_sse2(ix0, iy1, fx0, fy1);
+    const __m128 n11 = corner_sse2(ix1, iy1, fx1, fy1);
+    const __m128 fade_x = fade_sse2(fx0), fade_y = fade_sse2(fy0);
+    const __m128 n_x0 = mix_sse2(n00, n10, fade_x);
+    const __m128 n_x1 = mix_sse2(n01, n11, fade_x);
+    return _mm_mul_ps(_mm_set1_ps(2.3f), mix_sse2(n_x0, n_x1, fade_y));
+}
+
+static inline __m128 wave_height_sse2(__m128 x, __m128 z, float time)
+{
+    const __m128 cx = _mm_mul_ps(x, _mm_set1_ps(WaveField::scale));
+    const __m128 cz = _mm_mul_ps(z, _mm_set1_ps(WaveField::scale));
+    const __m128 ta = _mm_set1_ps(0.05f * time);
+    const __m128 tc = _mm_set1_ps(0.07f * time);
+    const __m128 td = _mm_set1_ps(0.09f * time);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const float cells = WaveField::cells;
+    const __m128 a = perlin_sse2(_mm_add_ps(cx, ta), _mm_add_ps(cz, ta), cells);
+    const __m128 b = perlin_sse2(_mm_add_ps(cx, one), _mm_add_ps(cz, one), cells);
+    const __m128 c = perlin_sse2(
+        _mm_add_ps(_mm_add_ps(cx, a), tc), _mm_add_ps(_mm_add_ps(cz, a), tc), cells);
+    const __m128 d = perlin_sse2(
+        _mm_add_ps(_mm_add_ps(cx, b), td), _mm_add_ps(_mm_add_ps(cz, b), td), cells);
+    const __m128 e = perlin_sse2(_mm_add_ps(a, b), _mm_add_ps(c, d), 0.0f);
+    return _mm_mul_ps(
+        _mm_set1_ps(WaveField::height_variance), _mm_sub_ps(e, _mm_set1_ps(0.5f)));
+}
+#endif
+
+// Set out[k] to the height of the waves at (x[k], z[k]) for k in [0, n),
+// four at a time where SSE2 is available.
+static void wave_heights(const float* x, const float* z, int n, float time, float* out)
+{
+    int k = 0;
+#if defined(__SSE2__)
+    for (; k + 4 <= n; k += 4)
+    {
+        _mm_storeu_ps(out + k, wave_height_sse2(_mm_loadu_ps(x + k), _mm_loadu_ps(z + k), time));
+    }
+#endif
+    for (; k < n; k += 1) out[k] = wave_height(x[k], z[k], time);
+}
+
+// -- WaveField --
+
+WaveField::WaveField()
+    : resolution(256),
+      interval(1),
+      time(0.0f),
+      baked_resolution(256),
+      generation(0),
+      frames(0)
+{
+    console->register_var(
+        "water.wave_resolution",
+        Int,
+        &resolution,
+        1,
+        "The width and height of the texture the waves are baked into, in texels");
+    console->register_var(
+        "water.wave_interval",
+        Int,
+        &interval,
+        1,
+        "The number of frames between bakes of the waves");
+}
+
+void WaveField::update(float time)
+{
+    const int wanted = std::max(16, std::min(4096, resolution));
+    frames += 1;
+    if (generation != 0 && frames < interval && wanted == baked_resolution) return;
+    frames = 0;
+    this->time = time;
+    baked_resolution = wanted;
+    generation += 1;
+}
+
+float WaveField::field_time() const
+{
+    return time;
+}
+
+int WaveField::field_resolution() const
+{
+    return baked_resolution;
+}
+
+unsigned int WaveField::field_generation() const
+{
+    return generation;
+}
+
+float WaveField::evaluate(float x, float z, float time)
+{
+    // As the water's waves were computed per vertex, with the noises the
+    // others depend on made periodic so the whole field tiles.
+    return wave_height(x, z, time);
+}
+
+float WaveField::height(float x, float z) const
+{
+    float h;
+    sample_range(&x, &z, 0, 1, &h, nullptr, nullptr, nullptr);
+    return h;
+}
+
+glm::vec3 WaveField::normal(float x, float z) const
+{
+    float h;
+    glm::vec3 n;
+    sample_range(&x, &z, 0, 1, &h, &n.x, &n.y, &n.z);
+    return n;
+}
+
+// The points given to each task of a large batch.
+static const int batch_band = 1024;
+
+void WaveField::sample_batch(
+    const float* x, const float* z, int n, float* height,
+    float* normal_x, float* normal_y, float* normal_z) const
+{
+    if (n <= batch_band)
+    {
+        sample_range(x, z, 0, n, height, normal_x, normal_y, normal_z);
+        return;
+    }
+    ThreadPool::shared().parallel_for(0, n, batch_band, [&](int begin, int end)
+    {
+        sample_range(x, z, begin, end, height, normal_x, normal_y, normal_z);
+    });
+}
+
+float WaveField::texel_centre(int i) const
+{
+    const int n = baked_resolution;
+    i = ((i % n) + n) % n;
+    return (float(i) + 0.5f) / float(n) * period;
+}
+
+// The points sampled side by side.
+static const int block_size = 16;
+
+void WaveField::sample_range(
+    const float* x, const float* z, int begin, int end, float* height,
+    float* normal_x, float* normal_y, float* normal_z) const
+{
+    // The texture is sampled at (x, z) / period, repeating, and filtered
+    // linearly between the centres of the four texels around that point.
+    // Each texel holds the normal from the heights of its neighbours, and
+    // its own height (see shaders/wave-normal.frag), so a point needs the
+    // heights of the 4x4 texels around it but the corners, or of the
+    // middle 2x2 for its height alone.
+    const bool normals = normal_x != nullptr;
+    const int n = baked_resolution;
+    const float spacing = period / float(n);
+    for (int first = begin; first < end; first += block_size)
+    {
+        const int count = std::min(block_size, end - first);
+
+        // The texel below and left of each point, and the weights of the
+        // texels past it.
+        int i0[block_size], j0[block_size];
+        float du[block_size], dv[block_size];
+        for (int k = 0; k < count; k += 1)
+        {
+            const float u = x[first + k] / period * float(n) - 0.5f;
+            const float v = z[first + k] / period * float(n) - 0.5f;
+            const float u0 = std::floor(u), v0 = std::floor(v);
+            du[k] = u - u0;
+            dv[k] = v - v0;
+            i0[k] = int(glsl_mod(u0, float(n)));
+            j0[k] = int(glsl_mod(v0, float(n)));
+        }
+
+        // The heights of the texels around each point, from (i0 - 1, j0 - 1).
+        float h[4][4][block_size];
+        for (int a = 0; a < 4; a += 1)
+        {
+            for (int b = 0; b < 4; b += 1)
+            {
+                const bool middle = a >= 1 && a <= 2 && b >= 1 && b <= 2;
+                const bool corner = (a == 0 || a == 3) && (b == 0 || b == 3);
+                if (corner || (!middle && !normals)) continue;
+                float tx[block_size], tz[block_size];
+                for (int k = 0; k < count; k += 1)
+                {
+                    tx[k] = texel_centre(i0[k] + a - 1);
+                    tz[k] = texel_centre(j0[k] + b - 1);
+                }
+                wave_heights(tx, tz, count, time, h[a][b]);
+            }
+        }
+
+        for (int k = 0; k < count; k += 1)
+        {
+            const float near = h[1][1][k] + (h[2][1][k] - h[1][1][k]) * du[k];
+            const float far = h[1][2][k] + (h[2][2][k] - h[1][2][k]) * du[k];
+            height[first + k] = near + (far - near) * dv[k];
+        }
+        if (!normals) continue;
+        for (int k = 0; k < count; k += 1)
+        {
+            glm::vec3 texels[2][2];
+            for (int a = 1; a <= 2; a += 1)
+            {
+                for (int b = 1; b <= 2; b += 1)
+                {
+                    texels[a - 1][b - 1] = glm::normalize(glm::vec3(
+                        h[a - 1][b][k] - h[a + 1][b][k],
+                        2.0f * spacing,
+                        h[a][b - 1][k] - h[a][b + 1][k]));
+                }
+            }
+            const glm::vec3 near = texels[0][0] + (texels[1][0] - texels[0][0]) * du[k];
+            const glm::vec3 far = texels[0][1] + (texels[1][1] - texels[0][1]) * du[k];
+            const glm::vec3 normal = glm::normalize(near + (far - near) * dv[k]);
+            normal_x[first + k] = normal.x;
+            normal_y[first + k] = normal.y;
+            normal_z[first + k] = normal.z;
+        }
+    }
+}
@@ -0,0 +1,88 @@
+// Authorship: James Kortman (a1648090)
+// WaveField class
+// The height of the ocean's waves, as a field which repeats every 'period'
+// world units in x and z. The Renderer bakes the field into a texture of
+// resolution * resolution texels, each frame or every few frames, holding
+// the surface normal and the height of the waves at each texel, and the
+// water shaders sample that texture. So noise is evaluated once per texel
+// per bake, rather than several times per water vertex in every frame,
+// and finer water meshes cost no more noise.
+// The field is mirrored on the CPU, sampled the same way, so the waves can
+// be queried.
+// The resolution and how often the field is baked are set through the
+// console (water.wave_resolution and water.wave_interval).
+
+#ifndef WAVEFIELD_HPP
+#define WAVEFIELD_HPP
+
+#include <glm/glm.hpp>
+
+class WaveField
+{
+public:
+    WaveField();
+    WaveField(const WaveField&) = delete;
+    WaveField& operator=(const WaveField&) = delete;
+
+    // The noise behind the waves repeats every 'cells' noise cells, each
+    // 1 / scale world units across, so the field tiles every 'period'.
+    // These must match shaders/wave-height.frag.
+    static constexpr float scale = 0.02f;
+    static constexpr float cells = 10.0f;
+    static constexpr float period = cells / scale;
+    // The difference in height between the lowest and highest waves.
+    static constexpr float height_variance = 0.8f;
+
+    // Call once per frame, with the scene's elapsed time. Moves the field
+    // to that time if it is due to be baked again.
+    void update(float time);
+
+    // The field as it was last moved on, to be baked.
+    // 'generation' changes whenever the field does.
+    float field_time() const;
+    int field_resolution() const;
+    unsigned int field_generation() const;
+
+    // The height of the waves at a point at a time, as baked into the
+    // texel centred there (see shaders/wave-height.frag).
+    static float evaluate(float x, float z, float time);
+
+    // -- CPU mirror --
+    // The height of the waves above (or below) the water at a point, and
+    // the normal of the water surface there, sampled from the field as it
+    // was last moved on, the way the water shaders sample the texture:
+    // interpolated between the four texels around the point.
+    float height(float x, float z) const;
+    glm::vec3 normal(float x, float z) const;
+    // The heights, and if normal_x is not null the normals, at n points
+    // (x[i], z[i]), as height() and normal() give them. Each coordinate is
+    // in its own array, and the points are evaluated a block at a time,
+    // side by side, so the work vectorises. Large batches are also split
+    // across the shared ThreadPool.
+    void sample_batch(
+        const float* x, const float* z, int n, float* height,
+        float* normal_x = nullptr, float* normal_y = nullptr,
+        float* normal_z = nullptr) const;
+
+private:
+    // The world coordinate of the centre of texel i along either axis
+    // (wrapped into the field).
+    float texel_centre(int i) const;
+    // Sample points [begin, end) of a batch.
+    void sample_range(
+        const float* x, const float* z, int begin, int end, float* height,
+        float* normal_x, float* normal_y, float* normal_z) const;
+
+    // The settings, set through the console.
+    int resolution;
+    int interval;
+
+    // The field to be baked.
+    float time;
+    int baked_resolution;
+    unsigned int generation;
+    // The frames since the field was last moved on.
+    int frames;
+};
+
+#endif // WAVEFIELD_HPP
@@ -4,6 +4,7 @@
 #include <cassert>
 #include <cmath>
 #include <chrono>
+#include <memory>
 #include <glm/gtc/constants.hpp>
 //#include <thread>
 #include <stdio.h>
@@ -13,19 +14,34 @@
 #include "LightSource.hpp"
 #include "Console.hpp"
 #include "Mesh.hpp"
+#include "MeshLoader.hpp"
 #include "Renderer.hpp"
 #include "ResourceManager.hpp"
 #include "Scene.hpp"
 #include "Shader.hpp"
 #include "InputHandler.hpp"
 #include "Landscape.hpp"
+#include "LandscapeLoader.hpp"
+#include "ChunkManager.hpp"
 #include "TerrainGenerator.hpp"
+#include "TerrainEditor.hpp"
+#include "TerrainTuner.hpp"
 #include "Water.hpp"
 #include "Demo.hpp"
 #include "Sound.hpp"
 
 const bool          WIREFRAME_MODE = false;
 const unsigned int  NUM_AA_SAMPLES = 4;
+// Generate an unbounded terrain in tiles around the camera,
+// rather than a single island.
+const bool          TILED_TERRAIN  = false;
+// Let the island be tuned and edited while the game runs. Otherwise its
+// CPU copies of the data uploaded to the GPU are freed once it is loaded,
+// and the triangles hidden below the sea are left out.
+const bool          EDITABLE_TERRAIN = true;
+// Erode the island (see Erosion.hpp). This changes its shape, and slows
+// down generating it when it isn't cached.
+const bool          ERODED_TERRAIN = false;
 
 int main(int argc, char** argv)
 {
@@ -61,6 +77,20 @@ int main(int argc, char** argv)
     // Create resources.
     ResourceManager resources;
 
+    // Create meshes.
+    // Each mesh entry in meshes is a name, dir name, and filename.
+    // They are read in the background while the shaders are compiled and
+    // the terrain is generated, and uploaded before the first frame.
+    const std::vector<std::array<std::string, 3>> meshes = {{
+        {{ "Cube",          "cube-simple",  "cube-simple"   }},
+        {{ "Pine01",        "tree",         "PineTree03"    }},
+        {{ "Pine02",        "pine",         "PineTransp"    }},
+        {{ "Stump",         "TreeStump",    "TreeStump03"   }},
+        {{ "Bonfire",       "bonfire",      "bonfire"       }},
+        {{ "Lighthouse",    "lighthouse",   "lighthouse"    }},
+    }};
+    MeshLoader mesh_loader(meshes, &resources);
+
     // Create shaders.
     // To load a shader into the resources, add the name here.
     const std::vector<std::string> shaders = {{
@@ -68,6 +98,7 @@ int main(int argc, char** argv)
         "obj-cel", "skybox", "horizon", "blur",
         "hdr", "depth", "shadow", "extract-brightness",
         "postprocess", "reflect", "ssao",
+        "wave-height", "wave-normal",
     }};
     for (const auto& shname: shaders)
     {
@@ -85,31 +116,54 @@ int main(int argc, char** argv)
     scene.ssao_shader               = resources.get_shader("ssao");
     scene.blur_shader               = resources.get_shader("blur");
     scene.hdr_shader                = resources.get_shader("hdr");
+    scene.wave_height_shader        = resources.get_shader("wave-height");
+    scene.wave_normal_shader        = resources.get_shader("wave-normal");
 
 
     resources.get_shader("ssao")->set_ssao(64);
     resources.get_shader("landscape")->set_ssao(64);
-    
-    // Create meshes.
-    // Each mesh entry in meshes is a name, dir name, and filename.
-    const std::vector<std::array<std::string, 3>> meshes = {{
-        {{ "Cube",          "cube-simple",  "cube-simple"   }},
-        {{ "Pine01",        "tree",         "PineTree03"    }},
-        {{ "Pine02",        "pine",         "PineTransp"    }},
-        {{ "Stump",         "TreeStump",    "TreeStump03"   }},
-        {{ "Bonfire",       "bonfire",      "bonfire"       }},
-        {{ "Lighthouse",    "lighthouse",   "lighthouse"    }},
-    }};
-    for (const auto& meshinfo: meshes)
+
+    // Generate landscape.
+    // The island is created in the background, side by side with the
+    // meshes, while the skybox and ocean are drawn, and added to the scene
+    // once it is uploaded (see below). Only the shaders must be ready.
+    const float max_height = 128.0f;    // Needs to be consistent with water.vert.
+    std::unique_ptr<LandscapeLoader> loader;
+    // Once it is in the scene, the island's parameters can be changed
+    // through the console (see TerrainTuner.hpp).
+    std::unique_ptr<TerrainTuner> tuner;
+    // And it can be edited with a brush (see TerrainEditor.hpp).
+    std::unique_ptr<TerrainEditor> editor;
+    if (TILED_TERRAIN)
     {
-        const std::string& name     = meshinfo[0];
-        const std::string& dir      = meshinfo[1];
-        const std::string& filename = meshinfo[2];
-        resources.give_mesh(
-            name,
-            renderer.create_materials(renderer.assign_vao(
-                Mesh::load_obj("models/" + dir + "/", filename + ".obj"))));
+        // Tiles of 65*65 vertices, with about the vertex spacing of the island.
+        // Tiles within 3 tiles of the camera are kept, with at most 64MB
+        // of tiles loaded.
+        // Note: The tiles require the same resources as the island below.
+        ChunkManager* chunks = new ChunkManager(
+            0, 65, 4.0f, max_height, 3, 64 << 20, &resources);
+        scene.give_chunks(chunks, resources.get_shader("landscape"));
     }
+    else
+    {
+        // Note: The TerrainGenerator requires certain meshes and shaders
+        // available with the correct name in resources. The meshes may
+        // still be loading; it waits for those it needs.
+        // See TerrainGenerator::populate().
+        // The landscape is loaded from the cache if it was generated
+        // on an earlier run.
+        loader.reset(new LandscapeLoader(
+            0, 100, 400.0f, max_height, &resources,
+            EDITABLE_TERRAIN, ERODED_TERRAIN));
+        if (EDITABLE_TERRAIN)
+        {
+            tuner.reset(new TerrainTuner(
+                0, 100, 400.0f, max_height, &resources, ERODED_TERRAIN));
+            editor.reset(new TerrainEditor());
+        }
+    }
+    resources.get_shader("landscape")->set_palette(TerrainGenerator::palette());
+    resources.get_shader("reflect")->set_palette(TerrainGenerator::palette());
 
     // Create lights.
     scene.world_light_day = LightSource(
@@ -123,7 +177,43 @@ int main(int argc, char** argv)
     scene.world_light_night_index = scene.lights.size() - 1;
     #endif
 
-    // Create objects not generated by terrain
+    // Create ocean.
+    // We can pass the landscape to the water generator and have it cull hidden faces.
+    // The ocean follows the camera, in levels of 32*32 quads spaced from
+    // 2 units apart (about a texel of the baked waves) near the camera,
+    // reaching 500 units out (see Water.hpp).
+    auto create_ocean = [&](Landscape* landscape)
+    {
+        Water* ocean = new Water(32, 2.0f, 1000.0f, 0.05f * max_height, landscape);
+        ocean->follow(scene.camera.position);
+        ocean = renderer.assign_vao(ocean);
+        if (scene.get_water() != nullptr) renderer.release_vao(scene.get_water());
+        scene.give_water(ocean, resources.get_shader("water"));
+        resources.get_shader("water")->set_palette(ocean->palette);
+    };
+    create_ocean(nullptr);
+
+    // Create skybox.
+    // The skybox must be inside the far plane, meaning the corners
+    // of the box must be slightly less than that distance.
+    //           __     If we have a circle with radius d, we need
+    //          |  --.  a square with radius d/sqrt(2) to stay within
+    //        d |  .  \ the bounds of the circle.
+    //          |.____| For a sphere and cube inside, we need to divide
+    //             d    by sqrt(3).
+    Skybox* skybox = renderer.assign_vao(
+        new Skybox((far_dist - 1.0f) / std::sqrt(3)));
+    scene.give_skybox(skybox, resources.get_shader("skybox"));
+
+    // Start background sounds
+    Sound* sound = new Sound;
+    sound->initialize();
+    scene.give_sound(sound);
+
+    // Upload the meshes read so far, and wait for the rest.
+    mesh_loader.finish(renderer);
+
+    // Create objects not generated by terrain, now their meshes are loaded.
     {
         Object* lighthouse = new Object(
             resources.get_mesh("Lighthouse"),
@@ -157,42 +247,6 @@ int main(int argc, char** argv)
         ));
     }
 
-    // Generate landscape.
-    const float max_height = 128.0f;    // Needs to be consistent with water.vert.
-    Landscape* landscape = nullptr;
-    {
-        // Note: The TerrainGenerator requires certain meshes and shaders
-        // available with the correct name in resources.
-        // See TerrainGenerator::populate().
-        TerrainGenerator tg(0, 100, 400.0f, max_height, &resources);
-        landscape = renderer.assign_vao(tg.landscape());
-        scene.give_landscape(landscape, resources.get_shader("landscape"));
-        resources.get_shader("landscape")->set_palette(landscape->palette);
-        resources.get_shader("reflect")->set_palette(landscape->palette);
-        scene.player.position =
-            landscape->get_pos_at(glm::vec3(0.0f, 0.0f, 0.0f))
-            + glm::vec3(0.0f, 1.0f, 0.0f);
-    }
-
-    // Create ocean.
-    // We can pass the landscape to the water generator and have it cull hidden faces.
-    Water* ocean = new Water(75, 1000.0f, 0.05f * max_height, landscape);
-    ocean = renderer.assign_vao(ocean);
-    scene.give_water(ocean, resources.get_shader("water"));
-    resources.get_shader("water")->set_palette(ocean->palette);
-
-    // Create skybox.
-    // The skybox must be inside the far plane, meaning the corners
-    // of the box must be slightly less than that distance.
-    //           __     If we have a circle with radius d, we need
-    //          |  --.  a square with radius d/sqrt(2) to stay within
-    //        d |  .  \ the bounds of the circle.
-    //          |.____| For a sphere and cube inside, we need to divide
-    //             d    by sqrt(3).
-    Skybox* skybox = renderer.assign_vao(
-        new Skybox((far_dist - 1.0f) / std::sqrt(3)));
-    scene.give_skybox(skybox, resources.get_shader("skybox"));
-
     // Create horizon.
     {
         Object* horizon = new Object(
@@ -204,11 +258,6 @@ int main(int argc, char** argv)
         scene.give_object(horizon);
     }
     
-    // Start background sounds
-    Sound* sound = new Sound;
-    sound->initialize();
-    scene.give_sound(sound);
-
     // Rendering loop
     auto current_time = std::chrono::steady_clock::now();
     while (!renderer.should_end())
@@ -221,7 +270,40 @@ int main(int argc, char** argv)
         current_time = frame_start_time;
 
         InputHandler::update();
+        if (loader != nullptr && !loader->done())
+        {
+            Landscape* landscape = loader->update(renderer);
+            if (landscape != nullptr)
+            {
+                scene.give_landscape(landscape, resources.get_shader("landscape"));
+                scene.player.position =
+                    landscape->get_pos_at(glm::vec3(0.0f, 0.0f, 0.0f))
+                    + glm::vec3(0.0f, 1.0f, 0.0f);
+                // Rebuild the ocean without the faces hidden by the island.
+                create_ocean(landscape);
+            }
+        }
+        if (tuner != nullptr)
+        {
+            // Rebuild the ocean if the island's shape changed.
+            Landscape* landscape = tuner->update(scene, renderer);
+            if (landscape != nullptr) create_ocean(landscape);
+        }
+        // Edits made while the island is regenerated would be lost.
+        if (editor != nullptr && !tuner->regenerating())
+        {
+            // Before the scene is updated, so collisions see the edit.
+            editor->update(scene, renderer, dt, tuner->parameters());
+        }
         scene.update(dt);
+        if (scene.get_water()->follow(scene.camera.position))
+        {
+            renderer.update_vao(scene.get_water());
+        }
+        if (scene.get_chunks() != nullptr)
+        {
+            scene.get_chunks()->update(scene.camera.position, renderer);
+        }
         renderer.render(scene);
         renderer.postrender();
     }